@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,8 +8,23 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <errno.h>
+#include <limits.h>
 #include <dirent.h>
+#include <fnmatch.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <math.h>
+#include <zlib.h>
+#include <openssl/evp.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/epoll.h>
+#endif
 
 // Defining port numbers for each server
 
@@ -28,6 +44,298 @@
 #define MAX_PATH 1024
 #define BUFFER_SIZE 4096
 
+// Defining bulk transfer sizes (zero-copy chunk and copy fallback buffer)
+#define TRANSMIT_CHUNK_SIZE 1048576
+#define TRANSMIT_BUFFER_SIZE 65536
+
+// Framed protocol version and header size (version, type, status, 64-bit length)
+#define FRAME_VERSION 1
+#define FRAME_HEADER_SIZE 12
+
+// Frame types
+#define FRAME_COMMAND 1
+#define FRAME_RESPONSE 2
+#define FRAME_FILE 3
+#define FRAME_NAME 4
+#define FRAME_LIST 5
+#define FRAME_DATA 6
+#define FRAME_END 7
+// Compressed file body: payload is the original size in decimal, followed by DATA frames
+// holding one chunk each until that many bytes are rebuilt
+#define FRAME_ZFILE 8
+// Content offered ahead of an uploadf body in hash-first sessions: payload is
+// "<size> <sha256 hex>", answered with HAVE (no body follows), SEND, or DELTA (in delta
+// sessions, with a DATA frame of chunk hashes of the stored copy)
+#define FRAME_DIGEST 9
+// Delta body sent after DELTA instead of a FILE frame: payload is the new size in decimal,
+// followed by DATA frames (literal bytes or a run of stored chunks to copy) and an END frame
+#define FRAME_DELTA 10
+
+// Encoding of a chunk after FRAME_ZFILE, carried in the DATA frame's status field
+#define CHUNK_STORED 0
+#define CHUNK_DEFLATE 1
+
+// Transfer codecs a client session can agree on with HELLO
+#define CODEC_NONE 0
+#define CODEC_DEFLATE 1
+
+// Largest chunk of a compressed file body, and the (fast) deflate level used on the wire
+#define TRANSFER_CHUNK_SIZE 65536
+#define TRANSFER_LEVEL 1
+
+// Bytes in a SHA-256 content hash
+#define DIGEST_SIZE 32
+
+// Largest DATA frame in a delta body (one largest content-defined chunk)
+#define DELTA_MAX_FRAME 65536
+
+// Tar archive block size, largest size the ustar octal field holds, and the
+// size up to which file bodies are copied into the frame buffer instead of sent with sendfile
+#define TAR_BLOCK_SIZE 512
+#define TAR_MAX_OCTAL_SIZE 077777777777ULL
+#define TAR_INLINE_LIMIT 32768
+
+// Frame status codes
+#define STATUS_OK 0
+#define STATUS_PARTIAL 1
+#define STATUS_ERROR 2
+#define STATUS_NOT_FOUND 3
+#define STATUS_BAD_REQUEST 4
+#define STATUS_UNSUPPORTED 5
+
+// Defining backend connection pool limits
+// Capacity of the idle list per backend
+#define POOL_MAX_IDLE 32
+// Idle connections kept per backend by a single client session
+#define POOL_SESSION_IDLE 4
+// Seconds an idle connection may wait in the pool before it is closed
+#define POOL_IDLE_TIMEOUT 30
+
+// Identifying backends in the connection pool
+#define BACKEND_S2 0
+#define BACKEND_S3 1
+#define BACKEND_S4 2
+#define BACKEND_COUNT 3
+
+// Targets of uploadf files that do not go to a backend
+#define UPLOAD_LOCAL -1
+#define UPLOAD_UNSUPPORTED -2
+
+// Seconds an event-mode worker waits on a client that stalls mid-command (part of a frame
+// sent, or not reading) before ending its session, so stalled clients cannot hold every worker
+#define CLIENT_IO_TIMEOUT 60
+
+// Milliseconds uploadf waits for backends to confirm stored files
+#define STORE_RESULT_TIMEOUT_MS 30000
+
+// Milliseconds dispfnames waits for each part of a backend file list
+#define LIST_TIMEOUT_MS 10000
+
+// Listings are streamed: names go out in LIST frames of at most LIST_CHUNK_SIZE bytes, in
+// name order. Pages of up to LIST_BATCH names are picked in one directory pass; longer listings
+// sort up to LIST_RUN_SIZE bytes (LIST_RUN_NAMES names) at a time and merge the sorted runs,
+// reading each back LIST_MERGE_BUFFER bytes at a time
+#define LIST_CHUNK_SIZE 8192
+#define LIST_BATCH 1024
+#define LIST_RUN_SIZE 262144
+#define LIST_RUN_NAMES 16384
+#define LIST_MERGE_BUFFER 4096
+
+// Namespace index of stored files that dispfnames answers from: its journal/snapshot file,
+// capacity, directories kept before the least recently used one is evicted (three quarters of
+// the table, keeping probe runs short), name sizes, listing groups (.c, .pdf, .txt, .zip), seconds a directory listing is
+// trusted before the servers are asked again, journal lines allowed beyond two per file
+// before it is compacted, and bytes of names a listing group may take to be kept (larger
+// groups are always listed from the servers)
+#define NAMESPACE_FILE ".S1.namespace"
+#define NAMESPACE_MAX_FILES 65536
+#define NAMESPACE_MAX_DIRS 4096
+#define NAMESPACE_DIR_LIMIT (NAMESPACE_MAX_DIRS / 4 * 3)
+#define NAMESPACE_NAME_SIZE 256
+#define NAMESPACE_DIR_SIZE 512
+#define NAMESPACE_TYPE_COUNT 4
+#define NAMESPACE_VERIFY_SECONDS 600
+#define NAMESPACE_JOURNAL_SLACK 4096
+#define NAMESPACE_RECORD_SIZE 16384
+
+// Milliseconds downltar waits for a backend to send its next tar member
+#define TAR_MEMBER_TIMEOUT_MS 30000
+
+// File types downltar can archive ("all" selects every one)
+#define TAR_TYPE_COUNT 4
+
+// Log of deleted local files ("time name" per line), and the member of a
+// downltar --since archive that lists files deleted since the cutoff
+#define TOMBSTONE_FILE ".S1.tombstones"
+#define TAR_MANIFEST_NAME ".dfs-deleted"
+
+// Compressed downltar (--gzip): bytes per independently compressed block, the output room
+// one block can need, most compression threads, deflate level, bytes sampled per block (in
+// COMPRESS_SAMPLE_COUNT runs) and the entropy in bits per byte from which a block is stored
+#define COMPRESS_BLOCK_SIZE 262144
+#define COMPRESS_OUTPUT_SIZE (COMPRESS_BLOCK_SIZE + COMPRESS_BLOCK_SIZE / 64 + 1024)
+#define COMPRESS_MAX_THREADS 8
+#define COMPRESS_LEVEL 6
+#define COMPRESS_SAMPLE_SIZE 4096
+#define COMPRESS_SAMPLE_COUNT 16
+#define COMPRESS_ENTROPY_LIMIT 7.5
+
+// States of a compressor block
+#define COMPRESS_FREE 0
+#define COMPRESS_QUEUED 1
+#define COMPRESS_BUSY 2
+#define COMPRESS_DONE 3
+
+// Most epoll events handled per reactor wakeup in event mode
+#define EVENT_BATCH_SIZE 64
+
+// Default pending-connection queue for the listening socket (--backlog)
+#define DEFAULT_BACKLOG 128
+// Seconds the pre-fork supervisor waits before restarting a worker that died at once
+#define WORKER_RESTART_DELAY 1
+
+// Selecting how S1 serves clients
+#define MODE_FORK 0
+#define MODE_EVENT 1
+#define MODE_PREFORK 2
+
+// Holding one downlf file whose source is open and ready to stream
+struct pending_download
+{
+    // Name sent to the client ahead of the data
+    char filename[256];
+    // Backend socket streaming the file, -1 for local .c files
+    int server_socket;
+    // Backend pool the socket belongs to
+    int backend;
+    // Path of local .c file in S1 storage
+    char local_path[MAX_PATH];
+    // Size announced by the source
+    long file_size;
+    // Set when the backend streams the body as compressed chunks (ZFILE)
+    int compressed;
+};
+
+// Holding one uploadf file whose STORE session runs alongside the others
+struct pending_upload
+{
+    // Name of the file as sent by the client
+    char filename[256];
+    // Backend pool index, or UPLOAD_LOCAL / UPLOAD_UNSUPPORTED
+    int backend;
+    // Backend socket carrying the STORE session, -1 if none
+    int server_socket;
+    // Destination directory on the target server
+    char server_path[512];
+    // Size of the body, -1 until the client announces it
+    long size;
+    // Set while the body is relayed and the server's verdict is outstanding
+    int awaiting_result;
+    // 0 when stored, -1 when it failed
+    int result;
+};
+
+// Conditions of a filtered dispfnames listing (-r, --name, --min-size, --max-size, --newer,
+// --older), passed on to the backends and checked while each directory is walked
+struct list_filter
+{
+    // Set to descend into subdirectories (names are then paths below the listed directory)
+    int recursive;
+    // Shell pattern the file name must match ("" for any)
+    char pattern[64];
+    // Size bounds in bytes and modification time bounds (seconds since the epoch), -1 for none;
+    // files must be at least min_size, at most max_size, changed at or after newer and before older
+    long min_size;
+    long max_size;
+    long newer;
+    long older;
+};
+
+// Holding one backend's part of a dispfnames listing
+struct remote_listing
+{
+    // Backend pool index
+    int backend;
+    // Storage root on the backend
+    const char *prefix;
+    // File type shown in log messages
+    const char *label;
+    // Connection carrying the LIST request
+    int server_socket;
+    // Set while the reply is outstanding
+    int waiting;
+    // Name the backend's part starts after ("" for its first name)
+    char after[256];
+};
+
+// dispfnames output on its way to the client
+struct listing_output
+{
+    // Client socket
+    int socket;
+    // Set when the client takes the listing as a stream (HELLO ... LIST stream); other clients
+    // get it as one LIST frame of at most LIST_CHUNK_SIZE bytes
+    int stream;
+    // Conditions of a filtered listing, whose names are "path\tsize\tmtime" (NULL for none)
+    const struct list_filter *filter;
+    // Names not sent yet
+    char chunk[LIST_CHUNK_SIZE];
+    int used;
+    // Names sent so far and the page size (-1 for no limit)
+    long emitted;
+    long limit;
+    // Group and name of the last name sent, where the next page starts
+    int last_type;
+    char last_name[256];
+    // Copies of groups listed from the servers, kept for the namespace index while they fit
+    int recording[NAMESPACE_TYPE_COUNT];
+    int recorded_length[NAMESPACE_TYPE_COUNT];
+    char recorded[NAMESPACE_TYPE_COUNT][NAMESPACE_RECORD_SIZE];
+};
+
+// Holding one backend's member stream within a downltar archive
+struct tar_source
+{
+    // Backend pool index
+    int backend;
+    // Connection carrying the CREATETAR stream, -1 once it is finished
+    int server_socket;
+    // Set while the last relayed frame ended inside a member
+    int mid_member;
+    // Deletion list the backend sent for a --since request (NUL terminated), and its length
+    char *deleted;
+    long deleted_length;
+    // 0 while streaming or finished, -1 when its members are missing from the archive
+    int result;
+};
+
+// Holding one idle backend connection kept warm for reuse
+struct pooled_connection
+{
+    // Connected socket to the backend
+    int socket;
+    // Time the connection was last returned to the pool
+    time_t last_used;
+};
+
+// Holding the idle connections of one backend server
+struct backend_pool
+{
+    // Server name for log messages
+    const char *name;
+    // Idle connections, most recently used last
+    struct pooled_connection idle[POOL_MAX_IDLE];
+    // Number of idle connections
+    int idle_count;
+};
+
+// Pool of warm connections per backend, owned by the process serving the client
+struct backend_pool backend_pools[BACKEND_COUNT] = {{.name = "S2"}, {.name = "S3"}, {.name = "S4"}};
+// Idle connections kept per backend (raised in event mode where workers share the pool)
+int pool_idle_limit = POOL_SESSION_IDLE;
+// Guarding the pool when worker threads share it
+pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* DIRECTORY MANAGEMENT FUNCTIONS */
 
 // Creating server directories if they don't exist
@@ -36,7 +344,7 @@ int initialize_server_directories()
     printf("\n[S1] === INITIALIZING SERVER DIRECTORIES ===\n");
 
     // Listing all directories to create
-    const char *directories[] = {"S1", "S1/temp", "S2", "S3", "S4"};
+    const char *directories[] = {"S1", "S2", "S3", "S4"};
     // Calculating number of directories
     int dir_count = sizeof(directories) / sizeof(directories[0]);
 
@@ -79,6 +387,8 @@ int create_full_directories(char *full_path)
     char *token;
     // Storing copy of original path
     char path_copy[MAX_PATH];
+    // Keeping tokenizer state local so concurrent sessions do not share it
+    char *save_ptr;
 
     printf("[S1] Creating directory structure: %s\n", full_path);
 
@@ -88,7 +398,7 @@ int create_full_directories(char *full_path)
     strcpy(temp_path, "");
 
     // Splitting path by forward slash
-    token = strtok(path_copy, "/");
+    token = strtok_r(path_copy, "/", &save_ptr);
 
     // Processing each path component
     while (token != NULL)
@@ -122,7 +432,7 @@ int create_full_directories(char *full_path)
         }
 
         // Getting next path component
-        token = strtok(NULL, "/");
+        token = strtok_r(NULL, "/", &save_ptr);
     }
 
     printf("[S1] Directory structure created successfully\n");
@@ -181,2818 +491,7096 @@ void convert_path_for_server(const char *s1_path, const char *server_prefix, cha
     printf("[S1] Path converted to: '%s'\n", result_path);
 }
 
-/* FILE TRANSFER FUNCTIONS */
+/* SOCKET HELPER FUNCTIONS */
 
-// Sending file to another server (S2/S3/S4) or client
-int send_file_to_S1(int socket, const char *full_path)
+// Receiving exactly length bytes from socket
+int recv_all(int socket, void *buffer, long length)
 {
-    // Creating buffer for reading file chunks
-    char buffer[BUFFER_SIZE];
-    // Creating file pointer for reading
-    FILE *file;
-    // Storing file size
-    long file_size;
-    // Tracking total bytes sent
+    // Tracking total bytes received so far
+    long total_received = 0;
+
+    // Looping until the whole block has arrived
+    while (total_received < length)
+    {
+        // Receiving next piece of the block
+        int bytes_received = recv(socket, (char *)buffer + total_received, length - total_received, 0);
+        // Checking if peer closed or failed
+        if (bytes_received <= 0)
+        {
+            return -1;
+        }
+
+        // Updating total received
+        total_received += bytes_received;
+    }
+
+    return 0;
+}
+
+// Sending exactly length bytes over socket
+int send_all(int socket, const void *buffer, long length)
+{
+    // Tracking total bytes sent so far
     long total_sent = 0;
 
-    printf("[S1] Preparing to send file: %s\n", full_path);
+    // Looping until the whole block has been written
+    while (total_sent < length)
+    {
+        // Sending next piece of the block
+        int bytes_sent = send(socket, (const char *)buffer + total_sent, length - total_sent, 0);
+        // Checking if send failed
+        if (bytes_sent <= 0)
+        {
+            return -1;
+        }
 
-    // Opening file for reading in binary mode
-    file = fopen(full_path, "rb");
-    // Checking if file exists
-    if (file == NULL)
+        // Updating total sent
+        total_sent += bytes_sent;
+    }
+
+    return 0;
+}
+
+/* FRAMING PROTOCOL FUNCTIONS */
+
+// Every message travels as one frame: version (1 byte), type (1 byte), status (2 bytes)
+// and payload length (8 bytes) in network byte order, followed by exactly length payload bytes
+
+// Sending a frame header announcing length payload bytes
+int send_frame_header(int socket, int type, int status, long length)
+{
+    // Packing header fields in network byte order
+    unsigned char header[FRAME_HEADER_SIZE];
+    header[0] = FRAME_VERSION;
+    header[1] = type;
+    header[2] = (status >> 8) & 0xFF;
+    header[3] = status & 0xFF;
+    for (int i = 0; i < 8; i++)
+    {
+        header[4 + i] = ((unsigned long long)length >> (56 - 8 * i)) & 0xFF;
+    }
+
+    return send_all(socket, header, FRAME_HEADER_SIZE);
+}
+
+// Sending a whole frame whose payload is in memory
+int send_frame(int socket, int type, int status, const void *payload, long length)
+{
+    if (send_frame_header(socket, type, status, length) == -1)
     {
-        printf("[S1] File not found: %s\n", full_path);
         return -1;
     }
+    return send_all(socket, payload, length);
+}
 
-    // Moving to end of file to get size
-    fseek(file, 0, SEEK_END);
-    // Getting current position (file size)
-    file_size = ftell(file);
-    // Moving back to beginning
-    fseek(file, 0, SEEK_SET);
+// Sending a text message as one frame (terminator is not sent)
+int send_text_frame(int socket, int type, int status, const char *text)
+{
+    return send_frame(socket, type, status, text, strlen(text));
+}
 
-    printf("[S1] File size: %ld bytes\n", file_size);
+// Receiving a frame header, rejecting other protocol versions
+int recv_frame_header(int socket, int *type, int *status, long *length)
+{
+    // Reading the fixed-size header
+    unsigned char header[FRAME_HEADER_SIZE];
+    if (recv_all(socket, header, FRAME_HEADER_SIZE) == -1)
+    {
+        return -1;
+    }
 
-    // Sending file size first
-    if (send(socket, &file_size, sizeof(file_size), 0) == -1)
+    // Checking protocol version
+    if (header[0] != FRAME_VERSION)
     {
-        printf("[S1] Failed to send file size\n");
-        fclose(file);
+        printf("[S1] ERROR: Unsupported frame version %d\n", header[0]);
         return -1;
     }
-    printf("[S1] File size sent\n");
 
-    // Sending file data in chunks
-    printf("[S1] Starting file transfer...\n");
-    while (total_sent < file_size)
+    // Unpacking fields from network byte order
+    unsigned long long value = 0;
+    for (int i = 0; i < 8; i++)
     {
-        // Reading chunk from file
-        int bytes_read = fread(buffer, 1, BUFFER_SIZE, file);
-        // Checking if read was successful
-        if (bytes_read <= 0)
-        {
-            printf("[S1] Failed to read from file\n");
-            fclose(file);
-            return -1;
-        }
+        value = (value << 8) | header[4 + i];
+    }
+    *type = header[1];
+    *status = (header[2] << 8) | header[3];
+    *length = (long)value;
 
-        // Sending chunk over socket
-        int bytes_sent = send(socket, buffer, bytes_read, 0);
-        // Checking if send was successful
-        if (bytes_sent <= 0)
-        {
-            printf("[S1] Failed to send file data\n");
-            fclose(file);
-            return -1;
-        }
+    // Rejecting lengths that cannot be real
+    if (*length < 0)
+    {
+        printf("[S1] ERROR: Invalid frame length\n");
+        return -1;
+    }
 
-        // Updating total bytes sent
-        total_sent += bytes_sent;
+    return 0;
+}
 
-        // Showing progress for larger files
-        if (file_size > 10000)
+// Dropping payload bytes nobody wants so the next frame lines up
+int skip_frame_payload(int socket, long length)
+{
+    // Creating buffer for unwanted data
+    char buffer[BUFFER_SIZE];
+
+    while (length > 0)
+    {
+        // Receiving and dropping next chunk
+        int to_receive = (length > BUFFER_SIZE) ? BUFFER_SIZE : length;
+        int bytes_received = recv(socket, buffer, to_receive, 0);
+        if (bytes_received <= 0)
         {
-            printf("[S1] Progress: %ld/%ld bytes (%.1f%%)\r",
-                   total_sent, file_size, (total_sent * 100.0) / file_size);
-            fflush(stdout);
+            return -1;
         }
+        length -= bytes_received;
     }
 
-    // Closing file
-    fclose(file);
-    printf("\n[S1] File sent successfully\n");
     return 0;
 }
 
-// Receiving file from client
-int receive_file_from_client(int client_socket, const char *filename)
+// Receiving a frame payload as text into buffer, dropping whatever does not fit
+// Returns number of bytes stored, or -1 if the stream broke
+int recv_frame_payload(int socket, long length, char *buffer, int max_size)
 {
-    // Building complete path for temporary storage
-    char full_path[MAX_PATH];
-    // Creating buffer for file data chunks
-    char buffer[BUFFER_SIZE];
-    // Creating file pointer for writing
-    FILE *file;
-    // Storing incoming file size
-    long file_size;
-    // Tracking total bytes received
-    long total_received = 0;
+    // Keeping as much as the buffer holds
+    long kept = (length < max_size - 1) ? length : max_size - 1;
+    if (recv_all(socket, buffer, kept) == -1)
+    {
+        return -1;
+    }
+    buffer[kept] = '\0';
 
-    printf("[S1] Receiving file from client: %s\n", filename);
+    // Skipping the rest
+    if (skip_frame_payload(socket, length - kept) == -1)
+    {
+        return -1;
+    }
 
-    // Adding small delay for synchronization
-    usleep(50000);
+    return kept;
+}
 
-    // Attempting to receive file size with retries
-    int attempts = 0;
-    int size_received = 0;
+// Receiving a whole text frame of the expected type
+// Returns number of bytes stored, or -1 if the stream broke or another frame type arrived
+int recv_text_frame(int socket, int expected_type, int *status, char *buffer, int max_size)
+{
+    // Storing header fields
+    int type;
+    long length;
 
-    // Retrying up to 3 times
-    while (attempts < 3 && size_received != sizeof(file_size))
+    if (recv_frame_header(socket, &type, status, &length) == -1)
     {
-        // Receiving file size
-        size_received = recv(client_socket, &file_size, sizeof(file_size), 0);
-        // Breaking if successful
-        if (size_received == sizeof(file_size))
-        {
-            break;
-        }
-
-        // Incrementing attempt counter
-        attempts++;
-        printf("[S1] Retry %d: Attempting to receive file size\n", attempts);
-        // Adding delay before retry
-        usleep(100000);
+        return -1;
     }
 
-    // Checking if file size received successfully
-    if (size_received != sizeof(file_size))
+    int kept = recv_frame_payload(socket, length, buffer, max_size);
+    if (kept == -1)
     {
-        printf("[S1] Failed to receive file size after %d attempts\n", attempts);
         return -1;
     }
 
-    // Validating file size is reasonable
-    if (file_size <= 0 || file_size > 100000000)
+    // Checking that the peer sent what we expected
+    if (type != expected_type)
     {
-        printf("[S1] Invalid file size: %ld bytes\n", file_size);
+        printf("[S1] ERROR: Expected frame type %d, got %d\n", expected_type, type);
         return -1;
     }
 
-    printf("[S1] File size: %ld bytes\n", file_size);
-
-    // Building path for temporary storage
-    snprintf(full_path, sizeof(full_path), "S1/temp/%s", filename);
+    return kept;
+}
 
-    // Creating temp directory if needed
-    create_full_directories("S1/temp");
+// Receiving and dropping one whole frame
+int skip_frame(int socket)
+{
+    // Storing header fields
+    int type, status;
+    long length;
 
-    // Opening file for writing
-    file = fopen(full_path, "wb");
-    // Checking if file creation successful
-    if (file == NULL)
+    if (recv_frame_header(socket, &type, &status, &length) == -1)
     {
-        printf("[S1] Failed to create temporary file: %s\n", full_path);
         return -1;
     }
+    return skip_frame_payload(socket, length);
+}
 
-    printf("[S1] Starting file reception...\n");
-    // Receiving file data in chunks
-    while (total_received < file_size)
+/* ZERO-COPY TRANSMIT FUNCTIONS */
+
+// Sending file_size bytes of an open file over a socket
+// Uses sendfile() so data moves from the page cache to the socket without a
+// user-space copy, falling back to a large-buffer loop where it is unavailable
+int transmit_file_data(int socket, int file_fd, long file_size, int show_progress)
+{
+    // Tracking total bytes sent
+    long total_sent = 0;
+
+#ifdef __linux__
+    // Tracking read position inside the file
+    off_t offset = 0;
+    while (total_sent < file_size)
     {
-        // Calculating bytes remaining
-        long remaining = file_size - total_received;
-        // Determining how much to receive this chunk
-        int to_receive = (remaining > BUFFER_SIZE) ? BUFFER_SIZE : remaining;
+        // Calculating how much to hand to the kernel this round
+        long remaining = file_size - total_sent;
+        size_t to_send = (remaining > TRANSMIT_CHUNK_SIZE) ? TRANSMIT_CHUNK_SIZE : remaining;
 
-        // Receiving data chunk
-        int bytes_received = recv(client_socket, buffer, to_receive, 0);
-        // Checking if receive successful
-        if (bytes_received <= 0)
+        // Sending chunk directly from file to socket
+        ssize_t bytes_sent = sendfile(socket, file_fd, &offset, to_send);
+        if (bytes_sent == -1 && errno == EINTR)
         {
-            printf("[S1] Failed to receive file data (got %d bytes)\n", bytes_received);
-            fclose(file);
-            return -1;
+            continue;
         }
-
-        // Writing received data to file
-        int bytes_written = fwrite(buffer, 1, bytes_received, file);
-        // Checking if all data written
-        if (bytes_written != bytes_received)
+        if (bytes_sent == -1 && total_sent == 0 && (errno == EINVAL || errno == ENOSYS))
         {
-            printf("[S1] Failed to write complete data to file\n");
-            fclose(file);
+            // Kernel cannot sendfile this descriptor pair - using copy loop instead
+            printf("[S1] sendfile not available, using buffered transmit\n");
+            break;
+        }
+        if (bytes_sent <= 0)
+        {
+            printf("[S1] Failed to send file data\n");
             return -1;
         }
 
-        // Updating total received
-        total_received += bytes_received;
+        // Updating total bytes sent
+        total_sent += bytes_sent;
 
         // Showing progress for larger files
-        if (file_size > 10000)
+        if (show_progress)
         {
             printf("[S1] Progress: %ld/%ld bytes (%.1f%%)\r",
-                   total_received, file_size, (total_received * 100.0) / file_size);
+                   total_sent, file_size, (total_sent * 100.0) / file_size);
             fflush(stdout);
         }
     }
+    if (total_sent == file_size)
+    {
+        return 0;
+    }
+#endif
 
-    // Closing file
-    fclose(file);
-    printf("\n[S1] File received and stored temporarily: %s\n", full_path);
+    // Creating large buffer for the copy fallback
+    char buffer[TRANSMIT_BUFFER_SIZE];
 
-    // Verifying file was written correctly
-    FILE *verify = fopen(full_path, "rb");
-    if (verify != NULL)
+    // Continuing from where zero-copy stopped
+    lseek(file_fd, total_sent, SEEK_SET);
+    while (total_sent < file_size)
     {
-        // Getting actual file size
-        fseek(verify, 0, SEEK_END);
-        long actual_size = ftell(verify);
-        fclose(verify);
+        // Calculating bytes remaining
+        long remaining = file_size - total_sent;
+        size_t to_read = (remaining > TRANSMIT_BUFFER_SIZE) ? TRANSMIT_BUFFER_SIZE : remaining;
 
-        // Comparing with expected size
-        if (actual_size == file_size)
+        // Reading chunk from file
+        ssize_t bytes_read = read(file_fd, buffer, to_read);
+        if (bytes_read <= 0)
         {
-            printf("[S1] File size verification: OK (%ld bytes)\n", actual_size);
+            printf("[S1] Failed to read from file\n");
+            return -1;
         }
-        else
+
+        // Sending chunk over socket
+        if (send_all(socket, buffer, bytes_read) == -1)
         {
-            printf("[S1] File size verification: FAILED (expected %ld, got %ld)\n",
-                   file_size, actual_size);
+            printf("[S1] Failed to send file data\n");
             return -1;
         }
+
+        // Updating total bytes sent
+        total_sent += bytes_read;
+
+        // Showing progress for larger files
+        if (show_progress)
+        {
+            printf("[S1] Progress: %ld/%ld bytes (%.1f%%)\r",
+                   total_sent, file_size, (total_sent * 100.0) / file_size);
+            fflush(stdout);
+        }
     }
 
     return 0;
 }
 
-// Receiving file from other servers (S2/S3/S4)
-int receive_file_from_S1(int server_socket, const char *filename, const char *dest_path)
+// Relaying byte_count bytes from one socket to another
+// Uses splice() through a pipe so the payload never enters user space,
+// falling back to a large-buffer loop where splice is unavailable
+// Returns 0 on success, -1 if the source failed, -2 if the destination failed
+// *consumed reports how many bytes were taken from the source either way
+int relay_socket_data(int from_socket, int to_socket, long byte_count, long *consumed)
 {
-    // Building complete path for file storage
-    char full_path[MAX_PATH];
-    // Creating buffer for file data
-    char buffer[BUFFER_SIZE];
-    // Creating file pointer for writing
-    FILE *file;
-    // Storing file size
-    long file_size;
-    // Tracking bytes received
-    long total_received = 0;
+    // Tracking bytes delivered to the destination
+    long total_relayed = 0;
 
-    printf("[S1] Receiving file from server: %s\n", filename);
+    *consumed = 0;
 
-    // Receiving file size from server
-    if (recv(server_socket, &file_size, sizeof(file_size), 0) <= 0)
+#ifdef __linux__
+    // Creating pipe used as the in-kernel staging buffer
+    int pipe_fds[2];
+    if (pipe(pipe_fds) == 0)
     {
-        printf("[S1] Failed to receive file size from server\n");
-        return -1;
-    }
+        // Growing the pipe so each splice moves more data (ignored if refused)
+        fcntl(pipe_fds[1], F_SETPIPE_SZ, TRANSMIT_CHUNK_SIZE);
 
-    printf("[S1] File size: %ld bytes\n", file_size);
+        // Storing outcome of the splice loop
+        int result = 0;
+        while (total_relayed < byte_count)
+        {
+            // Calculating how much to pull this round
+            long remaining = byte_count - total_relayed;
+            size_t to_move = (remaining > TRANSMIT_CHUNK_SIZE) ? TRANSMIT_CHUNK_SIZE : remaining;
 
-    // Creating destination directory if needed
-    char dest_path_copy[MAX_PATH];
-    strcpy(dest_path_copy, dest_path);
-    if (create_full_directories(dest_path_copy) == -1)
-    {
-        printf("[S1] Failed to create destination directory: %s\n", dest_path);
-        return -1;
-    }
+            // Moving data from source socket into the pipe
+            ssize_t bytes_in = splice(from_socket, NULL, pipe_fds[1], NULL, to_move, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (bytes_in == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (bytes_in == -1 && *consumed == 0 && (errno == EINVAL || errno == ENOSYS))
+            {
+                // Kernel cannot splice these sockets - using copy loop instead
+                printf("[S1] splice not available, using buffered relay\n");
+                result = 1;
+                break;
+            }
+            if (bytes_in <= 0)
+            {
+                printf("[S1] Source closed during relay (%ld/%ld bytes)\n", total_relayed, byte_count);
+                result = -1;
+                break;
+            }
+            *consumed += bytes_in;
 
-    // Building complete file path
-    snprintf(full_path, sizeof(full_path), "%s/%s", dest_path, filename);
-    printf("[S1] Saving to: %s\n", full_path);
+            // Moving the same data from the pipe to destination socket
+            while (bytes_in > 0)
+            {
+                ssize_t bytes_out = splice(pipe_fds[0], NULL, to_socket, NULL, bytes_in, SPLICE_F_MOVE | SPLICE_F_MORE);
+                if (bytes_out == -1 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (bytes_out <= 0)
+                {
+                    printf("[S1] Destination closed during relay (%ld/%ld bytes)\n", total_relayed, byte_count);
+                    result = -2;
+                    break;
+                }
+                bytes_in -= bytes_out;
+                total_relayed += bytes_out;
+            }
+            if (result != 0)
+            {
+                break;
+            }
+        }
 
-    // Opening file for writing
-    file = fopen(full_path, "wb");
-    if (file == NULL)
-    {
-        printf("[S1] Failed to create file: %s\n", full_path);
-        return -1;
-    }
+        // Closing the staging pipe
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
 
-    printf("[S1] Starting file transfer from server...\n");
-    // Receiving file data in chunks
-    while (total_received < file_size)
-    {
-        // Receiving data chunk
-        int bytes_received = recv(server_socket, buffer, BUFFER_SIZE, 0);
-        if (bytes_received <= 0)
+        if (result != 1)
         {
-            printf("[S1] Failed to receive file data from server\n");
-            fclose(file);
-            return -1;
+            return result;
         }
+    }
+#endif
 
-        // Writing data to file
-        int bytes_written = fwrite(buffer, 1, bytes_received, file);
-        if (bytes_written != bytes_received)
+    // Creating large buffer for the copy fallback
+    char buffer[TRANSMIT_BUFFER_SIZE];
+
+    while (total_relayed < byte_count)
+    {
+        // Calculating bytes remaining
+        long remaining = byte_count - total_relayed;
+        // Determining how much to receive this chunk
+        int to_receive = (remaining > TRANSMIT_BUFFER_SIZE) ? TRANSMIT_BUFFER_SIZE : remaining;
+
+        // Receiving chunk from source socket
+        int bytes_received = recv(from_socket, buffer, to_receive, 0);
+        if (bytes_received <= 0)
         {
-            printf("[S1] Error writing data to file\n");
-            fclose(file);
+            printf("[S1] Source closed during relay (%ld/%ld bytes)\n", total_relayed, byte_count);
             return -1;
         }
+        *consumed += bytes_received;
 
-        // Updating total received
-        total_received += bytes_received;
+        // Forwarding chunk to destination socket
+        if (send_all(to_socket, buffer, bytes_received) == -1)
+        {
+            printf("[S1] Destination closed during relay (%ld/%ld bytes)\n", total_relayed, byte_count);
+            return -2;
+        }
+
+        // Updating total relayed
+        total_relayed += bytes_received;
     }
 
-    // Closing file
-    fclose(file);
-    printf("[S1] File received successfully from server: %s\n", full_path);
     return 0;
 }
 
-/*SERVER CONNECTION FUNCTIONS */
+/* TRANSFER COMPRESSION FUNCTIONS */
 
-// Connecting to S2 (PDF server)
-int connect_to_s2()
+// Estimating bits of information per byte from samples spread over a block
+// Already-compressed data (.zip, most .pdf streams) comes out close to 8
+double sample_entropy(const unsigned char *data, long length)
 {
-    printf("[S1] Establishing connection to S2 (PDF server)...\n");
-
-    // Creating socket for S2 connection
-    int s2_socket = socket(AF_INET, SOCK_STREAM, 0);
-    // Checking if socket creation successful
-    if (s2_socket == -1)
+    // Counting byte values in evenly spaced samples
+    long counts[256] = {0};
+    long sampled = 0;
+    long step = (length > COMPRESS_SAMPLE_SIZE) ? length / COMPRESS_SAMPLE_COUNT : length;
+    long sample_length = (length > COMPRESS_SAMPLE_SIZE) ? COMPRESS_SAMPLE_SIZE / COMPRESS_SAMPLE_COUNT : length;
+    for (long start = 0; start + sample_length <= length && sampled < COMPRESS_SAMPLE_SIZE; start += step)
     {
-        printf("[S1] Failed to create socket for S2\n");
-        return -1;
+        for (long i = start; i < start + sample_length; i++)
+        {
+            counts[data[i]]++;
+        }
+        sampled += sample_length;
     }
-
-    // Setting up S2 address structure
-    // Initializing to zero
-    struct sockaddr_in s2_addr = {0};
-    // Setting IPv4 protocol
-    s2_addr.sin_family = AF_INET;
-    // Converting port to network format
-    s2_addr.sin_port = htons(S2_PORT);
-    // Setting IP
-    s2_addr.sin_addr.s_addr = INADDR_ANY;
-
-    // Attempting to connect to S2
-    if (connect(s2_socket, (struct sockaddr *)&s2_addr, sizeof(s2_addr)) == -1)
+    if (sampled == 0)
     {
-        printf("[S1] Failed to connect to S2 server\n");
-        // Closing socket before returning
-        close(s2_socket);
-        return -1;
+        return 0;
     }
 
-    printf("[S1] Successfully connected to S2 server\n");
-    return s2_socket;
+    // Summing -p log2 p over the byte values seen
+    double entropy = 0;
+    for (int value = 0; value < 256; value++)
+    {
+        if (counts[value] > 0)
+        {
+            double p = (double)counts[value] / sampled;
+            entropy -= p * log2(p);
+        }
+    }
+    return entropy;
 }
 
-// Connecting to S3 (Text server)
-int connect_to_s3()
+// Reading exactly length bytes from a file or socket
+int read_all(int fd, void *buffer, long length)
 {
-    printf("[S1] Establishing connection to S3 (Text server)...\n");
-
-    // Creating socket for S3 connection
-    int s3_socket = socket(AF_INET, SOCK_STREAM, 0);
-    // Checking if socket creation successful
-    if (s3_socket == -1)
+    long total_read = 0;
+    while (total_read < length)
     {
-        printf("[S1] Failed to create socket for S3\n");
-        return -1;
+        ssize_t bytes_read = read(fd, (char *)buffer + total_read, length - total_read);
+        if (bytes_read == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_read <= 0)
+        {
+            return -1;
+        }
+        total_read += bytes_read;
     }
+    return 0;
+}
 
-    // Setting up S3 address structure
-    struct sockaddr_in s3_addr = {0};
-    s3_addr.sin_family = AF_INET;
-    s3_addr.sin_port = htons(S3_PORT);
-    s3_addr.sin_addr.s_addr = INADDR_ANY;
-
-    // Attempting to connect to S3
-    if (connect(s3_socket, (struct sockaddr *)&s3_addr, sizeof(s3_addr)) == -1)
+// Writing exactly length bytes to a file or socket
+int write_all(int fd, const void *buffer, long length)
+{
+    long total_written = 0;
+    while (total_written < length)
     {
-        printf("[S1] Failed to connect to S3 server\n");
-        // Closing socket before returning
-        close(s3_socket);
-        return -1;
+        ssize_t bytes_written = write(fd, (const char *)buffer + total_written, length - total_written);
+        if (bytes_written == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_written <= 0)
+        {
+            return -1;
+        }
+        total_written += bytes_written;
     }
-
-    printf("[S1] Successfully connected to S3 server\n");
-    return s3_socket;
+    return 0;
 }
 
-// Connecting to S4 (ZIP server)
-int connect_to_s4()
+// Deciding whether a file body is worth compressing for this session
+// Archives are skipped by name, and when file_fd is given the start of the file is
+// sampled so already-compressed data keeps the zero-copy path
+int transfer_wants_compression(int codec, const char *filename, int file_fd)
 {
-    printf("[S1] Establishing connection to S4 (ZIP server)...\n");
-
-    // Creating socket for S4 connection
-    int s4_socket = socket(AF_INET, SOCK_STREAM, 0);
-    // Checking if socket creation successful
-    if (s4_socket == -1)
+    if (codec == CODEC_NONE)
     {
-        printf("[S1] Failed to create socket for S4\n");
-        return -1;
+        return 0;
     }
 
-    // Setting up S4 address structure
-    struct sockaddr_in s4_addr = {0};
-    s4_addr.sin_family = AF_INET;
-    s4_addr.sin_port = htons(S4_PORT);
-    s4_addr.sin_addr.s_addr = INADDR_ANY;
-
-    // Attempting to connect to S4
-    if (connect(s4_socket, (struct sockaddr *)&s4_addr, sizeof(s4_addr)) == -1)
+    const char *extension = strrchr(filename, '.');
+    if (extension != NULL && strcmp(extension, ".zip") == 0)
     {
-        printf("[S1] Failed to connect to S4 server\n");
-        // Closing socket before returning
-        close(s4_socket);
-        return -1;
+        return 0;
     }
 
-    printf("[S1] Successfully connected to S4 server\n");
-    return s4_socket;
+    if (file_fd != -1)
+    {
+        unsigned char sample[COMPRESS_SAMPLE_SIZE];
+        ssize_t sampled = pread(file_fd, sample, sizeof(sample), 0);
+        if (sampled > 0 && sample_entropy(sample, sampled) >= COMPRESS_ENTROPY_LIMIT)
+        {
+            return 0;
+        }
+    }
+    return 1;
 }
 
-// Sending file to other servers (S2/S3/S4)
-int send_file_to_server(int server_socket, const char *filename, const char *dest_path)
+// Sending file_size bytes read from from_fd (a local file or a backend socket) as a
+// compressed body: a ZFILE frame with the original size, then one DATA frame per chunk
+// Each chunk is deflated on its own, or stored when it samples as incompressible or does not shrink
+// Returns 0 on success, -1 if the source failed, -2 if the destination failed
+// *consumed reports how many bytes were taken from the source either way
+int send_compressed_file_data(int socket, int from_fd, long file_size, long *consumed)
 {
-    // Creating command buffer
-    char command[1024];
-    // Building temp file path
-    char temp_file_path[MAX_PATH];
-    // Creating response buffer
-    char response[256];
-
-    printf("[S1] Sending file to server: %s\n", filename);
-
-    // Building STORE command for server
-    snprintf(command, sizeof(command), "STORE %s %s", filename, dest_path);
-    printf("[S1] Sending command: %s\n", command);
+    *consumed = 0;
 
-    // Sending command to server
-    if (send(server_socket, command, strlen(command), 0) == -1)
+    // Preparing deflate without zlib header (each chunk is a raw deflate stream)
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, TRANSFER_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
     {
-        printf("[S1] Failed to send STORE command\n");
+        printf("[S1] ERROR: Cannot start compression\n");
         return -1;
     }
-
-    // Receiving response from server
-    int bytes_received = recv(server_socket, response, sizeof(response) - 1, 0);
-    if (bytes_received <= 0)
+    unsigned char *input = malloc(TRANSFER_CHUNK_SIZE);
+    unsigned char *output = malloc(TRANSFER_CHUNK_SIZE);
+
+    // Announcing the original size
+    char size_text[32];
+    snprintf(size_text, sizeof(size_text), "%ld", file_size);
+    int result = 0;
+    if (input == NULL || output == NULL)
     {
-        printf("[S1] No response from server\n");
-        return -1;
+        result = -1;
+    }
+    else if (send_text_frame(socket, FRAME_ZFILE, STATUS_OK, size_text) == -1)
+    {
+        result = -2;
     }
-    // Adding null terminator to response
-    response[bytes_received] = '\0';
-
-    printf("[S1] Server response: %s\n", response);
 
-    // Checking if server is ready to receive file
-    if (strncmp(response, "READY", 5) != 0)
+    long sent = 0;
+    while (result == 0 && *consumed < file_size)
     {
-        printf("[S1] Server not ready, received: %s\n", response);
-        return -1;
+        // Reading next chunk from the source
+        long remaining = file_size - *consumed;
+        long piece = (remaining > TRANSFER_CHUNK_SIZE) ? TRANSFER_CHUNK_SIZE : remaining;
+        if (read_all(from_fd, input, piece) == -1)
+        {
+            printf("[S1] ERROR: Source failed during compressed transfer\n");
+            result = -1;
+            break;
+        }
+        *consumed += piece;
+
+        // Deflating chunk, keeping it only if it comes out smaller
+        int encoding = CHUNK_STORED;
+        long length = piece;
+        if (sample_entropy(input, piece) < COMPRESS_ENTROPY_LIMIT)
+        {
+            deflateReset(&zs);
+            zs.next_in = input;
+            zs.avail_in = piece;
+            zs.next_out = output;
+            zs.avail_out = piece - 1;
+            if (deflate(&zs, Z_FINISH) == Z_STREAM_END)
+            {
+                encoding = CHUNK_DEFLATE;
+                length = zs.total_out;
+            }
+        }
+
+        // Sending chunk as one DATA frame tagged with its encoding
+        if (send_frame(socket, FRAME_DATA, encoding, (encoding == CHUNK_DEFLATE) ? output : input, length) == -1)
+        {
+            result = -2;
+            break;
+        }
+        sent += length;
     }
 
-    // Building temp file path
-    snprintf(temp_file_path, sizeof(temp_file_path), "S1/temp/%s", filename);
-    printf("[S1] Sending file data from: %s\n", temp_file_path);
+    deflateEnd(&zs);
+    free(input);
+    free(output);
+    if (result == 0)
+    {
+        printf("[S1] Compressed transfer: %ld -> %ld bytes\n", file_size, sent);
+    }
+    return result;
+}
 
-    // Sending file data to server using existing function
-    if (send_file_to_S1(server_socket, temp_file_path) == -1)
+// Receiving a compressed body of file_size bytes (the DATA frames after a ZFILE frame)
+// and writing the rebuilt data to to_fd (a local file or a backend socket)
+// With to_fd -1, or once writing has failed, the body is only drained
+// Returns 0 on success, -1 if writing failed (body drained), -2 if the stream broke or is corrupt
+int receive_compressed_file_data(int socket, long file_size, int to_fd)
+{
+    // Preparing raw inflate and chunk buffers
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -15) != Z_OK)
     {
-        printf("[S1] Failed to send file data to server\n");
-        return -1;
+        return -2;
     }
+    unsigned char *input = malloc(TRANSFER_CHUNK_SIZE);
+    unsigned char *output = malloc(TRANSFER_CHUNK_SIZE);
+    int result = (input == NULL || output == NULL) ? -2 : 0;
 
-    // Receiving final response from server
-    bytes_received = recv(server_socket, response, sizeof(response) - 1, 0);
-    if (bytes_received > 0)
+    long rebuilt = 0;
+    while (result != -2 && rebuilt < file_size)
     {
-        // Adding null terminator
-        response[bytes_received] = '\0';
-        printf("[S1] Final server response: %s\n", response);
+        // Receiving next chunk; no chunk is larger than the data it holds
+        int type, encoding;
+        long length;
+        if (recv_frame_header(socket, &type, &encoding, &length) == -1 || type != FRAME_DATA ||
+            length > TRANSFER_CHUNK_SIZE || recv_all(socket, input, length) == -1)
+        {
+            printf("[S1] ERROR: Compressed transfer broke after %ld bytes\n", rebuilt);
+            result = -2;
+            break;
+        }
 
-        // Checking if transfer successful
-        if (strncmp(response, "SUCCESS", 7) == 0)
+        // Rebuilding chunk, never past the announced size
+        long remaining = file_size - rebuilt;
+        long limit = (remaining > TRANSFER_CHUNK_SIZE) ? TRANSFER_CHUNK_SIZE : remaining;
+        unsigned char *data = input;
+        long data_length = length;
+        if (encoding == CHUNK_DEFLATE)
         {
-            printf("[S1] File transfer completed successfully\n");
-            return 0;
+            inflateReset(&zs);
+            zs.next_in = input;
+            zs.avail_in = length;
+            zs.next_out = output;
+            zs.avail_out = limit;
+            data = output;
+            data_length = (inflate(&zs, Z_FINISH) == Z_STREAM_END) ? (long)zs.total_out : 0;
         }
-        else
+        else if (encoding != CHUNK_STORED || length > limit)
         {
-            printf("[S1] Server reported error: %s\n", response);
-            return -1;
+            data_length = 0;
         }
+        if (data_length == 0)
+        {
+            printf("[S1] ERROR: Corrupt compressed chunk after %ld bytes\n", rebuilt);
+            result = -2;
+            break;
+        }
+
+        // Writing rebuilt data, draining the rest once the destination has failed
+        if (to_fd != -1 && result == 0 && write_all(to_fd, data, data_length) == -1)
+        {
+            printf("[S1] ERROR: Failed to write decompressed data\n");
+            result = -1;
+        }
+        rebuilt += data_length;
     }
-    else
-    {
-        printf("[S1] No final response from server\n");
-        return -1;
-    }
-}
 
-/*FILE MANAGEMENT FUNCTIONS*/
+    inflateEnd(&zs);
+    free(input);
+    free(output);
+    return result;
+}
 
-// Storing C file locally in S1
-int store_file_in_S1(const char *filename, const char *dest_path)
+// Relaying a compressed body of file_size bytes from a backend to the client unchanged
+// Every chunk but the last holds TRANSFER_CHUNK_SIZE bytes, so the chunk count follows from the size
+// Returns 0 on success, -1 if the source failed, -2 if the destination failed
+// *consumed reports how many payload bytes were taken from the source either way
+int relay_compressed_file_data(int from_socket, int to_socket, long file_size, long *consumed)
 {
-    // Building temporary file path
-    char temp_path[MAX_PATH];
-    // Building final file path
-    char final_path[MAX_PATH];
-    // Creating buffer for file copying
-    char buffer[BUFFER_SIZE];
-    // Creating file pointers for source and destination
-    FILE *temp_file, *final_file;
-    // Storing bytes read in each chunk
-    int bytes_read;
+    *consumed = 0;
 
-    printf("[S1] Storing C file locally: %s\n", filename);
+    // Announcing the original size
+    char size_text[32];
+    snprintf(size_text, sizeof(size_text), "%ld", file_size);
+    if (send_text_frame(to_socket, FRAME_ZFILE, STATUS_OK, size_text) == -1)
+    {
+        return -2;
+    }
 
-    // Creating destination directory if needed
-    char dest_path_copy[MAX_PATH];
-    strcpy(dest_path_copy, dest_path);
-    if (create_full_directories(dest_path_copy) == -1)
+    // Passing each chunk frame through
+    long chunk_count = (file_size + TRANSFER_CHUNK_SIZE - 1) / TRANSFER_CHUNK_SIZE;
+    for (long chunk = 0; chunk < chunk_count; chunk++)
     {
-        printf("[S1] Failed to create destination directory: %s\n", dest_path);
-        return -1;
+        int type, encoding;
+        long length;
+        if (recv_frame_header(from_socket, &type, &encoding, &length) == -1 || type != FRAME_DATA ||
+            length > TRANSFER_CHUNK_SIZE)
+        {
+            printf("[S1] ERROR: Bad compressed chunk from server\n");
+            return -1;
+        }
+        if (send_frame_header(to_socket, FRAME_DATA, encoding, length) == -1)
+        {
+            return -2;
+        }
+        long chunk_consumed;
+        int result = relay_socket_data(from_socket, to_socket, length, &chunk_consumed);
+        *consumed += chunk_consumed;
+        if (result != 0)
+        {
+            return result;
+        }
     }
 
-    // Building paths for temporary and final locations
-    snprintf(temp_path, sizeof(temp_path), "S1/temp/%s", filename);
-    snprintf(final_path, sizeof(final_path), "%s/%s", dest_path, filename);
+    printf("[S1] Relayed %ld bytes as %ld compressed bytes\n", file_size, *consumed);
+    return 0;
+}
 
-    printf("[S1] Moving file from %s to %s\n", temp_path, final_path);
+/* CONTENT HASH FUNCTIONS */
 
-    // Opening temporary file for reading
-    temp_file = fopen(temp_path, "rb");
-    if (temp_file == NULL)
+// Computing the SHA-256 of a whole file as 64 hex digits, without moving its offset
+// Returns 0, or -1 when the file could not be read
+int hash_file_content(int file_fd, char *hex)
+{
+    EVP_MD_CTX *digest = EVP_MD_CTX_new();
+    if (digest == NULL || EVP_DigestInit_ex(digest, EVP_sha256(), NULL) != 1)
     {
-        printf("[S1] Cannot open temp file: %s\n", temp_path);
+        EVP_MD_CTX_free(digest);
         return -1;
     }
 
-    // Opening final file for writing
-    final_file = fopen(final_path, "wb");
-    if (final_file == NULL)
+    // Hashing file from the start
+    char buffer[TRANSMIT_BUFFER_SIZE];
+    long offset = 0;
+    ssize_t bytes_read;
+    while ((bytes_read = pread(file_fd, buffer, sizeof(buffer), offset)) > 0)
     {
-        printf("[S1] Cannot create final file: %s\n", final_path);
-        // Closing temp file before returning
-        fclose(temp_file);
-        return -1;
+        EVP_DigestUpdate(digest, buffer, bytes_read);
+        offset += bytes_read;
     }
 
-    printf("[S1] Copying file data...\n");
-    // Copying file data from temp to final location
-    while ((bytes_read = fread(buffer, 1, BUFFER_SIZE, temp_file)) > 0)
+    unsigned char hash[DIGEST_SIZE];
+    int result = (bytes_read == 0 && EVP_DigestFinal_ex(digest, hash, NULL) == 1) ? 0 : -1;
+    EVP_MD_CTX_free(digest);
+    for (int i = 0; result == 0 && i < DIGEST_SIZE; i++)
     {
-        // Writing chunk to final file
-        int bytes_written = fwrite(buffer, 1, bytes_read, final_file);
-        // Checking if all bytes written successfully
-        if (bytes_written != bytes_read)
-        {
-            printf("[S1] Failed to write data to final file\n");
-            fclose(temp_file);
-            fclose(final_file);
-            return -1;
-        }
+        sprintf(hex + 2 * i, "%02x", hash[i]);
     }
+    return result;
+}
 
-    // Closing both files
-    fclose(temp_file);
-    fclose(final_file);
+// Receiving the DIGEST frame a hash-first client sends ahead of each uploadf file
+// Returns 0 with size and hash filled in, -1 when the client offers no hash (frame consumed),
+// -2 if client stream broke
+int receive_upload_digest(int client_socket, long *file_size, char *hex)
+{
+    int type, status;
+    long length;
+    char offer[128];
+    if (recv_frame_header(client_socket, &type, &status, &length) == -1 || type != FRAME_DIGEST ||
+        recv_frame_payload(client_socket, length, offer, sizeof(offer)) == -1)
+    {
+        printf("[S1] Expected content hash from client\n");
+        return -2;
+    }
 
-    // Deleting temporary file for cleanup
-    printf("[S1] Cleaning up temporary file: %s\n", temp_path);
-    if (remove(temp_path) == 0)
+    // Accepting only well-formed hashes, since backends turn them into paths
+    if (status != STATUS_OK || sscanf(offer, "%ld %64s", file_size, hex) != 2 ||
+        strlen(hex) != 2 * DIGEST_SIZE || strspn(hex, "0123456789abcdef") != 2 * DIGEST_SIZE)
     {
-        printf("[S1] Temporary file deleted successfully\n");
+        return -1;
     }
-    else
+    return 0;
+}
+
+// Checking whether a local file already holds content of the given size and hash
+int local_file_matches(const char *full_path, long file_size, const char *hex)
+{
+    int file_fd = open(full_path, O_RDONLY);
+    if (file_fd == -1)
     {
-        printf("[S1] Warning: Failed to delete temporary file\n");
-        // Don't return error - file was still copied successfully
+        return 0;
     }
 
-    printf("[S1] C file stored locally: %s\n", final_path);
-    return 0;
+    // Comparing sizes first so only likely matches are read
+    struct stat st;
+    char local_hex[2 * DIGEST_SIZE + 1];
+    int matches = fstat(file_fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size == file_size &&
+                  hash_file_content(file_fd, local_hex) == 0 && strcmp(local_hex, hex) == 0;
+    close(file_fd);
+    return matches;
 }
 
-// Deleting file (used for C files in S1)
-int delete_file(const char *full_path)
+/* FILE TRANSFER FUNCTIONS */
+
+// Sending a local file to the client as one FILE frame, or compressed when the session
+// agreed on a codec and the file looks compressible
+int send_file_to_S1(int socket, const char *full_path, int codec)
 {
-    printf("[S1] Attempting to delete file: %s\n", full_path);
+    // Storing file size
+    long file_size;
+    // Creating stat structure for file metadata
+    struct stat st;
+
+    printf("[S1] Preparing to send file: %s\n", full_path);
 
+    // Opening file for reading
+    int file_fd = open(full_path, O_RDONLY);
     // Checking if file exists
-    FILE *file = fopen(full_path, "r");
-    if (file == NULL)
+    if (file_fd == -1)
     {
         printf("[S1] File not found: %s\n", full_path);
         return -1;
     }
-    // Closing file handle
-    fclose(file);
 
-    // Removing the file
-    if (remove(full_path) == 0)
-    {
-        printf("[S1] File deleted successfully: %s\n", full_path);
-        return 0;
-    }
-    else
+    // Getting file size from metadata
+    if (fstat(file_fd, &st) == -1)
     {
-        printf("[S1] Failed to delete file: %s\n", full_path);
+        printf("[S1] Cannot read file size: %s\n", full_path);
+        close(file_fd);
         return -1;
     }
-}
-
-// Getting list of C files from local S1 directory
-int get_local_c_files(const char *directory_path, char *file_list, int max_size)
-{
-    // Creating directory pointer
-    DIR *dir;
-    // Creating directory entry pointer
-    struct dirent *entry;
-    // Creating temporary name buffer
-    char temp_name[256];
-    // Tracking total length of file list
-    int total_length = 0;
+    file_size = st.st_size;
 
-    printf("[S1] Getting local C files from: %s\n", directory_path);
+    printf("[S1] File size: %ld bytes\n", file_size);
 
-    // Initializing file list as empty
-    file_list[0] = '\0';
+    // Compressing body chunk by chunk for sessions that asked for it
+    if (transfer_wants_compression(codec, full_path, file_fd))
+    {
+        long consumed;
+        int result = send_compressed_file_data(socket, file_fd, file_size, &consumed);
+        close(file_fd);
+        return (result == 0) ? 0 : -1;
+    }
 
-    // Opening directory
-    dir = opendir(directory_path);
-    if (dir == NULL)
+    // Sending FILE frame header announcing the size
+    if (send_frame_header(socket, FRAME_FILE, STATUS_OK, file_size) == -1)
     {
-        printf("[S1] Cannot open directory: %s\n", directory_path);
+        printf("[S1] Failed to send file header\n");
+        close(file_fd);
         return -1;
     }
+    printf("[S1] File header sent\n");
 
-    // Reading directory entries
-    while ((entry = readdir(dir)) != NULL)
+    // Sending file data with zero-copy transmit
+    printf("[S1] Starting file transfer...\n");
+    if (transmit_file_data(socket, file_fd, file_size, file_size > 10000) == -1)
     {
-        // Skipping current and parent directory entries
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-        {
-            continue;
-        }
+        close(file_fd);
+        return -1;
+    }
 
-        // Filtering by .c extension
-        if (strstr(entry->d_name, ".c") != NULL)
-        {
-            // Formatting filename with newline
-            snprintf(temp_name, sizeof(temp_name), "%s\n", entry->d_name);
+    // Closing file
+    close(file_fd);
+    printf("\n[S1] File sent successfully\n");
+    return 0;
+}
 
-            // Checking if adding this file would exceed buffer size
-            if (total_length + strlen(temp_name) < max_size)
-            {
-                // Adding filename to list
-                strcat(file_list, temp_name);
-                total_length += strlen(temp_name);
-                printf("[S1] Found C file: %s", temp_name);
-            }
-            else
-            {
-                printf("[S1] Warning: Buffer full, skipping remaining files\n");
-                break;
-            }
+// Skipping a number of incoming bytes from client
+// Returns 0 when data was consumed, -2 if client stream broke
+int skip_client_bytes(int client_socket, long byte_count)
+{
+    // Creating buffer for unwanted data
+    char buffer[BUFFER_SIZE];
+    // Tracking total bytes skipped
+    long total_received = 0;
+
+    while (total_received < byte_count)
+    {
+        // Calculating bytes remaining
+        long remaining = byte_count - total_received;
+        // Determining how much to receive this chunk
+        int to_receive = (remaining > BUFFER_SIZE) ? BUFFER_SIZE : remaining;
+
+        // Receiving and dropping data chunk
+        int bytes_received = recv(client_socket, buffer, to_receive, 0);
+        if (bytes_received <= 0)
+        {
+            printf("[S1] Client stream broken while skipping data\n");
+            return -2;
         }
+
+        // Updating total skipped
+        total_received += bytes_received;
     }
 
-    // Closing directory
-    closedir(dir);
-    printf("[S1] Local C file listing complete\n");
     return 0;
 }
 
-// Getting file list from other servers (S2/S3/S4)
-int get_files_from_server(int server_socket, const char *directory_path, char *file_list, int max_size)
+// Draining a file body from client (raw or compressed) so the next frame lines up
+// Returns 0 when data was consumed, -2 if client stream broke
+int skip_client_file(int client_socket, long file_size, int compressed)
 {
-    // Creating command buffer
-    char command[1024];
-    // Creating response buffer
-    char response[4096];
-    // Storing bytes received
-    int bytes_received;
-
-    printf("[S1] Requesting file list from server for: %s\n", directory_path);
+    if (compressed)
+    {
+        return (receive_compressed_file_data(client_socket, file_size, -1) == 0) ? 0 : -2;
+    }
+    return skip_client_bytes(client_socket, file_size);
+}
 
-    // Building LIST command
-    snprintf(command, sizeof(command), "LIST %s", directory_path);
+// Receiving FILE (or compressed ZFILE) frame header from client
+// *compressed is set when the body follows as compressed chunks
+// Returns 0 when file data follows, -1 when the client has no data for this file
+// (frame consumed), -2 if client stream broke
+int receive_file_size_from_client(int client_socket, long *file_size, int *compressed)
+{
+    // Storing header fields
+    int type, status;
 
-    // Sending LIST command to server
-    if (send(server_socket, command, strlen(command), 0) == -1)
+    // Receiving the complete frame header in one go
+    if (recv_frame_header(client_socket, &type, &status, file_size) == -1)
     {
-        printf("[S1] Failed to send LIST command\n");
-        return -1;
+        printf("[S1] Failed to receive file header from client\n");
+        return -2;
     }
 
-    // Receiving file list from server
-    bytes_received = recv(server_socket, response, sizeof(response) - 1, 0);
-    if (bytes_received <= 0)
+    // Reading original size of a compressed body
+    *compressed = (type == FRAME_ZFILE);
+    if (*compressed)
     {
-        printf("[S1] Failed to receive file list from server\n");
-        return -1;
+        char size_text[32];
+        char *end;
+        if (recv_frame_payload(client_socket, *file_size, size_text, sizeof(size_text)) == -1)
+        {
+            printf("[S1] Failed to receive compressed file header from client\n");
+            return -2;
+        }
+        *file_size = strtol(size_text, &end, 10);
+        if (end == size_text || *end != '\0' || *file_size < 0)
+        {
+            printf("[S1] Invalid compressed file size from client\n");
+            return -2;
+        }
     }
 
-    // Adding null terminator
-    response[bytes_received] = '\0';
-    printf("[S1] Received file list from server:\n%s", response);
-
-    // Checking if no files found
-    if (strncmp(response, "No files", 8) == 0)
+    // Checking that file data is what arrived
+    if (type != FRAME_FILE && type != FRAME_ZFILE)
     {
-        printf("[S1] No files found on server\n");
-        // Setting empty list
-        file_list[0] = '\0';
-        return 0;
+        printf("[S1] Expected file data from client, got frame type %d\n", type);
+        return -2;
     }
 
-    // Copying response to file list
-    if (strlen(response) < max_size)
+    // Checking if client could not open the file
+    if (status != STATUS_OK)
     {
-        strcpy(file_list, response);
+        printf("[S1] Client has no data for this file\n");
+        return skip_client_bytes(client_socket, *file_size) == -2 ? -2 : -1;
     }
-    else
+
+    // Validating file size is reasonable
+    if (*file_size > 100000000)
     {
-        // Truncating if response too long
-        strncpy(file_list, response, max_size - 1);
-        file_list[max_size - 1] = '\0';
-        printf("[S1] Warning: File list truncated\n");
+        printf("[S1] Invalid file size: %ld bytes\n", *file_size);
+        return skip_client_file(client_socket, *file_size, *compressed) == -2 ? -2 : -1;
     }
 
-    printf("[S1] File list received from server\n");
+    printf("[S1] File size: %ld bytes%s\n", *file_size, *compressed ? " (compressed)" : "");
     return 0;
 }
 
-// Sorting file list alphabetically
-void sort_file_list(char file_list[][256], int count)
+// Discarding a whole file from client so the next file stays in sync
+// Returns 0 when data was consumed, -2 if client stream broke
+int discard_file_from_client(int client_socket)
 {
-    // Creating temporary buffer for swapping
-    char temp[256];
-
-    printf("[S1] Sorting %d files alphabetically\n", count);
+    // Storing incoming file size and encoding
+    long file_size;
+    int compressed;
 
-    // Using bubble sort algorithm
-    for (int i = 0; i < count - 1; i++)
+    // Receiving size so we know how much to skip
+    int header_result = receive_file_size_from_client(client_socket, &file_size, &compressed);
+    if (header_result != 0)
     {
-        for (int j = 0; j < count - i - 1; j++)
-        {
-            // Comparing adjacent elements
-            if (strcmp(file_list[j], file_list[j + 1]) > 0)
-            {
-                // Swapping elements if out of order
-                strcpy(temp, file_list[j]);
-                strcpy(file_list[j], file_list[j + 1]);
-                strcpy(file_list[j + 1], temp);
-            }
-        }
+        // Nothing left to skip unless the stream broke
+        return header_result == -2 ? -2 : 0;
     }
 
-    printf("[S1] File list sorted successfully\n");
+    printf("[S1] Discarding %ld bytes from client\n", file_size);
+    return skip_client_file(client_socket, file_size, compressed);
 }
 
-/* TAR FILE FUNCTIONS */
-
-// Creating tar file for C files locally
-int create_local_tar_c_files(const char *tar_filepath)
+// Receiving file from client straight into its final location
+// Returns 0 on success, -1 if file could not be stored, -2 if client stream broke
+int receive_file_from_client(int client_socket, const char *filename, const char *dest_path)
 {
-    // Declaring a command string
-    char command[2048];
-    // Declaring a file pointer for checking size later
-    FILE *tar_file;
-    // Declaring a variable to store return code of system()
-    int result_code;
+    // Building complete path for final storage
+    char full_path[MAX_PATH];
+    // Creating buffer for file data chunks
+    char buffer[BUFFER_SIZE];
+    // Creating file pointer for writing
+    FILE *file;
+    // Storing incoming file size and encoding
+    long file_size;
+    int compressed;
+    // Tracking total bytes received
+    long total_received = 0;
 
-    // Making sure S1 directory exists
-    create_full_directories("S1");
+    printf("[S1] Receiving file from client: %s\n", filename);
+
+    // Receiving FILE frame header from client
+    int header_result = receive_file_size_from_client(client_socket, &file_size, &compressed);
+    if (header_result != 0)
+    {
+        return header_result;
+    }
+
+    // Creating destination directory if needed
+    char dest_path_copy[MAX_PATH];
+    strcpy(dest_path_copy, dest_path);
+    if (create_full_directories(dest_path_copy) == -1)
+    {
+        printf("[S1] Failed to create destination directory: %s\n", dest_path);
+        // Consuming data so the session stays usable
+        return skip_client_file(client_socket, file_size, compressed) == -2 ? -2 : -1;
+    }
 
-    // Printing what we are creating
-    printf("[S1] Creating tar file for C files: %s\n", tar_filepath);
+    // Building path for final storage
+    snprintf(full_path, sizeof(full_path), "%s/%s", dest_path, filename);
 
-    // Trying a fast way first (may fail on macOS because -printf is GNU-only)
-    // Building the command (creating a tar at the exact path we received)
-    snprintf(
-        command,
-        sizeof(command),
-        // Changing directory to S1 then adding relative paths so the tar has clean paths
-        // Using GNU find's -printf when available
-        "sh -c \"cd S1 2>/dev/null && files=$(find . -name '*.c' -type f -printf '%%P\\n' 2>/dev/null); "
-        "if [ -n \\\"$files\\\" ]; then tar -cf '%s' -C S1 $files 2>/dev/null; else exit 99; fi\"",
-        tar_filepath);
+    // Opening file for writing
+    file = fopen(full_path, "wb");
+    // Checking if file creation successful
+    if (file == NULL)
+    {
+        printf("[S1] Failed to create file: %s\n", full_path);
+        // Consuming data so the session stays usable
+        return skip_client_file(client_socket, file_size, compressed) == -2 ? -2 : -1;
+    }
 
-    // Running the fast path
-    result_code = system(command);
+    // Decompressing a compressed body straight into the file
+    if (compressed)
+    {
+        int result = receive_compressed_file_data(client_socket, file_size, fileno(file));
+        fclose(file);
+        if (result != 0)
+        {
+            remove(full_path);
+            return result;
+        }
+        printf("[S1] File received and stored: %s\n", full_path);
+        return 0;
+    }
 
-    // Checking if fast path failed (non-zero) or special 99 (no files)
-    if (result_code != 0)
+    printf("[S1] Starting file reception into %s\n", full_path);
+    // Receiving file data in chunks
+    while (total_received < file_size)
     {
-        // Explaining why we are switching
-        printf("[S1] WARNING: First tar method failed or not supported, trying portable method\n");
+        // Calculating bytes remaining
+        long remaining = file_size - total_received;
+        // Determining how much to receive this chunk
+        int to_receive = (remaining > BUFFER_SIZE) ? BUFFER_SIZE : remaining;
 
-        // Building portable command (works on macOS/BSD and Linux)
-        // Finding files then piping list to tar with --files-from
-        snprintf(
-            command,
-            sizeof(command),
-            "find S1 -name '*.c' -type f 2>/dev/null | tar -cf '%s' --files-from=- 2>/dev/null",
-            tar_filepath);
+        // Receiving data chunk
+        int bytes_received = recv(client_socket, buffer, to_receive, 0);
+        // Checking if receive successful
+        if (bytes_received <= 0)
+        {
+            printf("[S1] Failed to receive file data (got %d bytes)\n", bytes_received);
+            fclose(file);
+            remove(full_path);
+            return -2;
+        }
 
-        // Running the portable path
-        result_code = system(command);
-        // Checking error again
-        if (result_code != 0)
+        // Writing received data to file
+        int bytes_written = fwrite(buffer, 1, bytes_received, file);
+        // Checking if all data written
+        if (bytes_written != bytes_received)
         {
-            // Printing error and returning
-            printf("[S1] ERROR: Both tar methods failed\n");
-            return -1;
+            printf("[S1] Failed to write complete data to file\n");
+            fclose(file);
+            remove(full_path);
+            // Skipping what is left of this file
+            total_received += bytes_received;
+            return skip_client_bytes(client_socket, file_size - total_received) == -2 ? -2 : -1;
+        }
+
+        // Updating total received
+        total_received += bytes_received;
+
+        // Showing progress for larger files
+        if (file_size > 10000)
+        {
+            printf("[S1] Progress: %ld/%ld bytes (%.1f%%)\r",
+                   total_received, file_size, (total_received * 100.0) / file_size);
+            fflush(stdout);
         }
     }
 
-    // Opening the tar file to verify it exists
-    tar_file = fopen(tar_filepath, "rb");
-    // Checking if open failed
-    if (tar_file == NULL)
+    // Closing file
+    fclose(file);
+    printf("\n[S1] File received and stored: %s\n", full_path);
+    return 0;
+}
+
+/*SERVER CONNECTION FUNCTIONS */
+
+// Connecting to S2 (PDF server)
+int connect_to_s2()
+{
+    printf("[S1] Establishing connection to S2 (PDF server)...\n");
+
+    // Creating socket for S2 connection
+    int s2_socket = socket(AF_INET, SOCK_STREAM, 0);
+    // Checking if socket creation successful
+    if (s2_socket == -1)
     {
-        // Printing error and returning
-        printf("[S1] ERROR: Tar file was not created: %s\n", tar_filepath);
+        printf("[S1] Failed to create socket for S2\n");
         return -1;
     }
 
-    // Moving to end of file to get size
-    fseek(tar_file, 0, SEEK_END);
-    // Getting size in bytes
-    long size = ftell(tar_file);
-    // Closing the file
-    fclose(tar_file);
+    // Setting up S2 address structure
+    // Initializing to zero
+    struct sockaddr_in s2_addr = {0};
+    // Setting IPv4 protocol
+    s2_addr.sin_family = AF_INET;
+    // Converting port to network format
+    s2_addr.sin_port = htons(S2_PORT);
+    // Setting IP
+    s2_addr.sin_addr.s_addr = INADDR_ANY;
 
-    // Checking if size is zero
-    if (size == 0)
+    // Attempting to connect to S2
+    if (connect(s2_socket, (struct sockaddr *)&s2_addr, sizeof(s2_addr)) == -1)
     {
-        // Printing error
-        printf("[S1] ERROR: Tar file is empty: %s\n", tar_filepath);
-        // Removing the empty file
-        remove(tar_filepath);
-        // Returning error
+        printf("[S1] Failed to connect to S2 server\n");
+        // Closing socket before returning
+        close(s2_socket);
         return -1;
     }
 
-    // Printing success message
-    printf("[S1] TAR file created successfully: %s (size: %ld bytes)\n", tar_filepath, size);
-    // Returning success
-    return 0;
+    printf("[S1] Successfully connected to S2 server\n");
+    return s2_socket;
 }
 
-// Sending tar file to client
-int send_tar_file_to_client(int client_socket, const char *tar_file_path)
+// Connecting to S3 (Text server)
+int connect_to_s3()
 {
-    // Creating file pointer for tar file
-    FILE *tar_file;
-    // Creating buffer for file data
-    char buffer[BUFFER_SIZE];
-    // Storing file size
-    long file_size;
-    // Tracking bytes sent
-    long total_sent = 0;
-
-    printf("[S1] Sending tar file to client: %s\n", tar_file_path);
+    printf("[S1] Establishing connection to S3 (Text server)...\n");
 
-    // Opening tar file for reading
-    tar_file = fopen(tar_file_path, "rb");
-    if (tar_file == NULL)
+    // Creating socket for S3 connection
+    int s3_socket = socket(AF_INET, SOCK_STREAM, 0);
+    // Checking if socket creation successful
+    if (s3_socket == -1)
     {
-        printf("[S1] Cannot open tar file: %s\n", tar_file_path);
+        printf("[S1] Failed to create socket for S3\n");
         return -1;
     }
 
-    // Getting tar file size
-    fseek(tar_file, 0, SEEK_END);
-    file_size = ftell(tar_file);
-    fseek(tar_file, 0, SEEK_SET);
-
-    printf("[S1] Tar file size: %ld bytes\n", file_size);
+    // Setting up S3 address structure
+    struct sockaddr_in s3_addr = {0};
+    s3_addr.sin_family = AF_INET;
+    s3_addr.sin_port = htons(S3_PORT);
+    s3_addr.sin_addr.s_addr = INADDR_ANY;
 
-    // Sending file size to client first
-    if (send(client_socket, &file_size, sizeof(file_size), 0) == -1)
+    // Attempting to connect to S3
+    if (connect(s3_socket, (struct sockaddr *)&s3_addr, sizeof(s3_addr)) == -1)
     {
-        printf("[S1] Failed to send tar file size\n");
-        fclose(tar_file);
+        printf("[S1] Failed to connect to S3 server\n");
+        // Closing socket before returning
+        close(s3_socket);
         return -1;
     }
 
-    printf("[S1] Starting tar file transfer...\n");
-    // Sending tar file data in chunks
-    while (total_sent < file_size)
-    {
-        // Reading chunk from tar file
-        int bytes_read = fread(buffer, 1, BUFFER_SIZE, tar_file);
-        if (bytes_read <= 0)
-        {
-            printf("[S1] Failed to read tar file\n");
-            fclose(tar_file);
-            return -1;
-        }
+    printf("[S1] Successfully connected to S3 server\n");
+    return s3_socket;
+}
 
-        // Sending chunk to client
-        int bytes_sent = send(client_socket, buffer, bytes_read, 0);
-        if (bytes_sent <= 0)
-        {
-            printf("[S1] Failed to send tar data\n");
-            fclose(tar_file);
-            return -1;
-        }
+// Connecting to S4 (ZIP server)
+int connect_to_s4()
+{
+    printf("[S1] Establishing connection to S4 (ZIP server)...\n");
 
-        // Updating total sent
-        total_sent += bytes_sent;
+    // Creating socket for S4 connection
+    int s4_socket = socket(AF_INET, SOCK_STREAM, 0);
+    // Checking if socket creation successful
+    if (s4_socket == -1)
+    {
+        printf("[S1] Failed to create socket for S4\n");
+        return -1;
+    }
+
+    // Setting up S4 address structure
+    struct sockaddr_in s4_addr = {0};
+    s4_addr.sin_family = AF_INET;
+    s4_addr.sin_port = htons(S4_PORT);
+    s4_addr.sin_addr.s_addr = INADDR_ANY;
 
-        // Showing progress
-        printf("[S1] Tar transfer progress: %ld/%ld bytes (%.1f%%)\r",
-               total_sent, file_size, (total_sent * 100.0) / file_size);
-        fflush(stdout);
+    // Attempting to connect to S4
+    if (connect(s4_socket, (struct sockaddr *)&s4_addr, sizeof(s4_addr)) == -1)
+    {
+        printf("[S1] Failed to connect to S4 server\n");
+        // Closing socket before returning
+        close(s4_socket);
+        return -1;
     }
 
-    // Closing tar file
-    fclose(tar_file);
-    printf("\n[S1] Tar file sent to client successfully\n");
-    return 0;
+    printf("[S1] Successfully connected to S4 server\n");
+    return s4_socket;
 }
 
-/* CLIENT PROCESSING FUNCTION */
-
-// Processing client requests in child process
-void prcclient(int client_socket)
+// Opening a STORE session on another server (S2/S3/S4)
+// Only the command is sent; the FILE frame follows as soon as the client's data arrives
+int open_store_session(int server_socket, const char *filename, const char *dest_path)
 {
-    printf("\n[S1] New client connected - starting service\n");
-
     // Creating command buffer
     char command[1024];
-    // Creating response buffer
-    char response[1024];
 
-    // Sending welcome message to client
-    char welcome[] = "Welcome to S1 server.";
-    send(client_socket, welcome, strlen(welcome), 0);
-    printf("[S1] Welcome message sent to client\n");
+    // Building STORE command for server
+    snprintf(command, sizeof(command), "STORE %s %s", filename, dest_path);
+    printf("[S1] Sending command: %s\n", command);
 
-    // Starting infinite loop to process client commands
-    while (1)
+    // Sending command to server
+    if (send_text_frame(server_socket, FRAME_COMMAND, STATUS_OK, command) == -1)
     {
-        // Clearing command buffer
-        memset(command, 0, sizeof(command));
-
-        // Receiving command from client
-        int bytes = recv(client_socket, command, sizeof(command) - 1, 0);
+        printf("[S1] Failed to send STORE command\n");
+        return -1;
+    }
 
-        // Checking if client disconnected
-        if (bytes <= 0)
-        {
-            printf("[S1] Client disconnected - ending session\n");
-            break;
-        }
+    return 0;
+}
 
-        // Adding null terminator to command
-        command[bytes] = '\0';
-        printf("\n[S1] Processing command: %s\n", command);
+// Offering a file's content hash on an open STORE session before any body is sent
+// With delta set the server may answer DELTA, sending the chunk hashes of its stored copy next
+// Returns 1 when the server linked content it already had (the STORE is done), 0 when it
+// wants the body, 2 when it wants a delta (session still open either way), -1 when it ended
+// the STORE without storing anything, -2 if the connection broke
+int offer_store_digest(int server_socket, long file_size, const char *hex, int delta)
+{
+    // Creating offer and response buffers
+    char offer[128];
+    char response[256];
+    int status;
 
-        /*=== UPLOADF COMMAND PROCESSING ===*/
-        if (strncmp(command, "uploadf", 7) == 0)
-        {
-            printf("[S1] Processing uploadf command\n");
+    snprintf(offer, sizeof(offer), "%ld %s%s", file_size, hex, delta ? " DELTA" : "");
+    if (send_text_frame(server_socket, FRAME_DIGEST, STATUS_OK, offer) == -1 ||
+        recv_text_frame(server_socket, FRAME_RESPONSE, &status, response, sizeof(response)) == -1)
+    {
+        printf("[S1] Failed to offer content hash to server\n");
+        return -2;
+    }
 
-            // Creating command copy for parsing
-            char command_copy[1024];
-            strcpy(command_copy, command);
+    if (status == STATUS_OK)
+    {
+        return 1;
+    }
+    if (status == STATUS_NOT_FOUND && strcmp(response, "SEND") == 0)
+    {
+        return 0;
+    }
+    if (status == STATUS_NOT_FOUND && strcmp(response, "DELTA") == 0 && delta)
+    {
+        return 2;
+    }
+    printf("[S1] Server did not take content hash: %s\n", response);
+    return -1;
+}
 
-            // Creating token array for parsed arguments
-            char *tokens[6];
-            int token_count = 0;
+// Streaming one file from client through to a server with an open STORE session
+// The size the client announced is left in *body_size
+// Returns 0 once the body is relayed, -1 if server could not take it (client data drained),
+// -2 if client stream broke
+int relay_store_data(int client_socket, int server_socket, long *body_size)
+{
+    // Storing incoming file size and encoding
+    long file_size;
+    int compressed;
 
-            // Parsing command using strtok
-            char *token = strtok(command_copy, " ");
-            while (token != NULL && token_count < 6)
-            {
-                // Allocating memory for token
-                tokens[token_count] = malloc(strlen(token) + 1);
-                strcpy(tokens[token_count], token);
-                token_count++;
-                token = strtok(NULL, " ");
-            }
+    // Receiving FILE frame header from client and passing it on (servers always get raw data)
+    int header_result = receive_file_size_from_client(client_socket, &file_size, &compressed);
+    if (header_result != 0)
+    {
+        return header_result;
+    }
+    *body_size = file_size;
+    if (send_frame_header(server_socket, FRAME_FILE, STATUS_OK, file_size) == -1)
+    {
+        printf("[S1] Failed to forward file header to server\n");
+        return skip_client_file(client_socket, file_size, compressed) == -2 ? -2 : -1;
+    }
 
-            printf("[S1] Parsed %d arguments from command\n", token_count);
-            for (int i = 0; i < token_count; i++)
-            {
-                printf("[S1] Argument[%d]: '%s'\n", i, tokens[i]);
-            }
+    // Decompressing a compressed body on its way to the server
+    if (compressed)
+    {
+        printf("[S1] Decompressing file on its way to server...\n");
+        return receive_compressed_file_data(client_socket, file_size, server_socket);
+    }
 
-            // Validating command structure
-            if (token_count < 3)
-            {
-                send(client_socket, "ERROR: Not enough arguments. Command: uploadf file1 [file2] [file3] dest_path", 75, 0);
-                printf("[S1] ERROR: Invalid uploadf - need at least 3 arguments\n");
-                // Freeing allocated memory
-                for (int i = 0; i < token_count; i++)
-                    free(tokens[i]);
-                continue;
-            }
+    printf("[S1] Starting cut-through relay...\n");
+    // Tracking bytes pulled from the client
+    long consumed;
+    // Forwarding file data from client socket to server socket
+    int relay_result = relay_socket_data(client_socket, server_socket, file_size, &consumed);
+    if (relay_result == -1)
+    {
+        printf("[S1] Failed to receive file data from client\n");
+        return -2;
+    }
+    if (relay_result == -2)
+    {
+        printf("[S1] Failed to forward file data to server, draining client\n");
+        // Skipping what is left of this file on the client side
+        return skip_client_bytes(client_socket, file_size - consumed) == -2 ? -2 : -1;
+    }
 
-            if (token_count > 5)
-            {
-                send(client_socket, "ERROR: Too many arguments. Max 3 files allowed", 47, 0);
-                printf("[S1] ERROR: Invalid uploadf - too many arguments\n");
-                // Freeing allocated memory
-                for (int i = 0; i < token_count; i++)
-                    free(tokens[i]);
-                continue;
-            }
+    return 0;
+}
 
-            // Extracting file count and destination
-            // Total tokens - command - dest_path
-            int file_count = token_count - 2;
-            char destination_path[512];
-            // Last token is dest_path
-            strcpy(destination_path, tokens[token_count - 1]);
+// Streaming a delta body (DELTA frame, DATA frames, END frame) from client to a server
+// Frames are passed on as they come; each is checked first so a confused client cannot
+// leave the server waiting for a body that never ends
+// Returns 0 once the body is relayed, -1 if server could not take it (client data drained),
+// -2 if client stream broke
+int relay_delta_data(int client_socket, int server_socket)
+{
+    int server_failed = 0;
+    long literal_bytes = 0;
 
-            // Extracting filenames
-            char filenames[3][256];
-            memset(filenames, 0, sizeof(filenames));
-            for (int i = 0; i < file_count && i < 3; i++)
-            {
-                // Skip command token
-                strcpy(filenames[i], tokens[i + 1]);
-            }
+    printf("[S1] Relaying delta body...\n");
+    for (int expected = FRAME_DELTA;; expected = FRAME_DATA)
+    {
+        // Receiving next frame header from client
+        int type, status;
+        long length;
+        if (recv_frame_header(client_socket, &type, &status, &length) == -1)
+        {
+            printf("[S1] Failed to receive delta body from client\n");
+            return -2;
+        }
+        if ((type != expected && !(expected == FRAME_DATA && type == FRAME_END)) || length > DELTA_MAX_FRAME)
+        {
+            printf("[S1] ERROR: Unexpected frame type %d in delta body\n", type);
+            return -2;
+        }
+        if (type == FRAME_DATA && status == 0)
+        {
+            literal_bytes += length;
+        }
 
-            printf("[S1] File count: %d\n", file_count);
-            printf("[S1] Destination path: '%s'\n", destination_path);
-            for (int i = 0; i < file_count; i++)
+        // Passing frame on, or draining it once the server has failed
+        long consumed = 0;
+        if (!server_failed && send_frame_header(server_socket, type, status, length) == -1)
+        {
+            server_failed = 1;
+        }
+        if (!server_failed)
+        {
+            int relay_result = relay_socket_data(client_socket, server_socket, length, &consumed);
+            if (relay_result == -1)
             {
-                printf("[S1] File[%d]: '%s'\n", i, filenames[i]);
+                printf("[S1] Failed to receive delta body from client\n");
+                return -2;
             }
+            server_failed = (relay_result == -2);
+        }
+        if (server_failed && skip_client_bytes(client_socket, length - consumed) == -2)
+        {
+            return -2;
+        }
 
-            // Freeing token memory
-            for (int i = 0; i < token_count; i++)
-                free(tokens[i]);
+        if (type == FRAME_END)
+        {
+            break;
+        }
+    }
 
-            // Sending ready response to client
-            send(client_socket, "READY", 5, 0);
-            printf("[S1] Sent READY signal to client\n");
+    if (server_failed)
+    {
+        printf("[S1] Failed to forward delta body to server, drained client\n");
+        return -1;
+    }
+    printf("[S1] Delta body relayed (%ld new bytes)\n", literal_bytes);
+    return 0;
+}
 
-            // Receiving files from client
-            int files_received = 0;
-            printf("[S1] Starting file reception phase\n");
+// Reading a server's final STORE reply
+// Returns 0 if the server stored the file, -1 otherwise
+int receive_store_result(int server_socket)
+{
+    // Creating response buffer
+    char response[256];
+    // Storing response status
+    int status;
 
-            for (int i = 0; i < file_count; i++)
-            {
-                printf("[S1] Receiving file %d/%d: %s\n", i + 1, file_count, filenames[i]);
+    if (recv_text_frame(server_socket, FRAME_RESPONSE, &status, response, sizeof(response)) == -1)
+    {
+        printf("[S1] No final response from server\n");
+        return -1;
+    }
+    printf("[S1] Final server response: %s\n", response);
 
-                // Receiving file from client
-                if (receive_file_from_client(client_socket, filenames[i]) == 0)
-                {
-                    files_received++;
-                    printf("[S1] Successfully received: %s\n", filenames[i]);
+    // Checking if transfer successful
+    if (status != STATUS_OK)
+    {
+        printf("[S1] Server reported error: %s\n", response);
+        return -1;
+    }
 
-                    // Adding delay between files for synchronization
-                    if (i < file_count - 1)
-                    {
-                        printf("[S1] Waiting before next file\n");
-                        // 100ms delay
-                        usleep(100000);
-                    }
-                }
-                else
-                {
-                    printf("[S1] ERROR: Failed to receive: %s\n", filenames[i]);
-                    break;
-                }
-            }
+    return 0;
+}
 
-            // Checking if all files received successfully
-            if (files_received != file_count)
-            {
-                send(client_socket, "ERROR: Failed to receive all files", 34, 0);
-                printf("[S1] ERROR: Upload failed - only received %d/%d files\n", files_received, file_count);
-                continue;
-            }
 
-            printf("[S1] All files received successfully\n");
-            printf("[S1] Starting file distribution phase\n");
+// Asking server to start streaming a file and reading its FILE frame header
+// With codec CODEC_DEFLATE the server may answer with a compressed body it already holds;
+// *compressed is set when it does and *file_size is then the original size
+int open_retrieve_session(int server_socket, const char *server_path, const char *filename, int codec,
+                          long *file_size, int *compressed)
+{
+    // Creating command buffer
+    char retrieve_command[1024];
 
-            // Distributing files to appropriate servers
-            int success_count = 0;
-            for (int i = 0; i < file_count; i++)
-            {
-                char *filename = filenames[i];
-                char server_path[512];
-                char temp_file_path[512];
+    // Building RETRIEVE command for server
+    snprintf(retrieve_command, sizeof(retrieve_command), "RETRIEVE %s/%s%s", server_path, filename,
+             (codec == CODEC_DEFLATE) ? " DEFLATE" : "");
+    printf("[S1] Sending command: %s\n", retrieve_command);
 
-                printf("\n[S1] Processing file: %s\n", filename);
-                printf("[S1] Source destination: '%s'\n", destination_path);
-                snprintf(temp_file_path, sizeof(temp_file_path), "S1/temp/%s", filename);
+    // Sending retrieve command to server
+    if (send_text_frame(server_socket, FRAME_COMMAND, STATUS_OK, retrieve_command) == -1)
+    {
+        printf("[S1] Failed to send RETRIEVE command\n");
+        return -1;
+    }
 
-                // Routing based on file extension
-                if (strstr(filename, ".pdf") != NULL)
-                {
-                    printf("[S1] Routing PDF file to S2 server\n");
-                    // Converting path for S2
-                    convert_path_for_server(destination_path, "S2", server_path, sizeof(server_path));
+    // Receiving frame header (a response instead of file data means the server has no such file)
+    int type, status;
+    if (recv_frame_header(server_socket, &type, &status, file_size) == -1)
+    {
+        printf("[S1] Failed to receive file header from server\n");
+        return -1;
+    }
 
-                    // Connecting to S2
-                    int s2_socket = connect_to_s2();
-                    if (s2_socket != -1)
-                    {
-                        // Sending file to S2
-                        if (send_file_to_server(s2_socket, filename, server_path) == 0)
-                        {
-                            success_count++;
-                            printf("[S1] SUCCESS: PDF file sent to S2\n");
-                            // Cleaning up temp file
-                            remove(temp_file_path);
-                        }
-                        else
-                        {
-                            printf("[S1] ERROR: Failed to send PDF to S2\n");
-                        }
-                        close(s2_socket);
-                    }
-                    else
-                    {
-                        printf("[S1] ERROR: Cannot connect to S2 server\n");
-                    }
-                }
-                else if (strstr(filename, ".txt") != NULL)
-                {
-                    printf("[S1] Routing TXT file to S3 server\n");
-                    // Converting path for S3
-                    convert_path_for_server(destination_path, "S3", server_path, sizeof(server_path));
+    // Reading original size of a compressed body
+    *compressed = (type == FRAME_ZFILE);
+    if (*compressed)
+    {
+        char size_text[32];
+        char *end;
+        if (recv_frame_payload(server_socket, *file_size, size_text, sizeof(size_text)) == -1)
+        {
+            printf("[S1] Failed to receive compressed file header from server\n");
+            return -1;
+        }
+        *file_size = strtol(size_text, &end, 10);
+        if (end == size_text || *end != '\0' || *file_size < 0)
+        {
+            printf("[S1] Invalid compressed file size from server\n");
+            return -1;
+        }
+        printf("[S1] Server will stream %ld bytes as compressed chunks\n", *file_size);
+        return 0;
+    }
+    if (type != FRAME_FILE)
+    {
+        printf("[S1] Server could not open file: %s/%s\n", server_path, filename);
+        return -1;
+    }
 
-                    // Connecting to S3
-                    int s3_socket = connect_to_s3();
-                    if (s3_socket != -1)
-                    {
-                        // Sending file to S3
-                        if (send_file_to_server(s3_socket, filename, server_path) == 0)
-                        {
-                            success_count++;
-                            printf("[S1] SUCCESS: TXT file sent to S3\n");
-                            // Cleaning up temp file
-                            remove(temp_file_path);
-                        }
-                        else
-                        {
-                            printf("[S1] ERROR: Failed to send TXT to S3\n");
-                        }
-                        close(s3_socket);
-                    }
-                    else
-                    {
-                        printf("[S1] ERROR: Cannot connect to S3 server\n");
-                    }
-                }
-                else if (strstr(filename, ".zip") != NULL)
-                {
-                    printf("[S1] Routing ZIP file to S4 server\n");
-                    // Converting path for S4
-                    convert_path_for_server(destination_path, "S4", server_path, sizeof(server_path));
+    printf("[S1] Server will stream %ld bytes\n", *file_size);
+    return 0;
+}
 
-                    // Connecting to S4
-                    int s4_socket = connect_to_s4();
-                    if (s4_socket != -1)
-                    {
-                        // Sending file to S4
-                        if (send_file_to_server(s4_socket, filename, server_path) == 0)
-                        {
-                            success_count++;
-                            printf("[S1] SUCCESS: ZIP file sent to S4\n");
-                            // Cleaning up temp file
-                            remove(temp_file_path);
-                        }
-                        else
-                        {
-                            printf("[S1] ERROR: Failed to send ZIP to S4\n");
-                        }
-                        close(s4_socket);
-                    }
-                    else
-                    {
-                        printf("[S1] ERROR: Cannot connect to S4 server\n");
-                    }
-                }
-                else if (strstr(filename, ".c") != NULL)
-                {
-                    printf("[S1] Storing C file locally in S1\n");
-                    // Converting path for local storage
-                    convert_path_for_server(destination_path, "S1", server_path, sizeof(server_path));
+/* BACKEND CONNECTION POOL FUNCTIONS */
 
-                    // Storing file locally
-                    if (store_file_in_S1(filename, server_path) == 0)
-                    {
-                        success_count++;
-                        printf("[S1] SUCCESS: C file stored locally\n");
-                    }
-                    else
-                    {
-                        printf("[S1] ERROR: Failed to store C file locally\n");
-                    }
-                }
-                else
-                {
-                    printf("[S1] WARNING: Unknown file type - skipping: %s\n", filename);
-                }
+// Opening a brand-new connection to the given backend
+int connect_to_backend(int backend)
+{
+    // Dispatching to the matching connect function
+    switch (backend)
+    {
+    case BACKEND_S2:
+        return connect_to_s2();
+    case BACKEND_S3:
+        return connect_to_s3();
+    case BACKEND_S4:
+        return connect_to_s4();
+    default:
+        return -1;
+    }
+}
 
-                printf("[S1] End processing file: %s\n", filename);
-            }
+// Checking that an idle pooled connection is still usable
+// A healthy idle connection has nothing to read: EOF means the backend
+// closed it and stray bytes mean an earlier exchange was left half-read
+int backend_connection_is_healthy(int server_socket)
+{
+    // Peeking one byte without blocking
+    char probe;
+    int bytes = recv(server_socket, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
 
-            // Sending final response to client
-            printf("\n[S1] Distribution summary: %d/%d files successful\n", success_count, file_count);
+    // Checking whether the socket simply has no data waiting
+    if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return 1;
+    }
 
-            if (success_count == file_count)
-            {
-                send(client_socket, "SUCCESS: All files uploaded and distributed successfully", 56, 0);
-                printf("[S1] SUCCESS: All files uploaded successfully\n");
-            }
-            else if (success_count > 0)
+    return 0;
+}
+
+// Checking out a connection to a backend, reusing a warm one when possible
+// Returns socket descriptor or -1 if backend cannot be reached
+int acquire_backend_connection(int backend)
+{
+    // Getting pool for this backend
+    struct backend_pool *pool = &backend_pools[backend];
+    // Getting current time for idle expiry
+    time_t now = time(NULL);
+
+    // Taking most recently used connections first
+    pthread_mutex_lock(&pool_lock);
+    while (pool->idle_count > 0)
+    {
+        // Removing connection from idle list
+        struct pooled_connection connection = pool->idle[--pool->idle_count];
+
+        // Dropping connections that sat idle too long
+        if (now - connection.last_used > POOL_IDLE_TIMEOUT)
+        {
+            printf("[S1] Dropping expired %s connection\n", pool->name);
+            close(connection.socket);
+            continue;
+        }
+
+        // Dropping connections the backend closed or left dirty
+        if (!backend_connection_is_healthy(connection.socket))
+        {
+            printf("[S1] Dropping stale %s connection\n", pool->name);
+            close(connection.socket);
+            continue;
+        }
+
+        pthread_mutex_unlock(&pool_lock);
+        printf("[S1] Reusing pooled connection to %s\n", pool->name);
+        return connection.socket;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    // Opening new connection when no warm one is available
+    return connect_to_backend(backend);
+}
+
+// Returning a connection to its backend pool
+// Connections whose exchange did not finish cleanly must pass reusable = 0
+void release_backend_connection(int backend, int server_socket, int reusable)
+{
+    // Getting pool for this backend
+    struct backend_pool *pool = &backend_pools[backend];
+
+    // Ignoring connections that were never opened
+    if (server_socket == -1)
+    {
+        return;
+    }
+
+    // Closing connections that cannot be trusted
+    if (!reusable)
+    {
+        close(server_socket);
+        return;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    // Closing connections that do not fit in the pool
+    if (pool->idle_count >= pool_idle_limit)
+    {
+        pthread_mutex_unlock(&pool_lock);
+        close(server_socket);
+        return;
+    }
+
+    // Keeping connection warm for the next request
+    pool->idle[pool->idle_count].socket = server_socket;
+    pool->idle[pool->idle_count].last_used = time(NULL);
+    pool->idle_count++;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// Closing idle connections that passed the idle timeout
+void expire_idle_backend_connections()
+{
+    // Getting current time for idle expiry
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&pool_lock);
+    for (int backend = 0; backend < BACKEND_COUNT; backend++)
+    {
+        struct backend_pool *pool = &backend_pools[backend];
+        // Tracking how many connections are kept
+        int kept = 0;
+
+        for (int i = 0; i < pool->idle_count; i++)
+        {
+            if (now - pool->idle[i].last_used > POOL_IDLE_TIMEOUT)
             {
-                char partial_msg[256];
-                snprintf(partial_msg, sizeof(partial_msg),
-                         "PARTIAL SUCCESS: %d/%d files uploaded successfully",
-                         success_count, file_count);
-                send(client_socket, partial_msg, strlen(partial_msg), 0);
-                printf("[S1] PARTIAL: Some files uploaded successfully\n");
+                printf("[S1] Closing idle %s connection\n", pool->name);
+                close(pool->idle[i].socket);
             }
             else
             {
-                send(client_socket, "ERROR: Failed to distribute any files", 37, 0);
-                printf("[S1] ERROR: All uploads failed\n");
+                // Compacting surviving connections to the front
+                pool->idle[kept++] = pool->idle[i];
             }
+        }
+        pool->idle_count = kept;
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
 
-            printf("[S1] UPLOADF command processing complete\n");
+// Closing every pooled connection
+void close_backend_pool()
+{
+    pthread_mutex_lock(&pool_lock);
+    for (int backend = 0; backend < BACKEND_COUNT; backend++)
+    {
+        struct backend_pool *pool = &backend_pools[backend];
+        for (int i = 0; i < pool->idle_count; i++)
+        {
+            close(pool->idle[i].socket);
         }
+        pool->idle_count = 0;
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// Waiting for every relayed upload's STORE verdict, reading each as its backend finishes
+void collect_store_results(struct pending_upload *uploads, int count)
+{
+    // Creating poll set for the outstanding verdicts
+    struct pollfd poll_set[3];
+    // Mapping poll entries back to uploads
+    int poll_owner[3];
 
-        /*=== DOWNLF COMMAND PROCESSING ===*/
-        else if (strncmp(command, "downlf", 6) == 0)
+    while (1)
+    {
+        // Rebuilding poll set from uploads still waiting
+        int poll_count = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (uploads[i].awaiting_result)
+            {
+                poll_set[poll_count].fd = uploads[i].server_socket;
+                poll_set[poll_count].events = POLLIN;
+                poll_set[poll_count].revents = 0;
+                poll_owner[poll_count] = i;
+                poll_count++;
+            }
+        }
+        if (poll_count == 0)
         {
-            printf("[S1] Processing downlf command\n");
+            return;
+        }
 
-            // Parsing command arguments
-            char cmd[20], file1_path[512], file2_path[512], extra_arg[512];
-            int argc = sscanf(command, "%s %s %s %s", cmd, file1_path, file2_path, extra_arg);
+        int ready = poll(poll_set, poll_count, STORE_RESULT_TIMEOUT_MS);
+        if (ready == -1 && errno == EINTR)
+        {
+            continue;
+        }
 
-            printf("[S1] Parsed %d arguments from downlf command\n", argc);
+        for (int p = 0; p < poll_count; p++)
+        {
+            struct pending_upload *upload = &uploads[poll_owner[p]];
 
-            // Validating argument count
-            if (argc < 2)
+            // Giving up on every verdict still missing after a timeout or poll error
+            if (ready <= 0)
             {
-                send(client_socket, "ERROR: Not enough arguments. Command: downlf filepath1 [filepath2]", 64, 0);
-                printf("[S1] ERROR: Invalid downlf - not enough arguments\n");
+                printf("[S1] ERROR: No verdict for %s\n", upload->filename);
+                release_backend_connection(upload->backend, upload->server_socket, 0);
+                upload->awaiting_result = 0;
                 continue;
             }
-
-            if (argc > 3)
+            if (poll_set[p].revents == 0)
             {
-                send(client_socket, "ERROR: Too many arguments. Command: downlf filepath1 [filepath2] (max 2 files)", 76, 0);
-                printf("[S1] ERROR: Invalid downlf - too many arguments\n");
                 continue;
             }
 
-            // Determining number of files to download
-            int file_count = argc - 1; // Subtract command name
-            char *file_paths[2] = {file1_path, file2_path};
+            // Recording verdict and returning the connection
+            upload->result = receive_store_result(upload->server_socket);
+            printf("[S1] %s: %s\n", upload->filename, upload->result == 0 ? "stored" : "failed");
+            release_backend_connection(upload->backend, upload->server_socket, upload->result == 0);
+            upload->awaiting_result = 0;
+        }
+    }
+}
 
-            printf("[S1] Download request for %d files\n", file_count);
+// Settling a hash-first client's content offer for one uploadf file before its body is sent
+// The client hears HAVE when S1 (.c files) or the target backend already holds the content,
+// the backend linking it under the new path; in delta sessions it hears DELTA, followed by the
+// backend's chunk hashes, when the backend can rebuild the file from a copy it holds; SEND otherwise
+// Returns 1 when the file is stored without a body, 0 when the body follows, 2 when a delta body
+// follows, -2 if client stream broke
+int settle_upload_digest(int client_socket, struct pending_upload *upload, int delta)
+{
+    // Storing offered size and hash
+    long file_size;
+    char hex[2 * DIGEST_SIZE + 1];
 
-            // Retrieving each file from appropriate servers
-            int success_count = 0;
-            for (int i = 0; i < file_count; i++)
-            {
-                char *full_path = file_paths[i];
-                char filename[256];
-                char directory_path[512];
-                char server_path[512];
+    int offer = receive_upload_digest(client_socket, &file_size, hex);
+    if (offer == -2)
+    {
+        return -2;
+    }
+    if (offer == 0)
+    {
+        upload->size = file_size;
+    }
 
-                printf("[S1] Processing download %d/%d: %s\n", i + 1, file_count, full_path);
+    int have = 0;
+    int stored = 0;
+    if (offer == 0 && upload->backend == UPLOAD_LOCAL)
+    {
+        // Leaving an unchanged .c file as it is
+        char full_path[MAX_PATH];
+        snprintf(full_path, sizeof(full_path), "%s/%s", upload->server_path, upload->filename);
+        have = local_file_matches(full_path, file_size, hex);
+    }
+    else if (offer == 0 && upload->server_socket != -1)
+    {
+        stored = offer_store_digest(upload->server_socket, file_size, hex, delta);
+        if (stored == -1 &&
+            open_store_session(upload->server_socket, upload->filename, upload->server_path) == -1)
+        {
+            // Server ended the STORE (it does not know content offers) and could not start another
+            stored = -2;
+        }
+        if (stored == -2)
+        {
+            release_backend_connection(upload->backend, upload->server_socket, 0);
+            upload->server_socket = -1;
+        }
+        else if (stored == 1)
+        {
+            release_backend_connection(upload->backend, upload->server_socket, 1);
+            upload->server_socket = -1;
+            have = 1;
+        }
+    }
 
-                // Extracting filename from full path
-                char *last_slash = strrchr(full_path, '/');
-                if (last_slash == NULL)
-                {
-                    printf("[S1] ERROR: Invalid file path format: %s\n", full_path);
-                    continue;
-                }
-                strcpy(filename, last_slash + 1);
+    // Passing the server's chunk hashes on to the client
+    if (stored == 2)
+    {
+        int type, status;
+        long length;
+        if (recv_frame_header(upload->server_socket, &type, &status, &length) == -1 || type != FRAME_DATA ||
+            length % DIGEST_SIZE != 0)
+        {
+            // Server broke off after offering a delta: asking for a body nobody will take
+            printf("[S1] No chunk list from server for %s\n", upload->filename);
+            release_backend_connection(upload->backend, upload->server_socket, 0);
+            upload->server_socket = -1;
+            stored = 0;
+        }
+        else
+        {
+            long consumed;
+            printf("[S1] Offering %ld stored chunks of %s to client\n", length / DIGEST_SIZE, upload->filename);
+            if (send_text_frame(client_socket, FRAME_RESPONSE, STATUS_NOT_FOUND, "DELTA") == -1 ||
+                send_frame_header(client_socket, FRAME_DATA, STATUS_OK, length) == -1 ||
+                relay_socket_data(upload->server_socket, client_socket, length, &consumed) != 0)
+            {
+                release_backend_connection(upload->backend, upload->server_socket, 0);
+                upload->server_socket = -1;
+                return -2;
+            }
+            return 2;
+        }
+    }
+
+    if (have)
+    {
+        printf("[S1] %s already stored - skipping its transfer\n", upload->filename);
+        upload->result = 0;
+    }
+    if (send_text_frame(client_socket, FRAME_RESPONSE, have ? STATUS_OK : STATUS_NOT_FOUND,
+                        have ? "HAVE" : "SEND") == -1)
+    {
+        return -2;
+    }
+    return have;
+}
+
+/*FILE MANAGEMENT FUNCTIONS*/
+
+// Deleting file (used for C files in S1)
+int delete_file(const char *full_path)
+{
+    printf("[S1] Attempting to delete file: %s\n", full_path);
+
+    // Checking if file exists
+    FILE *file = fopen(full_path, "r");
+    if (file == NULL)
+    {
+        printf("[S1] File not found: %s\n", full_path);
+        return -1;
+    }
+    // Closing file handle
+    fclose(file);
+
+    // Removing the file
+    if (remove(full_path) == 0)
+    {
+        printf("[S1] File deleted successfully: %s\n", full_path);
+        return 0;
+    }
+    else
+    {
+        printf("[S1] Failed to delete file: %s\n", full_path);
+        return -1;
+    }
+}
+
+/* FILE LISTING FUNCTIONS */
+
+// Next names of a directory in name order, picked a batch at a time in fixed memory
+struct name_batch
+{
+    // Slots holding the picked names
+    char (*names)[256];
+    // Slot numbers: a max-heap while picking, then sorted by name
+    int *order;
+    int count;
+    // Set when names after the cursor were left out because the batch was full
+    int more;
+};
+
+// Moving order[position] down the max-heap of count slots until its children sort before it
+void sift_name_down(struct name_batch *batch, int position, int count)
+{
+    while (2 * position + 1 < count)
+    {
+        int child = 2 * position + 1;
+        if (child + 1 < count && strcmp(batch->names[batch->order[child + 1]], batch->names[batch->order[child]]) > 0)
+        {
+            child++;
+        }
+        if (strcmp(batch->names[batch->order[child]], batch->names[batch->order[position]]) <= 0)
+        {
+            break;
+        }
+        int slot = batch->order[child];
+        batch->order[child] = batch->order[position];
+        batch->order[position] = slot;
+        position = child;
+    }
+}
+
+// Picking the first limit names (at most LIST_BATCH) in directory_path that contain file_extension
+// and sort after `after` ("" for the start), with one readdir pass: the smallest names seen so far
+// sit in a max-heap, so each new name only has to beat the largest of them
+// Returns 0 with batch->order sorted by name, or -1 when the directory cannot be read
+int pick_name_batch(const char *directory_path, const char *file_extension, const char *after, int limit,
+                    struct name_batch *batch)
+{
+    DIR *dir = opendir(directory_path);
+    if (dir == NULL)
+    {
+        return -1;
+    }
+    batch->count = 0;
+    batch->more = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strstr(name, file_extension) == NULL ||
+            strcmp(name, after) <= 0 || strlen(name) >= sizeof(batch->names[0]))
+        {
+            continue;
+        }
+
+        if (batch->count < limit)
+        {
+            // Filling a free slot and moving it up the heap
+            int position = batch->count++;
+            batch->order[position] = position;
+            snprintf(batch->names[position], sizeof(batch->names[0]), "%s", name);
+            while (position > 0 &&
+                   strcmp(batch->names[batch->order[(position - 1) / 2]], batch->names[batch->order[position]]) < 0)
+            {
+                int slot = batch->order[(position - 1) / 2];
+                batch->order[(position - 1) / 2] = batch->order[position];
+                batch->order[position] = slot;
+                position = (position - 1) / 2;
+            }
+            continue;
+        }
+
+        // Replacing the largest picked name when this one sorts before it
+        batch->more = 1;
+        if (limit > 0 && strcmp(name, batch->names[batch->order[0]]) < 0)
+        {
+            snprintf(batch->names[batch->order[0]], sizeof(batch->names[0]), "%s", name);
+            sift_name_down(batch, 0, batch->count);
+        }
+    }
+    closedir(dir);
+
+    // Sorting picked slots by name (heap sort: the largest goes to the end each round)
+    for (int end = batch->count - 1; end > 0; end--)
+    {
+        int slot = batch->order[0];
+        batch->order[0] = batch->order[end];
+        batch->order[end] = slot;
+        sift_name_down(batch, 0, end);
+    }
+    return 0;
+}
+
+// One sorted run of names spilled to the temporary file, read back a buffer at a time
+struct name_run
+{
+    // Unread part of the run in the file
+    long offset;
+    long end;
+    // Names read so far ('\0' after each), position is the run's current name
+    char buffer[LIST_MERGE_BUFFER];
+    int position;
+    int filled;
+};
+
+// A directory's names in name order after one readdir pass: names are packed into an arena and
+// sorted by pointer; a directory outgrowing the arena is spilled as sorted runs that are then
+// merged k ways through a min-heap, so no name is moved once it is stored
+struct sorted_names
+{
+    // Packed names of the run in memory (used bytes of the arena) and pointers to them in name order
+    char *arena;
+    long used;
+    char **sorted;
+    int count;
+    int next;
+    // Runs spilled so far (NULL while everything fits in the arena)
+    FILE *spill;
+    struct name_run *runs;
+    int run_count;
+    // Runs ordered by current name, and the run whose name was returned last (-1 for none)
+    int *heap;
+    int heap_count;
+    int last_run;
+    // Set when the spill file could not be read back
+    int failed;
+};
+
+// Ordering name pointers for qsort
+int compare_name_pointers(const void *first, const void *second)
+{
+    return strcmp(*(char *const *)first, *(char *const *)second);
+}
+
+// Writing the names in the arena as one sorted run at the end of the spill file
+// Returns 0, or -1 if the file could not be written
+int spill_name_run(struct sorted_names *names)
+{
+    qsort(names->sorted, names->count, sizeof(char *), compare_name_pointers);
+    if (names->spill == NULL && (names->spill = tmpfile()) == NULL)
+    {
+        return -1;
+    }
+    struct name_run *runs = realloc(names->runs, (names->run_count + 1) * sizeof(struct name_run));
+    if (runs == NULL)
+    {
+        return -1;
+    }
+    names->runs = runs;
+
+    struct name_run *run = &names->runs[names->run_count++];
+    run->offset = ftell(names->spill);
+    for (int i = 0; i < names->count; i++)
+    {
+        fwrite(names->sorted[i], 1, strlen(names->sorted[i]) + 1, names->spill);
+    }
+    run->end = ftell(names->spill);
+    run->position = 0;
+    run->filled = 0;
+    names->count = 0;
+    return (ferror(names->spill) || fflush(names->spill) != 0) ? -1 : 0;
+}
+
+// Making sure the run's current name is whole in its buffer, reading on from the file
+// Returns 1 when there is a current name, 0 once the run is used up, -1 if reading failed
+int load_name_run(struct sorted_names *names, struct name_run *run)
+{
+    if (memchr(run->buffer + run->position, '\0', run->filled - run->position) != NULL)
+    {
+        return 1;
+    }
+
+    // Moving the partial name to the front and filling the rest of the buffer
+    memmove(run->buffer, run->buffer + run->position, run->filled - run->position);
+    run->filled -= run->position;
+    run->position = 0;
+    long wanted = LIST_MERGE_BUFFER - run->filled;
+    if (wanted > run->end - run->offset)
+    {
+        wanted = run->end - run->offset;
+    }
+    if (wanted == 0)
+    {
+        return (run->filled == 0) ? 0 : -1;
+    }
+    ssize_t bytes_read = pread(fileno(names->spill), run->buffer + run->filled, wanted, run->offset);
+    if (bytes_read <= 0)
+    {
+        return -1;
+    }
+    run->offset += bytes_read;
+    run->filled += bytes_read;
+    return (memchr(run->buffer, '\0', run->filled) != NULL) ? 1 : -1;
+}
+
+// Moving heap[position] down the min-heap of runs until its children sort after it
+void sift_run_down(struct sorted_names *names, int position)
+{
+    while (2 * position + 1 < names->heap_count)
+    {
+        int child = 2 * position + 1;
+        struct name_run *runs = names->runs;
+        if (child + 1 < names->heap_count &&
+            strcmp(runs[names->heap[child + 1]].buffer + runs[names->heap[child + 1]].position,
+                   runs[names->heap[child]].buffer + runs[names->heap[child]].position) < 0)
+        {
+            child++;
+        }
+        if (strcmp(runs[names->heap[child]].buffer + runs[names->heap[child]].position,
+                   runs[names->heap[position]].buffer + runs[names->heap[position]].position) >= 0)
+        {
+            break;
+        }
+        int run = names->heap[child];
+        names->heap[child] = names->heap[position];
+        names->heap[position] = run;
+        position = child;
+    }
+}
+
+// Readying an empty set of names for add_sorted_name
+// Returns 0, or -2 when out of memory
+int prepare_sorted_names(struct sorted_names *names)
+{
+    memset(names, 0, sizeof(*names));
+    names->last_run = -1;
+    names->arena = malloc(LIST_RUN_SIZE);
+    names->sorted = malloc(LIST_RUN_NAMES * sizeof(char *));
+    return (names->arena == NULL || names->sorted == NULL) ? -2 : 0;
+}
+
+// Packing a name into the arena, spilling the arena as a sorted run first when it is full
+// Returns 0, or -2 when the spill file could not be written
+int add_sorted_name(struct sorted_names *names, const char *name)
+{
+    long size = strlen(name) + 1;
+    if (names->used + size > LIST_RUN_SIZE || names->count == LIST_RUN_NAMES)
+    {
+        if (spill_name_run(names) == -1)
+        {
+            return -2;
+        }
+        names->used = 0;
+    }
+    memcpy(names->arena + names->used, name, size);
+    names->sorted[names->count++] = names->arena + names->used;
+    names->used += size;
+    return 0;
+}
+
+// Putting the names added from directory_path in order, ready for next_sorted_name
+// Returns 0, or -2 when out of memory or spill space
+int order_sorted_names(struct sorted_names *names, const char *directory_path)
+{
+    if (names->spill == NULL)
+    {
+        // Everything fitted: sorting the pointers is all it takes
+        qsort(names->sorted, names->count, sizeof(char *), compare_name_pointers);
+        return 0;
+    }
+    if (names->count > 0 && spill_name_run(names) == -1)
+    {
+        return -2;
+    }
+
+    // Starting the merge with every run's first name in the heap
+    names->heap = malloc(names->run_count * sizeof(int));
+    if (names->heap == NULL)
+    {
+        return -2;
+    }
+    for (int run = 0; run < names->run_count; run++)
+    {
+        int loaded = load_name_run(names, &names->runs[run]);
+        names->failed = names->failed || loaded == -1;
+        if (loaded == 1)
+        {
+            names->heap[names->heap_count++] = run;
+        }
+    }
+    for (int position = names->heap_count / 2 - 1; position >= 0; position--)
+    {
+        sift_run_down(names, position);
+    }
+    printf("[S1] Merging %d sorted runs of names from %s\n", names->run_count, directory_path);
+    return 0;
+}
+
+// Reading directory_path once, keeping the names that contain file_extension and sort after
+// `after` ("" for all of them), ready to be taken in name order with next_sorted_name
+// Returns 0, -1 when the directory cannot be read, -2 when out of memory or spill space
+int open_sorted_names(struct sorted_names *names, const char *directory_path, const char *file_extension,
+                      const char *after)
+{
+    if (prepare_sorted_names(names) == -2)
+    {
+        return -2;
+    }
+    DIR *dir = opendir(directory_path);
+    if (dir == NULL)
+    {
+        return -1;
+    }
+
+    int result = 0;
+    struct dirent *entry;
+    while (result == 0 && (entry = readdir(dir)) != NULL)
+    {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strstr(name, file_extension) == NULL ||
+            strcmp(name, after) <= 0)
+        {
+            continue;
+        }
+        result = add_sorted_name(names, name);
+    }
+    closedir(dir);
+    return (result == 0) ? order_sorted_names(names, directory_path) : result;
+}
+
+// Taking the next name in order (valid until the following call)
+// Returns NULL at the end, or when a spilled run could not be read (names->failed is set)
+const char *next_sorted_name(struct sorted_names *names)
+{
+    if (names->spill == NULL)
+    {
+        return (names->next < names->count) ? names->sorted[names->next++] : NULL;
+    }
+
+    // Moving the run whose name went out last on to its next name
+    if (names->last_run != -1)
+    {
+        struct name_run *run = &names->runs[names->last_run];
+        run->position += strlen(run->buffer + run->position) + 1;
+        int loaded = load_name_run(names, run);
+        names->failed = names->failed || loaded == -1;
+        if (loaded != 1)
+        {
+            names->heap[0] = names->heap[--names->heap_count];
+        }
+        sift_run_down(names, 0);
+        names->last_run = -1;
+    }
+    if (names->heap_count == 0 || names->failed)
+    {
+        return NULL;
+    }
+    names->last_run = names->heap[0];
+    return names->runs[names->last_run].buffer + names->runs[names->last_run].position;
+}
+
+// Releasing everything open_sorted_names (or open_found_files) set up
+void close_sorted_names(struct sorted_names *names)
+{
+    if (names->spill != NULL)
+    {
+        fclose(names->spill);
+    }
+    free(names->arena);
+    free(names->sorted);
+    free(names->runs);
+    free(names->heap);
+}
+
+// Adding the files below one directory of a filtered listing (dir_fd, at `relative` within the
+// listed directory, "" at its top) that contain file_extension, sort after `after` and pass the
+// filter, as "path\tsize\tmtime" entries
+// Names are checked before anything is looked up, and only metadata is read; symbolic links
+// are not followed, and paths too long for a listing cursor are left out
+// Returns 0, or -2 when out of memory or spill space
+int walk_found_files(struct sorted_names *names, int dir_fd, const char *relative, const char *file_extension,
+                     const char *after, const struct list_filter *filter)
+{
+    DIR *dir = fdopendir(dir_fd);
+    if (dir == NULL)
+    {
+        close(dir_fd);
+        return 0;
+    }
+
+    int result = 0;
+    struct dirent *entry;
+    while (result == 0 && (entry = readdir(dir)) != NULL)
+    {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            (entry->d_type == DT_DIR && !filter->recursive) ||
+            (entry->d_type != DT_DIR && entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN))
+        {
+            continue;
+        }
+        char path[256];
+        if (snprintf(path, sizeof(path), "%s%s%s", relative, (relative[0] != '\0') ? "/" : "", name) >=
+            (int)sizeof(path))
+        {
+            printf("[S1] WARNING: Leaving %s/%s out of the listing - path too long\n", relative, name);
+            continue;
+        }
+
+        // Descending into subdirectories
+        struct stat info;
+        int is_dir = (entry->d_type == DT_DIR);
+        if (entry->d_type == DT_UNKNOWN)
+        {
+            if (fstatat(dirfd(dir), name, &info, AT_SYMLINK_NOFOLLOW) == -1 ||
+                (!S_ISDIR(info.st_mode) && !S_ISREG(info.st_mode)))
+            {
+                continue;
+            }
+            is_dir = S_ISDIR(info.st_mode);
+        }
+        if (is_dir)
+        {
+            int child_fd = filter->recursive ? openat(dirfd(dir), name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW) : -1;
+            if (child_fd != -1)
+            {
+                result = walk_found_files(names, child_fd, path, file_extension, after, filter);
+            }
+            continue;
+        }
+
+        // Checking the name, then size and modification time
+        if (strstr(name, file_extension) == NULL || strcmp(path, after) <= 0 ||
+            (filter->pattern[0] != '\0' && fnmatch(filter->pattern, name, 0) != 0) ||
+            (entry->d_type != DT_UNKNOWN && fstatat(dirfd(dir), name, &info, AT_SYMLINK_NOFOLLOW) == -1) ||
+            !S_ISREG(info.st_mode) || (filter->min_size != -1 && info.st_size < filter->min_size) ||
+            (filter->max_size != -1 && info.st_size > filter->max_size) ||
+            (filter->newer != -1 && info.st_mtime < filter->newer) ||
+            (filter->older != -1 && info.st_mtime >= filter->older))
+        {
+            continue;
+        }
+        char line[256 + 48];
+        snprintf(line, sizeof(line), "%s\t%ld\t%ld", path, (long)info.st_size, (long)info.st_mtime);
+        result = add_sorted_name(names, line);
+    }
+    closedir(dir);
+    return result;
+}
+
+// Walking directory_path for a filtered listing, ready to be taken in path order with
+// next_sorted_name; arguments as for walk_found_files
+// Returns 0, -1 when the directory cannot be read, -2 when out of memory or spill space
+int open_found_files(struct sorted_names *names, const char *directory_path, const char *file_extension,
+                     const char *after, const struct list_filter *filter)
+{
+    if (prepare_sorted_names(names) == -2)
+    {
+        return -2;
+    }
+    int dir_fd = open(directory_path, O_RDONLY | O_DIRECTORY);
+    if (dir_fd == -1)
+    {
+        return -1;
+    }
+    int result = walk_found_files(names, dir_fd, "", file_extension, after, filter);
+    return (result == 0) ? order_sorted_names(names, directory_path) : result;
+}
+
+// Hex-encoding a name so it travels as one word in LIST requests and continuation tokens
+// (hex must hold 2 * strlen(name) + 1 bytes)
+void encode_list_name(const char *name, char *hex)
+{
+    for (int i = 0; name[i] != '\0'; i++)
+    {
+        sprintf(hex + 2 * i, "%02x", (unsigned char)name[i]);
+    }
+    hex[2 * strlen(name)] = '\0';
+}
+
+// Turning a hex-encoded name from a continuation token back into text
+// Returns 0, or -1 when it is not valid hex or too long
+int decode_list_name(const char *hex, char *name, int max_size)
+{
+    int length = strlen(hex);
+    if (length % 2 != 0 || length / 2 >= max_size || (int)strspn(hex, "0123456789abcdefABCDEF") != length)
+    {
+        return -1;
+    }
+    for (int i = 0; i < length / 2; i++)
+    {
+        unsigned int value;
+        sscanf(hex + 2 * i, "%2x", &value);
+        name[i] = (char)value;
+    }
+    name[length / 2] = '\0';
+    return (strlen(name) == (size_t)length / 2) ? 0 : -1;
+}
+
+// Reading a whole number with an optional one-letter unit from units, scaled by the matching
+// entry of scales (e.g. "10M" with units "KMG")
+// Returns the value, or -1 when text is not one
+long parse_list_quantity(const char *text, const char *units, const long *scales)
+{
+    char *end;
+    long value = strtol(text, &end, 10);
+    const char *unit = (*end != '\0') ? strchr(units, *end) : NULL;
+    if (end == text || value < 0 || (*end != '\0' && (unit == NULL || end[1] != '\0')))
+    {
+        return -1;
+    }
+    long scale = (unit != NULL) ? scales[unit - units] : 1;
+    return (value > LONG_MAX / scale) ? -1 : value * scale;
+}
+
+// Reading a dispfnames size such as 512, 64K, 10M or 2G as bytes (-1 when invalid)
+long parse_list_size(const char *text)
+{
+    const long scales[] = {1024L, 1024L * 1024, 1024L * 1024 * 1024};
+    return parse_list_quantity(text, "KMG", scales);
+}
+
+// Reading a dispfnames age such as 90, 30m, 12h or 7d as seconds (-1 when invalid)
+long parse_list_age(const char *text)
+{
+    const long scales[] = {1L, 60L, 3600L, 86400L};
+    return parse_list_quantity(text, "smhd", scales);
+}
+
+// Sending LIST request to another server (S2/S3/S4) for its names in order after `after`
+// ("" for the start), at most count of them (-1 for all), that pass filter (NULL for all)
+int send_list_request(int server_socket, const char *directory_path, const char *after, long count,
+                      const struct list_filter *filter)
+{
+    // Creating command buffer
+    char command[1024];
+    // Spelling the cursor as hex, since names may hold spaces
+    char hex[2 * 256];
+    encode_list_name(after, hex);
+
+    printf("[S1] Requesting file list from server for: %s\n", directory_path);
+
+    // Building LIST command
+    int length = snprintf(command, sizeof(command), "LIST %s STREAM", directory_path);
+    if (after[0] != '\0' && length < (int)sizeof(command))
+    {
+        length += snprintf(command + length, sizeof(command) - length, " AFTER %s", hex);
+    }
+    if (count != -1 && length < (int)sizeof(command))
+    {
+        length += snprintf(command + length, sizeof(command) - length, " COUNT %ld", count);
+    }
+
+    // Adding the filter, so the backend checks it while it walks the directory
+    if (filter != NULL && length < (int)sizeof(command))
+    {
+        length += snprintf(command + length, sizeof(command) - length, " STAT%s", filter->recursive ? " RECURSIVE" : "");
+    }
+    if (filter != NULL && filter->pattern[0] != '\0' && length < (int)sizeof(command))
+    {
+        char pattern_hex[2 * sizeof(filter->pattern)];
+        encode_list_name(filter->pattern, pattern_hex);
+        length += snprintf(command + length, sizeof(command) - length, " NAME %s", pattern_hex);
+    }
+    const char *bound_names[4] = {"MINSIZE", "MAXSIZE", "NEWER", "OLDER"};
+    for (int i = 0; filter != NULL && i < 4 && length < (int)sizeof(command); i++)
+    {
+        long bound = (i == 0) ? filter->min_size : (i == 1) ? filter->max_size : (i == 2) ? filter->newer : filter->older;
+        if (bound != -1)
+        {
+            length += snprintf(command + length, sizeof(command) - length, " %s %ld", bound_names[i], bound);
+        }
+    }
+    if (length >= (int)sizeof(command))
+    {
+        printf("[S1] ERROR: LIST command too long\n");
+        return -1;
+    }
+
+    // Sending LIST command to server
+    if (send_text_frame(server_socket, FRAME_COMMAND, STATUS_OK, command) == -1)
+    {
+        printf("[S1] Failed to send LIST command\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Asking several backends for their part of a listing at once, so each one is already picking
+// names while earlier parts of the listing go to the client; count and filter as for
+// send_list_request
+void request_remote_listings(struct remote_listing *listings, int count, const char *pathname, long limit,
+                             const struct list_filter *filter)
+{
+    for (int i = 0; i < count; i++)
+    {
+        struct remote_listing *listing = &listings[i];
+        listing->waiting = 0;
+
+        printf("[S1] Getting %s files from %s\n", listing->label, listing->prefix);
+        listing->server_socket = acquire_backend_connection(listing->backend);
+        if (listing->server_socket == -1)
+        {
+            printf("[S1] ERROR: Failed to connect to %s\n", listing->prefix);
+            continue;
+        }
+
+        // Converting S1 path to backend path
+        char server_path[MAX_PATH];
+        convert_path_for_server(pathname, listing->prefix, server_path, sizeof(server_path));
+
+        if (send_list_request(listing->server_socket, server_path, listing->after, limit, filter) == 0)
+        {
+            listing->waiting = 1;
+        }
+        else
+        {
+            release_backend_connection(listing->backend, listing->server_socket, 0);
+        }
+    }
+}
+
+// Dropping connections whose listing was not read to its end (the page filled up first)
+void drop_remote_listings(struct remote_listing *listings, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (listings[i].waiting)
+        {
+            release_backend_connection(listings[i].backend, listings[i].server_socket, 0);
+            listings[i].waiting = 0;
+        }
+    }
+}
+
+// Adding a name of one listing group to the output, sending a LIST frame whenever one fills up
+// Returns 0, 1 when the output is full (page size reached, or the single frame of a client
+// without LIST stream), or -1 if the client connection broke
+int emit_listing_name(struct listing_output *output, int type, const char *name)
+{
+    int name_length = strlen(name);
+    if (output->limit != -1 && output->emitted >= output->limit)
+    {
+        return 1;
+    }
+    if (output->used + name_length + 1 >= LIST_CHUNK_SIZE)
+    {
+        if (!output->stream)
+        {
+            printf("[S1] WARNING: Listing cut short for a client without LIST stream\n");
+            return 1;
+        }
+        if (send_frame(output->socket, FRAME_LIST, STATUS_PARTIAL, output->chunk, output->used) == -1)
+        {
+            return -1;
+        }
+        output->used = 0;
+    }
+
+    memcpy(output->chunk + output->used, name, name_length);
+    output->chunk[output->used + name_length] = '\n';
+    output->used += name_length + 1;
+    output->emitted++;
+    output->last_type = type;
+
+    // Next page starts after the name, or after the path of a filtered entry (before its last
+    // two tab-separated fields)
+    int key_length = name_length;
+    int fields = (output->filter != NULL) ? 0 : 2;
+    while (fields < 2 && key_length > 0)
+    {
+        fields += (name[--key_length] == '\t');
+    }
+    snprintf(output->last_name, sizeof(output->last_name), "%.*s", key_length, name);
+
+    // Keeping a copy for the namespace index while the group still fits
+    if (output->recording[type])
+    {
+        int *length = &output->recorded_length[type];
+        if (*length + name_length + 2 > NAMESPACE_RECORD_SIZE)
+        {
+            output->recording[type] = 0;
+        }
+        else
+        {
+            *length += snprintf(output->recorded[type] + *length, NAMESPACE_RECORD_SIZE - *length, "%s\n", name);
+        }
+    }
+    return 0;
+}
+
+// Ending the listing: streamed clients get the last names and an END frame carrying the
+// continuation token (empty when nothing is left) with status PARTIAL when a server could not
+// be listed; other clients get the whole listing as one LIST frame
+int finish_listing_output(struct listing_output *output, int more, int partial)
+{
+    if (!output->stream)
+    {
+        return send_frame(output->socket, FRAME_LIST, STATUS_OK, output->chunk, output->used);
+    }
+    if (output->used > 0 && send_frame(output->socket, FRAME_LIST, STATUS_PARTIAL, output->chunk, output->used) == -1)
+    {
+        return -1;
+    }
+
+    // Token is the group and (hex) name the next page starts after
+    char token[2 * 256 + 16] = "";
+    if (more && output->emitted > 0)
+    {
+        int length = snprintf(token, sizeof(token), "%d-", output->last_type);
+        encode_list_name(output->last_name, token + length);
+    }
+    return send_text_frame(output->socket, FRAME_END, partial ? STATUS_PARTIAL : STATUS_OK, token);
+}
+
+// Ordering name pointers for qsort
+int compare_list_names(const void *first, const void *second)
+{
+    return strcmp(*(const char *const *)first, *(const char *const *)second);
+}
+
+// Sending the names of an old backend's single LIST reply (unsorted, cursor ignored) in name
+// order after `after`, so paging works the same as for streamed replies
+// Returns as for emit_listing_name
+int emit_unsorted_names(struct listing_output *output, int type, char *names, const char *after)
+{
+    char *sorted[LIST_CHUNK_SIZE / 2];
+    int count = 0;
+    char *save_ptr;
+    for (char *name = strtok_r(names, "\n", &save_ptr); name != NULL && count < LIST_CHUNK_SIZE / 2;
+         name = strtok_r(NULL, "\n", &save_ptr))
+    {
+        sorted[count++] = name;
+    }
+    qsort(sorted, count, sizeof(char *), compare_list_names);
+
+    for (int i = 0; i < count; i++)
+    {
+        int result = (strcmp(sorted[i], after) > 0) ? emit_listing_name(output, type, sorted[i]) : 0;
+        if (result != 0)
+        {
+            return result;
+        }
+    }
+    return 0;
+}
+
+// Relaying one backend's part of the listing to the output as its frames arrive
+// Returns 0 when the backend's whole part was sent, 1 when the output filled up first (more
+// may follow), -1 if the client connection broke, -2 when the backend could not be listed
+int relay_remote_listing(struct listing_output *output, struct remote_listing *listing, int type)
+{
+    if (!listing->waiting)
+    {
+        return -2;
+    }
+
+    char chunk[LIST_CHUNK_SIZE + 1];
+    int result = -2;
+    int reusable = 0;
+    while (1)
+    {
+        // Waiting a bounded time for the next frame
+        struct pollfd poll_entry;
+        poll_entry.fd = listing->server_socket;
+        poll_entry.events = POLLIN;
+        poll_entry.revents = 0;
+        int ready = poll(&poll_entry, 1, LIST_TIMEOUT_MS);
+        if (ready == -1 && errno == EINTR)
+        {
+            continue;
+        }
+
+        int frame_type, status;
+        long length;
+        if (ready <= 0 || recv_frame_header(listing->server_socket, &frame_type, &status, &length) == -1 ||
+            length > LIST_CHUNK_SIZE || recv_all(listing->server_socket, chunk, length) == -1)
+        {
+            printf("[S1] ERROR: No file list from %s\n", listing->prefix);
+            break;
+        }
+        chunk[length] = '\0';
+
+        // End of the stream: "MORE" when the backend stopped at the requested count
+        if (frame_type == FRAME_END)
+        {
+            reusable = 1;
+            if (status == STATUS_OK || status == STATUS_NOT_FOUND)
+            {
+                result = (strcmp(chunk, "MORE") == 0) ? 1 : 0;
+            }
+            break;
+        }
+        if (frame_type != FRAME_LIST)
+        {
+            printf("[S1] ERROR: Unexpected frame type %d from %s\n", frame_type, listing->prefix);
+            break;
+        }
+
+        // Old backends answer with the whole list in one frame; it may have been cut short,
+        // so the index does not keep it, and it is unfiltered, so filtered listings leave it out
+        if (status != STATUS_PARTIAL)
+        {
+            reusable = 1;
+            output->recording[type] = 0;
+            result = (output->filter != NULL) ? -2 : emit_unsorted_names(output, type, chunk, listing->after);
+            break;
+        }
+
+        // Passing each name on
+        char *save_ptr;
+        int emitted = 0;
+        for (char *name = strtok_r(chunk, "\n", &save_ptr); name != NULL && emitted == 0;
+             name = strtok_r(NULL, "\n", &save_ptr))
+        {
+            emitted = emit_listing_name(output, type, name);
+        }
+        if (emitted != 0)
+        {
+            // Output filled up (or the client went away) with the stream unfinished
+            result = emitted;
+            break;
+        }
+    }
+
+    release_backend_connection(listing->backend, listing->server_socket, reusable);
+    listing->waiting = 0;
+    return result;
+}
+
+// Sending the .c files S1 keeps in local_path, in name order after `after`
+// The directory is read once: a page with room for at most LIST_BATCH names keeps only those,
+// anything longer is sorted in runs and merged; a filtered listing walks it instead
+// Returns as for relay_remote_listing
+int list_local_files(struct listing_output *output, const char *local_path, const char *after)
+{
+    long room = (output->limit == -1) ? -1 : output->limit - output->emitted;
+    if (room == 0)
+    {
+        return 1;
+    }
+    printf("[S1] Getting local C files from: %s\n", local_path);
+
+    int result = 0;
+    int opened;
+    if (output->filter == NULL && room != -1 && room <= LIST_BATCH)
+    {
+        // Picking no more than the page still has room for
+        struct name_batch batch;
+        batch.names = malloc(LIST_BATCH * sizeof(batch.names[0]));
+        batch.order = malloc(LIST_BATCH * sizeof(int));
+        opened = (batch.names == NULL || batch.order == NULL) ? -2 :
+                 pick_name_batch(local_path, ".c", after, (int)room, &batch);
+        for (int i = 0; opened == 0 && i < batch.count && result == 0; i++)
+        {
+            result = emit_listing_name(output, 0, batch.names[batch.order[i]]);
+        }
+        if (opened == 0 && result == 0 && batch.more)
+        {
+            result = 1;
+        }
+        free(batch.names);
+        free(batch.order);
+    }
+    else
+    {
+        // Merging sorted runs until the page fills up or the names run out
+        struct sorted_names names;
+        opened = (output->filter != NULL) ? open_found_files(&names, local_path, ".c", after, output->filter) :
+                                            open_sorted_names(&names, local_path, ".c", after);
+        const char *name;
+        while (opened == 0 && result == 0 && (name = next_sorted_name(&names)) != NULL)
+        {
+            result = emit_listing_name(output, 0, name);
+        }
+        if (opened == 0 && result == 0 && names.failed)
+        {
+            result = -2;
+        }
+        close_sorted_names(&names);
+    }
+
+    if (opened != 0)
+    {
+        // A directory S1 does not have simply holds no .c files
+        result = (opened == -1 && access(local_path, F_OK) != 0) ? 0 : -2;
+    }
+    return result;
+}
+
+/* NAMESPACE INDEX FUNCTIONS */
+
+// One stored file known to the namespace index
+struct namespace_file
+{
+    // File name within its directory
+    char name[NAMESPACE_NAME_SIZE];
+    // Next file of the directory in name order, or next free slot; -1 ends the chain
+    int next;
+    // Listing group (position in dispfnames output) and where the file is stored
+    int type;
+    int backend;
+    // Size in bytes and time stored, -1 when only known from a server listing
+    long size;
+    long mtime;
+    // Set while a server listing is being merged in
+    int listed;
+};
+
+// One directory known to the index, holding at least one file (a directory whose last file goes
+// is freed, so paths that were only listed or mistyped take no slot)
+struct namespace_dir
+{
+    // Path below the storage roots ("/" or "/a/b"), empty for an unused slot
+    char path[NAMESPACE_DIR_SIZE];
+    // First file in name order, -1 when empty
+    int first_file;
+    // Kept per listing group, so a change or an unreachable server only costs that group's listing:
+    // set when every file of the type is known (a full listing was taken and only S1 changed it since)
+    int complete[NAMESPACE_TYPE_COUNT];
+    // When the server last confirmed the type's listing
+    long verified_at[NAMESPACE_TYPE_COUNT];
+    // Index clock at the type's last change, so a listing taken meanwhile is not mistaken for the whole truth
+    long generation[NAMESPACE_TYPE_COUNT];
+    // Use counter at the last lookup, picking which directory to evict
+    long last_used;
+};
+
+// Everything S1 knows about stored files, in memory shared by every worker thread and process
+struct namespace_index
+{
+    // Guarding everything below across processes (robust, so a dying worker cannot wedge it)
+    pthread_mutex_t lock;
+    // Head of the free file slot chain
+    int free_file;
+    int file_count;
+    // Lines appended to the journal since it was last compacted
+    long journal_lines;
+    // Advanced on every change; a directory's generations and the last time a change could have
+    // touched a directory without a slot (one freed, or listings forgotten) are clock values
+    long clock;
+    long unindexed_changed;
+    // Directories in the table, and the counter stamped on each one looked up
+    int dir_count;
+    long use_counter;
+    struct namespace_dir dirs[NAMESPACE_MAX_DIRS];
+    struct namespace_file files[NAMESPACE_MAX_FILES];
+};
+
+// Index mapped before any worker starts, NULL when it could not be set up
+// (dispfnames then always asks the servers)
+struct namespace_index *namespace_index = NULL;
+
+// Where each listing group is stored
+const int namespace_backends[NAMESPACE_TYPE_COUNT] = {UPLOAD_LOCAL, BACKEND_S2, BACKEND_S3, BACKEND_S4};
+// How each listing group is named in log messages
+const char *namespace_labels[NAMESPACE_TYPE_COUNT] = {"C", "PDF", "TXT", "ZIP"};
+
+// How long a listing is trusted before the servers are asked again (--listing-ttl),
+// catching files that reached the servers without going through S1
+int namespace_listing_ttl = NAMESPACE_VERIFY_SECONDS;
+
+// Set while the journal is replayed, so evictions then are not journaled again
+int namespace_replaying = 0;
+
+// Marking one listing group (or every group when type is -1) as needing a fresh listing in every directory
+void namespace_forget_listings(int type)
+{
+    long now = ++namespace_index->clock;
+    namespace_index->unindexed_changed = now;
+    for (int i = 0; i < NAMESPACE_MAX_DIRS; i++)
+    {
+        for (int group = 0; group < NAMESPACE_TYPE_COUNT; group++)
+        {
+            if (type == -1 || type == group)
+            {
+                namespace_index->dirs[i].complete[group] = 0;
+                namespace_index->dirs[i].generation[group] = now;
+            }
+        }
+    }
+}
+
+// Finding the listing group of a file name from its extension
+// Returns the group, or -1 for types S1 does not store
+int namespace_type_of(const char *name)
+{
+    const char *extension = strrchr(name, '.');
+    const char *extensions[NAMESPACE_TYPE_COUNT] = {".c", ".pdf", ".txt", ".zip"};
+    for (int type = 0; extension != NULL && type < NAMESPACE_TYPE_COUNT; type++)
+    {
+        if (strcmp(extension, extensions[type]) == 0)
+        {
+            return type;
+        }
+    }
+    return -1;
+}
+
+// Taking the index lock
+void namespace_lock(void)
+{
+    if (pthread_mutex_lock(&namespace_index->lock) == EOWNERDEAD)
+    {
+        // Worker died holding the lock, maybe halfway through a change: relisting every directory
+        pthread_mutex_consistent(&namespace_index->lock);
+        namespace_forget_listings(-1);
+    }
+}
+
+// Releasing the index lock
+void namespace_unlock(void)
+{
+    pthread_mutex_unlock(&namespace_index->lock);
+}
+
+// Turning a client directory (~S1/a/b, ~/S1, a/b...) into the index key ("/a/b", "/" for the root)
+// Returns 0, or -1 for paths that can be spelled more than one way (., .. segments), which are not indexed
+int namespace_directory_key(const char *s1_path, char *key, int max_size)
+{
+    // Using the same conversion as the servers, then dropping the storage root
+    char local_path[MAX_PATH];
+    convert_path_for_server(s1_path, "S1", local_path, sizeof(local_path));
+
+    // Copying segments, skipping empty ones so a/b/ and a//b land on a/b
+    int length = 0;
+    char *save_ptr;
+    char *segment = strtok_r(local_path + 2, "/", &save_ptr);
+    while (segment != NULL)
+    {
+        if (strcmp(segment, ".") == 0 || strcmp(segment, "..") == 0 || strpbrk(segment, "\t\n") != NULL ||
+            length + (int)strlen(segment) + 2 > max_size)
+        {
+            return -1;
+        }
+        length += snprintf(key + length, max_size - length, "/%s", segment);
+        segment = strtok_r(NULL, "/", &save_ptr);
+    }
+    if (length == 0)
+    {
+        snprintf(key, max_size, "/");
+    }
+    return 0;
+}
+
+// Hashing a directory path (FNV-1a) to its first probe slot
+int namespace_dir_home(const char *key)
+{
+    unsigned int hash = 2166136261U;
+    for (const char *c = key; *c != '\0'; c++)
+    {
+        hash = (hash ^ (unsigned char)*c) * 16777619U;
+    }
+    return hash % NAMESPACE_MAX_DIRS;
+}
+
+// Adding or updating a file in a directory, keeping the chain in name order
+// Returns the file's slot, or -1 when the index is full
+int namespace_put_file(int dir_slot, const char *name, int type, long size, long mtime)
+{
+    struct namespace_dir *dir = &namespace_index->dirs[dir_slot];
+    dir->generation[type] = ++namespace_index->clock;
+
+    // Walking to the name or the place it belongs
+    int *link = &dir->first_file;
+    while (*link != -1 && strcmp(namespace_index->files[*link].name, name) < 0)
+    {
+        link = &namespace_index->files[*link].next;
+    }
+    struct namespace_file *file;
+    if (*link != -1 && strcmp(namespace_index->files[*link].name, name) == 0)
+    {
+        // Same name under another type cannot happen for real files, but the old group changes too
+        file = &namespace_index->files[*link];
+        dir->generation[file->type] = namespace_index->clock;
+    }
+    else
+    {
+        // Taking a free slot and linking it in
+        if (namespace_index->free_file == -1)
+        {
+            dir->complete[type] = 0;
+            return -1;
+        }
+        int slot = namespace_index->free_file;
+        file = &namespace_index->files[slot];
+        namespace_index->free_file = file->next;
+        namespace_index->file_count++;
+        snprintf(file->name, sizeof(file->name), "%s", name);
+        file->next = *link;
+        file->listed = 0;
+        *link = slot;
+    }
+
+    file->type = type;
+    file->backend = namespace_backends[type];
+    file->size = size;
+    file->mtime = mtime;
+    return file - namespace_index->files;
+}
+
+// Dropping a file from a directory (nothing happens when it is not there)
+void namespace_drop_file(int dir_slot, const char *name)
+{
+    struct namespace_dir *dir = &namespace_index->dirs[dir_slot];
+    int *link = &dir->first_file;
+    while (*link != -1 && strcmp(namespace_index->files[*link].name, name) != 0)
+    {
+        link = &namespace_index->files[*link].next;
+    }
+
+    // Bumping the group the name belongs to (all groups when the name says nothing about it)
+    int type = (*link != -1) ? namespace_index->files[*link].type : namespace_type_of(name);
+    long now = ++namespace_index->clock;
+    for (int group = 0; group < NAMESPACE_TYPE_COUNT; group++)
+    {
+        if (type == -1 || type == group)
+        {
+            dir->generation[group] = now;
+        }
+    }
+
+    if (*link != -1)
+    {
+        int slot = *link;
+        *link = namespace_index->files[slot].next;
+        namespace_index->files[slot].next = namespace_index->free_file;
+        namespace_index->free_file = slot;
+        namespace_index->file_count--;
+    }
+}
+
+// Dropping every file of one listing group from a directory and marking the group unlisted
+void namespace_clear_type(int dir_slot, int type)
+{
+    struct namespace_dir *dir = &namespace_index->dirs[dir_slot];
+    for (int slot = dir->first_file; slot != -1;)
+    {
+        struct namespace_file *file = &namespace_index->files[slot];
+        slot = file->next;
+        if (file->type == type)
+        {
+            namespace_drop_file(dir_slot, file->name);
+        }
+    }
+    dir->complete[type] = 0;
+}
+
+// Freeing a directory's slot along with any files still in it
+// Later directories of the same probe run are moved back into the gap (no tombstones), so other
+// slot numbers held by the caller are no longer valid afterwards
+void namespace_free_dir(int dir_slot)
+{
+    struct namespace_dir *dirs = namespace_index->dirs;
+    while (dirs[dir_slot].first_file != -1)
+    {
+        int slot = dirs[dir_slot].first_file;
+        dirs[dir_slot].first_file = namespace_index->files[slot].next;
+        namespace_index->files[slot].next = namespace_index->free_file;
+        namespace_index->free_file = slot;
+        namespace_index->file_count--;
+    }
+    namespace_index->unindexed_changed = ++namespace_index->clock;
+    namespace_index->dir_count--;
+
+    // Moving back each later entry of the run whose home is not between the gap and itself
+    int gap = dir_slot;
+    dirs[gap].path[0] = '\0';
+    for (int next = (gap + 1) % NAMESPACE_MAX_DIRS; dirs[next].path[0] != '\0'; next = (next + 1) % NAMESPACE_MAX_DIRS)
+    {
+        int home = namespace_dir_home(dirs[next].path);
+        int stays = (gap <= next) ? (gap < home && home <= next) : (gap < home || home <= next);
+        if (!stays)
+        {
+            dirs[gap] = dirs[next];
+            dirs[next].path[0] = '\0';
+            gap = next;
+        }
+    }
+}
+
+// Freeing every directory that holds no files (left by replayed clears and removals)
+// Moves slots, so only called while no slot is held (after replaying the journal)
+void namespace_sweep_dirs(void)
+{
+    for (int i = 0; i < NAMESPACE_MAX_DIRS;)
+    {
+        // Checking the same slot again after a free, since a later directory may have moved into it
+        if (namespace_index->dirs[i].path[0] != '\0' && namespace_index->dirs[i].first_file == -1)
+        {
+            namespace_free_dir(i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+// Writing the whole index as journal lines (files, then which listing groups are complete),
+// leaving out directories that hold no files
+// Returns 0, or -1 if writing failed
+int namespace_write_lines(FILE *file, long *lines)
+{
+    *lines = 0;
+    for (int i = 0; i < NAMESPACE_MAX_DIRS; i++)
+    {
+        struct namespace_dir *dir = &namespace_index->dirs[i];
+        if (dir->path[0] == '\0' || dir->first_file == -1)
+        {
+            continue;
+        }
+        for (int slot = dir->first_file; slot != -1; slot = namespace_index->files[slot].next)
+        {
+            struct namespace_file *entry = &namespace_index->files[slot];
+            fprintf(file, "+\t%s\t%s\t%d\t%ld\t%ld\n", dir->path, entry->name, entry->type, entry->size, entry->mtime);
+            (*lines)++;
+        }
+        for (int type = 0; type < NAMESPACE_TYPE_COUNT; type++)
+        {
+            if (dir->complete[type])
+            {
+                fprintf(file, "=\t%s\t%d\t%ld\n", dir->path, type, dir->verified_at[type]);
+                (*lines)++;
+            }
+        }
+    }
+    return ferror(file) ? -1 : 0;
+}
+
+// Rewriting the journal as a snapshot of the index (temporary file renamed into place)
+// Called while changes are under way, so slots are left where they are
+void namespace_compact(void)
+{
+    char temp_path[64];
+    snprintf(temp_path, sizeof(temp_path), "%s.%d", NAMESPACE_FILE, (int)getpid());
+    FILE *file = fopen(temp_path, "w");
+    long lines;
+    if (file == NULL || namespace_write_lines(file, &lines) == -1 || fclose(file) != 0 ||
+        rename(temp_path, NAMESPACE_FILE) == -1)
+    {
+        printf("[S1] WARNING: Failed to snapshot namespace index\n");
+        if (file != NULL)
+        {
+            unlink(temp_path);
+        }
+        return;
+    }
+    namespace_index->journal_lines = lines;
+    printf("[S1] Namespace index snapshot written (%d files)\n", namespace_index->file_count);
+}
+
+// Appending changes to the journal, so the index survives restarts
+// Called with the lock held, which keeps lines from different workers apart and in order
+void namespace_journal(const char *text, int line_count)
+{
+    int length = strlen(text);
+    int journal_fd = open(NAMESPACE_FILE, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (journal_fd == -1 || write(journal_fd, text, length) != length)
+    {
+        printf("[S1] WARNING: Failed to journal namespace change\n");
+    }
+    if (journal_fd != -1)
+    {
+        close(journal_fd);
+    }
+
+    // Compacting once the journal is mostly history
+    namespace_index->journal_lines += line_count;
+    if (namespace_index->journal_lines > 2L * namespace_index->file_count + NAMESPACE_JOURNAL_SLACK)
+    {
+        namespace_compact();
+    }
+}
+
+// Evicting the directory looked up least long ago, along with its files (one left empty while
+// the journal is replayed goes first)
+// Its listing groups are journaled as cleared, so replaying the journal does not bring it back
+void namespace_evict_dir(void)
+{
+    int oldest = -1;
+    for (int i = 0; i < NAMESPACE_MAX_DIRS; i++)
+    {
+        struct namespace_dir *dir = &namespace_index->dirs[i];
+        if (dir->path[0] == '\0')
+        {
+            continue;
+        }
+        if (oldest == -1 || (dir->first_file == -1) > (namespace_index->dirs[oldest].first_file == -1) ||
+            ((dir->first_file == -1) == (namespace_index->dirs[oldest].first_file == -1) &&
+             dir->last_used < namespace_index->dirs[oldest].last_used))
+        {
+            oldest = i;
+        }
+    }
+    if (oldest == -1)
+    {
+        return;
+    }
+
+    char lines[NAMESPACE_TYPE_COUNT * (NAMESPACE_DIR_SIZE + 16)];
+    int length = 0;
+    for (int type = 0; type < NAMESPACE_TYPE_COUNT; type++)
+    {
+        length += snprintf(lines + length, sizeof(lines) - length, "~\t%s\t%d\n", namespace_index->dirs[oldest].path, type);
+    }
+    if (!namespace_replaying)
+    {
+        printf("[S1] Namespace index holds %d directories - evicting least recently used %s\n",
+               namespace_index->dir_count, namespace_index->dirs[oldest].path);
+    }
+    namespace_free_dir(oldest);
+    if (!namespace_replaying)
+    {
+        namespace_journal(lines, NAMESPACE_TYPE_COUNT);
+    }
+}
+
+// Finding a directory's slot, creating it when asked (evicting the least recently used
+// directory first when the table holds NAMESPACE_DIR_LIMIT of them)
+// Creating moves other slots, so the caller must not hold any
+// Returns the slot, or -1 when it is not there
+int namespace_find_dir(const char *key, int create)
+{
+    int home = namespace_dir_home(key);
+    for (int probe = 0; probe < NAMESPACE_MAX_DIRS; probe++)
+    {
+        struct namespace_dir *dir = &namespace_index->dirs[(home + probe) % NAMESPACE_MAX_DIRS];
+        if (strcmp(dir->path, key) == 0)
+        {
+            dir->last_used = ++namespace_index->use_counter;
+            return dir - namespace_index->dirs;
+        }
+        if (dir->path[0] == '\0')
+        {
+            break;
+        }
+    }
+    if (!create)
+    {
+        return -1;
+    }
+
+    // Making room, then probing again since eviction moves directories back along their runs
+    if (namespace_index->dir_count >= NAMESPACE_DIR_LIMIT)
+    {
+        namespace_evict_dir();
+    }
+    for (int probe = 0; probe < NAMESPACE_MAX_DIRS; probe++)
+    {
+        struct namespace_dir *dir = &namespace_index->dirs[(home + probe) % NAMESPACE_MAX_DIRS];
+        if (dir->path[0] == '\0')
+        {
+            // New directory counts as changed for every listing already under way
+            snprintf(dir->path, sizeof(dir->path), "%s", key);
+            dir->first_file = -1;
+            dir->last_used = ++namespace_index->use_counter;
+            long now = ++namespace_index->clock;
+            for (int type = 0; type < NAMESPACE_TYPE_COUNT; type++)
+            {
+                dir->complete[type] = 0;
+                dir->verified_at[type] = 0;
+                dir->generation[type] = now;
+            }
+            namespace_index->dir_count++;
+            return dir - namespace_index->dirs;
+        }
+    }
+    return -1;
+}
+
+// Applying one journal line to the index
+void namespace_replay_line(char *line)
+{
+    char path[NAMESPACE_DIR_SIZE];
+    char name[NAMESPACE_NAME_SIZE];
+    int type;
+    long size, mtime, verified_at;
+    int dir_slot;
+
+    line[strcspn(line, "\n")] = '\0';
+    if (sscanf(line, "+\t%511[^\t]\t%255[^\t]\t%d\t%ld\t%ld", path, name, &type, &size, &mtime) == 5 &&
+        type >= 0 && type < NAMESPACE_TYPE_COUNT && (dir_slot = namespace_find_dir(path, 1)) != -1)
+    {
+        namespace_put_file(dir_slot, name, type, size, mtime);
+    }
+    else if (sscanf(line, "-\t%511[^\t]\t%255[^\t]", path, name) == 2 && (dir_slot = namespace_find_dir(path, 0)) != -1)
+    {
+        namespace_drop_file(dir_slot, name);
+    }
+    else if (sscanf(line, "~\t%511[^\t]\t%d", path, &type) == 2 && type >= 0 && type < NAMESPACE_TYPE_COUNT &&
+             (dir_slot = namespace_find_dir(path, 0)) != -1)
+    {
+        namespace_clear_type(dir_slot, type);
+    }
+    else if (sscanf(line, "=\t%511[^\t]\t%d\t%ld", path, &type, &verified_at) == 3 && type >= 0 &&
+             type < NAMESPACE_TYPE_COUNT && (dir_slot = namespace_find_dir(path, 0)) != -1)
+    {
+        namespace_index->dirs[dir_slot].complete[type] = 1;
+        namespace_index->dirs[dir_slot].verified_at[type] = verified_at;
+    }
+    else if (sscanf(line, "!\t%d", &type) == 1 && type >= 0 && type < NAMESPACE_TYPE_COUNT)
+    {
+        namespace_forget_listings(type);
+    }
+    else if (strcmp(line, "!") == 0)
+    {
+        namespace_forget_listings(-1);
+    }
+}
+
+// Mapping the shared index and loading it from the journal
+// Must run before workers start so they all inherit the same mapping
+void namespace_open(void)
+{
+    struct namespace_index *index = mmap(NULL, sizeof(struct namespace_index), PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (index == MAP_FAILED)
+    {
+        printf("[S1] WARNING: No namespace index - dispfnames will always ask the servers\n");
+        return;
+    }
+
+    // Setting up a lock that works across the fork and prefork worker processes
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&index->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+
+    // Chaining every file slot into the free list (the mapping starts zeroed)
+    for (int i = 0; i < NAMESPACE_MAX_FILES; i++)
+    {
+        index->files[i].next = (i + 1 < NAMESPACE_MAX_FILES) ? i + 1 : -1;
+    }
+    index->free_file = 0;
+    namespace_index = index;
+
+    // Replaying journal, then compacting it into a fresh snapshot
+    FILE *journal = fopen(NAMESPACE_FILE, "r");
+    if (journal != NULL)
+    {
+        char line[NAMESPACE_DIR_SIZE + NAMESPACE_NAME_SIZE + 96];
+        namespace_replaying = 1;
+        while (fgets(line, sizeof(line), journal) != NULL)
+        {
+            namespace_replay_line(line);
+        }
+        namespace_replaying = 0;
+        fclose(journal);
+    }
+    namespace_sweep_dirs();
+    namespace_compact();
+    printf("[S1] Namespace index loaded: %d files\n", index->file_count);
+}
+
+// Recording a file stored by uploadf in directory s1_path (backend: where it went)
+void namespace_add_file(const char *s1_path, const char *name, int backend, long size)
+{
+    if (namespace_index == NULL)
+    {
+        return;
+    }
+    int type = 0;
+    while (type < NAMESPACE_TYPE_COUNT && namespace_backends[type] != backend)
+    {
+        type++;
+    }
+    char key[NAMESPACE_DIR_SIZE];
+    int indexable = type < NAMESPACE_TYPE_COUNT && namespace_directory_key(s1_path, key, sizeof(key)) == 0 &&
+                    strpbrk(name, "/\t\n") == NULL && strlen(name) < NAMESPACE_NAME_SIZE;
+
+    namespace_lock();
+    char line[NAMESPACE_DIR_SIZE + NAMESPACE_NAME_SIZE + 96];
+    int dir_slot = indexable ? namespace_find_dir(key, 1) : -1;
+    long now = time(NULL);
+    if (dir_slot != -1 && namespace_put_file(dir_slot, name, type, size, now) != -1)
+    {
+        snprintf(line, sizeof(line), "+\t%s\t%s\t%d\t%ld\t%ld\n", key, name, type, size, now);
+    }
+    else if (dir_slot != -1)
+    {
+        // Index is full: only this directory's listing of the type is now unknown
+        printf("[S1] WARNING: Namespace index is full - relisting %s files of %s\n", namespace_labels[type], key);
+        namespace_clear_type(dir_slot, type);
+        snprintf(line, sizeof(line), "~\t%s\t%d\n", key, type);
+    }
+    else if (type < NAMESPACE_TYPE_COUNT)
+    {
+        // Could not say which directory changed (odd path spelling): trusting no listing of the type
+        printf("[S1] WARNING: Namespace index cannot track %s - relisting %s files\n", name, namespace_labels[type]);
+        namespace_forget_listings(type);
+        snprintf(line, sizeof(line), "!\t%d\n", type);
+    }
+    else
+    {
+        printf("[S1] WARNING: Namespace index cannot track %s - relisting directories\n", name);
+        namespace_forget_listings(-1);
+        snprintf(line, sizeof(line), "!\n");
+    }
+    namespace_journal(line, 1);
+    namespace_unlock();
+}
+
+// Recording a file deleted by removef from directory s1_path
+void namespace_remove_file(const char *s1_path, const char *name)
+{
+    if (namespace_index == NULL)
+    {
+        return;
+    }
+    char key[NAMESPACE_DIR_SIZE];
+    int indexable = namespace_directory_key(s1_path, key, sizeof(key)) == 0 && strpbrk(name, "/\t\n") == NULL;
+
+    namespace_lock();
+    char line[NAMESPACE_DIR_SIZE + NAMESPACE_NAME_SIZE + 16];
+    int dir_slot = indexable ? namespace_find_dir(key, 0) : -1;
+    if (dir_slot != -1)
+    {
+        namespace_drop_file(dir_slot, name);
+        snprintf(line, sizeof(line), "-\t%s\t%s\n", key, name);
+        if (namespace_index->dirs[dir_slot].first_file == -1)
+        {
+            // Last file gone: the next listing asks the servers again
+            namespace_free_dir(dir_slot);
+        }
+        namespace_journal(line, 1);
+    }
+    else if (indexable)
+    {
+        // Directory not in the index: only listings of it already under way need to know
+        namespace_index->unindexed_changed = ++namespace_index->clock;
+    }
+    else
+    {
+        // Could not say which directory changed: trusting no listing of the file's type
+        int type = namespace_type_of(name);
+        snprintf(line, sizeof(line), (type == -1) ? "!\n" : "!\t%d\n", type);
+        namespace_forget_listings(type);
+        namespace_journal(line, 1);
+    }
+    namespace_unlock();
+}
+
+// Finding which listing groups of s1_path the index can answer: those whose complete listing
+// was confirmed within the listing TTL
+// Returns a mask of them (bit 1 << type); the others must be asked of the servers
+int namespace_cached_types(const char *s1_path)
+{
+    char key[NAMESPACE_DIR_SIZE];
+    if (namespace_index == NULL || namespace_directory_key(s1_path, key, sizeof(key)) == -1)
+    {
+        return 0;
+    }
+
+    namespace_lock();
+    int dir_slot = namespace_find_dir(key, 0);
+    struct namespace_dir *dir = (dir_slot == -1) ? NULL : &namespace_index->dirs[dir_slot];
+    long now = time(NULL);
+    int answered = 0;
+    for (int type = 0; dir != NULL && type < NAMESPACE_TYPE_COUNT; type++)
+    {
+        if (dir->complete[type] && now - dir->verified_at[type] < namespace_listing_ttl)
+        {
+            answered |= 1 << type;
+        }
+    }
+    namespace_unlock();
+    return answered;
+}
+
+// Copying the names of one type in s1_path that sort after `after` into buffer, newline
+// separated and in name order, as many as fit (so the lock is never held while sending)
+// Returns the number copied, 0 once there are no more
+int namespace_copy_names(const char *s1_path, int type, const char *after, char *buffer, int max_size)
+{
+    char key[NAMESPACE_DIR_SIZE];
+    if (namespace_index == NULL || namespace_directory_key(s1_path, key, sizeof(key)) == -1)
+    {
+        return 0;
+    }
+
+    namespace_lock();
+    int dir_slot = namespace_find_dir(key, 0);
+    int count = 0;
+    int length = 0;
+    for (int slot = (dir_slot == -1) ? -1 : namespace_index->dirs[dir_slot].first_file; slot != -1;
+         slot = namespace_index->files[slot].next)
+    {
+        struct namespace_file *file = &namespace_index->files[slot];
+        if (file->type != type || strcmp(file->name, after) <= 0)
+        {
+            continue;
+        }
+        int name_length = strlen(file->name);
+        if (length + name_length + 2 > max_size)
+        {
+            break;
+        }
+        length += snprintf(buffer + length, max_size - length, "%s\n", file->name);
+        count++;
+    }
+    namespace_unlock();
+    return count;
+}
+
+// Sending the names of one type in s1_path from the index, in name order after `after`
+// Returns as for relay_remote_listing
+int list_indexed_files(struct listing_output *output, const char *s1_path, int type, const char *after)
+{
+    char names[LIST_CHUNK_SIZE];
+    char cursor[NAMESPACE_NAME_SIZE];
+    snprintf(cursor, sizeof(cursor), "%s", after);
+    while (namespace_copy_names(s1_path, type, cursor, names, sizeof(names)) > 0)
+    {
+        char *save_ptr;
+        for (char *name = strtok_r(names, "\n", &save_ptr); name != NULL; name = strtok_r(NULL, "\n", &save_ptr))
+        {
+            int result = emit_listing_name(output, type, name);
+            if (result != 0)
+            {
+                return result;
+            }
+            snprintf(cursor, sizeof(cursor), "%s", name);
+        }
+    }
+    return 0;
+}
+
+// Noting the index clock before the servers are asked for a listing, so changes made meanwhile
+// can be told apart (nothing is created for the directory yet)
+// Returns the value to hand to namespace_record_listing (-1 when there is no index)
+long namespace_listing_clock(void)
+{
+    if (namespace_index == NULL)
+    {
+        return -1;
+    }
+    namespace_lock();
+    long clock = namespace_index->clock;
+    namespace_unlock();
+    return clock;
+}
+
+// Taking full server listings of some groups of s1_path (listed_types: bit 1 << type per group,
+// lists: newline separated names per group) as the directory's contents. Sizes and times recorded
+// by uploadf are kept for names that are still there. A group S1 changed after listed_at (from
+// namespace_listing_clock) is dropped as possibly out of date. A directory is only added when the
+// listing found files in it, and one left without files is freed
+void namespace_record_listing(const char *s1_path, long listed_at, const char *lists[NAMESPACE_TYPE_COUNT],
+                              int listed_types)
+{
+    char key[NAMESPACE_DIR_SIZE];
+    if (namespace_index == NULL || listed_at == -1 || listed_types == 0 ||
+        namespace_directory_key(s1_path, key, sizeof(key)) == -1)
+    {
+        return;
+    }
+
+    namespace_lock();
+    int dir_slot = namespace_find_dir(key, 0);
+    if (dir_slot == -1)
+    {
+        // Adding the directory only when it has files and nothing could have changed it meanwhile
+        int found = 0;
+        for (int type = 0; type < NAMESPACE_TYPE_COUNT; type++)
+        {
+            found = found || ((listed_types & (1 << type)) && lists[type][0] != '\0');
+        }
+        if (found && namespace_index->unindexed_changed <= listed_at)
+        {
+            dir_slot = namespace_find_dir(key, 1);
+        }
+        if (dir_slot == -1)
+        {
+            namespace_unlock();
+            return;
+        }
+        // Listing started before the directory existed in the index, and nothing changed since
+        for (int type = 0; type < NAMESPACE_TYPE_COUNT; type++)
+        {
+            namespace_index->dirs[dir_slot].generation[type] = listed_at;
+        }
+    }
+    struct namespace_dir *dir = &namespace_index->dirs[dir_slot];
+    int recorded = 0;
+    for (int type = 0; type < NAMESPACE_TYPE_COUNT; type++)
+    {
+        if (!(listed_types & (1 << type)))
+        {
+            continue;
+        }
+        if (dir->generation[type] > listed_at)
+        {
+            printf("[S1] %s files of %s changed while listing - not indexing them\n", namespace_labels[type], key);
+            continue;
+        }
+        recorded |= 1 << type;
+    }
+    if (recorded == 0)
+    {
+        namespace_unlock();
+        return;
+    }
+
+    // Marking listed names, adding the ones the index did not have (or had under another type)
+    for (int type = 0; type < NAMESPACE_TYPE_COUNT; type++)
+    {
+        if (!(recorded & (1 << type)))
+        {
+            continue;
+        }
+        dir->complete[type] = 1;
+        for (const char *line = lists[type]; *line != '\0'; line += strcspn(line, "\n") + 1)
+        {
+            char name[NAMESPACE_NAME_SIZE];
+            int name_length = strcspn(line, "\n");
+            if (name_length >= NAMESPACE_NAME_SIZE || memchr(line, '/', name_length) != NULL ||
+                memchr(line, '\t', name_length) != NULL)
+            {
+                dir->complete[type] = 0;
+                continue;
+            }
+            memcpy(name, line, name_length);
+            name[name_length] = '\0';
+            int slot = dir->first_file;
+            while (slot != -1 && strcmp(namespace_index->files[slot].name, name) != 0)
+            {
+                slot = namespace_index->files[slot].next;
+            }
+            if (slot == -1 || namespace_index->files[slot].type != type)
+            {
+                slot = namespace_put_file(dir_slot, name, type, -1, -1);
+            }
+            if (slot == -1)
+            {
+                dir->complete[type] = 0;
+                continue;
+            }
+            namespace_index->files[slot].listed = 1;
+        }
+    }
+
+    // Dropping names of those groups the servers no longer have
+    for (int slot = dir->first_file; slot != -1;)
+    {
+        struct namespace_file *file = &namespace_index->files[slot];
+        slot = file->next;
+        if ((recorded & (1 << file->type)) && !file->listed)
+        {
+            namespace_drop_file(dir_slot, file->name);
+        }
+        file->listed = 0;
+    }
+
+    // Journaling each group afresh: cleared, every file, then whether it is complete (a directory
+    // left empty only journals the clears, and is freed)
+    int emptied = (dir->first_file == -1);
+    for (int type = 0; emptied && type < NAMESPACE_TYPE_COUNT; type++)
+    {
+        dir->complete[type] = 0;
+    }
+    long now = time(NULL);
+    int line_count = 0;
+    for (int type = 0; type < NAMESPACE_TYPE_COUNT; type++)
+    {
+        if (recorded & (1 << type))
+        {
+            dir->verified_at[type] = now;
+            line_count += dir->complete[type] ? 2 : 1;
+        }
+    }
+    for (int slot = dir->first_file; slot != -1; slot = namespace_index->files[slot].next)
+    {
+        line_count += (recorded & (1 << namespace_index->files[slot].type)) ? 1 : 0;
+    }
+    long capacity = (long)line_count * (NAMESPACE_DIR_SIZE + NAMESPACE_NAME_SIZE + 96);
+    char *text = malloc(capacity);
+    long length = 0;
+    for (int type = 0; text != NULL && type < NAMESPACE_TYPE_COUNT; type++)
+    {
+        if (!(recorded & (1 << type)))
+        {
+            continue;
+        }
+        length += snprintf(text + length, capacity - length, "~\t%s\t%d\n", key, type);
+        for (int slot = dir->first_file; slot != -1; slot = namespace_index->files[slot].next)
+        {
+            struct namespace_file *file = &namespace_index->files[slot];
+            if (file->type == type)
+            {
+                length += snprintf(text + length, capacity - length, "+\t%s\t%s\t%d\t%ld\t%ld\n", key, file->name,
+                                   file->type, file->size, file->mtime);
+            }
+        }
+        if (dir->complete[type])
+        {
+            length += snprintf(text + length, capacity - length, "=\t%s\t%d\t%ld\n", key, type, now);
+        }
+    }
+    if (text != NULL)
+    {
+        namespace_journal(text, line_count);
+    }
+    char summary[64] = "";
+    for (int type = 0; type < NAMESPACE_TYPE_COUNT; type++)
+    {
+        if (recorded & (1 << type))
+        {
+            // Out of memory: the listing stays in memory only, and is not trusted after a restart
+            dir->complete[type] = dir->complete[type] && text != NULL;
+            snprintf(summary + strlen(summary), sizeof(summary) - strlen(summary), " %s%s", namespace_labels[type],
+                     dir->complete[type] ? "" : "(partial)");
+        }
+    }
+    free(text);
+    if (emptied)
+    {
+        namespace_free_dir(dir_slot);
+        snprintf(summary, sizeof(summary), " none (no files)");
+    }
+    namespace_unlock();
+    printf("[S1] Namespace index now holds listings of %s:%s\n", key, summary);
+}
+
+/* COMPRESSION FUNCTIONS */
+
+// Holding one block of archive bytes on its way through the compressor
+struct compress_slot
+{
+    // Raw archive bytes and how many are filled
+    unsigned char *input;
+    long input_length;
+    // One complete gzip member holding those bytes
+    unsigned char *output;
+    long output_length;
+    // COMPRESS_FREE, COMPRESS_QUEUED, COMPRESS_BUSY or COMPRESS_DONE
+    int state;
+    // Set when compression failed
+    int failed;
+};
+
+// Compressing a tar stream on a pool of threads while it is being produced
+// Blocks are compressed independently into gzip members; concatenated they form one .gz
+// file, so blocks can be compressed in any order and sent in sequence
+struct block_compressor
+{
+    // Socket the compressed DATA frames go to
+    int socket;
+    // Ring of blocks; block number n lives in slots[n % slot_count]
+    struct compress_slot slots[2 * COMPRESS_MAX_THREADS];
+    int slot_count;
+    // Number of the block being filled, and of the oldest block not yet sent
+    long next_fill;
+    long next_send;
+    // Guarding slot states
+    pthread_mutex_t lock;
+    // Signalled when a block is queued (workers) or compressed (sender)
+    pthread_cond_t queued;
+    pthread_cond_t done;
+    // Set when workers must exit
+    int stopping;
+    // Compression threads
+    pthread_t threads[COMPRESS_MAX_THREADS];
+    int thread_count;
+    // Blocks stored without compression and bytes in and out, for the log
+    long stored_blocks;
+    long long raw_bytes;
+    long long sent_bytes;
+};
+
+// Compressing one block into a gzip member
+// Blocks that sample as incompressible are stored (level 0) so no time is spent on them
+int compress_block(struct compress_slot *slot, int *stored)
+{
+    *stored = sample_entropy(slot->input, slot->input_length) >= COMPRESS_ENTROPY_LIMIT;
+
+    // Setting up deflate with a gzip wrapper (window bits + 16)
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, *stored ? Z_NO_COMPRESSION : COMPRESS_LEVEL, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return -1;
+    }
+
+    // Compressing whole block in one call into the worst-case sized output buffer
+    zs.next_in = slot->input;
+    zs.avail_in = slot->input_length;
+    zs.next_out = slot->output;
+    zs.avail_out = COMPRESS_OUTPUT_SIZE;
+    int result = deflate(&zs, Z_FINISH);
+    slot->output_length = zs.total_out;
+    deflateEnd(&zs);
+    return (result == Z_STREAM_END) ? 0 : -1;
+}
+
+// Thread body - compressing queued blocks until the compressor stops
+void *compress_worker(void *arg)
+{
+    struct block_compressor *compressor = arg;
+
+    pthread_mutex_lock(&compressor->lock);
+    while (1)
+    {
+        // Taking the oldest queued block
+        struct compress_slot *slot = NULL;
+        for (long block = compressor->next_send; block < compressor->next_fill; block++)
+        {
+            struct compress_slot *candidate = &compressor->slots[block % compressor->slot_count];
+            if (candidate->state == COMPRESS_QUEUED)
+            {
+                slot = candidate;
+                break;
+            }
+        }
+        if (slot == NULL)
+        {
+            if (compressor->stopping)
+            {
+                break;
+            }
+            pthread_cond_wait(&compressor->queued, &compressor->lock);
+            continue;
+        }
+        slot->state = COMPRESS_BUSY;
+        pthread_mutex_unlock(&compressor->lock);
+
+        // Compressing outside the lock so blocks are worked on in parallel
+        int stored;
+        int failed = compress_block(slot, &stored) == -1;
+
+        pthread_mutex_lock(&compressor->lock);
+        slot->failed = failed;
+        slot->state = COMPRESS_DONE;
+        compressor->stored_blocks += stored;
+        pthread_cond_broadcast(&compressor->done);
+    }
+    pthread_mutex_unlock(&compressor->lock);
+    return NULL;
+}
+
+// Sending compressed blocks in order until block number limit has been sent
+// Returns 0, or -1 if compression failed or the connection broke
+int send_compressed_blocks(struct block_compressor *compressor, long limit)
+{
+    while (compressor->next_send < limit)
+    {
+        // Waiting for the oldest block to be compressed
+        struct compress_slot *slot = &compressor->slots[compressor->next_send % compressor->slot_count];
+        pthread_mutex_lock(&compressor->lock);
+        while (slot->state != COMPRESS_DONE)
+        {
+            pthread_cond_wait(&compressor->done, &compressor->lock);
+        }
+        pthread_mutex_unlock(&compressor->lock);
+
+        // Sending its gzip member as one DATA frame
+        if (slot->failed)
+        {
+            printf("[S1] ERROR: Failed to compress tar block\n");
+            return -1;
+        }
+        if (send_frame(compressor->socket, FRAME_DATA, STATUS_OK, slot->output, slot->output_length) == -1)
+        {
+            return -1;
+        }
+        compressor->raw_bytes += slot->input_length;
+        compressor->sent_bytes += slot->output_length;
+
+        // Handing the slot back for reuse
+        pthread_mutex_lock(&compressor->lock);
+        slot->state = COMPRESS_FREE;
+        slot->input_length = 0;
+        compressor->next_send++;
+        pthread_mutex_unlock(&compressor->lock);
+    }
+    return 0;
+}
+
+// Queueing the block being filled for compression
+void queue_compress_block(struct block_compressor *compressor)
+{
+    pthread_mutex_lock(&compressor->lock);
+    compressor->slots[compressor->next_fill % compressor->slot_count].state = COMPRESS_QUEUED;
+    compressor->next_fill++;
+    pthread_cond_signal(&compressor->queued);
+    pthread_mutex_unlock(&compressor->lock);
+}
+
+// Stopping the worker threads and freeing the compressor
+void free_block_compressor(struct block_compressor *compressor)
+{
+    pthread_mutex_lock(&compressor->lock);
+    // Dropping blocks nobody will send
+    for (int i = 0; i < compressor->slot_count; i++)
+    {
+        if (compressor->slots[i].state == COMPRESS_QUEUED)
+        {
+            compressor->slots[i].state = COMPRESS_FREE;
+        }
+    }
+    compressor->stopping = 1;
+    pthread_cond_broadcast(&compressor->queued);
+    pthread_mutex_unlock(&compressor->lock);
+    for (int i = 0; i < compressor->thread_count; i++)
+    {
+        pthread_join(compressor->threads[i], NULL);
+    }
+
+    for (int i = 0; i < compressor->slot_count; i++)
+    {
+        free(compressor->slots[i].input);
+        free(compressor->slots[i].output);
+    }
+    pthread_mutex_destroy(&compressor->lock);
+    pthread_cond_destroy(&compressor->queued);
+    pthread_cond_destroy(&compressor->done);
+    free(compressor);
+}
+
+// Starting a compressor that sends gzip members to socket as DATA frames
+// Returns NULL when memory or threads are not available
+struct block_compressor *start_block_compressor(int socket)
+{
+    struct block_compressor *compressor = calloc(1, sizeof(*compressor));
+    if (compressor == NULL)
+    {
+        return NULL;
+    }
+    compressor->socket = socket;
+    pthread_mutex_init(&compressor->lock, NULL);
+    pthread_cond_init(&compressor->queued, NULL);
+    pthread_cond_init(&compressor->done, NULL);
+
+    // Using one thread per core, two blocks per thread so sending overlaps compression
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int thread_count = (cores < 1) ? 1 : (cores > COMPRESS_MAX_THREADS) ? COMPRESS_MAX_THREADS : cores;
+    compressor->slot_count = 2 * thread_count;
+
+    for (int i = 0; i < compressor->slot_count; i++)
+    {
+        compressor->slots[i].input = malloc(COMPRESS_BLOCK_SIZE);
+        compressor->slots[i].output = malloc(COMPRESS_OUTPUT_SIZE);
+        if (compressor->slots[i].input == NULL || compressor->slots[i].output == NULL)
+        {
+            free_block_compressor(compressor);
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        if (pthread_create(&compressor->threads[i], NULL, compress_worker, compressor) != 0)
+        {
+            break;
+        }
+        compressor->thread_count++;
+    }
+    if (compressor->thread_count == 0)
+    {
+        free_block_compressor(compressor);
+        return NULL;
+    }
+
+    printf("[S1] Compressing tar stream on %d threads\n", compressor->thread_count);
+    return compressor;
+}
+
+// Adding archive bytes to the compressed stream (NULL data adds zeros)
+// Returns 0, or -1 if compression failed or the connection broke
+int compressor_write(struct block_compressor *compressor, const void *data, long length)
+{
+    while (length > 0)
+    {
+        // Freeing the slot for the next block by sending the block that used it before
+        long block = compressor->next_fill;
+        if (send_compressed_blocks(compressor, block - compressor->slot_count + 1) == -1)
+        {
+            return -1;
+        }
+
+        // Copying as much as fits into the block
+        struct compress_slot *slot = &compressor->slots[block % compressor->slot_count];
+        long piece = COMPRESS_BLOCK_SIZE - slot->input_length;
+        if (piece > length)
+        {
+            piece = length;
+        }
+        if (data != NULL)
+        {
+            memcpy(slot->input + slot->input_length, data, piece);
+            data = (const char *)data + piece;
+        }
+        else
+        {
+            memset(slot->input + slot->input_length, 0, piece);
+        }
+        slot->input_length += piece;
+        length -= piece;
+
+        // Handing full block to the workers
+        if (slot->input_length == COMPRESS_BLOCK_SIZE)
+        {
+            queue_compress_block(compressor);
+        }
+    }
+    return 0;
+}
+
+// Compressing what is left, sending every block in order and freeing the compressor
+// With send_pending unset the remaining blocks are dropped (the client stream is broken)
+// Returns 0, or -1 if compression failed or the connection broke
+int finish_block_compressor(struct block_compressor *compressor, int send_pending)
+{
+    int result = 0;
+    if (send_pending)
+    {
+        // Queueing partly filled block
+        if (compressor->slots[compressor->next_fill % compressor->slot_count].input_length > 0)
+        {
+            queue_compress_block(compressor);
+        }
+        result = send_compressed_blocks(compressor, compressor->next_fill);
+        printf("[S1] Compressed tar stream %lld -> %lld bytes (%ld blocks stored as incompressible)\n",
+               compressor->raw_bytes, compressor->sent_bytes, compressor->stored_blocks);
+    }
+
+    free_block_compressor(compressor);
+    return result;
+}
+
+/* TOMBSTONE FUNCTIONS */
+
+// Mapping an on-disk path under root (root/dir/file) to its name inside archives (dir/file)
+// Returns NULL for paths the directory walk would spell differently
+const char *tar_member_name(const char *root, const char *path)
+{
+    int root_length = strlen(root);
+    if (strncmp(path, root, root_length) != 0 || path[root_length] != '/')
+    {
+        return NULL;
+    }
+
+    const char *name = path + root_length + 1;
+    if (name[0] == '\0' || name[0] == '/' || strstr(name, "//") != NULL ||
+        strncmp(name, "./", 2) == 0 || strncmp(name, "../", 3) == 0 ||
+        strstr(name, "/./") != NULL || strstr(name, "/../") != NULL)
+    {
+        return NULL;
+    }
+    return name;
+}
+
+// Appending a deleted file to the tombstone log so downltar --since can report the deletion
+void record_tombstone(const char *root, const char *path)
+{
+    const char *name = tar_member_name(root, path);
+    if (name == NULL)
+    {
+        printf("[S1] WARNING: Not recording deletion of %s\n", path);
+        return;
+    }
+
+    // Writing the whole line at once so concurrent deletions never interleave
+    char line[MAX_PATH + 32];
+    int length = snprintf(line, sizeof(line), "%ld %s\n", (long)time(NULL), name);
+    int log_fd = open(TOMBSTONE_FILE, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (log_fd == -1 || write(log_fd, line, length) != length)
+    {
+        printf("[S1] WARNING: Failed to record deletion of %s\n", name);
+    }
+    if (log_fd != -1)
+    {
+        close(log_fd);
+    }
+}
+
+// Collecting names deleted at or after since that have not been stored again
+// Only names ending in file_extension are kept, each once
+// Returns a malloc'd newline separated list (empty when there is nothing), or NULL
+char *collect_tombstones(const char *root, const char *file_extension, long since, long *length)
+{
+    // Starting with an empty list
+    long capacity = BUFFER_SIZE;
+    char *names = malloc(capacity);
+    if (names == NULL)
+    {
+        return NULL;
+    }
+    names[0] = '\0';
+    *length = 0;
+
+    // Returning empty list when nothing was ever deleted
+    FILE *log = fopen(TOMBSTONE_FILE, "r");
+    if (log == NULL)
+    {
+        return names;
+    }
+
+    // Reading "time name" lines
+    char line[MAX_PATH + 32];
+    int extension_length = strlen(file_extension);
+    while (fgets(line, sizeof(line), log) != NULL)
+    {
+        long deleted_at;
+        char name[MAX_PATH];
+        if (sscanf(line, "%ld %1023[^\n]", &deleted_at, name) != 2 || deleted_at < since)
+        {
+            continue;
+        }
+
+        // Skipping other file types and names that exist again
+        int name_length = strlen(name);
+        if (name_length < extension_length || strcmp(name + name_length - extension_length, file_extension) != 0)
+        {
+            continue;
+        }
+        // A name too long to check is treated as present rather than tested cut short
+        char full_path[MAX_PATH];
+        if (snprintf(full_path, sizeof(full_path), "%s/%s", root, name) >= (int)sizeof(full_path) ||
+            access(full_path, F_OK) == 0)
+        {
+            continue;
+        }
+
+        // Skipping names already listed
+        char entry[MAX_PATH + 2];
+        snprintf(entry, sizeof(entry), "\n%s\n", name);
+        if (strncmp(names, entry + 1, name_length + 1) == 0 || strstr(names, entry) != NULL)
+        {
+            continue;
+        }
+
+        // Growing list when the name does not fit
+        while (*length + name_length + 2 > capacity)
+        {
+            char *grown = realloc(names, capacity * 2);
+            if (grown == NULL)
+            {
+                free(names);
+                fclose(log);
+                return NULL;
+            }
+            names = grown;
+            capacity *= 2;
+        }
+
+        // Appending name and newline
+        memcpy(names + *length, entry + 1, name_length + 1);
+        *length += name_length + 1;
+        names[*length] = '\0';
+    }
+
+    fclose(log);
+    return names;
+}
+
+/* TAR STREAM FUNCTIONS */
+
+// Holding a tar archive that is written straight to a socket as DATA frames
+struct tar_stream
+{
+    // Socket the frames go to
+    int socket;
+    // Headers, padding and small files collected into one frame
+    char buffer[TRANSMIT_BUFFER_SIZE];
+    // Bytes waiting in buffer
+    int used;
+    // Set while a member is partly written, so frames sent meanwhile are marked as continuing
+    int in_member;
+    // Members written so far
+    int member_count;
+    // Files last modified before this time are left out (0 archives everything)
+    long since;
+    // Compressor the archive bytes go through instead of plain DATA frames, or NULL
+    struct block_compressor *compressor;
+};
+
+// Sending whatever is buffered as one DATA frame
+// The frame is STATUS_OK when it ends on a member boundary and STATUS_PARTIAL when the
+// next DATA frame continues a member, so a reader may splice streams at OK frames
+int tar_stream_flush(struct tar_stream *stream)
+{
+    if (stream->used == 0)
+    {
+        return 0;
+    }
+    if (stream->compressor != NULL)
+    {
+        if (compressor_write(stream->compressor, stream->buffer, stream->used) == -1)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        int status = stream->in_member ? STATUS_PARTIAL : STATUS_OK;
+        if (send_frame(stream->socket, FRAME_DATA, status, stream->buffer, stream->used) == -1)
+        {
+            return -1;
+        }
+    }
+    stream->used = 0;
+    return 0;
+}
+
+// Appending bytes to the archive (NULL data appends zeros)
+int tar_stream_write(struct tar_stream *stream, const void *data, long length)
+{
+    while (length > 0)
+    {
+        // Flushing once the buffer is full
+        if (stream->used == (int)sizeof(stream->buffer) && tar_stream_flush(stream) == -1)
+        {
+            return -1;
+        }
+
+        // Copying as much as fits
+        long room = sizeof(stream->buffer) - stream->used;
+        long piece = (length < room) ? length : room;
+        if (data != NULL)
+        {
+            memcpy(stream->buffer + stream->used, data, piece);
+            data = (const char *)data + piece;
+        }
+        else
+        {
+            memset(stream->buffer + stream->used, 0, piece);
+        }
+        stream->used += piece;
+        length -= piece;
+    }
+
+    return 0;
+}
+
+// Padding the archive with zeros up to the next block boundary after length bytes
+int tar_stream_pad(struct tar_stream *stream, unsigned long long length)
+{
+    long padding = (TAR_BLOCK_SIZE - length % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+    return tar_stream_write(stream, NULL, padding);
+}
+
+// Writing a number as zero-padded octal into a header field of width bytes
+void tar_format_octal(char *field, int width, unsigned long long value)
+{
+    // Keeping only the digits that fit (the last byte holds the terminator)
+    unsigned long long limit = 1ULL << (3 * (width - 1));
+    snprintf(field, width, "%0*llo", width - 1, value % limit);
+}
+
+// Writing one 512-byte ustar header block
+int tar_write_header_block(struct tar_stream *stream, const char *name, const char *prefix,
+                           char type, unsigned long long size, const struct stat *st)
+{
+    // Starting from an all-zero block
+    char header[TAR_BLOCK_SIZE];
+    memset(header, 0, sizeof(header));
+
+    // Filling fields at their ustar offsets
+    memcpy(header, name, strnlen(name, 100));
+    tar_format_octal(header + 100, 8, st->st_mode & 07777);
+    tar_format_octal(header + 108, 8, st->st_uid);
+    tar_format_octal(header + 116, 8, st->st_gid);
+    tar_format_octal(header + 124, 12, size);
+    tar_format_octal(header + 136, 12, st->st_mtime);
+    header[156] = type;
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+    memcpy(header + 345, prefix, strnlen(prefix, 155));
+
+    // Computing checksum with the checksum field counted as spaces
+    memset(header + 148, ' ', 8);
+    unsigned int checksum = 0;
+    for (int i = 0; i < TAR_BLOCK_SIZE; i++)
+    {
+        checksum += (unsigned char)header[i];
+    }
+    snprintf(header + 148, 8, "%06o", checksum);
+
+    return tar_stream_write(stream, header, TAR_BLOCK_SIZE);
+}
+
+// Adding one pax record ("length key=value\n", where length counts the whole record)
+void tar_add_pax_record(char *records, int max_size, const char *key, const char *value)
+{
+    // Sizing the record, whose length field counts its own digits
+    int body = strlen(key) + strlen(value) + 3;
+    int length = body + 1;
+    while (length != body + snprintf(NULL, 0, "%d", length))
+    {
+        length = body + snprintf(NULL, 0, "%d", length);
+    }
+
+    int used = strlen(records);
+    snprintf(records + used, max_size - used, "%d %s=%s\n", length, key, value);
+}
+
+// Writing the header of one member, preceded by a pax extended header when the
+// name or size does not fit the classic ustar fields
+int tar_write_member_header(struct tar_stream *stream, const char *member_name, const struct stat *st)
+{
+    // Storing ustar name split and pax records
+    char name[101] = "";
+    char prefix[156] = "";
+    char records[MAX_PATH + 64] = "";
+    int name_length = strlen(member_name);
+
+    if (name_length <= 100)
+    {
+        strcpy(name, member_name);
+    }
+    else
+    {
+        // Looking for a slash that splits the path into prefix (155) and name (100)
+        const char *split = NULL;
+        for (const char *p = member_name; *p != '\0'; p++)
+        {
+            if (*p == '/' && name_length - (p - member_name) - 1 <= 100)
+            {
+                split = p;
+                break;
+            }
+        }
+
+        if (split != NULL && split != member_name && split - member_name <= 155 && split[1] != '\0')
+        {
+            memcpy(prefix, member_name, split - member_name);
+            strcpy(name, split + 1);
+        }
+        else
+        {
+            // Path too long for ustar - carrying it in a pax record
+            tar_add_pax_record(records, sizeof(records), "path", member_name);
+            memcpy(name, member_name, 100);
+        }
+    }
+
+    // Sizes of 8 GiB and more do not fit the 11-digit octal field
+    unsigned long long size = st->st_size;
+    if (size > TAR_MAX_OCTAL_SIZE)
+    {
+        char size_text[32];
+        snprintf(size_text, sizeof(size_text), "%llu", size);
+        tar_add_pax_record(records, sizeof(records), "size", size_text);
+        size = 0;
+    }
+
+    // Sending pax extended header first when needed
+    if (records[0] != '\0')
+    {
+        long records_length = strlen(records);
+        if (tar_write_header_block(stream, "././S1PaxHeader", "", 'x', records_length, st) == -1 ||
+            tar_stream_write(stream, records, records_length) == -1 ||
+            tar_stream_pad(stream, records_length) == -1)
+        {
+            return -1;
+        }
+    }
+
+    return tar_write_header_block(stream, name, prefix, '0', size, st);
+}
+
+// Adding one file to the archive
+// Returns 0 when added, 1 when skipped (unreadable), -1 if the connection broke
+int tar_add_file(struct tar_stream *stream, const char *full_path, const char *member_name)
+{
+    // Opening file for reading
+    int file_fd = open(full_path, O_RDONLY);
+    if (file_fd == -1)
+    {
+        printf("[S1] WARNING: Skipping unreadable file: %s\n", full_path);
+        return 1;
+    }
+
+    // Reading size and metadata from the open descriptor
+    struct stat st;
+    if (fstat(file_fd, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        close(file_fd);
+        return 1;
+    }
+    long file_size = st.st_size;
+
+    // Starting a small member in a fresh frame when it would not fit the room left,
+    // so it is never split across frames (headers take at most a few blocks)
+    if (file_size <= TAR_INLINE_LIMIT &&
+        stream->used + 6 * TAR_BLOCK_SIZE + file_size > (long)sizeof(stream->buffer) &&
+        tar_stream_flush(stream) == -1)
+    {
+        close(file_fd);
+        return -1;
+    }
+    stream->in_member = 1;
+
+    if (tar_write_member_header(stream, member_name, &st) == -1)
+    {
+        close(file_fd);
+        return -1;
+    }
+
+    if (file_size <= TAR_INLINE_LIMIT || stream->compressor != NULL)
+    {
+        // Copying small file (or any file that is compressed) through the frame buffer
+        long total_read = 0;
+        while (total_read < file_size)
+        {
+            if (stream->used == (int)sizeof(stream->buffer) && tar_stream_flush(stream) == -1)
+            {
+                close(file_fd);
+                return -1;
+            }
+            long room = sizeof(stream->buffer) - stream->used;
+            long remaining = file_size - total_read;
+            ssize_t bytes_read = read(file_fd, stream->buffer + stream->used, (remaining < room) ? remaining : room);
+            if (bytes_read <= 0)
+            {
+                // File shrank while reading - zero-filling so the member keeps its announced size
+                printf("[S1] WARNING: %s changed while being archived\n", full_path);
+                if (tar_stream_write(stream, NULL, remaining) == -1)
+                {
+                    close(file_fd);
+                    return -1;
+                }
+                break;
+            }
+            stream->used += bytes_read;
+            total_read += bytes_read;
+        }
+    }
+    else
+    {
+        // Handing the body of a large file to the kernel as its own DATA frame
+        if (tar_stream_flush(stream) == -1 ||
+            send_frame_header(stream->socket, FRAME_DATA, STATUS_PARTIAL, file_size) == -1 ||
+            transmit_file_data(stream->socket, file_fd, file_size, 0) == -1)
+        {
+            close(file_fd);
+            return -1;
+        }
+    }
+
+    // Closing file and padding member to a whole block
+    close(file_fd);
+    if (tar_stream_pad(stream, file_size) == -1)
+    {
+        return -1;
+    }
+    stream->in_member = 0;
+
+    stream->member_count++;
+    printf("[S1] Archived %s (%ld bytes)\n", member_name, file_size);
+    return 0;
+}
+
+// Walking directory recursively and adding every regular file whose name ends in file_extension
+// member_prefix is the directory's path inside the archive ("" at the root)
+// Returns 0 when the walk finished, -1 if the connection broke
+int tar_add_directory(struct tar_stream *stream, const char *directory, const char *member_prefix,
+                      const char *file_extension)
+{
+    // Opening directory
+    DIR *dir = opendir(directory);
+    if (dir == NULL)
+    {
+        printf("[S1] WARNING: Cannot open directory: %s\n", directory);
+        return 0;
+    }
+
+    // Reading entries one by one
+    struct dirent *entry;
+    int extension_length = strlen(file_extension);
+    while ((entry = readdir(dir)) != NULL)
+    {
+        // Skipping current and parent directory entries
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        // Building path on disk and name inside the archive
+        char full_path[MAX_PATH];
+        char member_name[MAX_PATH];
+        snprintf(full_path, sizeof(full_path), "%s/%s", directory, entry->d_name);
+        if (member_prefix[0] != '\0')
+        {
+            snprintf(member_name, sizeof(member_name), "%s/%s", member_prefix, entry->d_name);
+        }
+        else
+        {
+            snprintf(member_name, sizeof(member_name), "%s", entry->d_name);
+        }
+
+        // Checking entry type without following symlinks
+        struct stat st;
+        if (lstat(full_path, &st) == -1)
+        {
+            continue;
+        }
+
+        int result = 0;
+        if (S_ISDIR(st.st_mode))
+        {
+            // Descending into subdirectory
+            result = tar_add_directory(stream, full_path, member_name, file_extension);
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            // Adding file when its name ends with the extension and it changed at or after since
+            int name_length = strlen(entry->d_name);
+            if (name_length >= extension_length &&
+                strcmp(entry->d_name + name_length - extension_length, file_extension) == 0 &&
+                st.st_mtime >= stream->since)
+            {
+                result = tar_add_file(stream, full_path, member_name);
+            }
+        }
+
+        if (result == -1)
+        {
+            closedir(dir);
+            return -1;
+        }
+    }
+
+    // Closing directory
+    closedir(dir);
+    return 0;
+}
+
+// Streaming every matching file under root_directory modified at or after since as tar
+// members in DATA frames (through compressor when it is set)
+// The end-of-archive blocks are left out so several streams can be joined into one archive
+// Returns number of members, or -1 if the connection broke
+int stream_tar_members(int socket, const char *root_directory, const char *file_extension, long since,
+                       struct block_compressor *compressor)
+{
+    printf("[S1] Streaming %s files under %s as tar members\n", file_extension, root_directory);
+
+    // Allocating writer state (its frame buffer is too big for a thread stack)
+    struct tar_stream *stream = malloc(sizeof(*stream));
+    if (stream == NULL)
+    {
+        return -1;
+    }
+    stream->socket = socket;
+    stream->used = 0;
+    stream->in_member = 0;
+    stream->member_count = 0;
+    stream->since = since;
+    stream->compressor = compressor;
+
+    // Walking the tree and sending what is left in the buffer
+    int result = tar_add_directory(stream, root_directory, "", file_extension);
+    if (result == 0)
+    {
+        result = tar_stream_flush(stream);
+    }
+    if (result == 0)
+    {
+        result = stream->member_count;
+        printf("[S1] Streamed %d tar members\n", result);
+    }
+
+    free(stream);
+    return result;
+}
+
+// Streaming text held in memory as one tar member (the deletion manifest)
+// Returns 0, or -1 if the connection broke
+int stream_tar_text_member(int socket, const char *member_name, const char *text, long length,
+                           struct block_compressor *compressor)
+{
+    // Allocating writer state
+    struct tar_stream *stream = malloc(sizeof(*stream));
+    if (stream == NULL)
+    {
+        return -1;
+    }
+    stream->socket = socket;
+    stream->used = 0;
+    stream->in_member = 1;
+    stream->member_count = 0;
+    stream->since = 0;
+    stream->compressor = compressor;
+
+    // Describing member as a regular file owned by the server and written now
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFREG | 0644;
+    st.st_uid = getuid();
+    st.st_gid = getgid();
+    st.st_mtime = time(NULL);
+    st.st_size = length;
+
+    // Writing header, text and padding, then sending them
+    int result = tar_write_member_header(stream, member_name, &st);
+    if (result == 0)
+    {
+        result = tar_stream_write(stream, text, length);
+    }
+    if (result == 0)
+    {
+        result = tar_stream_pad(stream, length);
+    }
+    stream->in_member = 0;
+    if (result == 0)
+    {
+        result = tar_stream_flush(stream);
+    }
+
+    free(stream);
+    return result;
+}
+
+// Passing a backend's tar frames on to the client until the next member boundary
+// (through compressor when it is set)
+// Returns 1 at a member boundary, 0 when the backend finished, -1 when it failed between
+// frames (client still in sync), -2 if the client stream is no longer usable
+int relay_tar_member_run(struct tar_source *source, int client_socket, struct block_compressor *compressor)
+{
+    const char *server_name = backend_pools[source->backend].name;
+
+    while (1)
+    {
+        // Receiving next frame header from the backend
+        int type, status;
+        long length;
+        if (recv_frame_header(source->server_socket, &type, &status, &length) == -1)
+        {
+            printf("[S1] ERROR: %s stopped sending tar members\n", server_name);
+            return -1;
+        }
+
+        // Keeping the deletion list a backend sends ahead of its END frame
+        if (type == FRAME_LIST)
+        {
+            char *grown = realloc(source->deleted, source->deleted_length + length + 1);
+            if (grown == NULL)
+            {
+                skip_frame_payload(source->server_socket, length);
+                return -1;
+            }
+            source->deleted = grown;
+            if (recv_all(source->server_socket, source->deleted + source->deleted_length, length) == -1)
+            {
+                return -1;
+            }
+            source->deleted_length += length;
+            source->deleted[source->deleted_length] = '\0';
+            continue;
+        }
+
+        // Checking for the end of the member stream
+        if (type != FRAME_DATA)
+        {
+            char response[256];
+            if (recv_frame_payload(source->server_socket, length, response, sizeof(response)) == -1)
+            {
+                return -1;
+            }
+            if (type == FRAME_END && status == STATUS_OK)
+            {
+                return 0;
+            }
+            printf("[S1] ERROR: %s could not stream tar: %s\n", server_name, response);
+            return -1;
+        }
+
+        if (compressor != NULL)
+        {
+            // Feeding the payload to the compressor as it arrives
+            char buffer[TRANSMIT_BUFFER_SIZE];
+            long remaining = length;
+            while (remaining > 0)
+            {
+                long piece = (remaining > TRANSMIT_BUFFER_SIZE) ? TRANSMIT_BUFFER_SIZE : remaining;
+                if (recv_all(source->server_socket, buffer, piece) == -1 ||
+                    compressor_write(compressor, buffer, piece) == -1)
+                {
+                    printf("[S1] ERROR: Tar relay broke mid-frame\n");
+                    return -2;
+                }
+                remaining -= piece;
+            }
+        }
+        else
+        {
+            // Forwarding the DATA frame header, then splicing its payload through
+            long consumed;
+            if (send_frame_header(client_socket, FRAME_DATA, status, length) == -1 ||
+                relay_socket_data(source->server_socket, client_socket, length, &consumed) != 0)
+            {
+                printf("[S1] ERROR: Tar relay broke mid-frame\n");
+                return -2;
+            }
+        }
+
+        // Handing the turn back once a frame ends on a member boundary
+        source->mid_member = (status == STATUS_PARTIAL);
+        if (!source->mid_member)
+        {
+            return 1;
+        }
+    }
+}
+
+// Splicing the backends' member streams into the client archive in whatever order they arrive
+// A source is only switched away from at a member boundary, so members never interleave
+// Sources that fail between members are dropped with result -1 and the archive stays valid
+// Returns 0 when the remaining sources finished, -1 when a source failed inside a member
+// (archive unusable, client still in sync), -2 if the client stream is no longer usable
+int merge_tar_sources(struct tar_source *sources, int count, int client_socket, struct block_compressor *compressor)
+{
+    // Creating poll set for the sources still streaming
+    struct pollfd poll_set[BACKEND_COUNT];
+    // Mapping poll entries back to sources
+    int poll_owner[BACKEND_COUNT];
+    // Tracking how the merge ended
+    int outcome = 0;
+
+    while (outcome == 0)
+    {
+        // Rebuilding poll set from sources still streaming
+        int poll_count = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (sources[i].server_socket != -1)
+            {
+                poll_set[poll_count].fd = sources[i].server_socket;
+                poll_set[poll_count].events = POLLIN;
+                poll_set[poll_count].revents = 0;
+                poll_owner[poll_count] = i;
+                poll_count++;
+            }
+        }
+        if (poll_count == 0)
+        {
+            break;
+        }
+
+        int ready = poll(poll_set, poll_count, TAR_MEMBER_TIMEOUT_MS);
+        if (ready == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ready <= 0)
+        {
+            // Every source waiting here sits on a member boundary, so dropping them is safe
+            printf("[S1] ERROR: Timed out waiting for tar members\n");
+            break;
+        }
+
+        // Relaying one member run from each source that has data
+        for (int p = 0; p < poll_count && outcome == 0; p++)
+        {
+            if (poll_set[p].revents == 0)
+            {
+                continue;
+            }
+
+            struct tar_source *source = &sources[poll_owner[p]];
+            int result = relay_tar_member_run(source, client_socket, compressor);
+            if (result == 1)
+            {
+                continue;
+            }
+
+            // Returning connection to pool, reusable once the stream ended cleanly
+            release_backend_connection(source->backend, source->server_socket, result == 0);
+            source->server_socket = -1;
+            if (result == 0)
+            {
+                continue;
+            }
+
+            source->result = -1;
+            if (result == -2)
+            {
+                outcome = -2;
+            }
+            else if (source->mid_member)
+            {
+                printf("[S1] ERROR: %s failed inside a member - archive is unusable\n",
+                       backend_pools[source->backend].name);
+                outcome = -1;
+            }
+        }
+    }
+
+    // Dropping sources that never finished (timed out, or cut short by a failure)
+    for (int i = 0; i < count; i++)
+    {
+        if (sources[i].server_socket != -1)
+        {
+            printf("[S1] ERROR: No complete tar stream from %s\n", backend_pools[sources[i].backend].name);
+            release_backend_connection(sources[i].backend, sources[i].server_socket, 0);
+            sources[i].server_socket = -1;
+            sources[i].result = -1;
+        }
+    }
+
+    return outcome;
+}
+
+// Closing the archive sent to the client
+// A usable archive (STATUS_OK, or STATUS_PARTIAL when some sources are missing) gets its two
+// zero end-of-archive blocks before the END frame; STATUS_ERROR tells the client to drop it
+// The compressor, if any, is flushed and freed here
+int finish_tar_stream(int client_socket, struct block_compressor *compressor, int status, const char *message)
+{
+    if (status == STATUS_ERROR)
+    {
+        if (compressor != NULL)
+        {
+            finish_block_compressor(compressor, 0);
+        }
+        return send_text_frame(client_socket, FRAME_END, STATUS_ERROR, message);
+    }
+
+    // Sending end-of-archive marker
+    char trailer[2 * TAR_BLOCK_SIZE];
+    memset(trailer, 0, sizeof(trailer));
+    if (compressor != NULL)
+    {
+        // Compressing the marker with the rest and sending every block still in flight
+        if (compressor_write(compressor, trailer, sizeof(trailer)) == -1)
+        {
+            finish_block_compressor(compressor, 0);
+            return -1;
+        }
+        if (finish_block_compressor(compressor, 1) == -1)
+        {
+            return -1;
+        }
+    }
+    else if (send_frame(client_socket, FRAME_DATA, STATUS_OK, trailer, sizeof(trailer)) == -1)
+    {
+        return -1;
+    }
+
+    return send_text_frame(client_socket, FRAME_END, status, message);
+}
+
+/* CLIENT PROCESSING FUNCTION */
+
+// State kept for one client connection between its commands
+struct client_session
+{
+    // Client socket
+    int socket;
+    // Transfer codec agreed with HELLO (CODEC_NONE until then)
+    int codec;
+    // Set when the client offers content hashes ahead of uploadf bodies (HELLO ... HASH sha256)
+    int hash_first;
+    // Set when the client can send uploadf bodies as deltas against stored copies (HELLO ... DELTA cdc)
+    int delta;
+    // Set when the client takes dispfnames listings as a stream of frames (HELLO ... LIST stream)
+    int list_stream;
+};
+
+// Processing client requests in child process
+// Processing one command from the client
+// Returns 0 to keep the session open, -1 when the session must be closed
+int process_client_command(struct client_session *session, char *command)
+{
+    // Client this command came from
+    int client_socket = session->socket;
+    // Creating response buffer
+    char response[1024];
+
+
+    /*=== UPLOADF COMMAND PROCESSING ===*/
+    if (strncmp(command, "uploadf", 7) == 0)
+    {
+        printf("[S1] Processing uploadf command\n");
+
+        // Creating command copy for parsing
+        char command_copy[1024];
+        strcpy(command_copy, command);
+
+        // Creating token array for parsed arguments
+        char *tokens[6];
+        int token_count = 0;
+
+        // Parsing command using strtok_r
+        // Keeping strtok_r position for this command
+        char *save_ptr;
+        char *token = strtok_r(command_copy, " ", &save_ptr);
+        while (token != NULL && token_count < 6)
+        {
+            // Allocating memory for token
+            tokens[token_count] = malloc(strlen(token) + 1);
+            strcpy(tokens[token_count], token);
+            token_count++;
+            token = strtok_r(NULL, " ", &save_ptr);
+        }
+
+        printf("[S1] Parsed %d arguments from command\n", token_count);
+        for (int i = 0; i < token_count; i++)
+        {
+            printf("[S1] Argument[%d]: '%s'\n", i, tokens[i]);
+        }
+
+        // Validating command structure
+        if (token_count < 3)
+        {
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_BAD_REQUEST, "ERROR: Not enough arguments. Command: uploadf file1 [file2] [file3] dest_path");
+            printf("[S1] ERROR: Invalid uploadf - need at least 3 arguments\n");
+            // Freeing allocated memory
+            for (int i = 0; i < token_count; i++)
+                free(tokens[i]);
+            return 0;
+        }
+
+        if (token_count > 5)
+        {
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_BAD_REQUEST, "ERROR: Too many arguments. Max 3 files allowed");
+            printf("[S1] ERROR: Invalid uploadf - too many arguments\n");
+            // Freeing allocated memory
+            for (int i = 0; i < token_count; i++)
+                free(tokens[i]);
+            return 0;
+        }
+
+        // Extracting file count and destination
+        // Total tokens - command - dest_path
+        int file_count = token_count - 2;
+        char destination_path[512];
+        // Last token is dest_path
+        strcpy(destination_path, tokens[token_count - 1]);
+
+        // Extracting filenames
+        char filenames[3][256];
+        memset(filenames, 0, sizeof(filenames));
+        for (int i = 0; i < file_count && i < 3; i++)
+        {
+            // Skip command token
+            strcpy(filenames[i], tokens[i + 1]);
+        }
+
+        printf("[S1] File count: %d\n", file_count);
+        printf("[S1] Destination path: '%s'\n", destination_path);
+        for (int i = 0; i < file_count; i++)
+        {
+            printf("[S1] File[%d]: '%s'\n", i, filenames[i]);
+        }
+
+        // Freeing token memory
+        for (int i = 0; i < token_count; i++)
+            free(tokens[i]);
 
-                // Extracting directory path
-                int dir_length = last_slash - full_path;
-                strncpy(directory_path, full_path, dir_length);
-                directory_path[dir_length] = '\0';
+        // Opening a STORE session on every target backend up front so they get ready in parallel
+        struct pending_upload uploads[3];
+        int success_count = 0;
+        // Tracking whether the client stream broke mid-upload
+        int client_failed = 0;
+        printf("[S1] Opening storage sessions\n");
 
-                printf("[S1] Filename: %s, Directory: %s\n", filename, directory_path);
+        for (int i = 0; i < file_count; i++)
+        {
+            struct pending_upload *upload = &uploads[i];
+            strcpy(upload->filename, filenames[i]);
+            upload->server_socket = -1;
+            upload->size = -1;
+            upload->awaiting_result = 0;
+            upload->result = -1;
+
+            // Routing based on file extension
+            const char *prefix;
+            if (strstr(upload->filename, ".pdf") != NULL)
+            {
+                upload->backend = BACKEND_S2;
+                prefix = "S2";
+            }
+            else if (strstr(upload->filename, ".txt") != NULL)
+            {
+                upload->backend = BACKEND_S3;
+                prefix = "S3";
+            }
+            else if (strstr(upload->filename, ".zip") != NULL)
+            {
+                upload->backend = BACKEND_S4;
+                prefix = "S4";
+            }
+            else if (strstr(upload->filename, ".c") != NULL)
+            {
+                upload->backend = UPLOAD_LOCAL;
+                prefix = "S1";
+            }
+            else
+            {
+                printf("[S1] WARNING: Unknown file type - will skip: %s\n", upload->filename);
+                upload->backend = UPLOAD_UNSUPPORTED;
+                continue;
+            }
+
+            // Converting destination for the target server
+            convert_path_for_server(destination_path, prefix, upload->server_path, sizeof(upload->server_path));
+            if (upload->backend == UPLOAD_LOCAL)
+            {
+                continue;
+            }
+
+            // Checking out connection and sending STORE before any data arrives
+            upload->server_socket = acquire_backend_connection(upload->backend);
+            if (upload->server_socket == -1)
+            {
+                printf("[S1] ERROR: Cannot connect to %s for %s\n", prefix, upload->filename);
+                continue;
+            }
+            if (open_store_session(upload->server_socket, upload->filename, upload->server_path) == -1)
+            {
+                release_backend_connection(upload->backend, upload->server_socket, 0);
+                upload->server_socket = -1;
+            }
+        }
+
+        // Sending ready response to client
+        send_text_frame(client_socket, FRAME_RESPONSE, STATUS_OK, "READY");
+        printf("[S1] Sent READY signal to client\n");
+
+        // Relaying each file as it arrives; the client sends them one after another
+        printf("[S1] Starting streaming distribution phase\n");
+        for (int i = 0; i < file_count && !client_failed; i++)
+        {
+            struct pending_upload *upload = &uploads[i];
+            // Storing outcome of this file (0 ok, -1 failed, -2 client stream broken)
+            int result;
+
+            printf("\n[S1] Processing file %d/%d: %s\n", i + 1, file_count, upload->filename);
+
+            // Skipping the body when a hash-first client offers content that is already stored
+            int offer = session->hash_first ? settle_upload_digest(client_socket, upload, session->delta) : 0;
+            if (offer == 1)
+            {
+                continue;
+            }
+
+            if (offer == -2)
+            {
+                result = -2;
+            }
+            else if (offer == 2)
+            {
+                // Streaming delta to the backend, which rebuilds the file from its stored copy
+                result = relay_delta_data(client_socket, upload->server_socket);
+                if (result == 0)
+                {
+                    upload->awaiting_result = 1;
+                }
+                else
+                {
+                    release_backend_connection(upload->backend, upload->server_socket, 0);
+                    upload->server_socket = -1;
+                }
+            }
+            else if (upload->backend == UPLOAD_LOCAL)
+            {
+                printf("[S1] Storing C file locally in S1\n");
+                // Writing file straight into local storage
+                result = receive_file_from_client(client_socket, upload->filename, upload->server_path);
+                upload->result = result == 0 ? 0 : -1;
+            }
+            else if (upload->server_socket == -1)
+            {
+                printf("[S1] ERROR: No storage session for %s - skipping its data\n", upload->filename);
+                // Consuming the data so the next file lines up
+                result = discard_file_from_client(client_socket) == -2 ? -2 : -1;
+            }
+            else
+            {
+                // Streaming body to the backend without waiting for its verdict
+                result = relay_store_data(client_socket, upload->server_socket, &upload->size);
+                if (result == 0)
+                {
+                    upload->awaiting_result = 1;
+                }
+                else
+                {
+                    release_backend_connection(upload->backend, upload->server_socket, 0);
+                    upload->server_socket = -1;
+                }
+            }
+
+            if (result == -2)
+            {
+                printf("[S1] ERROR: Client stream broken while receiving: %s\n", upload->filename);
+                client_failed = 1;
+            }
+        }
+
+        // Closing STORE sessions that never got a body (the client stream broke before their
+        // file), so their backends stop waiting for one
+        for (int i = 0; i < file_count; i++)
+        {
+            if (uploads[i].server_socket != -1 && !uploads[i].awaiting_result)
+            {
+                release_backend_connection(uploads[i].backend, uploads[i].server_socket, 0);
+                uploads[i].server_socket = -1;
+            }
+        }
+
+        // Collecting the backends' verdicts as they finish writing
+        collect_store_results(uploads, file_count);
 
-                // Routing to appropriate server based on file extension
-                if (strstr(filename, ".pdf") != NULL)
+        // Counting stored files and recording them in the namespace index
+        for (int i = 0; i < file_count; i++)
+        {
+            if (uploads[i].result == 0)
+            {
+                success_count++;
+                if (uploads[i].backend == UPLOAD_LOCAL)
                 {
-                    printf("[S1] Retrieving PDF file from S2\n");
+                    // Taking size from the stored copy, since an unchanged .c file is never sent
+                    // (-1 when the path does not fit, rather than the size of a cut-short one)
+                    char local_path[MAX_PATH];
+                    struct stat st;
+                    int fits = snprintf(local_path, sizeof(local_path), "%s/%s", uploads[i].server_path,
+                                        uploads[i].filename) < (int)sizeof(local_path);
+                    uploads[i].size = (fits && stat(local_path, &st) == 0) ? st.st_size : -1;
+                }
+                namespace_add_file(destination_path, uploads[i].filename, uploads[i].backend, uploads[i].size);
+            }
+        }
+
+        // Checking if client stream broke before all files arrived; the stream is out of sync
+        // then, so the session ends
+        if (client_failed)
+        {
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_ERROR, "ERROR: Failed to receive all files");
+            printf("[S1] ERROR: Upload failed - client stream broken\n");
+            return -1;
+        }
+
+        // Sending final response to client
+        printf("\n[S1] Distribution summary: %d/%d files successful\n", success_count, file_count);
+
+        if (success_count == file_count)
+        {
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_OK, "SUCCESS: All files uploaded and distributed successfully");
+            printf("[S1] SUCCESS: All files uploaded successfully\n");
+        }
+        else if (success_count > 0)
+        {
+            char partial_msg[256];
+            snprintf(partial_msg, sizeof(partial_msg),
+                     "PARTIAL SUCCESS: %d/%d files uploaded successfully",
+                     success_count, file_count);
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_PARTIAL, partial_msg);
+            printf("[S1] PARTIAL: Some files uploaded successfully\n");
+        }
+        else
+        {
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_ERROR, "ERROR: Failed to distribute any files");
+            printf("[S1] ERROR: All uploads failed\n");
+        }
+
+        printf("[S1] UPLOADF command processing complete\n");
+    }
+
+    /*=== DOWNLF COMMAND PROCESSING ===*/
+    else if (strncmp(command, "downlf", 6) == 0)
+    {
+        printf("[S1] Processing downlf command\n");
+
+        // Parsing command arguments
+        char cmd[20], file1_path[512], file2_path[512], extra_arg[512];
+        int argc = sscanf(command, "%s %s %s %s", cmd, file1_path, file2_path, extra_arg);
+
+        printf("[S1] Parsed %d arguments from downlf command\n", argc);
+
+        // Validating argument count
+        if (argc < 2)
+        {
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_BAD_REQUEST, "ERROR: Not enough arguments. Command: downlf filepath1 [filepath2]");
+            printf("[S1] ERROR: Invalid downlf - not enough arguments\n");
+            return 0;
+        }
+
+        if (argc > 3)
+        {
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_BAD_REQUEST, "ERROR: Too many arguments. Command: downlf filepath1 [filepath2] (max 2 files)");
+            printf("[S1] ERROR: Invalid downlf - too many arguments\n");
+            return 0;
+        }
+
+        // Determining number of files to download
+        int file_count = argc - 1; // Subtract command name
+        char *file_paths[2] = {file1_path, file2_path};
+
+        printf("[S1] Download request for %d files\n", file_count);
+
+        // Opening a retrieve session for each file before talking to the client
+        struct pending_download downloads[2];
+        int success_count = 0;
+        for (int i = 0; i < file_count; i++)
+        {
+            char *full_path = file_paths[i];
+            char filename[256];
+            char directory_path[512];
+            char server_path[512];
+
+            printf("[S1] Processing download %d/%d: %s\n", i + 1, file_count, full_path);
+
+            // Extracting filename from full path
+            char *last_slash = strrchr(full_path, '/');
+            if (last_slash == NULL)
+            {
+                printf("[S1] ERROR: Invalid file path format: %s\n", full_path);
+                continue;
+            }
+            strcpy(filename, last_slash + 1);
+
+            // Extracting directory path
+            int dir_length = last_slash - full_path;
+            strncpy(directory_path, full_path, dir_length);
+            directory_path[dir_length] = '\0';
+
+            printf("[S1] Filename: %s, Directory: %s\n", filename, directory_path);
 
-                    // Converting ~S1/abcd to S2/abcd
-                    if (strncmp(directory_path, "~/S1/", 5) == 0)
+            // Preparing slot for this download
+            struct pending_download *download = &downloads[success_count];
+            strcpy(download->filename, filename);
+            download->server_socket = -1;
+            download->compressed = 0;
+
+            // Routing to appropriate server based on file extension
+            if (strstr(filename, ".pdf") != NULL)
+            {
+                printf("[S1] Retrieving PDF file from S2\n");
+                // Converting ~S1/abcd to S2/abcd
+                convert_path_for_server(directory_path, "S2", server_path, sizeof(server_path));
+
+                // Checking out S2 connection
+                int s2_socket = acquire_backend_connection(BACKEND_S2);
+                if (s2_socket != -1)
+                {
+                    // Asking S2 for the file and reading its size header
+                    if (open_retrieve_session(s2_socket, server_path, filename, CODEC_NONE, &download->file_size,
+                                              &download->compressed) == 0)
+                    {
+                        download->server_socket = s2_socket;
+                        download->backend = BACKEND_S2;
+                        success_count++;
+                        printf("[S1] S2 is ready to stream %s\n", filename);
+                    }
+                    else
                     {
-                        snprintf(server_path, sizeof(server_path), "S2/%s", directory_path + 5);
+                        printf("[S1] ERROR: Failed to retrieve %s from S2\n", filename);
+                        release_backend_connection(BACKEND_S2, s2_socket, 0);
                     }
-                    else if (strncmp(directory_path, "~/S1", 4) == 0)
+                }
+                else
+                {
+                    printf("[S1] ERROR: Cannot connect to S2\n");
+                }
+            }
+            else if (strstr(filename, ".txt") != NULL)
+            {
+                printf("[S1] Retrieving TXT file from S3\n");
+                // Converting path for S3
+                convert_path_for_server(directory_path, "S3", server_path, sizeof(server_path));
+
+                // Checking out S3 connection
+                int s3_socket = acquire_backend_connection(BACKEND_S3);
+                if (s3_socket != -1)
+                {
+                    // Asking S3 for the file and reading its size header
+                    if (open_retrieve_session(s3_socket, server_path, filename, session->codec, &download->file_size,
+                                              &download->compressed) == 0)
                     {
-                        strcpy(server_path, "S2");
+                        download->server_socket = s3_socket;
+                        download->backend = BACKEND_S3;
+                        success_count++;
+                        printf("[S1] S3 is ready to stream %s\n", filename);
                     }
-                    else if (strncmp(directory_path, "~S1/", 4) == 0)
+                    else
                     {
-                        snprintf(server_path, sizeof(server_path), "S2/%s", directory_path + 4);
+                        printf("[S1] ERROR: Failed to retrieve %s from S3\n", filename);
+                        release_backend_connection(BACKEND_S3, s3_socket, 0);
                     }
-                    else if (strncmp(directory_path, "~S1", 3) == 0)
+                }
+                else
+                {
+                    printf("[S1] ERROR: Cannot connect to S3\n");
+                }
+            }
+            else if (strstr(filename, ".zip") != NULL)
+            {
+                printf("[S1] Retrieving ZIP file from S4\n");
+                // Converting path for S4
+                convert_path_for_server(directory_path, "S4", server_path, sizeof(server_path));
+
+                // Checking out S4 connection
+                int s4_socket = acquire_backend_connection(BACKEND_S4);
+                if (s4_socket != -1)
+                {
+                    // Asking S4 for the file and reading its size header
+                    if (open_retrieve_session(s4_socket, server_path, filename, CODEC_NONE, &download->file_size,
+                                              &download->compressed) == 0)
                     {
-                        strcpy(server_path, "S2");
+                        download->server_socket = s4_socket;
+                        download->backend = BACKEND_S4;
+                        success_count++;
+                        printf("[S1] S4 is ready to stream %s\n", filename);
                     }
                     else
                     {
-                        snprintf(server_path, sizeof(server_path), "S2/%s", directory_path);
+                        printf("[S1] ERROR: Failed to retrieve %s from S4\n", filename);
+                        release_backend_connection(BACKEND_S4, s4_socket, 0);
                     }
+                }
+                else
+                {
+                    printf("[S1] ERROR: Cannot connect to S4\n");
+                }
+            }
+            else if (strstr(filename, ".c") != NULL)
+            {
+                printf("[S1] Retrieving C file from local S1 storage\n");
+
+                // Converting path for local S1 storage
+                char local_directory[MAX_PATH];
+                convert_path_for_server(directory_path, "S1", local_directory, sizeof(local_directory));
+                snprintf(download->local_path, sizeof(download->local_path), "%s/%s", local_directory, filename);
+
+                // Checking that the local file exists
+                struct stat st;
+                if (stat(download->local_path, &st) == 0 && S_ISREG(st.st_mode))
+                {
+                    download->file_size = st.st_size;
+                    success_count++;
+                    printf("[S1] Local C file ready: %s\n", download->local_path);
+                }
+                else
+                {
+                    printf("[S1] ERROR: Local C file not found: %s\n", download->local_path);
+                }
+            }
+            else
+            {
+                printf("[S1] ERROR: Unknown file type: %s\n", filename);
+            }
+        }
+
+        // Checking if any files were successfully retrieved
+        if (success_count == 0)
+        {
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_NOT_FOUND, "ERROR: No files could be retrieved");
+            printf("[S1] ERROR: Download failed - no files retrieved\n");
+            return 0;
+        }
+
+        // Sending client number of files we're sending
+        char count_msg[64];
+        snprintf(count_msg, sizeof(count_msg), "READY %d", success_count);
+        send_text_frame(client_socket, FRAME_RESPONSE, STATUS_OK, count_msg);
+        printf("[S1] Told client we're sending %d files\n", success_count);
+
+        // Relaying each file straight from its source to the client
+        int session_broken = 0;
+        for (int i = 0; i < success_count; i++)
+        {
+            struct pending_download *download = &downloads[i];
+
+            // Skipping remaining relays once the client stream is unusable
+            if (session_broken)
+            {
+                if (download->server_socket != -1)
+                {
+                    release_backend_connection(download->backend, download->server_socket, 0);
+                }
+                continue;
+            }
+
+            printf("[S1] Sending %s to client\n", download->filename);
+
+            // Sending filename as a NAME frame
+            if (send_text_frame(client_socket, FRAME_NAME, STATUS_OK, download->filename) == -1)
+            {
+                printf("[S1] ERROR: Failed to send filename\n");
+                session_broken = 1;
+                if (download->server_socket != -1)
+                {
+                    release_backend_connection(download->backend, download->server_socket, 0);
+                }
+                continue;
+            }
+
+            if (download->server_socket != -1)
+            {
+                // Tracking bytes pulled from the backend
+                long consumed = 0;
+                // Tracking whether the backend stream was fully consumed
+                int relay_complete = 0;
+                // Storing outcome of the relay
+                int relay_result;
+                if (download->compressed)
+                {
+                    // Passing chunks the backend already holds compressed straight through
+                    relay_result = relay_compressed_file_data(download->server_socket, client_socket,
+                                                              download->file_size, &consumed);
+                }
+                else if (transfer_wants_compression(session->codec, download->filename, -1))
+                {
+                    // Compressing the body chunk by chunk as it arrives from the backend
+                    relay_result = send_compressed_file_data(client_socket, download->server_socket,
+                                                             download->file_size, &consumed);
+                }
+                else if (send_frame_header(client_socket, FRAME_FILE, STATUS_OK, download->file_size) == -1)
+                {
+                    relay_result = -2;
+                }
+                else
+                {
+                    // Passing FILE frame header through, then splicing the file body
+                    relay_result = relay_socket_data(download->server_socket, client_socket, download->file_size, &consumed);
+                }
+                if (relay_result != 0)
+                {
+                    printf("[S1] ERROR: Relay of %s broke mid-stream\n", download->filename);
+                    session_broken = 1;
+                }
+                else
+                {
+                    printf("[S1] Successfully relayed %s to client\n", download->filename);
+                    relay_complete = 1;
+                }
+                // Returning backend connection, reusable only if nothing was left unread
+                release_backend_connection(download->backend, download->server_socket, relay_complete);
+            }
+            else
+            {
+                // Sending local file data using existing function
+                if (send_file_to_S1(client_socket, download->local_path, session->codec) == 0)
+                {
+                    printf("[S1] Successfully sent %s to client\n", download->filename);
+                }
+                else
+                {
+                    printf("[S1] ERROR: Failed to send %s to client\n", download->filename);
+                    session_broken = 1;
+                }
+            }
+        }
+
+        // Ending session if the client can no longer be kept in sync
+        if (session_broken)
+        {
+            printf("[S1] ERROR: Download stream broken - closing client session\n");
+            return -1;
+        }
+
+        printf("[S1] DOWNLF command processing complete\n");
+    }
+
+    /*=== REMOVEF COMMAND PROCESSING ===*/
+    else if (strncmp(command, "removef", 7) == 0)
+    {
+        printf("[S1] Processing removef command\n");
+
+        // First, parsing ALL arguments to count them properly
+        char cmd[20];
+        char args[10][512];
+        int total_args = 0;
+
+        // Parsing the entire command to count all arguments
+        char command_copy[1024];
+        strcpy(command_copy, command);
+
+        // Tokenizing command to extract all arguments
+        // Keeping strtok_r position for this command
+        char *save_ptr;
+        char *token = strtok_r(command_copy, " ", &save_ptr);
+        while (token != NULL && total_args < 10)
+        {
+            if (total_args == 0)
+            {
+                // First token is the command
+                strcpy(cmd, token);
+            }
+            else
+            {
+                // Store file arguments
+                strcpy(args[total_args - 1], token);
+            }
+            total_args++;
+            // Getting next token
+            token = strtok_r(NULL, " ", &save_ptr);
+        }
+
+        // Calculating file count (subtract command name)
+        int file_count = total_args - 1;
+
+        printf("[S1] Parsed %d total arguments, %d file arguments\n", total_args, file_count);
+
+        // VALIDATION FIRST - before doing any work
+        if (file_count < 1)
+        {
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_BAD_REQUEST, "ERROR: Not enough arguments. Command: removef filepath1 [filepath2]");
+            printf("[S1] ERROR: Invalid removef - not enough arguments\n");
+            return 0;
+        }
+
+        if (file_count > 2)
+        {
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_BAD_REQUEST, "ERROR: Too many arguments. Max 2 files allowed");
+            printf("[S1] ERROR: Invalid removef - too many arguments (%d files provided, max 2 allowed)\n", file_count);
+            return 0;
+        }
+
+        printf("[S1] Validation passed - processing %d file(s) for deletion\n", file_count);
+
+        // Now extract the validated file paths
+        char file1_path[512] = "";
+        char file2_path[512] = "";
+
+        if (file_count >= 1)
+        {
+            strcpy(file1_path, args[0]);
+            printf("[S1] File 1 path: %s\n", file1_path);
+        }
+        if (file_count >= 2)
+        {
+            strcpy(file2_path, args[1]);
+            printf("[S1] File 2 path: %s\n", file2_path);
+        }
+
+        // Processing each file and deleting from appropriate servers
+        char *file_paths[2] = {file1_path, file2_path};
+        int success_count = 0;
+
+        for (int i = 0; i < file_count; i++)
+        {
+            char *full_path = file_paths[i];
+            char filename[256];
+            char directory_path[512];
+            char server_path[512];
+            char delete_command[1024];
+            char response[256];
+
+            // Skip empty paths (shouldn't happen with new validation, but safety check)
+            if (strlen(full_path) == 0)
+            {
+                continue;
+            }
+
+            printf("[S1] Processing deletion %d/%d: %s\n", i + 1, file_count, full_path);
+            int deleted_before = success_count;
+
+            // Extracting filename from full path
+            char *last_slash = strrchr(full_path, '/');
+            if (last_slash == NULL)
+            {
+                printf("[S1] ERROR: Invalid file path format: %s\n", full_path);
+                continue;
+            }
+            // Getting filename after last slash
+            strcpy(filename, last_slash + 1);
+
+            // Extracting directory path
+            int dir_length = last_slash - full_path;
+            strncpy(directory_path, full_path, dir_length);
+            directory_path[dir_length] = '\0';
+
+            printf("[S1] Filename: %s, Directory: %s\n", filename, directory_path);
+
+            // Route to appropriate server based on file extension
+            if (strstr(filename, ".pdf") != NULL)
+            {
+                printf("[S1] Deleting PDF file from S2\n");
+
+                // Converting ~S1/project to S2/project
+                if (strncmp(directory_path, "~/S1/", 5) == 0)
+                {
+                    snprintf(server_path, sizeof(server_path), "S2/%s", directory_path + 5);
+                }
+                else if (strncmp(directory_path, "~/S1", 4) == 0)
+                {
+                    strcpy(server_path, "S2");
+                }
+                else if (strncmp(directory_path, "~S1/", 4) == 0)
+                {
+                    snprintf(server_path, sizeof(server_path), "S2/%s", directory_path + 4);
+                }
+                else if (strncmp(directory_path, "~S1", 3) == 0)
+                {
+                    strcpy(server_path, "S2");
+                }
+                else
+                {
+                    snprintf(server_path, sizeof(server_path), "S2/%s", directory_path);
+                }
 
-                    // Connecting to S2
-                    int s2_socket = connect_to_s2();
-                    if (s2_socket != -1)
-                    {
-                        char retrieve_command[1024];
-                        snprintf(retrieve_command, sizeof(retrieve_command), "RETRIEVE %s/%s", server_path, filename);
-                        printf("[S1] Sending to S2: %s\n", retrieve_command);
+                // Checking out S2 connection
+                int s2_socket = acquire_backend_connection(BACKEND_S2);
+                if (s2_socket != -1)
+                {
+                    // Tracking whether S2 answered so the connection stays in sync
+                    int s2_answered = 0;
 
-                        // Sending retrieve command to S2
-                        if (send(s2_socket, retrieve_command, strlen(retrieve_command), 0) != -1)
+                    // Sending DELETE command to S2
+                    snprintf(delete_command, sizeof(delete_command), "DELETE %s/%s", server_path, filename);
+                    printf("[S1] Sending to S2: %s\n", delete_command);
+
+                    // Sending delete command to S2
+                    if (send_text_frame(s2_socket, FRAME_COMMAND, STATUS_OK, delete_command) != -1)
+                    {
+                        // Waiting for response from S2
+                        int status;
+                        int bytes = recv_text_frame(s2_socket, FRAME_RESPONSE, &status, response, sizeof(response));
+                        if (bytes != -1)
                         {
-                            // Receiving file from S2 and saving to temp
-                            if (receive_file_from_S1(s2_socket, filename, "S1/temp") == 0)
+                            printf("[S1] S2 response: %s\n", response);
+                            s2_answered = 1;
+
+                            // Checking if deletion was successful
+                            if (status == STATUS_OK)
                             {
                                 success_count++;
-                                printf("[S1] Successfully retrieved %s from S2\n", filename);
+                                printf("[S1] Successfully deleted %s from S2\n", filename);
                             }
                             else
                             {
-                                printf("[S1] ERROR: Failed to receive %s from S2\n", filename);
+                                printf("[S1] ERROR: Failed to delete %s from S2\n", filename);
                             }
                         }
                         else
                         {
-                            printf("[S1] ERROR: Failed to send RETRIEVE command to S2\n");
+                            printf("[S1] ERROR: No response from S2\n");
                         }
-                        close(s2_socket);
                     }
                     else
                     {
-                        printf("[S1] ERROR: Cannot connect to S2\n");
+                        printf("[S1] ERROR: Failed to send DELETE command to S2\n");
                     }
+                    // Returning connection to S2 pool
+                    release_backend_connection(BACKEND_S2, s2_socket, s2_answered);
                 }
-                else if (strstr(filename, ".txt") != NULL)
+                else
                 {
-                    printf("[S1] Retrieving TXT file from S3\n");
+                    printf("[S1] ERROR: Cannot connect to S2\n");
+                }
+            }
+            else if (strstr(filename, ".txt") != NULL)
+            {
+                printf("[S1] Deleting TXT file from S3\n");
 
-                    // Converting path for S3
-                    if (strncmp(directory_path, "~/S1/", 5) == 0)
-                    {
-                        snprintf(server_path, sizeof(server_path), "S3/%s", directory_path + 5);
-                    }
-                    else if (strncmp(directory_path, "~/S1", 4) == 0)
-                    {
-                        strcpy(server_path, "S3");
-                    }
-                    else if (strncmp(directory_path, "~S1/", 4) == 0)
-                    {
-                        snprintf(server_path, sizeof(server_path), "S3/%s", directory_path + 4);
-                    }
-                    else if (strncmp(directory_path, "~S1", 3) == 0)
-                    {
-                        strcpy(server_path, "S3");
-                    }
-                    else
-                    {
-                        snprintf(server_path, sizeof(server_path), "S3/%s", directory_path);
-                    }
+                // Converting ~S1/project to S3/project
+                if (strncmp(directory_path, "~/S1/", 5) == 0)
+                {
+                    snprintf(server_path, sizeof(server_path), "S3/%s", directory_path + 5);
+                }
+                else if (strncmp(directory_path, "~/S1", 4) == 0)
+                {
+                    strcpy(server_path, "S3");
+                }
+                else if (strncmp(directory_path, "~S1/", 4) == 0)
+                {
+                    snprintf(server_path, sizeof(server_path), "S3/%s", directory_path + 4);
+                }
+                else if (strncmp(directory_path, "~S1", 3) == 0)
+                {
+                    strcpy(server_path, "S3");
+                }
+                else
+                {
+                    snprintf(server_path, sizeof(server_path), "S3/%s", directory_path);
+                }
 
-                    // Connecting to S3
-                    int s3_socket = connect_to_s3();
-                    if (s3_socket != -1)
-                    {
-                        char retrieve_command[1024];
-                        snprintf(retrieve_command, sizeof(retrieve_command), "RETRIEVE %s/%s", server_path, filename);
-                        printf("[S1] Sending to S3: %s\n", retrieve_command);
+                // Checking out S3 connection
+                int s3_socket = acquire_backend_connection(BACKEND_S3);
+                if (s3_socket != -1)
+                {
+                    // Tracking whether S3 answered so the connection stays in sync
+                    int s3_answered = 0;
 
-                        // Sending retrieve command to S3
-                        if (send(s3_socket, retrieve_command, strlen(retrieve_command), 0) != -1)
+                    // Sending DELETE command to S3
+                    snprintf(delete_command, sizeof(delete_command), "DELETE %s/%s", server_path, filename);
+                    printf("[S1] Sending to S3: %s\n", delete_command);
+
+                    // Sending delete command to S3
+                    if (send_text_frame(s3_socket, FRAME_COMMAND, STATUS_OK, delete_command) != -1)
+                    {
+                        // Waiting for response from S3
+                        int status;
+                        int bytes = recv_text_frame(s3_socket, FRAME_RESPONSE, &status, response, sizeof(response));
+                        if (bytes != -1)
                         {
-                            // Receiving file from S3 and saving to temp
-                            if (receive_file_from_S1(s3_socket, filename, "S1/temp") == 0)
+                            printf("[S1] S3 response: %s\n", response);
+                            s3_answered = 1;
+
+                            // Checking if deletion was successful
+                            if (status == STATUS_OK)
                             {
                                 success_count++;
-                                printf("[S1] Successfully retrieved %s from S3\n", filename);
+                                printf("[S1] Successfully deleted %s from S3\n", filename);
                             }
                             else
                             {
-                                printf("[S1] ERROR: Failed to receive %s from S3\n", filename);
+                                printf("[S1] ERROR: Failed to delete %s from S3\n", filename);
                             }
                         }
                         else
                         {
-                            printf("[S1] ERROR: Failed to send RETRIEVE command to S3\n");
+                            printf("[S1] ERROR: No response from S3\n");
                         }
-                        close(s3_socket);
                     }
                     else
                     {
-                        printf("[S1] ERROR: Cannot connect to S3\n");
+                        printf("[S1] ERROR: Failed to send DELETE command to S3\n");
                     }
+                    // Returning connection to S3 pool
+                    release_backend_connection(BACKEND_S3, s3_socket, s3_answered);
                 }
-                else if (strstr(filename, ".zip") != NULL)
+                else
                 {
-                    printf("[S1] Retrieving ZIP file from S4\n");
+                    printf("[S1] ERROR: Cannot connect to S3\n");
+                }
+            }
+            else if (strstr(filename, ".zip") != NULL)
+            {
+                printf("[S1] Deleting ZIP file from S4\n");
 
-                    // Converting path for S4
-                    if (strncmp(directory_path, "~/S1/", 5) == 0)
-                    {
-                        snprintf(server_path, sizeof(server_path), "S4/%s", directory_path + 5);
-                    }
-                    else if (strncmp(directory_path, "~/S1", 4) == 0)
-                    {
-                        strcpy(server_path, "S4");
-                    }
-                    else if (strncmp(directory_path, "~S1/", 4) == 0)
-                    {
-                        snprintf(server_path, sizeof(server_path), "S4/%s", directory_path + 4);
-                    }
-                    else if (strncmp(directory_path, "~S1", 3) == 0)
-                    {
-                        strcpy(server_path, "S4");
-                    }
-                    else
-                    {
-                        snprintf(server_path, sizeof(server_path), "S4/%s", directory_path);
-                    }
+                // Converting ~S1/project to S4/project
+                if (strncmp(directory_path, "~/S1/", 5) == 0)
+                {
+                    snprintf(server_path, sizeof(server_path), "S4/%s", directory_path + 5);
+                }
+                else if (strncmp(directory_path, "~/S1", 4) == 0)
+                {
+                    strcpy(server_path, "S4");
+                }
+                else if (strncmp(directory_path, "~S1/", 4) == 0)
+                {
+                    snprintf(server_path, sizeof(server_path), "S4/%s", directory_path + 4);
+                }
+                else if (strncmp(directory_path, "~S1", 3) == 0)
+                {
+                    strcpy(server_path, "S4");
+                }
+                else
+                {
+                    snprintf(server_path, sizeof(server_path), "S4/%s", directory_path);
+                }
 
-                    // Connecting to S4
-                    int s4_socket = connect_to_s4();
-                    if (s4_socket != -1)
-                    {
-                        char retrieve_command[1024];
-                        snprintf(retrieve_command, sizeof(retrieve_command), "RETRIEVE %s/%s", server_path, filename);
-                        printf("[S1] Sending to S4: %s\n", retrieve_command);
+                // Checking out S4 connection
+                int s4_socket = acquire_backend_connection(BACKEND_S4);
+                if (s4_socket != -1)
+                {
+                    // Tracking whether S4 answered so the connection stays in sync
+                    int s4_answered = 0;
 
-                        // Sending retrieve command to S4
-                        if (send(s4_socket, retrieve_command, strlen(retrieve_command), 0) != -1)
+                    // Sending DELETE command to S4
+                    snprintf(delete_command, sizeof(delete_command), "DELETE %s/%s", server_path, filename);
+                    printf("[S1] Sending to S4: %s\n", delete_command);
+
+                    // Sending delete command to S4
+                    if (send_text_frame(s4_socket, FRAME_COMMAND, STATUS_OK, delete_command) != -1)
+                    {
+                        // Waiting for response from S4
+                        int status;
+                        int bytes = recv_text_frame(s4_socket, FRAME_RESPONSE, &status, response, sizeof(response));
+                        if (bytes != -1)
                         {
-                            // Receiving file from S4 and saving to temp
-                            if (receive_file_from_S1(s4_socket, filename, "S1/temp") == 0)
+                            printf("[S1] S4 response: %s\n", response);
+                            s4_answered = 1;
+
+                            // Checking if deletion was successful
+                            if (status == STATUS_OK)
                             {
                                 success_count++;
-                                printf("[S1] Successfully retrieved %s from S4\n", filename);
+                                printf("[S1] Successfully deleted %s from S4\n", filename);
                             }
                             else
                             {
-                                printf("[S1] ERROR: Failed to receive %s from S4\n", filename);
+                                printf("[S1] ERROR: Failed to delete %s from S4\n", filename);
                             }
                         }
                         else
                         {
-                            printf("[S1] ERROR: Failed to send RETRIEVE command to S4\n");
+                            printf("[S1] ERROR: No response from S4\n");
                         }
-                        close(s4_socket);
                     }
                     else
                     {
-                        printf("[S1] ERROR: Cannot connect to S4\n");
+                        printf("[S1] ERROR: Failed to send DELETE command to S4\n");
                     }
+                    // Returning connection to S4 pool
+                    release_backend_connection(BACKEND_S4, s4_socket, s4_answered);
+                }
+                else
+                {
+                    printf("[S1] ERROR: Cannot connect to S4\n");
+                }
+            }
+            else if (strstr(filename, ".c") != NULL)
+            {
+                printf("[S1] Deleting C file from local S1 storage\n");
+
+                // For .c files, delete from local S1 storage
+                char local_path[MAX_PATH];
+
+                // Convert S1 client path format to actual local filesystem path
+                if (strncmp(directory_path, "~/S1/", 5) == 0)
+                {
+                    // ~/S1/abcd -> S1/abcd
+                    snprintf(local_path, sizeof(local_path), "S1/%s/%s", directory_path + 5, filename);
+                }
+                else if (strncmp(directory_path, "~/S1", 4) == 0)
+                {
+                    // ~/S1 -> S1
+                    snprintf(local_path, sizeof(local_path), "S1/%s", filename);
+                }
+                else if (strncmp(directory_path, "~S1/", 4) == 0)
+                {
+                    // ~S1/abcd -> S1/abcd
+                    snprintf(local_path, sizeof(local_path), "S1/%s/%s", directory_path + 4, filename);
+                }
+                else if (strncmp(directory_path, "~S1", 3) == 0)
+                {
+                    // ~S1 -> S1
+                    snprintf(local_path, sizeof(local_path), "S1/%s", filename);
+                }
+                else
+                {
+                    // Relative path -> S1/path
+                    snprintf(local_path, sizeof(local_path), "S1/%s/%s", directory_path, filename);
                 }
-                else if (strstr(filename, ".c") != NULL)
+
+                printf("[S1] Deleting local file: %s\n", local_path);
+
+                // Using existing delete_file function
+                if (delete_file(local_path) == 0)
+                {
+                    success_count++;
+                    printf("[S1] Successfully deleted local C file: %s\n", filename);
+                    // Remembering deletion for incremental archives
+                    record_tombstone("S1", local_path);
+                }
+                else
+                {
+                    printf("[S1] ERROR: Failed to delete local C file: %s\n", filename);
+                }
+            }
+            else
+            {
+                printf("[S1] ERROR: Unknown file type: %s\n", filename);
+            }
+
+            // Dropping deleted file from the namespace index
+            if (success_count > deleted_before)
+            {
+                namespace_remove_file(directory_path, filename);
+            }
+        }
+
+        // Sending final response to client
+        printf("\n[S1] Deletion summary: %d/%d files successful\n", success_count, file_count);
+
+        if (success_count == file_count)
+        {
+            // All files deleted successfully
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_OK, "SUCCESS: All files deleted successfully");
+            printf("[S1] SUCCESS: All deletions completed successfully\n");
+        }
+        else if (success_count > 0)
+        {
+            // Some files deleted, some failed
+            char partial_msg[256];
+            snprintf(partial_msg, sizeof(partial_msg),
+                     "PARTIAL SUCCESS: %d/%d files deleted successfully",
+                     success_count, file_count);
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_PARTIAL, partial_msg);
+            printf("[S1] PARTIAL: Deletion partially completed\n");
+        }
+        else
+        {
+            // All files failed
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_ERROR, "ERROR: Failed to delete any files");
+            printf("[S1] ERROR: All deletions failed\n");
+        }
+
+        printf("[S1] REMOVEF command processing complete\n");
+    }
+
+    /*=== DISPFNAMES COMMAND PROCESSING ===*/
+    else if (strncmp(command, "dispfnames", 10) == 0)
+    {
+        printf("[S1] Processing dispfnames command\n");
+
+        char pathname[MAX_PATH];
+        // Page size (-1 for the whole listing) and where the page starts (group, then name after)
+        long page_size = -1;
+        int start_type = 0;
+        char start_after[256] = "";
+
+        // Conditions of a filtered listing, checked by each server while it walks the directory
+        struct list_filter filter = {0, "", -1, -1, -1, -1};
+        int filtered = 0;
+        time_t now = time(NULL);
+
+        // Parsing the command: dispfnames pathname [--page N] [--after TOKEN] [-r] [--name GLOB]
+        // [--min-size SIZE] [--max-size SIZE] [--newer AGE] [--older AGE]
+        int valid = sscanf(command, "dispfnames %s", pathname) == 1;
+        char command_copy[1024];
+        snprintf(command_copy, sizeof(command_copy), "%s", command);
+        char *save_ptr;
+        char *word = strtok_r(command_copy, " ", &save_ptr);
+        word = strtok_r(NULL, " ", &save_ptr);
+        while (valid && (word = strtok_r(NULL, " ", &save_ptr)) != NULL)
+        {
+            char *value = (strcmp(word, "-r") == 0) ? NULL : strtok_r(NULL, " ", &save_ptr);
+            char *end = NULL;
+            long age;
+            if (strcmp(word, "-r") == 0)
+            {
+                filter.recursive = 1;
+                filtered = 1;
+            }
+            else if (strcmp(word, "--page") == 0 && value != NULL)
+            {
+                page_size = strtol(value, &end, 10);
+                valid = end != value && *end == '\0' && page_size > 0;
+            }
+            else if (strcmp(word, "--after") == 0 && value != NULL)
+            {
+                // Token is "<group>-<hex name>", as sent at the end of the previous page
+                start_type = strtol(value, &end, 10);
+                valid = end != value && *end == '-' && start_type >= 0 && start_type < NAMESPACE_TYPE_COUNT &&
+                        decode_list_name(end + 1, start_after, sizeof(start_after)) == 0;
+            }
+            else if (strcmp(word, "--name") == 0 && value != NULL)
+            {
+                valid = strlen(value) < sizeof(filter.pattern);
+                snprintf(filter.pattern, sizeof(filter.pattern), "%s", value);
+                filtered = 1;
+            }
+            else if (strcmp(word, "--min-size") == 0 && value != NULL)
+            {
+                filter.min_size = parse_list_size(value);
+                valid = filter.min_size != -1;
+                filtered = 1;
+            }
+            else if (strcmp(word, "--max-size") == 0 && value != NULL)
+            {
+                filter.max_size = parse_list_size(value);
+                valid = filter.max_size != -1;
+                filtered = 1;
+            }
+            else if ((strcmp(word, "--newer") == 0 || strcmp(word, "--older") == 0) && value != NULL &&
+                     (age = parse_list_age(value)) != -1)
+            {
+                // Turning the age into a time: --newer keeps files changed within it, --older
+                // files changed before it
+                long since = (now > age) ? (long)(now - age) : 0;
+                *((word[2] == 'n') ? &filter.newer : &filter.older) = since;
+                filtered = 1;
+            }
+            else
+            {
+                valid = 0;
+            }
+        }
+
+        // Setting up output, with room for copies of the groups the index may keep
+        struct listing_output *output = valid ? malloc(sizeof(struct listing_output)) : NULL;
+        if (output != NULL)
+        {
+            printf("[S1] Displaying files for pathname: %s\n", pathname);
+            output->socket = client_socket;
+            output->stream = session->list_stream;
+            output->filter = filtered ? &filter : NULL;
+            output->used = 0;
+            output->emitted = 0;
+            output->limit = page_size;
+            output->last_type = start_type;
+            output->last_name[0] = '\0';
+            for (int type = 0; type < NAMESPACE_TYPE_COUNT; type++)
+            {
+                output->recording[type] = 0;
+                output->recorded_length[type] = 0;
+                output->recorded[type][0] = '\0';
+            }
+
+            // Finding which groups the namespace index answers (it holds no sizes to filter on),
+            // and noting the directory's state first so changes made while the others are listed
+            // are noticed
+            int cached_types = filtered ? 0 : namespace_cached_types(pathname);
+            long listed_at = namespace_listing_clock();
+
+            // Asking backends for the groups the index does not hold, all before reading any
+            struct remote_listing all_listings[BACKEND_COUNT] = {
+                {.backend = BACKEND_S2, .prefix = "S2", .label = "PDF", .server_socket = -1},
+                {.backend = BACKEND_S3, .prefix = "S3", .label = "TXT", .server_socket = -1},
+                {.backend = BACKEND_S4, .prefix = "S4", .label = "ZIP", .server_socket = -1}};
+            struct remote_listing listings[BACKEND_COUNT];
+            int listing_count = 0;
+            for (int backend = 0; backend < BACKEND_COUNT; backend++)
+            {
+                // Groups follow .c, so backend b holds group b + 1
+                int type = backend + 1;
+                if (type >= start_type && !(cached_types & (1 << type)))
                 {
-                    printf("[S1] Retrieving C file from local S1 storage\n");
+                    listings[listing_count] = all_listings[backend];
+                    snprintf(listings[listing_count].after, sizeof(listings[0].after), "%s",
+                             (type == start_type) ? start_after : "");
+                    listing_count++;
+                }
+            }
+            request_remote_listings(listings, listing_count, pathname, page_size, output->filter);
+
+            // Sending groups in order: .c, .pdf, .txt, .zip
+            int complete_types = 0;
+            int partial = 0;
+            int result = 0;
+            int next_listing = 0;
+            for (int type = start_type; type < NAMESPACE_TYPE_COUNT && result == 0; type++)
+            {
+                const char *after = (type == start_type) ? start_after : "";
+                // Copying unfiltered groups listed live from their first name, for the index
+                output->recording[type] = after[0] == '\0' && !filtered && !(cached_types & (1 << type));
 
-                    // Converting path for local S1 storage
-                    char local_directory[MAX_PATH];
-                    if (strncmp(directory_path, "~/S1/", 5) == 0)
+                if (cached_types & (1 << type))
+                {
+                    printf("[S1] %s files taken from the namespace index\n", namespace_labels[type]);
+                    result = list_indexed_files(output, pathname, type, after);
+                }
+                else if (type == 0)
+                {
+                    // Converting client path to local filesystem path
+                    char local_c_path[MAX_PATH];
+                    if (strncmp(pathname, "~/S1/", 5) == 0)
                     {
-                        // ~/S1/program -> S1/program
-                        snprintf(local_directory, sizeof(local_directory), "S1/%s", directory_path + 5);
+                        // ~/S1/code -> S1/code
+                        snprintf(local_c_path, sizeof(local_c_path), "S1/%s", pathname + 5);
                     }
-                    else if (strncmp(directory_path, "~/S1", 4) == 0)
+                    else if (strncmp(pathname, "~/S1", 4) == 0)
                     {
                         // ~/S1 -> S1
-                        strcpy(local_directory, "S1");
+                        strcpy(local_c_path, "S1");
                     }
-                    else if (strncmp(directory_path, "~S1/", 4) == 0)
+                    else if (strncmp(pathname, "~S1/", 4) == 0)
                     {
-                        // ~S1/program -> S1/program
-                        snprintf(local_directory, sizeof(local_directory), "S1/%s", directory_path + 4);
+                        // ~S1/code -> S1/code
+                        snprintf(local_c_path, sizeof(local_c_path), "S1/%s", pathname + 4);
                     }
-                    else if (strncmp(directory_path, "~S1", 3) == 0)
+                    else if (strncmp(pathname, "~S1", 3) == 0)
                     {
                         // ~S1 -> S1
-                        strcpy(local_directory, "S1");
+                        strcpy(local_c_path, "S1");
                     }
                     else
                     {
-                        // Relative path -> S1/relative_path
-                        snprintf(local_directory, sizeof(local_directory), "S1/%s", directory_path);
+                        // Relative path -> S1/path
+                        snprintf(local_c_path, sizeof(local_c_path), "S1/%s", pathname);
                     }
+                    result = list_local_files(output, local_c_path, after);
+                }
+                else
+                {
+                    result = relay_remote_listing(output, &listings[next_listing++], type);
+                }
 
-                    // Copying from local S1 storage to temp
-                    char local_path[MAX_PATH];
-                    char temp_path[MAX_PATH];
-                    snprintf(local_path, sizeof(local_path), "%s/%s", local_directory, filename);
-                    snprintf(temp_path, sizeof(temp_path), "S1/temp/%s", filename);
+                // A server that could not be listed leaves its group out
+                if (result == -2)
+                {
+                    printf("[S1] ERROR: Failed to list %s files\n", namespace_labels[type]);
+                    partial = 1;
+                    result = 0;
+                }
+                else if (result == 0 && output->recording[type])
+                {
+                    complete_types |= 1 << type;
+                }
+            }
+            drop_remote_listings(listings, listing_count);
 
-                    printf("[S1] Copying from %s to %s\n", local_path, temp_path);
+            // Keeping full listings in the index so the next dispfnames is answered from memory
+            const char *records[NAMESPACE_TYPE_COUNT];
+            for (int type = 0; type < NAMESPACE_TYPE_COUNT; type++)
+            {
+                records[type] = output->recorded[type];
+                if (!output->recording[type])
+                {
+                    complete_types &= ~(1 << type);
+                }
+            }
+            namespace_record_listing(pathname, listed_at, records, complete_types);
 
-                    // Opening source file for reading
-                    FILE *src = fopen(local_path, "rb");
-                    if (src != NULL)
-                    {
-                        // Creating temp directory if needed
-                        create_full_directories("S1/temp");
+            // Ending the listing, with a continuation token when the page filled up first
+            int more = (result == 1);
+            if (result != -1)
+            {
+                result = finish_listing_output(output, more, partial);
+            }
+            printf("[S1] Sent %ld names%s\n", output->emitted, more ? ", more left" : "");
+            free(output);
+            if (result == -1)
+            {
+                printf("[S1] ERROR: Client connection lost during listing\n");
+                return -1;
+            }
+            printf("[S1] DISPFNAMES command completed\n");
+        }
+        else if (valid)
+        {
+            printf("[S1] ERROR: Out of memory for listing\n");
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_ERROR, "ERROR: Server out of memory");
+        }
+        else
+        {
+            // Invalid command format
+            printf("[S1] ERROR: Invalid dispfnames command format\n");
+            char error_msg[] = "ERROR: Invalid command format. Command: dispfnames pathname [--page N] [--after TOKEN] "
+                               "[-r] [--name GLOB] [--min-size SIZE] [--max-size SIZE] [--newer AGE] [--older AGE]";
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_BAD_REQUEST, error_msg);
+        }
+    }
 
-                        // Opening destination file for writing
-                        FILE *dst = fopen(temp_path, "wb");
-                        if (dst != NULL)
-                        {
-                            // Copying file data
-                            char buffer[BUFFER_SIZE];
-                            int bytes_read;
-                            while ((bytes_read = fread(buffer, 1, BUFFER_SIZE, src)) > 0)
-                            {
-                                fwrite(buffer, 1, bytes_read, dst);
-                            }
-                            fclose(dst);
-                            success_count++;
-                            printf("[S1] Successfully copied local C file\n");
-                        }
-                        else
-                        {
-                            printf("[S1] ERROR: Failed to create temp file: %s\n", temp_path);
-                        }
-                        fclose(src);
-                    }
-                    else
-                    {
-                        printf("[S1] ERROR: Local C file not found: %s\n", local_path);
-                    }
+    /*=== TEST COMMAND PROCESSING ===*/
+    else if (strncmp(command, "TEST", 4) == 0)
+    {
+        // Client is testing the connection
+        printf("[S1] Processing TEST command\n");
+
+        // Testing connections to other servers (pooled ones are health-checked on checkout)
+        int s2_sock = acquire_backend_connection(BACKEND_S2);
+        int s3_sock = acquire_backend_connection(BACKEND_S3);
+        int s4_sock = acquire_backend_connection(BACKEND_S4);
+
+        // Checking if all servers are accessible
+        int status;
+        if (s2_sock != -1 && s3_sock != -1 && s4_sock != -1)
+        {
+            strcpy(response, "S1 OK - All servers connected");
+            status = STATUS_OK;
+        }
+        else
+        {
+            strcpy(response, "S1 ERROR - Some servers not available");
+            status = STATUS_ERROR;
+        }
+
+        // Returning the test connections to their pools
+        release_backend_connection(BACKEND_S2, s2_sock, 1);
+        release_backend_connection(BACKEND_S3, s3_sock, 1);
+        release_backend_connection(BACKEND_S4, s4_sock, 1);
+
+        // Sending test response to client
+        send_text_frame(client_socket, FRAME_RESPONSE, status, response);
+        printf("[S1] TEST command completed\n");
+    }
+
+    /*=== DOWNLTAR COMMAND PROCESSING ===*/
+    // Checking if the command is downltar
+    else if (strncmp(command, "downltar", 8) == 0)
+    {
+        // Printing that we are starting downltar
+        printf("[S1] Processing downltar command\n");
+
+        // Listing the archivable file types and the backend holding each (.c stays in S1)
+        const char *tar_types[TAR_TYPE_COUNT] = {".c", ".pdf", ".txt", ".zip"};
+        const int tar_backends[TAR_TYPE_COUNT] = {-1, BACKEND_S2, BACKEND_S3, BACKEND_S4};
+        // Marking which types go into the archive
+        int wanted[TAR_TYPE_COUNT] = {0, 0, 0, 0};
+        // Counting the types requested
+        int wanted_count = 0;
+        // Remembering a type we do not know
+        char *invalid_type = NULL;
+        // Cutoff for an incremental archive (--since seconds), and whether one was given
+        long since = 0;
+        int since_given = 0;
+        // Set for a gzip compressed archive (--gzip)
+        int compress = 0;
+
+        // Copying command so tokenizing does not modify it
+        char command_copy[1024];
+        snprintf(command_copy, sizeof(command_copy), "%s", command);
+
+        // Skipping the command word, then reading each requested type
+        char *save_ptr;
+        char *token = strtok_r(command_copy, " \t\r\n", &save_ptr);
+        while ((token = strtok_r(NULL, " \t\r\n", &save_ptr)) != NULL)
+        {
+            // Reading the incremental cutoff in seconds since the epoch
+            if (strcmp(token, "--since") == 0)
+            {
+                char *value = strtok_r(NULL, " \t\r\n", &save_ptr);
+                char *end = NULL;
+                if (value != NULL)
+                {
+                    since = strtol(value, &end, 10);
                 }
-                else
+                if (value == NULL || end == value || *end != '\0' || since < 0)
+                {
+                    invalid_type = (value != NULL) ? value : token;
+                    break;
+                }
+                since_given = 1;
+                continue;
+            }
+
+            // Choosing compressed output
+            if (strcmp(token, "--gzip") == 0)
+            {
+                compress = 1;
+                continue;
+            }
+
+            wanted_count++;
+
+            // Selecting every type for "all"
+            if (strcmp(token, "all") == 0)
+            {
+                for (int t = 0; t < TAR_TYPE_COUNT; t++)
                 {
-                    printf("[S1] ERROR: Unknown file type: %s\n", filename);
+                    wanted[t] = 1;
                 }
+                continue;
+            }
+
+            // Finding the type in the table
+            int t = 0;
+            while (t < TAR_TYPE_COUNT && strcmp(token, tar_types[t]) != 0)
+            {
+                t++;
+            }
+            if (t == TAR_TYPE_COUNT)
+            {
+                invalid_type = token;
+                break;
+            }
+            wanted[t] = 1;
+        }
+
+        // Printing how many types we got
+        printf("[S1] Parsed %d filetypes from downltar command\n", wanted_count);
+
+        // Checking if the format is correct (at least one type)
+        if (wanted_count == 0)
+        {
+            // Telling client format is wrong
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_BAD_REQUEST, "FORMAT_ERROR: Command: downltar filetype [filetype...] | all [--since seconds] [--gzip]");
+            // Printing error info
+            printf("[S1] ERROR: Invalid downltar - incorrect arguments\n");
+            // Returning to wait for the next command
+            return 0;
+        }
+
+        // Validating the allowed types
+        if (invalid_type != NULL)
+        {
+            // Informing client that type is invalid
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_BAD_REQUEST, "INVALID_TYPE: Only .c, .pdf, .txt, .zip or all supported, --since takes seconds");
+            // Printing error
+            printf("[S1] ERROR: Invalid filetype: %s\n", invalid_type);
+            // Skipping the rest for invalid type
+            return 0;
+        }
+
+        // Taking the snapshot time before any tree is walked, so a later --since of this
+        // value never misses a file changed while the archive was built
+        long snapshot = (long)time(NULL);
+
+        // Asking every backend involved to start streaming before anything is relayed,
+        // so they walk their trees in parallel while S1 sends its own members
+        struct tar_source sources[BACKEND_COUNT];
+        int source_count = 0;
+        // Naming sources whose members will be missing from the archive
+        char missing[64] = "";
+        for (int t = 0; t < TAR_TYPE_COUNT; t++)
+        {
+            if (!wanted[t] || tar_backends[t] == -1)
+            {
+                continue;
+            }
+
+            struct tar_source *source = &sources[source_count];
+            source->backend = tar_backends[t];
+            source->mid_member = 0;
+            source->result = 0;
+            source->deleted = NULL;
+            source->deleted_length = 0;
+            const char *server_name = backend_pools[source->backend].name;
+
+            // Saying which server streams the members
+            printf("[S1] Requesting %s tar stream from %s\n", tar_types[t], server_name);
+
+            // Checking out backend connection
+            source->server_socket = acquire_backend_connection(source->backend);
+            // Checking connection success
+            if (source->server_socket == -1)
+            {
+                // Printing that we could not connect
+                printf("[S1] ERROR: Cannot connect to %s server\n", server_name);
+                strncat(missing, " ", sizeof(missing) - strlen(missing) - 1);
+                strncat(missing, server_name, sizeof(missing) - strlen(missing) - 1);
+                continue;
+            }
+
+            // Asking the backend to stream its tree under ~/S2, ~/S3 or ~/S4 (only recent changes for --since)
+            char createtar_command[64];
+            if (since_given)
+            {
+                snprintf(createtar_command, sizeof(createtar_command), "CREATETAR ~/%s SINCE %ld", server_name, since);
             }
+            else
+            {
+                snprintf(createtar_command, sizeof(createtar_command), "CREATETAR ~/%s", server_name);
+            }
+            // Printing what we send
+            printf("[S1] Sending to %s: %s\n", server_name, createtar_command);
 
-            // Checking if any files were successfully retrieved
-            if (success_count == 0)
+            // Sending the CREATETAR request
+            if (send_text_frame(source->server_socket, FRAME_COMMAND, STATUS_OK, createtar_command) == -1)
             {
-                send(client_socket, "ERROR: No files could be retrieved", 34, 0);
-                printf("[S1] ERROR: Download failed - no files retrieved\n");
+                // Printing send failure
+                printf("[S1] ERROR: Failed to send CREATETAR command to %s\n", server_name);
+                release_backend_connection(source->backend, source->server_socket, 0);
+                strncat(missing, " ", sizeof(missing) - strlen(missing) - 1);
+                strncat(missing, server_name, sizeof(missing) - strlen(missing) - 1);
                 continue;
             }
 
-            // Sending client number of files we're sending
-            char count_msg[64];
-            snprintf(count_msg, sizeof(count_msg), "READY %d", success_count);
-            send(client_socket, count_msg, strlen(count_msg), 0);
-            printf("[S1] Told client we're sending %d files\n", success_count);
+            source_count++;
+        }
 
-            // Adding delay to ensure client processes READY message
-            sleep(1);
+        // Telling client before any archive data was sent when no source is left at all
+        if (!wanted[0] && source_count == 0)
+        {
+            send_text_frame(client_socket, FRAME_RESPONSE, STATUS_ERROR, "TAR_ERROR: Storage server not available");
+            return 0;
+        }
 
-            // Sending each file to client
-            for (int i = 0; i < file_count; i++)
+        // Starting the compression threads before the first archive byte is produced
+        struct block_compressor *compressor = NULL;
+        if (compress)
+        {
+            compressor = start_block_compressor(client_socket);
+            if (compressor == NULL)
             {
-                char *full_path = file_paths[i];
-                char filename[256];
-                char temp_path[MAX_PATH];
-
-                // Extracting filename
-                char *last_slash = strrchr(full_path, '/');
-                if (last_slash != NULL)
+                printf("[S1] ERROR: Cannot start tar compressor\n");
+                for (int i = 0; i < source_count; i++)
                 {
-                    strcpy(filename, last_slash + 1);
-                    snprintf(temp_path, sizeof(temp_path), "S1/temp/%s", filename);
-
-                    // Checking if file exists in temp
-                    FILE *check_file = fopen(temp_path, "r");
-                    if (check_file != NULL)
-                    {
-                        fclose(check_file);
-
-                        printf("[S1] Sending %s to client\n", filename);
-
-                        // Sending filename with null terminator
-                        char filename_with_null[300];
-                        snprintf(filename_with_null, sizeof(filename_with_null), "%s", filename);
-                        int filename_len = strlen(filename_with_null) + 1; // +1 for null terminator
-
-                        // Sending filename to client
-                        if (send(client_socket, filename_with_null, filename_len, 0) == -1)
-                        {
-                            printf("[S1] ERROR: Failed to send filename\n");
-                            continue;
-                        }
-                        printf("[S1] Sent filename: '%s' with null terminator\n", filename);
-
-                        // Sending file data using existing function
-                        if (send_file_to_S1(client_socket, temp_path) == 0)
-                        {
-                            printf("[S1] Successfully sent %s to client\n", filename);
-                        }
-                        else
-                        {
-                            printf("[S1] ERROR: Failed to send %s to client\n", filename);
-                        }
-
-                        // Cleaning up temp file
-                        remove(temp_path);
-                        printf("[S1] Cleaned up temp file: %s\n", temp_path);
-                    }
-                    else
-                    {
-                        printf("[S1] ERROR: File not found in temp after retrieval: %s\n", temp_path);
-                    }
+                    release_backend_connection(sources[i].backend, sources[i].server_socket, 0);
                 }
+                send_text_frame(client_socket, FRAME_RESPONSE, STATUS_ERROR, "TAR_ERROR: Compression not available");
+                return 0;
             }
-
-            printf("[S1] DOWNLF command processing complete\n");
         }
 
-        /*=== REMOVEF COMMAND PROCESSING ===*/
-        else if (strncmp(command, "removef", 7) == 0)
+        // Tracking how the member streams ended (0 complete, -1 unusable, -2 client broken)
+        int tar_result = 0;
+
+        // Sending local C files first while the backends fill their socket buffers
+        if (wanted[0])
         {
-            printf("[S1] Processing removef command\n");
+            // Saying we are streaming C files straight from local storage
+            printf("[S1] Streaming tar of C files from local S1 storage\n");
 
-            // First, parsing ALL arguments to count them properly
-            char cmd[20];
-            char args[10][512];
-            int total_args = 0;
+            // Writing members straight to the client - no tar file on disk
+            if (stream_tar_members(client_socket, "S1", ".c", since, compressor) == -1)
+            {
+                tar_result = -2;
+            }
+        }
 
-            // Parsing the entire command to count all arguments
-            char command_copy[1024];
-            strcpy(command_copy, command);
+        if (tar_result == 0)
+        {
+            // Relaying backend members to the client as they arrive
+            tar_result = merge_tar_sources(sources, source_count, client_socket, compressor);
+        }
+        else
+        {
+            // Dropping backend streams nobody will read
+            for (int i = 0; i < source_count; i++)
+            {
+                release_backend_connection(sources[i].backend, sources[i].server_socket, 0);
+            }
+        }
 
-            // Tokenizing command to extract all arguments
-            char *token = strtok(command_copy, " ");
-            while (token != NULL && total_args < 10)
+        // Gathering local and backend deletions for an incremental archive
+        char *manifest = NULL;
+        long manifest_length = 0;
+        if (since_given && tar_result == 0)
+        {
+            manifest = wanted[0] ? collect_tombstones("S1", ".c", since, &manifest_length) : strdup("");
+            for (int i = 0; manifest != NULL && i < source_count; i++)
             {
-                if (total_args == 0)
+                if (sources[i].deleted_length == 0)
                 {
-                    // First token is the command
-                    strcpy(cmd, token);
+                    continue;
                 }
-                else
+                char *grown = realloc(manifest, manifest_length + sources[i].deleted_length + 1);
+                if (grown == NULL)
                 {
-                    // Store file arguments
-                    strcpy(args[total_args - 1], token);
+                    free(manifest);
+                    manifest = NULL;
+                    break;
                 }
-                total_args++;
-                // Getting next token
-                token = strtok(NULL, " ");
+                manifest = grown;
+                memcpy(manifest + manifest_length, sources[i].deleted, sources[i].deleted_length + 1);
+                manifest_length += sources[i].deleted_length;
             }
+            if (manifest == NULL)
+            {
+                // Archive without its deletion list would silently miss removals
+                printf("[S1] ERROR: Could not build deletion manifest\n");
+                tar_result = -1;
+            }
+        }
+        for (int i = 0; i < source_count; i++)
+        {
+            free(sources[i].deleted);
+        }
 
-            // Calculating file count (subtract command name)
-            int file_count = total_args - 1;
-
-            printf("[S1] Parsed %d total arguments, %d file arguments\n", total_args, file_count);
+        // Ending session if the client stream broke mid-frame
+        if (tar_result == -2)
+        {
+            printf("[S1] ERROR: Tar stream to client broken - closing client session\n");
+            if (compressor != NULL)
+            {
+                finish_block_compressor(compressor, 0);
+            }
+            return -1;
+        }
 
-            // VALIDATION FIRST - before doing any work
-            if (file_count < 1)
+        // Adding manifest as the last member before the archive is closed
+        if (manifest != NULL)
+        {
+            int sent = stream_tar_text_member(client_socket, TAR_MANIFEST_NAME, manifest, manifest_length, compressor);
+            free(manifest);
+            if (sent == -1)
             {
-                send(client_socket, "ERROR: Not enough arguments. Command: removef filepath1 [filepath2]", 65, 0);
-                printf("[S1] ERROR: Invalid removef - not enough arguments\n");
-                continue;
+                if (compressor != NULL)
+                {
+                    finish_block_compressor(compressor, 0);
+                }
+                printf("[S1] ERROR: Tar stream to client broken - closing client session\n");
+                return -1;
             }
+        }
 
-            if (file_count > 2)
+        // Naming backends whose stream was cut short between members
+        for (int i = 0; i < source_count; i++)
+        {
+            if (sources[i].result == -1)
             {
-                send(client_socket, "ERROR: Too many arguments. Max 2 files allowed", 47, 0);
-                printf("[S1] ERROR: Invalid removef - too many arguments (%d files provided, max 2 allowed)\n", file_count);
-                continue;
+                strncat(missing, " ", sizeof(missing) - strlen(missing) - 1);
+                strncat(missing, backend_pools[sources[i].backend].name, sizeof(missing) - strlen(missing) - 1);
             }
+        }
+
+        // Choosing how the archive is closed
+        // A complete archive carries its snapshot time, the --since value for the next one
+        int end_status = STATUS_OK;
+        char end_message[128];
+        snprintf(end_message, sizeof(end_message), "SNAPSHOT %ld", snapshot);
+        if (tar_result == -1)
+        {
+            end_status = STATUS_ERROR;
+            snprintf(end_message, sizeof(end_message), "TAR_ERROR: Failed to create tar file");
+        }
+        else if (missing[0] != '\0')
+        {
+            end_status = STATUS_PARTIAL;
+            snprintf(end_message, sizeof(end_message), "TAR_PARTIAL: Missing files from%s", missing);
+        }
 
-            printf("[S1] Validation passed - processing %d file(s) for deletion\n", file_count);
+        // Closing the archive (or telling client it failed)
+        if (finish_tar_stream(client_socket, compressor, end_status, end_message) == -1)
+        {
+            printf("[S1] ERROR: Failed to finish tar stream\n");
+            return -1;
+        }
+        if (end_status == STATUS_OK)
+        {
+            printf("[S1] Tar stream sent to client successfully\n");
+        }
+        else
+        {
+            printf("[S1] ERROR: Tar stream incomplete: %s\n", end_message);
+        }
 
-            // Now extract the validated file paths
-            char file1_path[512] = "";
-            char file2_path[512] = "";
+        // Printing that we finished this command
+        printf("[S1] DOWNLTAR command processing complete\n");
+    }
 
-            if (file_count >= 1)
+    /*=== HELLO COMMAND PROCESSING ===*/
+    else if (strncmp(command, "HELLO", 5) == 0)
+    {
+        // Client is offering session features ("HELLO COMPRESS deflate HASH sha256 DELTA cdc LIST stream")
+        printf("[S1] Processing HELLO command\n");
+
+        // Picking deflate, hash-first and delta uploads and streamed listings when they are offered
+        session->codec = CODEC_NONE;
+        session->hash_first = 0;
+        session->delta = 0;
+        session->list_stream = 0;
+        char command_copy[1024];
+        snprintf(command_copy, sizeof(command_copy), "%s", command);
+        char *save_ptr;
+        char *word = strtok_r(command_copy, " \t\r\n", &save_ptr);
+        const char *offering = "";
+        while ((word = strtok_r(NULL, " \t\r\n", &save_ptr)) != NULL)
+        {
+            if (strcmp(word, "COMPRESS") == 0 || strcmp(word, "HASH") == 0 || strcmp(word, "DELTA") == 0 ||
+                strcmp(word, "LIST") == 0)
             {
-                strcpy(file1_path, args[0]);
-                printf("[S1] File 1 path: %s\n", file1_path);
+                offering = word;
             }
-            if (file_count >= 2)
+            else if (strcmp(offering, "COMPRESS") == 0 && strcmp(word, "deflate") == 0)
             {
-                strcpy(file2_path, args[1]);
-                printf("[S1] File 2 path: %s\n", file2_path);
+                session->codec = CODEC_DEFLATE;
             }
-
-            // Processing each file and deleting from appropriate servers
-            char *file_paths[2] = {file1_path, file2_path};
-            int success_count = 0;
-
-            for (int i = 0; i < file_count; i++)
+            else if (strcmp(offering, "HASH") == 0 && strcmp(word, "sha256") == 0)
             {
-                char *full_path = file_paths[i];
-                char filename[256];
-                char directory_path[512];
-                char server_path[512];
-                char delete_command[1024];
-                char response[256];
-
-                // Skip empty paths (shouldn't happen with new validation, but safety check)
-                if (strlen(full_path) == 0)
-                {
-                    continue;
-                }
-
-                printf("[S1] Processing deletion %d/%d: %s\n", i + 1, file_count, full_path);
+                session->hash_first = 1;
+            }
+            else if (strcmp(offering, "DELTA") == 0 && strcmp(word, "cdc") == 0)
+            {
+                session->delta = 1;
+            }
+            else if (strcmp(offering, "LIST") == 0 && strcmp(word, "stream") == 0)
+            {
+                session->list_stream = 1;
+            }
+        }
+        // Deltas are only ever offered in answer to a content hash
+        session->delta = session->delta && session->hash_first;
+
+        // Telling client what later transfers may use (HASH, DELTA and LIST only answer clients that
+        // asked, so older clients still see the reply they expect)
+        char hello[64];
+        snprintf(hello, sizeof(hello), "HELLO COMPRESS %s%s%s%s", (session->codec == CODEC_DEFLATE) ? "deflate" : "none",
+                 session->hash_first ? " HASH sha256" : "", session->delta ? " DELTA cdc" : "",
+                 session->list_stream ? " LIST stream" : "");
+        send_text_frame(client_socket, FRAME_RESPONSE, STATUS_OK, hello);
+        printf("[S1] Session transfers: %s%s%s%s\n", (session->codec == CODEC_DEFLATE) ? "deflate" : "uncompressed",
+               session->hash_first ? ", hash-first uploads" : "", session->delta ? ", delta uploads" : "",
+               session->list_stream ? ", streamed listings" : "");
+    }
 
-                // Extracting filename from full path
-                char *last_slash = strrchr(full_path, '/');
-                if (last_slash == NULL)
-                {
-                    printf("[S1] ERROR: Invalid file path format: %s\n", full_path);
-                    continue;
-                }
-                // Getting filename after last slash
-                strcpy(filename, last_slash + 1);
+    /*=== UNKNOWN COMMAND HANDLING ===*/
+    else
+    {
+        // Unknown command received from client
+        printf("[S1] ERROR: Unknown command from client: %s\n", command);
+        strcpy(response, "ERROR: Unknown command");
+        send_text_frame(client_socket, FRAME_RESPONSE, STATUS_UNSUPPORTED, response);
+    }
 
-                // Extracting directory path
-                int dir_length = last_slash - full_path;
-                strncpy(directory_path, full_path, dir_length);
-                directory_path[dir_length] = '\0';
+    return 0;
+}
 
-                printf("[S1] Filename: %s, Directory: %s\n", filename, directory_path);
+// Serving one client for its whole session (fork and pre-fork modes)
+void prcclient(int client_socket)
+{
+    printf("\n[S1] New client connected - starting service\n");
 
-                // Route to appropriate server based on file extension
-                if (strstr(filename, ".pdf") != NULL)
-                {
-                    printf("[S1] Deleting PDF file from S2\n");
+    // Creating command buffer
+    char command[1024];
+    // Keeping session state for the whole connection
+    struct client_session session = {client_socket, CODEC_NONE, 0, 0, 0};
 
-                    // Converting ~S1/project to S2/project
-                    if (strncmp(directory_path, "~/S1/", 5) == 0)
-                    {
-                        snprintf(server_path, sizeof(server_path), "S2/%s", directory_path + 5);
-                    }
-                    else if (strncmp(directory_path, "~/S1", 4) == 0)
-                    {
-                        strcpy(server_path, "S2");
-                    }
-                    else if (strncmp(directory_path, "~S1/", 4) == 0)
-                    {
-                        snprintf(server_path, sizeof(server_path), "S2/%s", directory_path + 4);
-                    }
-                    else if (strncmp(directory_path, "~S1", 3) == 0)
-                    {
-                        strcpy(server_path, "S2");
-                    }
-                    else
-                    {
-                        snprintf(server_path, sizeof(server_path), "S2/%s", directory_path);
-                    }
+    // Sending welcome message to client
+    char welcome[] = "Welcome to S1 server.";
+    send_text_frame(client_socket, FRAME_RESPONSE, STATUS_OK, welcome);
+    printf("[S1] Welcome message sent to client\n");
 
-                    // Connecting to S2
-                    int s2_socket = connect_to_s2();
-                    if (s2_socket != -1)
-                    {
-                        // Sending DELETE command to S2
-                        snprintf(delete_command, sizeof(delete_command), "DELETE %s/%s", server_path, filename);
-                        printf("[S1] Sending to S2: %s\n", delete_command);
+    // Starting infinite loop to process client commands
+    while (1)
+    {
+        // Clearing command buffer
+        memset(command, 0, sizeof(command));
 
-                        // Sending delete command to S2
-                        if (send(s2_socket, delete_command, strlen(delete_command), 0) != -1)
-                        {
-                            // Waiting for response from S2
-                            int bytes = recv(s2_socket, response, sizeof(response) - 1, 0);
-                            if (bytes > 0)
-                            {
-                                // Adding null terminator to response
-                                response[bytes] = '\0';
-                                printf("[S1] S2 response: %s\n", response);
-
-                                // Checking if deletion was successful
-                                if (strstr(response, "SUCCESS") != NULL)
-                                {
-                                    success_count++;
-                                    printf("[S1] Successfully deleted %s from S2\n", filename);
-                                }
-                                else
-                                {
-                                    printf("[S1] ERROR: Failed to delete %s from S2\n", filename);
-                                }
-                            }
-                            else
-                            {
-                                printf("[S1] ERROR: No response from S2\n");
-                            }
-                        }
-                        else
-                        {
-                            printf("[S1] ERROR: Failed to send DELETE command to S2\n");
-                        }
-                        // Closing connection to S2
-                        close(s2_socket);
-                    }
-                    else
-                    {
-                        printf("[S1] ERROR: Cannot connect to S2\n");
-                    }
-                }
-                else if (strstr(filename, ".txt") != NULL)
-                {
-                    printf("[S1] Deleting TXT file from S3\n");
+        // Waiting for next command, closing idle backend connections while the client is quiet
+        struct pollfd client_poll = {client_socket, POLLIN, 0};
+        while (poll(&client_poll, 1, POOL_IDLE_TIMEOUT * 1000) == 0)
+        {
+            expire_idle_backend_connections();
+        }
 
-                    // Converting ~S1/project to S3/project
-                    if (strncmp(directory_path, "~/S1/", 5) == 0)
-                    {
-                        snprintf(server_path, sizeof(server_path), "S3/%s", directory_path + 5);
-                    }
-                    else if (strncmp(directory_path, "~/S1", 4) == 0)
-                    {
-                        strcpy(server_path, "S3");
-                    }
-                    else if (strncmp(directory_path, "~S1/", 4) == 0)
-                    {
-                        snprintf(server_path, sizeof(server_path), "S3/%s", directory_path + 4);
-                    }
-                    else if (strncmp(directory_path, "~S1", 3) == 0)
-                    {
-                        strcpy(server_path, "S3");
-                    }
-                    else
-                    {
-                        snprintf(server_path, sizeof(server_path), "S3/%s", directory_path);
-                    }
+        // Receiving next COMMAND frame from client
+        int status;
+        int bytes = recv_text_frame(client_socket, FRAME_COMMAND, &status, command, sizeof(command));
 
-                    // Connecting to S3
-                    int s3_socket = connect_to_s3();
-                    if (s3_socket != -1)
-                    {
-                        // Sending DELETE command to S3
-                        snprintf(delete_command, sizeof(delete_command), "DELETE %s/%s", server_path, filename);
-                        printf("[S1] Sending to S3: %s\n", delete_command);
+        // Checking if client disconnected
+        if (bytes == -1)
+        {
+            printf("[S1] Client disconnected - ending session\n");
+            break;
+        }
+        printf("\n[S1] Processing command: %s\n", command);
 
-                        // Sending delete command to S3
-                        if (send(s3_socket, delete_command, strlen(delete_command), 0) != -1)
-                        {
-                            // Waiting for response from S3
-                            int bytes = recv(s3_socket, response, sizeof(response) - 1, 0);
-                            if (bytes > 0)
-                            {
-                                // Adding null terminator to response
-                                response[bytes] = '\0';
-                                printf("[S1] S3 response: %s\n", response);
-
-                                // Checking if deletion was successful
-                                if (strstr(response, "SUCCESS") != NULL)
-                                {
-                                    success_count++;
-                                    printf("[S1] Successfully deleted %s from S3\n", filename);
-                                }
-                                else
-                                {
-                                    printf("[S1] ERROR: Failed to delete %s from S3\n", filename);
-                                }
-                            }
-                            else
-                            {
-                                printf("[S1] ERROR: No response from S3\n");
-                            }
-                        }
-                        else
-                        {
-                            printf("[S1] ERROR: Failed to send DELETE command to S3\n");
-                        }
-                        // Closing connection to S3
-                        close(s3_socket);
-                    }
-                    else
-                    {
-                        printf("[S1] ERROR: Cannot connect to S3\n");
-                    }
-                }
-                else if (strstr(filename, ".zip") != NULL)
-                {
-                    printf("[S1] Deleting ZIP file from S4\n");
+        // Running the command, ending session if the stream is out of sync
+        if (process_client_command(&session, command) == -1)
+        {
+            break;
+        }
+    }
 
-                    // Converting ~S1/project to S4/project
-                    if (strncmp(directory_path, "~/S1/", 5) == 0)
-                    {
-                        snprintf(server_path, sizeof(server_path), "S4/%s", directory_path + 5);
-                    }
-                    else if (strncmp(directory_path, "~/S1", 4) == 0)
-                    {
-                        strcpy(server_path, "S4");
-                    }
-                    else if (strncmp(directory_path, "~S1/", 4) == 0)
-                    {
-                        snprintf(server_path, sizeof(server_path), "S4/%s", directory_path + 4);
-                    }
-                    else if (strncmp(directory_path, "~S1", 3) == 0)
-                    {
-                        strcpy(server_path, "S4");
-                    }
-                    else
-                    {
-                        snprintf(server_path, sizeof(server_path), "S4/%s", directory_path);
-                    }
+    // Closing client connection
+    close(client_socket);
+    printf("[S1] Client connection closed\n");
+}
 
-                    // Connecting to S4
-                    int s4_socket = connect_to_s4();
-                    if (s4_socket != -1)
-                    {
-                        // Sending DELETE command to S4
-                        snprintf(delete_command, sizeof(delete_command), "DELETE %s/%s", server_path, filename);
-                        printf("[S1] Sending to S4: %s\n", delete_command);
+/* LISTENING SOCKET FUNCTIONS */
 
-                        // Sending delete command to S4
-                        if (send(s4_socket, delete_command, strlen(delete_command), 0) != -1)
-                        {
-                            // Waiting for response from S4
-                            int bytes = recv(s4_socket, response, sizeof(response) - 1, 0);
-                            if (bytes > 0)
-                            {
-                                // Adding null terminator to response
-                                response[bytes] = '\0';
-                                printf("[S1] S4 response: %s\n", response);
-
-                                // Checking if deletion was successful
-                                if (strstr(response, "SUCCESS") != NULL)
-                                {
-                                    success_count++;
-                                    printf("[S1] Successfully deleted %s from S4\n", filename);
-                                }
-                                else
-                                {
-                                    printf("[S1] ERROR: Failed to delete %s from S4\n", filename);
-                                }
-                            }
-                            else
-                            {
-                                printf("[S1] ERROR: No response from S4\n");
-                            }
-                        }
-                        else
-                        {
-                            printf("[S1] ERROR: Failed to send DELETE command to S4\n");
-                        }
-                        // Closing connection to S4
-                        close(s4_socket);
-                    }
-                    else
-                    {
-                        printf("[S1] ERROR: Cannot connect to S4\n");
-                    }
-                }
-                else if (strstr(filename, ".c") != NULL)
-                {
-                    printf("[S1] Deleting C file from local S1 storage\n");
+// Creating the socket S1 listens on for client connections
+// reuse_port lets several pre-fork workers bind their own socket to the same port
+// Returns socket descriptor or -1 on error
+int create_listen_socket(int backlog, int reuse_port)
+{
+    // Creating a socket for S1 to listen for client connections
+    printf("[S1] Creating server socket\n");
+    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_socket == -1)
+    {
+        printf("[S1] ERROR: Failed to create server socket\n");
+        return -1;
+    }
 
-                    // For .c files, delete from local S1 storage
-                    char local_path[MAX_PATH];
+    // Setting socket option to reuse address
+    printf("[S1] Setting socket options\n");
+    int opt = 1;
+    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
+    {
+        printf("[S1] WARNING: Failed to set socket options\n");
+    }
 
-                    // Convert S1 client path format to actual local filesystem path
-                    if (strncmp(directory_path, "~/S1/", 5) == 0)
-                    {
-                        // ~/S1/abcd -> S1/abcd
-                        snprintf(local_path, sizeof(local_path), "S1/%s/%s", directory_path + 5, filename);
-                    }
-                    else if (strncmp(directory_path, "~/S1", 4) == 0)
-                    {
-                        // ~/S1 -> S1
-                        snprintf(local_path, sizeof(local_path), "S1/%s", filename);
-                    }
-                    else if (strncmp(directory_path, "~S1/", 4) == 0)
-                    {
-                        // ~S1/abcd -> S1/abcd
-                        snprintf(local_path, sizeof(local_path), "S1/%s/%s", directory_path + 4, filename);
-                    }
-                    else if (strncmp(directory_path, "~S1", 3) == 0)
-                    {
-                        // ~S1 -> S1
-                        snprintf(local_path, sizeof(local_path), "S1/%s", filename);
-                    }
-                    else
-                    {
-                        // Relative path -> S1/path
-                        snprintf(local_path, sizeof(local_path), "S1/%s/%s", directory_path, filename);
-                    }
+#ifdef SO_REUSEPORT
+    // Sharing the port between worker sockets so the kernel balances connections
+    if (reuse_port && setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+    {
+        printf("[S1] ERROR: Failed to set SO_REUSEPORT\n");
+        close(server_socket);
+        return -1;
+    }
+#endif
 
-                    printf("[S1] Deleting local file: %s\n", local_path);
+    // Creating address structure for S1 server
+    printf("[S1] Configuring server address\n");
+    struct sockaddr_in server_addr = {0};
+    // Setting the protocol family to IPv4
+    server_addr.sin_family = AF_INET;
+    // Setting to accept connections from any IP address
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    // Converting port number to network format and assigning
+    server_addr.sin_port = htons(S1_PORT);
 
-                    // Using existing delete_file function
-                    if (delete_file(local_path) == 0)
-                    {
-                        success_count++;
-                        printf("[S1] Successfully deleted local C file: %s\n", filename);
-                    }
-                    else
-                    {
-                        printf("[S1] ERROR: Failed to delete local C file: %s\n", filename);
-                    }
-                }
-                else
-                {
-                    printf("[S1] ERROR: Unknown file type: %s\n", filename);
-                }
-            }
+    // Binding the socket to the address
+    printf("[S1] Binding socket to address\n");
+    if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1)
+    {
+        printf("[S1] ERROR: Failed to bind socket to address\n");
+        printf("[S1] Make sure port %d is not already in use\n", S1_PORT);
+        // Closing socket before returning
+        close(server_socket);
+        return -1;
+    }
 
-            // Sending final response to client
-            printf("\n[S1] Deletion summary: %d/%d files successful\n", success_count, file_count);
+    // Starting to listen for client connections
+    // The backlog is how many finished handshakes the kernel queues while every worker is busy
+    printf("[S1] Starting to listen for connections (backlog %d)\n", backlog);
+    if (listen(server_socket, backlog) == -1)
+    {
+        printf("[S1] ERROR: Failed to listen on socket\n");
+        // Closing socket before returning
+        close(server_socket);
+        return -1;
+    }
 
-            if (success_count == file_count)
-            {
-                // All files deleted successfully
-                send(client_socket, "SUCCESS: All files deleted successfully", 39, 0);
-                printf("[S1] SUCCESS: All deletions completed successfully\n");
-            }
-            else if (success_count > 0)
-            {
-                // Some files deleted, some failed
-                char partial_msg[256];
-                snprintf(partial_msg, sizeof(partial_msg),
-                         "PARTIAL SUCCESS: %d/%d files deleted successfully",
-                         success_count, file_count);
-                send(client_socket, partial_msg, strlen(partial_msg), 0);
-                printf("[S1] PARTIAL: Deletion partially completed\n");
-            }
-            else
-            {
-                // All files failed
-                send(client_socket, "ERROR: Failed to delete any files", 33, 0);
-                printf("[S1] ERROR: All deletions failed\n");
-            }
+    return server_socket;
+}
 
-            printf("[S1] REMOVEF command processing complete\n");
-        }
+/* EVENT-DRIVEN MODE FUNCTIONS */
 
-        /*=== DISPFNAMES COMMAND PROCESSING ===*/
-        else if (strncmp(command, "dispfnames", 10) == 0)
-        {
-            printf("[S1] Processing dispfnames command\n");
+#ifdef __linux__
 
-            char pathname[MAX_PATH];
+// Holding one client connection that has a command waiting
+struct ready_connection
+{
+    // Session whose socket has readable data
+    struct client_session *session;
+    // Next connection in the queue
+    struct ready_connection *next;
+};
+
+// Queue of ready client connections handed from the reactor to worker threads
+struct ready_queue
+{
+    // First connection to serve
+    struct ready_connection *head;
+    // Last connection queued
+    struct ready_connection *tail;
+    // Guarding head and tail
+    pthread_mutex_t lock;
+    // Waking workers when a connection is queued
+    pthread_cond_t not_empty;
+};
+
+// Connections waiting for a worker
+struct ready_queue ready_connections = {NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+// epoll instance watching the listening socket and every idle client
+int event_fd = -1;
+
+// Arming epoll for one client so exactly one readiness event is delivered
+// EPOLLONESHOT keeps a session owned by at most one worker at a time
+int watch_client_connection(struct client_session *session, int operation)
+{
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.ptr = session;
 
-            // Parsing the command to extract pathname
-            if (sscanf(command, "dispfnames %s", pathname) == 1)
-            {
-                printf("[S1] Displaying files for pathname: %s\n", pathname);
+    if (epoll_ctl(event_fd, operation, session->socket, &event) == -1)
+    {
+        printf("[S1] ERROR: Cannot watch client connection %d\n", session->socket);
+        return -1;
+    }
 
-                // Buffers for different file types
-                char c_files[2048] = "";
-                char pdf_files[2048] = "";
-                char txt_files[2048] = "";
-                char zip_files[2048] = "";
-                char consolidated_list[8192] = "";
+    return 0;
+}
 
-                // Arrays for sorting files
-                char c_list[100][256];
-                char pdf_list[100][256];
-                char txt_list[100][256];
-                char zip_list[100][256];
-                int c_count = 0, pdf_count = 0, txt_count = 0, zip_count = 0;
+// Adding a client connection with a pending command to the ready queue
+void queue_ready_connection(struct client_session *session)
+{
+    // Creating queue entry
+    struct ready_connection *entry = malloc(sizeof(struct ready_connection));
+    if (entry == NULL)
+    {
+        printf("[S1] ERROR: Out of memory - dropping client %d\n", session->socket);
+        close(session->socket);
+        free(session);
+        return;
+    }
+    entry->session = session;
+    entry->next = NULL;
 
-                // Getting .c files from local S1 directory
-                printf("[S1] Getting local C files\n");
+    // Appending entry and waking one worker
+    pthread_mutex_lock(&ready_connections.lock);
+    if (ready_connections.tail == NULL)
+    {
+        ready_connections.head = entry;
+    }
+    else
+    {
+        ready_connections.tail->next = entry;
+    }
+    ready_connections.tail = entry;
+    pthread_cond_signal(&ready_connections.not_empty);
+    pthread_mutex_unlock(&ready_connections.lock);
+}
 
-                // Converting client path to local filesystem path
-                char local_c_path[MAX_PATH];
-                if (strncmp(pathname, "~/S1/", 5) == 0)
-                {
-                    // ~/S1/code -> S1/code
-                    snprintf(local_c_path, sizeof(local_c_path), "S1/%s", pathname + 5);
-                }
-                else if (strncmp(pathname, "~/S1", 4) == 0)
-                {
-                    // ~/S1 -> S1
-                    strcpy(local_c_path, "S1");
-                }
-                else if (strncmp(pathname, "~S1/", 4) == 0)
-                {
-                    // ~S1/code -> S1/code
-                    snprintf(local_c_path, sizeof(local_c_path), "S1/%s", pathname + 4);
-                }
-                else if (strncmp(pathname, "~S1", 3) == 0)
-                {
-                    // ~S1 -> S1
-                    strcpy(local_c_path, "S1");
-                }
-                else
-                {
-                    // Relative path -> S1/path
-                    snprintf(local_c_path, sizeof(local_c_path), "S1/%s", pathname);
-                }
+// Taking the next ready client connection, waiting if there is none
+struct client_session *take_ready_connection()
+{
+    pthread_mutex_lock(&ready_connections.lock);
+    while (ready_connections.head == NULL)
+    {
+        pthread_cond_wait(&ready_connections.not_empty, &ready_connections.lock);
+    }
 
-                printf("[S1] Converted local path: %s\n", local_c_path);
+    // Removing entry from the front of the queue
+    struct ready_connection *entry = ready_connections.head;
+    ready_connections.head = entry->next;
+    if (ready_connections.head == NULL)
+    {
+        ready_connections.tail = NULL;
+    }
+    pthread_mutex_unlock(&ready_connections.lock);
 
-                // Getting local C files
-                if (get_local_c_files(local_c_path, c_files, sizeof(c_files)) == 0)
-                {
-                    // Parsing c_files into array for sorting
-                    char c_files_copy[2048];
-                    strcpy(c_files_copy, c_files);
+    struct client_session *session = entry->session;
+    free(entry);
+    return session;
+}
 
-                    // Tokenizing C files string
-                    char *token = strtok(c_files_copy, "\n");
-                    while (token != NULL && c_count < 100)
-                    {
-                        strcpy(c_list[c_count], token);
-                        c_count++;
-                        token = strtok(NULL, "\n");
-                    }
-                    // Sorting C files alphabetically
-                    sort_file_list(c_list, c_count);
-                    printf("[S1] Found %d C files\n", c_count);
-                }
-                else
-                {
-                    printf("[S1] ERROR: Failed to get local C files\n");
-                }
+// Ending an event-mode client session
+void close_event_client(struct client_session *session)
+{
+    // Closing the socket also removes it from the epoll set
+    close(session->socket);
+    printf("[S1] Client connection %d closed\n", session->socket);
+    free(session);
+}
 
-                // Getting .pdf files from S2
-                printf("[S1] Getting PDF files from S2\n");
-                int s2_socket = connect_to_s2();
-                if (s2_socket != -1)
-                {
-                    // Converting S1 path to S2 path
-                    char s2_path[MAX_PATH];
-                    if (strncmp(pathname, "~/S1/", 5) == 0)
-                    {
-                        // ~/S1/code -> S2/code
-                        snprintf(s2_path, sizeof(s2_path), "S2/%s", pathname + 5);
-                    }
-                    else if (strncmp(pathname, "~/S1", 4) == 0)
-                    {
-                        // ~/S1 -> S2
-                        strcpy(s2_path, "S2");
-                    }
-                    else if (strncmp(pathname, "~S1/", 4) == 0)
-                    {
-                        // ~S1/code -> S2/code
-                        snprintf(s2_path, sizeof(s2_path), "S2/%s", pathname + 4);
-                    }
-                    else if (strncmp(pathname, "~S1", 3) == 0)
-                    {
-                        // ~S1 -> S2
-                        strcpy(s2_path, "S2");
-                    }
-                    else
-                    {
-                        // Relative path -> S2/path
-                        snprintf(s2_path, sizeof(s2_path), "S2/%s", pathname);
-                    }
+// Worker thread body - running one command for each ready client, then handing it back to epoll
+void *event_worker(void *arg)
+{
+    (void)arg;
 
-                    printf("[S1] Converted S2 path: %s\n", s2_path);
+    // Creating command buffer
+    char command[1024];
 
-                    // Getting PDF files from S2
-                    if (get_files_from_server(s2_socket, s2_path, pdf_files, sizeof(pdf_files)) == 0)
-                    {
-                        // Parsing pdf_files into array for sorting
-                        char pdf_files_copy[2048];
-                        strcpy(pdf_files_copy, pdf_files);
+    while (1)
+    {
+        // Waiting for a client that has sent a command
+        struct client_session *session = take_ready_connection();
+        int client_socket = session->socket;
 
-                        // Tokenizing PDF files string
-                        char *token = strtok(pdf_files_copy, "\n");
-                        while (token != NULL && pdf_count < 100)
-                        {
-                            strcpy(pdf_list[pdf_count], token);
-                            pdf_count++;
-                            token = strtok(NULL, "\n");
-                        }
-                        // Sorting PDF files alphabetically
-                        sort_file_list(pdf_list, pdf_count);
-                        printf("[S1] Found %d PDF files\n", pdf_count);
-                    }
-                    // Closing connection to S2
-                    close(s2_socket);
-                }
-                else
-                {
-                    printf("[S1] ERROR: Failed to connect to S2\n");
-                }
+        // Receiving next COMMAND frame from client
+        memset(command, 0, sizeof(command));
+        int status;
+        int bytes = recv_text_frame(client_socket, FRAME_COMMAND, &status, command, sizeof(command));
 
-                // Getting .txt files from S3
-                printf("[S1] Getting TXT files from S3\n");
-                int s3_socket = connect_to_s3();
-                if (s3_socket != -1)
-                {
-                    // Converting S1 path to S3 path
-                    char s3_path[MAX_PATH];
-                    if (strncmp(pathname, "~/S1/", 5) == 0)
-                    {
-                        // ~/S1/code -> S3/code
-                        snprintf(s3_path, sizeof(s3_path), "S3/%s", pathname + 5);
-                    }
-                    else if (strncmp(pathname, "~/S1", 4) == 0)
-                    {
-                        // ~/S1 -> S3
-                        strcpy(s3_path, "S3");
-                    }
-                    else if (strncmp(pathname, "~S1/", 4) == 0)
-                    {
-                        // ~S1/code -> S3/code
-                        snprintf(s3_path, sizeof(s3_path), "S3/%s", pathname + 4);
-                    }
-                    else if (strncmp(pathname, "~S1", 3) == 0)
-                    {
-                        // ~S1 -> S3
-                        strcpy(s3_path, "S3");
-                    }
-                    else
-                    {
-                        // Relative path -> S3/path
-                        snprintf(s3_path, sizeof(s3_path), "S3/%s", pathname);
-                    }
+        // Checking if client disconnected
+        if (bytes == -1)
+        {
+            printf("[S1] Client %d disconnected - ending session\n", client_socket);
+            close_event_client(session);
+            continue;
+        }
+        printf("\n[S1] Processing command from client %d: %s\n", client_socket, command);
 
-                    printf("[S1] Converted S3 path: %s\n", s3_path);
+        // Running the command, ending session if the stream is out of sync
+        if (process_client_command(session, command) == -1)
+        {
+            close_event_client(session);
+            continue;
+        }
 
-                    // Getting TXT files from S3
-                    if (get_files_from_server(s3_socket, s3_path, txt_files, sizeof(txt_files)) == 0)
-                    {
-                        // Parsing txt_files into array for sorting
-                        char txt_files_copy[2048];
-                        strcpy(txt_files_copy, txt_files);
+        // Returning the idle session to the reactor
+        if (watch_client_connection(session, EPOLL_CTL_MOD) == -1)
+        {
+            close_event_client(session);
+        }
+    }
 
-                        // Tokenizing TXT files string
-                        char *token = strtok(txt_files_copy, "\n");
-                        while (token != NULL && txt_count < 100)
-                        {
-                            strcpy(txt_list[txt_count], token);
-                            txt_count++;
-                            token = strtok(NULL, "\n");
-                        }
-                        // Sorting TXT files alphabetically
-                        sort_file_list(txt_list, txt_count);
-                        printf("[S1] Found %d TXT files\n", txt_count);
-                    }
-                    // Closing connection to S3
-                    close(s3_socket);
-                }
-                else
-                {
-                    printf("[S1] ERROR: Failed to connect to S3\n");
-                }
+    return NULL;
+}
 
-                // Getting .zip files from S4
-                printf("[S1] Getting ZIP files from S4\n");
-                int s4_socket = connect_to_s4();
-                if (s4_socket != -1)
-                {
-                    // Converting S1 path to S4 path
-                    char s4_path[MAX_PATH];
-                    if (strncmp(pathname, "~/S1/", 5) == 0)
-                    {
-                        // ~/S1/code -> S4/code
-                        snprintf(s4_path, sizeof(s4_path), "S4/%s", pathname + 5);
-                    }
-                    else if (strncmp(pathname, "~/S1", 4) == 0)
-                    {
-                        // ~/S1 -> S4
-                        strcpy(s4_path, "S4");
-                    }
-                    else if (strncmp(pathname, "~S1/", 4) == 0)
-                    {
-                        // ~S1/code -> S4/code
-                        snprintf(s4_path, sizeof(s4_path), "S4/%s", pathname + 4);
-                    }
-                    else if (strncmp(pathname, "~S1", 3) == 0)
-                    {
-                        // ~S1 -> S4
-                        strcpy(s4_path, "S4");
-                    }
-                    else
-                    {
-                        // Relative path -> S4/path
-                        snprintf(s4_path, sizeof(s4_path), "S4/%s", pathname);
-                    }
+// Accepting every pending client on the non-blocking listening socket
+void accept_event_clients(int server_socket)
+{
+    while (1)
+    {
+        // Accepted sockets stay blocking on Linux; workers use plain blocking I/O on them
+        int client_socket = accept(server_socket, NULL, NULL);
+        if (client_socket == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                printf("[S1] ERROR: Failed to accept client connection\n");
+            }
+            // Stopping once the accept queue is drained
+            return;
+        }
 
-                    printf("[S1] Converted S4 path: %s\n", s4_path);
+        printf("[S1] New client %d connected\n", client_socket);
 
-                    // Getting ZIP files from S4
-                    if (get_files_from_server(s4_socket, s4_path, zip_files, sizeof(zip_files)) == 0)
-                    {
-                        // Parsing zip_files into array for sorting
-                        char zip_files_copy[2048];
-                        strcpy(zip_files_copy, zip_files);
+        // Bounding every blocking read and write, so a worker gives up on a stalled client
+        // (recv_all/send_all then fail and the session is closed)
+        struct timeval timeout = {CLIENT_IO_TIMEOUT, 0};
+        if (setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1 ||
+            setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1)
+        {
+            printf("[S1] ERROR: Cannot set timeouts for client %d - dropping it\n", client_socket);
+            close(client_socket);
+            continue;
+        }
 
-                        // Tokenizing ZIP files string
-                        char *token = strtok(zip_files_copy, "\n");
-                        while (token != NULL && zip_count < 100)
-                        {
-                            strcpy(zip_list[zip_count], token);
-                            zip_count++;
-                            token = strtok(NULL, "\n");
-                        }
-                        // Sorting ZIP files alphabetically
-                        sort_file_list(zip_list, zip_count);
-                        printf("[S1] Found %d ZIP files\n", zip_count);
-                    }
-                    // Closing connection to S4
-                    close(s4_socket);
-                }
-                else
-                {
-                    printf("[S1] ERROR: Failed to connect to S4\n");
-                }
+        // Sending welcome message to client
+        char welcome[] = "Welcome to S1 server.";
+        send_text_frame(client_socket, FRAME_RESPONSE, STATUS_OK, welcome);
 
-                // Consolidating all file lists in order: .c, .pdf, .txt, .zip
-                printf("[S1] Consolidating file lists\n");
-                printf("[S1] Total files found - C:%d, PDF:%d, TXT:%d, ZIP:%d\n",
-                       c_count, pdf_count, txt_count, zip_count);
+        // Creating session state that follows the connection between workers
+        struct client_session *session = malloc(sizeof(struct client_session));
+        if (session == NULL)
+        {
+            printf("[S1] ERROR: Out of memory - dropping client %d\n", client_socket);
+            close(client_socket);
+            continue;
+        }
+        session->socket = client_socket;
+        session->codec = CODEC_NONE;
+        session->hash_first = 0;
+        session->delta = 0;
+        session->list_stream = 0;
+
+        // Parking the session in epoll until the client sends a command
+        if (watch_client_connection(session, EPOLL_CTL_ADD) == -1)
+        {
+            close(client_socket);
+            free(session);
+        }
+    }
+}
 
-                // Adding .c files
-                for (int i = 0; i < c_count; i++)
-                {
-                    strcat(consolidated_list, c_list[i]);
-                    strcat(consolidated_list, "\n");
-                }
+// Serving all clients from one epoll reactor and a fixed set of worker threads
+// Idle sessions cost only their socket and epoll entry instead of a process
+void run_event_loop(int server_socket, int worker_count)
+{
+    // Making accept non-blocking so the reactor never stalls on it
+    int flags = fcntl(server_socket, F_GETFL, 0);
+    fcntl(server_socket, F_SETFL, flags | O_NONBLOCK);
 
-                // Adding .pdf files
-                for (int i = 0; i < pdf_count; i++)
-                {
-                    strcat(consolidated_list, pdf_list[i]);
-                    strcat(consolidated_list, "\n");
-                }
+    // Creating epoll instance
+    event_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (event_fd == -1)
+    {
+        printf("[S1] ERROR: Failed to create epoll instance\n");
+        exit(1);
+    }
 
-                // Adding .txt files
-                for (int i = 0; i < txt_count; i++)
-                {
-                    strcat(consolidated_list, txt_list[i]);
-                    strcat(consolidated_list, "\n");
-                }
+    // Watching listening socket for new clients
+    struct epoll_event listen_event = {0};
+    listen_event.events = EPOLLIN;
+    // Client sessions carry their state in data.ptr; NULL marks the listening socket
+    listen_event.data.ptr = NULL;
+    if (epoll_ctl(event_fd, EPOLL_CTL_ADD, server_socket, &listen_event) == -1)
+    {
+        printf("[S1] ERROR: Failed to watch listening socket\n");
+        exit(1);
+    }
 
-                // Adding .zip files
-                for (int i = 0; i < zip_count; i++)
-                {
-                    strcat(consolidated_list, zip_list[i]);
-                    strcat(consolidated_list, "\n");
-                }
+    // Sharing warm backend connections between all workers
+    pool_idle_limit = worker_count < POOL_MAX_IDLE ? worker_count : POOL_MAX_IDLE;
 
-                // Sending consolidated list to client
-                if (strlen(consolidated_list) > 0)
-                {
-                    printf("[S1] Sending file list to client\n");
-                    send(client_socket, consolidated_list, strlen(consolidated_list), 0);
-                }
-                else
-                {
-                    char no_files_msg[] = "No files found in the specified directory\n";
-                    printf("[S1] No files found, sending message to client\n");
-                    send(client_socket, no_files_msg, strlen(no_files_msg), 0);
-                }
+    // Starting worker threads
+    for (int i = 0; i < worker_count; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, event_worker, NULL) != 0)
+        {
+            printf("[S1] ERROR: Failed to start worker thread\n");
+            exit(1);
+        }
+        pthread_detach(thread);
+    }
+    printf("[S1] Event mode running with %d worker threads\n", worker_count);
 
-                printf("[S1] DISPFNAMES command completed\n");
-            }
-            else
+    // Reactor loop - waiting for new clients and for commands from idle clients
+    struct epoll_event events[EVENT_BATCH_SIZE];
+    while (1)
+    {
+        int ready = epoll_wait(event_fd, events, EVENT_BATCH_SIZE, POOL_IDLE_TIMEOUT * 1000);
+        if (ready == -1)
+        {
+            if (errno != EINTR)
             {
-                // Invalid command format
-                printf("[S1] ERROR: Invalid dispfnames command format\n");
-                char error_msg[] = "ERROR: Invalid command format. Command: dispfnames pathname";
-                send(client_socket, error_msg, strlen(error_msg), 0);
+                printf("[S1] ERROR: epoll_wait failed\n");
             }
+            continue;
         }
 
-        /*=== TEST COMMAND PROCESSING ===*/
-        else if (strncmp(command, "TEST", 4) == 0)
+        // Closing idle backend connections while everything is quiet
+        if (ready == 0)
         {
-            // Client is testing the connection
-            printf("[S1] Processing TEST command\n");
-
-            // Testing connections to other servers
-            int s2_sock = connect_to_s2();
-            int s3_sock = connect_to_s3();
-            int s4_sock = connect_to_s4();
+            expire_idle_backend_connections();
+            continue;
+        }
 
-            // Checking if all servers are accessible
-            if (s2_sock != -1 && s3_sock != -1 && s4_sock != -1)
+        for (int i = 0; i < ready; i++)
+        {
+            if (events[i].data.ptr == NULL)
             {
-                strcpy(response, "S1 OK - All servers connected");
-                // Closing the test connections
-                close(s2_sock);
-                close(s3_sock);
-                close(s4_sock);
+                accept_event_clients(server_socket);
             }
             else
             {
-                strcpy(response, "S1 ERROR - Some servers not available");
+                // Handing the session to a worker; ONESHOT keeps it quiet until re-armed
+                queue_ready_connection(events[i].data.ptr);
             }
-
-            // Sending test response to client
-            send(client_socket, response, strlen(response), 0);
-            printf("[S1] TEST command completed\n");
         }
+    }
+}
 
-        /*=== DOWNLTAR COMMAND PROCESSING ===*/
-        // Checking if the command is downltar
-        else if (strncmp(command, "downltar", 8) == 0)
-        {
-            // Printing that we are starting downltar
-            printf("[S1] Processing downltar command\n");
+#endif
 
-            // Declaring variables for parsing
-            char cmd[20], filetype[10];
-            // Parsing command into two parts (command and filetype)
-            int argc = sscanf(command, "%s %s", cmd, filetype);
+/* PRE-FORK MODE FUNCTIONS */
 
-            // Printing how many arguments we got
-            printf("[S1] Parsed %d arguments from downltar command\n", argc);
+// Set by SIGINT/SIGTERM so the pre-fork supervisor stops its workers
+volatile sig_atomic_t supervisor_stop = 0;
 
-            // Checking if the format is correct (must be exactly 2 things)
-            if (argc != 2)
-            {
-                // Telling client format is wrong
-                send(client_socket, "FORMAT_ERROR: Command: downltar filetype", 38, 0);
-                // Printing error info
-                printf("[S1] ERROR: Invalid downltar - incorrect arguments\n");
-                // Continuing to the next loop
-                continue;
-            }
+// Recording a stop request for the supervisor loop
+void request_supervisor_stop(int signal_number)
+{
+    (void)signal_number;
+    supervisor_stop = 1;
+}
+
+// Worker body - accepting and serving one client session at a time
+// shared_socket is -1 when each worker opens its own SO_REUSEPORT socket
+void run_prefork_worker(int worker_id, int shared_socket, int backlog)
+{
+    int server_socket = shared_socket;
+
+    // Opening this worker's own socket so the kernel spreads connections across workers
+    if (server_socket == -1)
+    {
+        server_socket = create_listen_socket(backlog, 1);
+        if (server_socket == -1)
+        {
+            printf("[S1] Worker %d cannot listen - exiting\n", worker_id);
+            exit(1);
+        }
+    }
 
-            // Printing which filetype we are handling
-            printf("[S1] Filetype requested: %s\n", filetype);
+    printf("[S1] Worker %d (PID %d) accepting clients\n", worker_id, getpid());
 
-            // Validating the allowed types (.c, .pdf, .txt only)
-            if (strcmp(filetype, ".c") != 0 && strcmp(filetype, ".pdf") != 0 && strcmp(filetype, ".txt") != 0)
+    while (1)
+    {
+        // Waiting for a client to connect and accepting the connection
+        int client_socket = accept(server_socket, NULL, NULL);
+        if (client_socket == -1)
+        {
+            if (errno != EINTR)
             {
-                // Checking if user asked for .zip which is not allowed here
-                if (strcmp(filetype, ".zip") == 0)
-                {
-                    // Informing client that .zip is not supported for tar
-                    send(client_socket, "ZIP file not supported for tar operations", 41, 0);
-                    // Printing error
-                    printf("[S1] ERROR: ZIP files not supported for tar operations\n");
-                }
-                else
-                {
-                    // Informing client that type is invalid
-                    send(client_socket, "INVALID_TYPE: Only .c, .pdf, .txt supported", 44, 0);
-                    // Printing error
-                    printf("[S1] ERROR: Invalid filetype: %s\n", filetype);
-                }
-                // Skipping the rest for invalid type
-                continue;
+                printf("[S1] ERROR: Worker %d failed to accept client connection\n", worker_id);
             }
+            continue;
+        }
 
-            // Declaring holders for tar file info
-            char tar_filename[256];
-            char tar_path[MAX_PATH];
-            // Setting flag for success or failure
-            int tar_success = 0;
+        // Serving the whole session in this worker; backend connections stay warm for the next client
+        prcclient(client_socket);
+    }
+}
 
-            // Handling based on the filetype
-            if (strcmp(filetype, ".c") == 0)
-            {
-                // Saying we are creating tar for C files locally
-                printf("[S1] Creating tar file for C files locally\n");
+// Starting one pre-fork worker process
+// Returns worker PID or -1 if fork failed
+pid_t start_prefork_worker(int worker_id, int shared_socket, int backlog)
+{
+    pid_t worker_pid = fork();
 
-                // Making sure our temp folder exists
-                create_full_directories("S1/temp");
+    if (worker_pid == 0)
+    {
+        // Restoring default signal handling in the worker
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
 
-                // Choosing a fixed tar name inside S1/temp
-                strcpy(tar_filename, "S1/temp/cfiles.tar");
+        run_prefork_worker(worker_id, shared_socket, backlog);
+        exit(0);
+    }
 
-                // Removing old tar if it already exists
-                if (access(tar_filename, F_OK) == 0)
-                {
-                    // Printing that we are cleaning old tar
-                    printf("[S1] Removing existing tar file: %s\n", tar_filename);
-                    // Deleting the old tar
-                    remove(tar_filename);
-                }
+    if (worker_pid == -1)
+    {
+        printf("[S1] ERROR: Failed to start worker %d\n", worker_id);
+    }
+    else
+    {
+        printf("[S1] Started worker %d with PID %d\n", worker_id, worker_pid);
+    }
 
-                // Creating the tar file at the fixed path (inside temp)
-                if (create_local_tar_c_files(tar_filename) == 0)
-                {
-                    // Saving the path to send later
-                    strcpy(tar_path, tar_filename);
-                    // Marking success
-                    tar_success = 1;
-                    // Printing confirmation
-                    printf("[S1] Successfully created C files tar: %s\n", tar_path);
-                }
-                else
-                {
-                    // Printing failure reason
-                    printf("[S1] ERROR: Failed to create C files tar\n");
-                }
-            }
-            else if (strcmp(filetype, ".pdf") == 0)
-            {
-                // Saying we are requesting tar file from S2
-                printf("[S1] Requesting PDF tar file from S2\n");
+    return worker_pid;
+}
 
-                // Connecting to S2 server
-                int s2_socket = connect_to_s2();
-                // Checking connection success
-                if (s2_socket != -1)
-                {
-                    // Declaring buffers for commands and responses
-                    char createtar_command[1024];
-                    char s2_response[1024];
+// Running a fixed pool of worker processes and restarting any that exit
+// Concurrency is bounded by worker_count; extra clients wait in the listen backlog
+void run_prefork_pool(int worker_count, int backlog)
+{
+    // Creating worker tables
+    pid_t *worker_pids = calloc(worker_count, sizeof(pid_t));
+    time_t *worker_started = calloc(worker_count, sizeof(time_t));
+    if (worker_pids == NULL || worker_started == NULL)
+    {
+        printf("[S1] ERROR: Out of memory for worker table\n");
+        exit(1);
+    }
 
-                    // Asking S2 to create its tar under ~/S2
-                    snprintf(createtar_command, sizeof(createtar_command), "CREATETAR ~/S2");
-                    // Printing what we send
-                    printf("[S1] Sending to S2: %s\n", createtar_command);
+    // Sharing one listening socket when the platform has no SO_REUSEPORT
+    int shared_socket = -1;
+#ifndef SO_REUSEPORT
+    shared_socket = create_listen_socket(backlog, 0);
+    if (shared_socket == -1)
+    {
+        exit(1);
+    }
+#endif
 
-                    // Sending the CREATETAR request
-                    if (send(s2_socket, createtar_command, strlen(createtar_command), 0) != -1)
-                    {
-                        // Receiving the response path from S2
-                        int bytes_received = recv(s2_socket, s2_response, sizeof(s2_response) - 1, 0);
-                        // Checking if we got something
-                        if (bytes_received > 0)
-                        {
-                            // Terminating the string
-                            s2_response[bytes_received] = '\0';
-                            // Printing response
-                            printf("[S1] S2 response: %s\n", s2_response);
+    // Catching stop signals without SA_RESTART so waitpid returns to check them
+    struct sigaction stop_action = {0};
+    stop_action.sa_handler = request_supervisor_stop;
+    sigemptyset(&stop_action.sa_mask);
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
 
-                            // Checking if S2 returned a path starting with S2/
-                            if (strncmp(s2_response, "S2/", 3) == 0)
-                            {
-                                // Building retrieve command with that path
-                                char retrieve_command[1024];
-                                snprintf(retrieve_command, sizeof(retrieve_command), "RETRIEVE %s", s2_response);
-                                // Printing what we will retrieve
-                                printf("[S1] Retrieving tar file: %s\n", retrieve_command);
-
-                                // Sending retrieve request
-                                if (send(s2_socket, retrieve_command, strlen(retrieve_command), 0) != -1)
-                                {
-                                    // Naming the local tar filename
-                                    strcpy(tar_filename, "pdffiles.tar");
-                                    // Receiving the tar into S1/temp
-                                    if (receive_file_from_S1(s2_socket, "pdffiles.tar", "S1/temp") == 0)
-                                    {
-                                        // Building full path to the tar in temp
-                                        snprintf(tar_path, sizeof(tar_path), "S1/temp/%s", tar_filename);
-                                        // Marking success
-                                        tar_success = 1;
-                                        // Printing success
-                                        printf("[S1] Successfully received PDF tar file from S2\n");
-                                    }
-                                    else
-                                    {
-                                        // Printing error if receive failed
-                                        printf("[S1] ERROR: Failed to receive PDF tar file from S2\n");
-                                    }
-                                }
-                                else
-                                {
-                                    // Printing error if retrieve command failed to send
-                                    printf("[S1] ERROR: Failed to send RETRIEVE command to S2\n");
-                                }
-                            }
-                            // Checking if S2 said it failed to create
-                            else if (strstr(s2_response, "TAR_ERROR") != NULL)
-                            {
-                                // Printing that S2 failed
-                                printf("[S1] ERROR: S2 failed to create PDF tar file\n");
-                            }
-                            else
-                            {
-                                // Printing unexpected response
-                                printf("[S1] ERROR: Unexpected response from S2: %s\n", s2_response);
-                            }
-                        }
-                        else
-                        {
-                            // Printing error when no response came
-                            printf("[S1] ERROR: No response from S2 for CREATETAR\n");
-                        }
-                    }
-                    else
-                    {
-                        // Printing send failure
-                        printf("[S1] ERROR: Failed to send CREATETAR command to S2\n");
-                    }
+    // Starting all workers
+    for (int i = 0; i < worker_count; i++)
+    {
+        worker_pids[i] = start_prefork_worker(i, shared_socket, backlog);
+        worker_started[i] = time(NULL);
+    }
 
-                    // Closing connection to S2
-                    close(s2_socket);
-                }
-                else
-                {
-                    // Printing that we could not connect to S2
-                    printf("[S1] ERROR: Cannot connect to S2 server\n");
-                }
+    printf("[S1] Pre-fork pool running with %d workers\n", worker_count);
+
+    // Supervising workers until asked to stop
+    while (!supervisor_stop)
+    {
+        int status;
+        pid_t exited_pid = waitpid(-1, &status, 0);
+        if (exited_pid == -1)
+        {
+            // Retrying workers that could not be forked earlier
+            if (errno == ECHILD)
+            {
+                sleep(WORKER_RESTART_DELAY);
             }
-            else if (strcmp(filetype, ".txt") == 0)
+            else if (errno != EINTR)
             {
-                // Saying we are requesting tar file from S3
-                printf("[S1] Requesting TXT tar file from S3\n");
-
-                // Connecting to S3 server
-                int s3_socket = connect_to_s3();
-                // Checking connection success
-                if (s3_socket != -1)
-                {
-                    // Declaring buffers for commands and responses
-                    char createtar_command[1024];
-                    char s3_response[1024];
-
-                    // Asking S3 to create its tar under ~/S3
-                    snprintf(createtar_command, sizeof(createtar_command), "CREATETAR ~/S3");
-                    // Printing what we send
-                    printf("[S1] Sending to S3: %s\n", createtar_command);
-
-                    // Sending the CREATETAR request
-                    if (send(s3_socket, createtar_command, strlen(createtar_command), 0) != -1)
-                    {
-                        // Receiving the response path from S3
-                        int bytes_received = recv(s3_socket, s3_response, sizeof(s3_response) - 1, 0);
-                        // Checking if we got something
-                        if (bytes_received > 0)
-                        {
-                            // Terminating the string
-                            s3_response[bytes_received] = '\0';
-                            // Printing response
-                            printf("[S1] S3 response: %s\n", s3_response);
-
-                            // Checking if S3 returned a path starting with S3/
-                            if (strncmp(s3_response, "S3/", 3) == 0)
-                            {
-                                // Building retrieve command with that path
-                                char retrieve_command[1024];
-                                snprintf(retrieve_command, sizeof(retrieve_command), "RETRIEVE %s", s3_response);
-                                // Printing what we will retrieve
-                                printf("[S1] Retrieving tar file: %s\n", retrieve_command);
-
-                                // Sending retrieve request
-                                if (send(s3_socket, retrieve_command, strlen(retrieve_command), 0) != -1)
-                                {
-                                    // Naming the local tar filename
-                                    strcpy(tar_filename, "txtfiles.tar");
-                                    // Receiving the tar into S1/temp
-                                    if (receive_file_from_S1(s3_socket, "txtfiles.tar", "S1/temp") == 0)
-                                    {
-                                        // Building full path to the tar in temp
-                                        snprintf(tar_path, sizeof(tar_path), "S1/temp/%s", tar_filename);
-                                        // Marking success
-                                        tar_success = 1;
-                                        // Printing success
-                                        printf("[S1] Successfully received TXT tar file from S3\n");
-                                    }
-                                    else
-                                    {
-                                        // Printing error if receive failed
-                                        printf("[S1] ERROR: Failed to receive TXT tar file from S3\n");
-                                    }
-                                }
-                                else
-                                {
-                                    // Printing error if retrieve command failed to send
-                                    printf("[S1] ERROR: Failed to send RETRIEVE command to S3\n");
-                                }
-                            }
-                            // Checking if S3 said it failed to create
-                            else if (strstr(s3_response, "TAR_ERROR") != NULL)
-                            {
-                                // Printing that S3 failed
-                                printf("[S1] ERROR: S3 failed to create TXT tar file\n");
-                            }
-                            else
-                            {
-                                // Printing unexpected response
-                                printf("[S1] ERROR: Unexpected response from S3: %s\n", s3_response);
-                            }
-                        }
-                        else
-                        {
-                            // Printing error when no response came
-                            printf("[S1] ERROR: No response from S3 for CREATETAR\n");
-                        }
-                    }
-                    else
-                    {
-                        // Printing send failure
-                        printf("[S1] ERROR: Failed to send CREATETAR command to S3\n");
-                    }
-
-                    // Closing connection to S3
-                    close(s3_socket);
-                }
-                else
-                {
-                    // Printing that we could not connect to S3
-                    printf("[S1] ERROR: Cannot connect to S3 server\n");
-                }
+                printf("[S1] ERROR: waitpid failed in supervisor\n");
             }
+        }
 
-            // Checking if a tar is ready to send
-            if (tar_success)
+        for (int i = 0; i < worker_count && !supervisor_stop; i++)
+        {
+            // Skipping workers that are still running
+            if (worker_pids[i] != -1 && worker_pids[i] != exited_pid)
             {
-                // Informing client that tar is ready
-                printf("[S1] Sending TAR_READY response to client\n");
-                send(client_socket, "TAR_READY", 9, 0);
-
-                // Waiting a short time so client can switch to receive mode
-                usleep(500000); // 500 ms
-
-                // Printing which tar we are sending
-                printf("[S1] Sending tar file to client: %s\n", tar_path);
-                // Sending the tar file
-                if (send_tar_file_to_client(client_socket, tar_path) == 0)
-                {
-                    // Printing success
-                    printf("[S1] Tar file sent successfully to client\n");
+                continue;
+            }
 
-                    // Trying to delete local tar after sending
-                    if (remove(tar_path) == 0)
-                    {
-                        // Printing cleanup success
-                        printf("[S1] Cleaned up tar file: %s\n", tar_path);
-                    }
-                    else
-                    {
-                        // Printing cleanup warning
-                        printf("[S1] Warning: Failed to clean up tar file: %s\n", tar_path);
-                    }
-                }
-                else
-                {
-                    // Printing error if sending failed
-                    printf("[S1] ERROR: Failed to send tar file to client\n");
-                }
+            if (exited_pid > 0 && worker_pids[i] == exited_pid)
+            {
+                printf("[S1] Worker %d (PID %d) exited with status %d - restarting\n",
+                       i, exited_pid, WIFEXITED(status) ? WEXITSTATUS(status) : -1);
             }
-            else
+
+            // Backing off when a worker dies right after starting (for example port still busy)
+            if (time(NULL) - worker_started[i] < WORKER_RESTART_DELAY)
             {
-                // Informing client that tar creation failed
-                printf("[S1] ERROR: Tar file creation failed\n");
-                send(client_socket, "TAR_ERROR: Failed to create tar file", 36, 0);
+                sleep(WORKER_RESTART_DELAY);
             }
 
-            // Printing that we finished this command
-            printf("[S1] DOWNLTAR command processing complete\n");
+            worker_pids[i] = start_prefork_worker(i, shared_socket, backlog);
+            worker_started[i] = time(NULL);
         }
+    }
 
-        /*=== UNKNOWN COMMAND HANDLING ===*/
-        else
+    // Stopping all workers
+    printf("[S1] Stopping pre-fork workers\n");
+    for (int i = 0; i < worker_count; i++)
+    {
+        if (worker_pids[i] > 0)
         {
-            // Unknown command received from client
-            printf("[S1] ERROR: Unknown command from client: %s\n", command);
-            strcpy(response, "ERROR: Unknown command");
-            send(client_socket, response, strlen(response), 0);
+            kill(worker_pids[i], SIGTERM);
         }
     }
-
-    // Closing client connection
-    close(client_socket);
-    printf("[S1] Client connection closed\n");
-}
-
-/*=== MAIN FUNCTION ===*/
-
-// Main function - this is where S1 server starts
-int main()
-{
-    // Printing startup banner
-    printf("S1 - This is server 1 -S1\n");
-    printf("Starting on port %d\n", S1_PORT);
-
-    // Initializing all server directories
-    printf("[S1] Initializing server directories\n");
-    initialize_server_directories();
-
-    // Creating a socket for S1 to listen for client connections
-    printf("[S1] Creating server socket\n");
-    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket == -1)
+    while (waitpid(-1, NULL, 0) > 0)
     {
-        printf("[S1] ERROR: Failed to create server socket\n");
-        // Exiting with error code
-        exit(1);
     }
 
-    // Setting socket option to reuse address
-    printf("[S1] Setting socket options\n");
-    int opt = 1;
-    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
-    {
-        printf("[S1] WARNING: Failed to set socket options\n");
-    }
+    free(worker_pids);
+    free(worker_started);
+    printf("[S1] Server shutting down\n");
+    exit(0);
+}
 
-    // Creating address structure for S1 server
-    printf("[S1] Configuring server address\n");
-    struct sockaddr_in server_addr = {0};
-    // Setting the protocol family to IPv4
-    server_addr.sin_family = AF_INET;
-    // Setting to accept connections from any IP address
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    // Converting port number to network format and assigning
-    server_addr.sin_port = htons(S1_PORT);
+/* PROCESS MODE FUNCTIONS */
 
-    // Binding the socket to the address
-    printf("[S1] Binding socket to address\n");
-    if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1)
-    {
-        printf("[S1] ERROR: Failed to bind socket to address\n");
-        printf("[S1] Make sure port %d is not already in use\n", S1_PORT);
-        // Closing socket before exit
-        close(server_socket);
-        exit(1);
-    }
+// Reaping finished child processes so they do not stay as zombies
+void reap_children(int signal_number)
+{
+    (void)signal_number;
 
-    // Starting to listen for client connections
-    // The parameter 5 means we can have up to 5 pending connections in queue
-    printf("[S1] Starting to listen for connections\n");
-    if (listen(server_socket, 5) == -1)
+    // Keeping errno intact for the code this handler interrupted
+    int saved_errno = errno;
+    while (waitpid(-1, NULL, WNOHANG) > 0)
     {
-        printf("[S1] ERROR: Failed to listen on socket\n");
-        // Closing socket before exit
-        close(server_socket);
-        exit(1);
     }
+    errno = saved_errno;
+}
 
-    printf("\n[S1] Server is ready and waiting for clients\n");
-    printf("[S1] Listening on port %d\n", S1_PORT);
-    printf("[S1] Press Ctrl+C to stop server\n\n");
+// Serving each client in its own forked child process
+void run_fork_loop(int server_socket)
+{
+    // Installing SIGCHLD handler so finished children are reaped
+    struct sigaction child_action = {0};
+    child_action.sa_handler = reap_children;
+    sigemptyset(&child_action.sa_mask);
+    child_action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &child_action, NULL);
 
     // Main server loop - keep accepting client connections forever
     while (1)
@@ -3025,6 +7613,8 @@ int main()
 
             // Processing client requests in child process
             prcclient(client_socket);
+            // Closing backend connections kept for this client
+            close_backend_pool();
 
             printf("[S1] Child process ending\n");
             // Child process exits when client handling is complete
@@ -3050,6 +7640,154 @@ int main()
             close(client_socket);
         }
     }
+}
+
+/*=== MAIN FUNCTION ===*/
+
+// Printing command line options
+void print_usage(const char *program)
+{
+    printf("Usage: %s [--mode fork|event|prefork] [--workers N] [--backlog N] [--listing-ttl SECONDS]\n", program);
+    printf("  --mode fork     one child process per client (default)\n");
+    printf("  --mode event    epoll reactor with a pool of worker threads\n");
+    printf("  --mode prefork  fixed pool of worker processes supervised by the parent\n");
+    printf("  --workers N     worker threads (event, default 2 per core) or processes (prefork, default 1 per core)\n");
+    printf("  --backlog N     pending connection queue length (default %d)\n", DEFAULT_BACKLOG);
+    printf("  --listing-ttl SECONDS  how long dispfnames trusts an indexed listing before asking the servers\n");
+    printf("                         again (default %d, 0 always asks)\n", NAMESPACE_VERIFY_SECONDS);
+}
+
+// Main function - this is where S1 server starts
+int main(int argc, char *argv[])
+{
+    // Selecting how clients are served
+    int server_mode = MODE_FORK;
+    // Worker count, 0 means sized from the core count
+    int worker_count = 0;
+    // Listen queue length
+    int backlog = DEFAULT_BACKLOG;
+
+    // Parsing command line options
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "fork") == 0)
+            {
+                server_mode = MODE_FORK;
+            }
+            else if (strcmp(argv[i], "event") == 0)
+            {
+                server_mode = MODE_EVENT;
+            }
+            else if (strcmp(argv[i], "prefork") == 0)
+            {
+                server_mode = MODE_PREFORK;
+            }
+            else
+            {
+                print_usage(argv[0]);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+        {
+            worker_count = atoi(argv[++i]);
+            if (worker_count < 1)
+            {
+                print_usage(argv[0]);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--backlog") == 0 && i + 1 < argc)
+        {
+            backlog = atoi(argv[++i]);
+            if (backlog < 1)
+            {
+                print_usage(argv[0]);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--listing-ttl") == 0 && i + 1 < argc)
+        {
+            char *end;
+            namespace_listing_ttl = strtol(argv[++i], &end, 10);
+            if (end == argv[i] || *end != '\0' || namespace_listing_ttl < 0)
+            {
+                print_usage(argv[0]);
+                exit(1);
+            }
+        }
+        else
+        {
+            print_usage(argv[0]);
+            exit(1);
+        }
+    }
+
+#ifndef __linux__
+    if (server_mode == MODE_EVENT)
+    {
+        printf("[S1] ERROR: Event mode needs epoll and is only available on Linux\n");
+        exit(1);
+    }
+#endif
+
+    // Sizing workers from the core count when not given
+    if (worker_count == 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cores < 1)
+        {
+            cores = 2;
+        }
+        worker_count = server_mode == MODE_EVENT ? (int)cores * 2 : (int)cores;
+    }
+
+    // Printing startup banner
+    printf("S1 - This is server 1 -S1\n");
+    printf("Starting on port %d\n", S1_PORT);
+    printf("Serving clients in %s mode\n",
+           server_mode == MODE_EVENT ? "event" : (server_mode == MODE_PREFORK ? "prefork" : "fork"));
+
+    // Ignoring SIGPIPE so a vanished client only fails the send on its own connection
+    signal(SIGPIPE, SIG_IGN);
+
+    // Initializing all server directories
+    printf("[S1] Initializing server directories\n");
+    initialize_server_directories();
+
+    // Loading the namespace index before any worker starts, so all of them share it
+    namespace_open();
+
+    // Handing the port to supervised worker processes
+    if (server_mode == MODE_PREFORK)
+    {
+        printf("[S1] Press Ctrl+C to stop server\n\n");
+        run_prefork_pool(worker_count, backlog);
+    }
+
+    // Creating the socket S1 listens on
+    int server_socket = create_listen_socket(backlog, 0);
+    if (server_socket == -1)
+    {
+        // Exiting with error code
+        exit(1);
+    }
+
+    printf("\n[S1] Server is ready and waiting for clients\n");
+    printf("[S1] Listening on port %d\n", S1_PORT);
+    printf("[S1] Press Ctrl+C to stop server\n\n");
+
+    // Serving clients in the selected mode
+#ifdef __linux__
+    if (server_mode == MODE_EVENT)
+    {
+        run_event_loop(server_socket, worker_count);
+    }
+#endif
+    run_fork_loop(server_socket);
 
     // This code never executes because of the infinite loop above
     // But included for completeness
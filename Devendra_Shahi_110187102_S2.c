@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -6,13 +7,108 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <dirent.h>
+#include <fnmatch.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/xattr.h>
+#include <openssl/evp.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 // Port number for S2 PDF server
 #define PORT 4302
 #define MAX_PATH 1024
 #define BUFFER_SIZE 4096
 
+// Pending S1 connections the kernel may queue while all threads are busy
+#define LISTEN_BACKLOG 128
+
+// Defining bulk transfer sizes (zero-copy chunk and copy fallback buffer)
+#define TRANSMIT_CHUNK_SIZE 1048576
+#define TRANSMIT_BUFFER_SIZE 65536
+
+// Framed protocol version and header size (version, type, status, 64-bit length)
+#define FRAME_VERSION 1
+#define FRAME_HEADER_SIZE 12
+
+// Frame types
+#define FRAME_COMMAND 1
+#define FRAME_RESPONSE 2
+#define FRAME_FILE 3
+#define FRAME_NAME 4
+#define FRAME_LIST 5
+#define FRAME_DATA 6
+#define FRAME_END 7
+// Content offered ahead of a STORE body: payload is "<size> <sha256 hex>", followed by
+// " DELTA" when the client can send the file as a delta against the copy it replaces
+#define FRAME_DIGEST 9
+// Delta body: payload is the new size in decimal, followed by DATA frames (literal bytes or a
+// run of chunks copied from the file being replaced) and an END frame
+#define FRAME_DELTA 10
+
+// Instruction carried in the status field of each DATA frame of a delta body
+#define DELTA_LITERAL 0
+#define DELTA_COPY 1
+
+// Tar archive block size, largest size the ustar octal field holds, and the
+// size up to which file bodies are copied into the frame buffer instead of sent with sendfile
+#define TAR_BLOCK_SIZE 512
+#define TAR_MAX_OCTAL_SIZE 077777777777ULL
+#define TAR_INLINE_LIMIT 32768
+
+// Storage root whose archive is cached between CREATETAR requests, the cache file kept
+// beside it and its rebuild scratch file, and how many changed names are remembered
+// before the next request rebuilds the whole cache instead of patching it
+#define TAR_CACHE_ROOT "S2"
+#define TAR_CACHE_FILE ".S2.tarcache"
+#define TAR_CACHE_TEMP_FILE ".S2.tarcache.tmp"
+#define TAR_CACHE_MAX_DIRTY 256
+
+// Log of deleted files ("time name" per line) read by CREATETAR ... SINCE
+#define TOMBSTONE_FILE ".S2.tombstones"
+
+// Content-addressed store of file bodies, named by the SHA-256 of their content
+// Kept outside the storage root so listings and archives never see it
+#define BLOB_STORE_DIR ".S2.blobs"
+// Extended attribute recording on every stored copy which blob it is
+#define BLOB_XATTR "user.dfs.sha256"
+#define BLOB_HASH_SIZE 32
+
+// Delta uploads: new content from DELTA_MIN_SIZE bytes is matched against the stored copy in
+// content-defined chunks of CDC_MIN_SIZE to CDC_MAX_SIZE bytes, cut where the top
+// CDC_BOUNDARY_BITS of a rolling hash are clear (about every 8 KB); the gear table behind
+// the hash is derived from CDC_GEAR_SEED, which client and servers must share
+#define DELTA_MIN_SIZE 65536
+#define CDC_MIN_SIZE 2048
+#define CDC_MAX_SIZE 65536
+#define CDC_BOUNDARY_BITS 13
+#define CDC_GEAR_SEED 0x6466732d63646331ULL
+
+// Listings streamed to S1: names go out in LIST frames of at most LIST_CHUNK_SIZE bytes, in
+// name order. Pages of up to LIST_BATCH names are picked in one directory pass; longer listings
+// sort up to LIST_RUN_SIZE bytes (LIST_RUN_NAMES names) at a time and merge the sorted runs,
+// reading each back LIST_MERGE_BUFFER bytes at a time
+#define LIST_CHUNK_SIZE 8192
+#define LIST_BATCH 1024
+#define LIST_RUN_SIZE 262144
+#define LIST_RUN_NAMES 16384
+#define LIST_MERGE_BUFFER 4096
+
+// Frame status codes
+#define STATUS_OK 0
+#define STATUS_PARTIAL 1
+#define STATUS_ERROR 2
+#define STATUS_NOT_FOUND 3
+#define STATUS_BAD_REQUEST 4
+#define STATUS_UNSUPPORTED 5
+
+// Set by --dedup: each distinct content is stored once and every path holding it is a hard link
+int store_deduplicated = 0;
+
 /*=== DIRECTORY MANAGEMENT FUNCTIONS ===*/
 
 // Creating full directory path recursively
@@ -24,6 +120,8 @@ int create_full_directories(char *full_path)
     char *token;
     // Creating copy of original path
     char path_copy[MAX_PATH];
+    // Keeping tokenizer state local so concurrent connections do not share it
+    char *save_ptr;
 
     printf("[S2] Creating directory structure: %s\n", full_path);
 
@@ -33,7 +131,7 @@ int create_full_directories(char *full_path)
     strcpy(temp_path, "");
 
     // Splitting path by forward slash
-    token = strtok(path_copy, "/");
+    token = strtok_r(path_copy, "/", &save_ptr);
 
     // Processing each path component
     while (token != NULL)
@@ -69,107 +167,174 @@ int create_full_directories(char *full_path)
         }
 
         // Getting next path component
-        token = strtok(NULL, "/");
+        token = strtok_r(NULL, "/", &save_ptr);
     }
 
     printf("[S2] All directories created successfully\n");
     return 0;
 }
 
-/*=== TAR FILE FUNCTIONS ===*/
+/*=== BLOB STORE FUNCTIONS ===*/
 
-// Creating tar file for specific file type
-int create_tar_file(const char *root_directory, const char *file_extension, const char *tar_filename)
+// Formatting a SHA-256 digest as the 64 hex digits that name its blob
+void blob_hash_hex(const unsigned char *digest, char *hex)
 {
-    // Creating command buffer for system call
-    char command[2048];
+    for (int i = 0; i < BLOB_HASH_SIZE; i++)
+    {
+        sprintf(hex + 2 * i, "%02x", digest[i]);
+    }
+}
 
-    printf("[S2] Creating tar file %s for %s files in %s\n", tar_filename, file_extension, root_directory);
+// Building the path of the blob holding the content with a hex hash (.S2.blobs/ab/abcd...)
+// Blobs are spread over 256 directories by their first two digits so no directory gets huge
+void blob_path(const char *hex, char *path, int max_size)
+{
+    snprintf(path, max_size, "%s/%.2s/%s", BLOB_STORE_DIR, hex, hex);
+}
 
-    // Building tar command using find to include all files in subdirectories
-    snprintf(command, sizeof(command),
-             "cd %s && find . -name '*%s' -type f | tar -cf %s -T -",
-             root_directory, file_extension, tar_filename);
+// Opening a temporary file inside the blob store for a body that is being received
+// It has to live on the same filesystem as the blobs so it can be linked into place
+// Returns the file opened for writing with its name in temp_path, or NULL
+FILE *blob_open_temp(char *temp_path, int max_size)
+{
+    if (mkdir(BLOB_STORE_DIR, 0755) == -1 && errno != EEXIST)
+    {
+        return NULL;
+    }
+    snprintf(temp_path, max_size, "%s/incoming.XXXXXX", BLOB_STORE_DIR);
+    int temp_fd = mkstemp(temp_path);
+    if (temp_fd == -1)
+    {
+        return NULL;
+    }
 
-    printf("[S2] Executing command: %s\n", command);
+    // Giving the body the permissions a plain upload would get
+    fchmod(temp_fd, 0644);
+    FILE *file = fdopen(temp_fd, "wb");
+    if (file == NULL)
+    {
+        close(temp_fd);
+        unlink(temp_path);
+    }
+    return file;
+}
 
-    // Executing the tar command
-    int result = system(command);
-    if (result == 0)
+// Dropping full_path's reference to its blob before the path is removed or replaced
+// Every stored path is a hard link to its blob, so the link count is the reference count:
+// when it is 2 only this path and the blob itself are left, and the blob goes too
+void blob_release(const char *full_path)
+{
+    struct stat st;
+    if (lstat(full_path, &st) == -1 || !S_ISREG(st.st_mode) || st.st_nlink != 2)
     {
-        printf("[S2] TAR file created successfully: %s\n", tar_filename);
-        return 0;
+        return;
     }
-    else
+
+    // Finding blob through the hash recorded on the shared inode
+    char hex[2 * BLOB_HASH_SIZE + 1];
+    if (getxattr(full_path, BLOB_XATTR, hex, 2 * BLOB_HASH_SIZE) != 2 * BLOB_HASH_SIZE)
     {
-        printf("[S2] ERROR: Failed to create TAR file\n");
-        return -1;
+        return;
     }
-}
+    hex[2 * BLOB_HASH_SIZE] = '\0';
+    char blob[MAX_PATH];
+    blob_path(hex, blob, sizeof(blob));
 
-/*=== FILE LISTING FUNCTIONS ===*/
+    // Removing it only when it really is the same file
+    struct stat blob_st;
+    if (stat(blob, &blob_st) == 0 && blob_st.st_dev == st.st_dev && blob_st.st_ino == st.st_ino)
+    {
+        unlink(blob);
+        printf("[S2] Released last reference to blob %.12s\n", hex);
+    }
+}
 
-// Sending file list to S1 server
-int send_filelist_to_S1(int s1_socket, const char *directory_path, const char *file_extension)
+// Making sure full_path can be written in place without changing other paths that share its blob
+void blob_detach(const char *full_path)
 {
-    // Creating directory pointer
-    DIR *dir;
-    // Creating directory entry structure
-    struct dirent *entry;
-    // Creating buffer to collect all file names
-    char file_list[4096] = "";
-    // Creating temporary buffer for each file name
-    char temp_name[256];
+    struct stat st;
+    if (lstat(full_path, &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink > 1)
+    {
+        blob_release(full_path);
+        unlink(full_path);
+    }
+}
 
-    printf("[S2] Collecting file list from: %s\n", directory_path);
+// Pointing full_path at an existing blob, replacing whatever the path held before
+// Returns 0, or -1 when the link could not be made (full_path is then left as it was)
+int blob_link_path(const char *blob, const char *full_path)
+{
+    // Nothing to do when the path already holds this blob
+    struct stat st, blob_st;
+    if (stat(blob, &blob_st) == -1)
+    {
+        return -1;
+    }
+    if (lstat(full_path, &st) == 0 && st.st_dev == blob_st.st_dev && st.st_ino == blob_st.st_ino)
+    {
+        return 0;
+    }
 
-    // Opening directory
-    dir = opendir(directory_path);
-    if (dir == NULL)
+    // Linking under a temporary name next to the path, then renaming it over the path
+    // so readers see either the old file or the new one
+    char link_path[MAX_PATH];
+    snprintf(link_path, sizeof(link_path), "%s.blob-link", full_path);
+    unlink(link_path);
+    if (link(blob, link_path) == -1)
     {
-        printf("[S2] Cannot open directory: %s\n", directory_path);
-        // Sending "No files" message to S1
-        send(s1_socket, "No files", 8, 0);
+        return -1;
+    }
+    blob_release(full_path);
+    if (rename(link_path, full_path) == -1)
+    {
+        unlink(link_path);
         return -1;
     }
 
-    // Reading directory entries and collecting filenames
-    while ((entry = readdir(dir)) != NULL)
+    // Marking the content as changed now, so downltar --since picks up the new path
+    // (other paths sharing the blob show up as changed too, which is harmless)
+    utimensat(AT_FDCWD, full_path, NULL, 0);
+    return 0;
+}
+
+// Moving a fully received body from its temporary file to full_path through the blob store
+// Content seen before is linked to the existing blob and the new copy dropped;
+// new content becomes a blob first. Without extended attributes on the filesystem the
+// body is stored as a plain file, since its blob could never be released again
+// Returns 0, or -1 when the file could not be stored (temporary file removed)
+int blob_commit(const char *temp_path, const unsigned char *digest, const char *full_path)
+{
+    char hex[2 * BLOB_HASH_SIZE + 1];
+    blob_hash_hex(digest, hex);
+    char blob[MAX_PATH];
+    snprintf(blob, sizeof(blob), "%s/%.2s", BLOB_STORE_DIR, hex);
+    int have_directory = mkdir(blob, 0755) == 0 || errno == EEXIST;
+    blob_path(hex, blob, sizeof(blob));
+
+    // Turning body into the blob, unless the same content is already stored
+    int duplicate = 0;
+    if (have_directory && setxattr(temp_path, BLOB_XATTR, hex, 2 * BLOB_HASH_SIZE, 0) == 0)
     {
-        // Skipping current and parent directory entries
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        if (link(temp_path, blob) == -1 && errno == EEXIST)
         {
-            continue;
+            duplicate = 1;
         }
-
-        // Filtering by extension if specified
-        if (file_extension != NULL && strstr(entry->d_name, file_extension) == NULL)
+        if (blob_link_path(blob, full_path) == 0)
         {
-            continue;
+            unlink(temp_path);
+            printf("[S2] %s content %.12s for %s\n", duplicate ? "Deduplicated" : "Stored new", hex, full_path);
+            return 0;
         }
-
-        // Formatting filename with newline
-        snprintf(temp_name, sizeof(temp_name), "%s\n", entry->d_name);
-        // Adding filename to list
-        strcat(file_list, temp_name);
     }
 
-    // Closing directory
-    closedir(dir);
-
-    // Sending file list to S1
-    if (strlen(file_list) == 0)
+    // Keeping the body as a file of its own
+    printf("[S2] WARNING: Storing %s without deduplication\n", full_path);
+    blob_release(full_path);
+    if (rename(temp_path, full_path) == -1)
     {
-        // Sending "No files" if list is empty
-        send(s1_socket, "No files", 8, 0);
-    }
-    else
-    {
-        // Sending the complete file list
-        send(s1_socket, file_list, strlen(file_list), 0);
-        printf("[S2] File list sent to S1\n");
+        unlink(temp_path);
+        return -1;
     }
-
     return 0;
 }
 
@@ -190,6 +355,9 @@ int delete_file(const char *full_path)
     // Closing file handle
     fclose(file);
 
+    // Dropping the blob too when this was its last path
+    blob_release(full_path);
+
     // Removing the file
     if (remove(full_path) == 0)
     {
@@ -203,426 +371,2901 @@ int delete_file(const char *full_path)
     }
 }
 
-/*=== FILE TRANSFER FUNCTIONS ===*/
+/*=== ZERO-COPY TRANSMIT FUNCTIONS ===*/
 
-// Sending file to S1 server
-int send_file_to_S1(int s1_socket, const char *full_path)
+// Sending exactly length bytes over socket
+int send_all(int socket, const void *buffer, long length)
 {
-    // Creating buffer for reading file data chunks
-    char buffer[BUFFER_SIZE];
-    // Creating file pointer for reading
-    FILE *file;
-    // Storing file size
-    long file_size;
-    // Tracking total bytes sent
+    // Tracking total bytes sent so far
     long total_sent = 0;
 
-    printf("[S2] Preparing to send file: %s\n", full_path);
-
-    // Opening file for reading in binary mode
-    file = fopen(full_path, "rb");
-    if (file == NULL)
+    // Looping until the whole block has been written
+    while (total_sent < length)
     {
-        printf("[S2] ERROR: File not found: %s\n", full_path);
-        return -1;
+        // Sending next piece of the block
+        int bytes_sent = send(socket, (const char *)buffer + total_sent, length - total_sent, 0);
+        // Checking if send failed
+        if (bytes_sent <= 0)
+        {
+            return -1;
+        }
+
+        // Updating total sent
+        total_sent += bytes_sent;
     }
 
-    // Moving to end of file to get size
-    fseek(file, 0, SEEK_END);
-    // Getting current position (file size)
-    file_size = ftell(file);
-    // Moving back to beginning
-    fseek(file, 0, SEEK_SET);
+    return 0;
+}
 
-    printf("[S2] File size: %ld bytes\n", file_size);
+// Sending file_size bytes of an open file over a socket
+// Uses sendfile() so data moves from the page cache to the socket without a
+// user-space copy, falling back to a large-buffer loop where it is unavailable
+int transmit_file_data(int socket, int file_fd, long file_size)
+{
+    // Tracking total bytes sent
+    long total_sent = 0;
 
-    // Sending file size to S1 first
-    if (send(s1_socket, &file_size, sizeof(file_size), 0) == -1)
+#ifdef __linux__
+    // Tracking read position inside the file
+    off_t offset = 0;
+    while (total_sent < file_size)
     {
-        printf("[S2] ERROR: Failed to send file size to S1\n");
-        fclose(file);
-        return -1;
+        // Calculating how much to hand to the kernel this round
+        long remaining = file_size - total_sent;
+        size_t to_send = (remaining > TRANSMIT_CHUNK_SIZE) ? TRANSMIT_CHUNK_SIZE : remaining;
+
+        // Sending chunk directly from file to socket
+        ssize_t bytes_sent = sendfile(socket, file_fd, &offset, to_send);
+        if (bytes_sent == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_sent == -1 && total_sent == 0 && (errno == EINVAL || errno == ENOSYS))
+        {
+            // Kernel cannot sendfile this descriptor pair - using copy loop instead
+            printf("[S2] sendfile not available, using buffered transmit\n");
+            break;
+        }
+        if (bytes_sent <= 0)
+        {
+            printf("[S2] ERROR: Failed to send file data to S1\n");
+            return -1;
+        }
+
+        // Updating total bytes sent
+        total_sent += bytes_sent;
+    }
+    if (total_sent == file_size)
+    {
+        return 0;
     }
-    printf("[S2] File size sent to S1\n");
+#endif
 
-    printf("[S2] Starting file transfer\n");
-    // Sending file data in chunks
+    // Creating large buffer for the copy fallback
+    char buffer[TRANSMIT_BUFFER_SIZE];
+
+    // Continuing from where zero-copy stopped
+    lseek(file_fd, total_sent, SEEK_SET);
     while (total_sent < file_size)
     {
+        // Calculating bytes remaining
+        long remaining = file_size - total_sent;
+        size_t to_read = (remaining > TRANSMIT_BUFFER_SIZE) ? TRANSMIT_BUFFER_SIZE : remaining;
+
         // Reading data chunk from file
-        int bytes_read = fread(buffer, 1, BUFFER_SIZE, file);
+        ssize_t bytes_read = read(file_fd, buffer, to_read);
         if (bytes_read <= 0)
         {
             printf("[S2] ERROR: Failed to read from file\n");
-            fclose(file);
             return -1;
         }
 
         // Sending chunk to S1
-        int bytes_sent = send(s1_socket, buffer, bytes_read, 0);
-        if (bytes_sent <= 0)
+        if (send_all(socket, buffer, bytes_read) == -1)
         {
             printf("[S2] ERROR: Failed to send file data to S1\n");
-            fclose(file);
             return -1;
         }
 
         // Updating total bytes sent
-        total_sent += bytes_sent;
+        total_sent += bytes_read;
     }
 
-    // Closing file
-    fclose(file);
-    printf("[S2] File sent successfully\n");
     return 0;
 }
 
-// Receiving file from S1 server
-int receive_file_from_S1(int s1_socket, const char *filename, const char *filepath)
+/*=== FRAMING PROTOCOL FUNCTIONS ===*/
+
+// Every message travels as one frame: version (1 byte), type (1 byte), status (2 bytes)
+// and payload length (8 bytes) in network byte order, followed by exactly length payload bytes
+
+// Receiving exactly length bytes from socket
+int recv_all(int socket, void *buffer, long length)
 {
-    // Creating complete path including filename
-    char full_path[MAX_PATH];
-    // Creating buffer for reading file data chunks
-    char buffer[BUFFER_SIZE];
-    // Creating file pointer for writing
-    FILE *file;
-    // Storing incoming file size
-    long file_size;
-    // Tracking total bytes received
+    // Tracking total bytes received so far
     long total_received = 0;
 
-    printf("[S2] Preparing to receive file: %s\n", filename);
+    // Looping until the whole block has arrived
+    while (total_received < length)
+    {
+        // Receiving next piece of the block
+        int bytes_received = recv(socket, (char *)buffer + total_received, length - total_received, 0);
+        // Checking if peer closed or failed
+        if (bytes_received <= 0)
+        {
+            return -1;
+        }
+
+        // Updating total received
+        total_received += bytes_received;
+    }
+
+    return 0;
+}
+
+// Sending a frame header announcing length payload bytes
+int send_frame_header(int socket, int type, int status, long length)
+{
+    // Packing header fields in network byte order
+    unsigned char header[FRAME_HEADER_SIZE];
+    header[0] = FRAME_VERSION;
+    header[1] = type;
+    header[2] = (status >> 8) & 0xFF;
+    header[3] = status & 0xFF;
+    for (int i = 0; i < 8; i++)
+    {
+        header[4 + i] = ((unsigned long long)length >> (56 - 8 * i)) & 0xFF;
+    }
+
+    return send_all(socket, header, FRAME_HEADER_SIZE);
+}
 
-    // Receiving file size from S1
-    if (recv(s1_socket, &file_size, sizeof(file_size), 0) <= 0)
+// Sending a whole frame whose payload is in memory
+int send_frame(int socket, int type, int status, const void *payload, long length)
+{
+    if (send_frame_header(socket, type, status, length) == -1)
     {
-        printf("[S2] ERROR: Failed to receive file size\n");
         return -1;
     }
-    printf("[S2] File size: %ld bytes\n", file_size);
+    return send_all(socket, payload, length);
+}
 
-    // Creating mutable copy of filepath for directory creation
-    char filepath_copy[MAX_PATH];
-    strcpy(filepath_copy, filepath);
+// Sending a text message as one frame (terminator is not sent)
+int send_text_frame(int socket, int type, int status, const char *text)
+{
+    return send_frame(socket, type, status, text, strlen(text));
+}
 
-    // Creating the directory structure if it doesn't exist
-    if (create_full_directories(filepath_copy) == -1)
+// Receiving a frame header, rejecting other protocol versions
+int recv_frame_header(int socket, int *type, int *status, long *length)
+{
+    // Reading the fixed-size header
+    unsigned char header[FRAME_HEADER_SIZE];
+    if (recv_all(socket, header, FRAME_HEADER_SIZE) == -1)
     {
-        printf("[S2] ERROR: Failed to create directory structure\n");
         return -1;
     }
 
-    // Building complete path for file storage
-    snprintf(full_path, sizeof(full_path), "%s/%s", filepath, filename);
-    printf("[S2] Saving file to: %s\n", full_path);
+    // Checking protocol version
+    if (header[0] != FRAME_VERSION)
+    {
+        printf("[S2] ERROR: Unsupported frame version %d\n", header[0]);
+        return -1;
+    }
 
-    // Opening file for writing in binary mode
-    file = fopen(full_path, "wb");
-    if (file == NULL)
+    // Unpacking fields from network byte order
+    unsigned long long value = 0;
+    for (int i = 0; i < 8; i++)
     {
-        printf("[S2] ERROR: Failed to create file %s\n", full_path);
+        value = (value << 8) | header[4 + i];
+    }
+    *type = header[1];
+    *status = (header[2] << 8) | header[3];
+    *length = (long)value;
+
+    // Rejecting lengths that cannot be real
+    if (*length < 0)
+    {
+        printf("[S2] ERROR: Invalid frame length\n");
         return -1;
     }
 
-    printf("[S2] Starting file transfer\n");
-    // Receiving file data in chunks
-    while (total_received < file_size)
+    return 0;
+}
+
+// Dropping payload bytes nobody wants so the next frame lines up
+int skip_frame_payload(int socket, long length)
+{
+    // Creating buffer for unwanted data
+    char buffer[BUFFER_SIZE];
+
+    while (length > 0)
     {
-        // Receiving data chunk from S1
-        int bytes_received = recv(s1_socket, buffer, BUFFER_SIZE, 0);
+        // Receiving and dropping next chunk
+        int to_receive = (length > BUFFER_SIZE) ? BUFFER_SIZE : length;
+        int bytes_received = recv(socket, buffer, to_receive, 0);
         if (bytes_received <= 0)
         {
-            printf("[S2] ERROR: Failed to receive file data\n");
-            fclose(file);
-            return -1;
-        }
-
-        // Writing received data to file
-        int bytes_written = fwrite(buffer, 1, bytes_received, file);
-        if (bytes_written != bytes_received)
-        {
-            printf("[S2] ERROR: Failed to write data to file\n");
-            fclose(file);
             return -1;
         }
-
-        // Updating total received
-        total_received += bytes_received;
+        length -= bytes_received;
     }
 
-    // Closing file
-    fclose(file);
-    printf("[S2] File received successfully: %s\n", full_path);
     return 0;
 }
 
-/*=== MAIN FUNCTION ===*/
-
-// Main function - S2 PDF server entry point
-int main()
+// Receiving a frame payload as text into buffer, dropping whatever does not fit
+// Returns number of bytes stored, or -1 if the stream broke
+int recv_frame_payload(int socket, long length, char *buffer, int max_size)
 {
-    // Printing startup message
-    printf("S2 - PDF File Server\n");
-    printf("Starting on port %d\n", PORT);
-
-    // Creating socket for S2 server
-    printf("[S2] Creating server socket\n");
-    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket == -1)
+    // Keeping as much as the buffer holds
+    long kept = (length < max_size - 1) ? length : max_size - 1;
+    if (recv_all(socket, buffer, kept) == -1)
     {
-        printf("[S2] ERROR: Failed to create socket\n");
-        exit(1);
+        return -1;
     }
+    buffer[kept] = '\0';
 
-    // Setting socket option to reuse address
-    printf("[S2] Setting socket options\n");
-    int opt = 1;
-    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
+    // Skipping the rest
+    if (skip_frame_payload(socket, length - kept) == -1)
     {
-        printf("[S2] WARNING: Failed to set socket options\n");
+        return -1;
     }
 
-    // Creating address structure for S2
-    printf("[S2] Configuring server address\n");
-    struct sockaddr_in addr = {0};
-    // Setting protocol family to IPv4
-    addr.sin_family = AF_INET;
-    // Setting to accept connections from any IP address
-    addr.sin_addr.s_addr = INADDR_ANY;
-    // Converting port number to network format
-    addr.sin_port = htons(PORT);
+    return kept;
+}
 
-    // Binding socket to address
-    printf("[S2] Binding socket to address\n");
-    if (bind(server_socket, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+// Receiving a whole text frame of the expected type
+// Returns number of bytes stored, or -1 if the stream broke or another frame type arrived
+int recv_text_frame(int socket, int expected_type, int *status, char *buffer, int max_size)
+{
+    // Storing header fields
+    int type;
+    long length;
+
+    if (recv_frame_header(socket, &type, status, &length) == -1)
     {
-        printf("[S2] ERROR: Failed to bind socket\n");
-        close(server_socket);
-        exit(1);
+        return -1;
     }
 
-    // Starting to listen for S1 connections
-    printf("[S2] Starting to listen for connections\n");
-    if (listen(server_socket, 1) == -1)
+    int kept = recv_frame_payload(socket, length, buffer, max_size);
+    if (kept == -1)
     {
-        printf("[S2] ERROR: Failed to listen on socket\n");
-        close(server_socket);
-        exit(1);
+        return -1;
     }
 
-    printf("\n[S2] Server is ready and waiting for S1 connections\n");
-    printf("[S2] Listening on port %d\n", PORT);
-
-    // Main server loop - keep accepting S1 connections
+    // Checking that the peer sent what we expected
+    if (type != expected_type)
+    {
+        printf("[S2] ERROR: Expected frame type %d, got %d\n", expected_type, type);
+        return -1;
+    }
+
+    return kept;
+}
+
+// Receiving and dropping one whole frame
+int skip_frame(int socket)
+{
+    // Storing header fields
+    int type, status;
+    long length;
+
+    if (recv_frame_header(socket, &type, &status, &length) == -1)
+    {
+        return -1;
+    }
+    return skip_frame_payload(socket, length);
+}
+
+/*=== TOMBSTONE FUNCTIONS ===*/
+
+// Mapping an on-disk path under root (root/dir/file) to its name inside archives (dir/file)
+// Returns NULL for paths the directory walk would spell differently
+const char *tar_member_name(const char *root, const char *path)
+{
+    int root_length = strlen(root);
+    if (strncmp(path, root, root_length) != 0 || path[root_length] != '/')
+    {
+        return NULL;
+    }
+
+    const char *name = path + root_length + 1;
+    if (name[0] == '\0' || name[0] == '/' || strstr(name, "//") != NULL ||
+        strncmp(name, "./", 2) == 0 || strncmp(name, "../", 3) == 0 ||
+        strstr(name, "/./") != NULL || strstr(name, "/../") != NULL)
+    {
+        return NULL;
+    }
+    return name;
+}
+
+// Appending a deleted file to the tombstone log so downltar --since can report the deletion
+void record_tombstone(const char *root, const char *path)
+{
+    const char *name = tar_member_name(root, path);
+    if (name == NULL)
+    {
+        printf("[S2] WARNING: Not recording deletion of %s\n", path);
+        return;
+    }
+
+    // Writing the whole line at once so concurrent deletions never interleave
+    char line[MAX_PATH + 32];
+    int length = snprintf(line, sizeof(line), "%ld %s\n", (long)time(NULL), name);
+    int log_fd = open(TOMBSTONE_FILE, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (log_fd == -1 || write(log_fd, line, length) != length)
+    {
+        printf("[S2] WARNING: Failed to record deletion of %s\n", name);
+    }
+    if (log_fd != -1)
+    {
+        close(log_fd);
+    }
+}
+
+// Collecting names deleted at or after since that have not been stored again
+// Only names ending in file_extension are kept, each once
+// Returns a malloc'd newline separated list (empty when there is nothing), or NULL
+char *collect_tombstones(const char *root, const char *file_extension, long since, long *length)
+{
+    // Starting with an empty list
+    long capacity = BUFFER_SIZE;
+    char *names = malloc(capacity);
+    if (names == NULL)
+    {
+        return NULL;
+    }
+    names[0] = '\0';
+    *length = 0;
+
+    // Returning empty list when nothing was ever deleted
+    FILE *log = fopen(TOMBSTONE_FILE, "r");
+    if (log == NULL)
+    {
+        return names;
+    }
+
+    // Reading "time name" lines
+    char line[MAX_PATH + 32];
+    int extension_length = strlen(file_extension);
+    while (fgets(line, sizeof(line), log) != NULL)
+    {
+        long deleted_at;
+        char name[MAX_PATH];
+        if (sscanf(line, "%ld %1023[^\n]", &deleted_at, name) != 2 || deleted_at < since)
+        {
+            continue;
+        }
+
+        // Skipping other file types and names that exist again
+        int name_length = strlen(name);
+        if (name_length < extension_length || strcmp(name + name_length - extension_length, file_extension) != 0)
+        {
+            continue;
+        }
+        // A name too long to check is treated as present rather than tested cut short
+        char full_path[MAX_PATH];
+        if (snprintf(full_path, sizeof(full_path), "%s/%s", root, name) >= (int)sizeof(full_path) ||
+            access(full_path, F_OK) == 0)
+        {
+            continue;
+        }
+
+        // Skipping names already listed
+        char entry[MAX_PATH + 2];
+        snprintf(entry, sizeof(entry), "\n%s\n", name);
+        if (strncmp(names, entry + 1, name_length + 1) == 0 || strstr(names, entry) != NULL)
+        {
+            continue;
+        }
+
+        // Growing list when the name does not fit
+        while (*length + name_length + 2 > capacity)
+        {
+            char *grown = realloc(names, capacity * 2);
+            if (grown == NULL)
+            {
+                free(names);
+                fclose(log);
+                return NULL;
+            }
+            names = grown;
+            capacity *= 2;
+        }
+
+        // Appending name and newline
+        memcpy(names + *length, entry + 1, name_length + 1);
+        *length += name_length + 1;
+        names[*length] = '\0';
+    }
+
+    fclose(log);
+    return names;
+}
+
+/*=== TAR CACHE STATE ===*/
+
+// Locating one member inside the cached archive
+struct tar_cache_member
+{
+    // Member name relative to the storage root
+    char *name;
+    // Offset of the member's first header block in the cache file
+    long offset;
+    // Bytes from that header through the member's last padding block
+    long length;
+};
+
+// Holding the archive of the whole storage root kept between CREATETAR requests
+struct tar_cache
+{
+    // Serializing cache rebuilds; guards the cache file and everything from built down
+    pthread_mutex_t build_lock;
+    // Guarding generation and the changed-name list, held only briefly so STORE never waits on a rebuild
+    pthread_mutex_t lock;
+    // Bumped by every STORE and DELETE under the storage root
+    unsigned long generation;
+    // Names of members changed since the last rebuild, relative to the storage root
+    char *dirty[TAR_CACHE_MAX_DIRTY];
+    int dirty_count;
+    // Set when more names changed than dirty holds, or a path did not map to a member name
+    int dirty_overflow;
+    // Set once the cache file holds a complete archive
+    int built;
+    // Generation the cache file reflects
+    unsigned long cached_generation;
+    // Members in cache file order
+    struct tar_cache_member *members;
+    int member_count;
+    int member_capacity;
+    // Bytes of members in the cache file (the end-of-archive blocks are never stored)
+    long archive_size;
+};
+
+// Cache of the archive served for CREATETAR ~/S2
+struct tar_cache archive_cache = {.build_lock = PTHREAD_MUTEX_INITIALIZER, .lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Recording that a file under the storage root was stored or deleted
+// path is the on-disk path (S2/dir/file), NULL when it was too long to build; the next
+// CREATETAR patches just that member
+void tar_cache_mark_changed(struct tar_cache *cache, const char *path)
+{
+    // Mapping the path to a member name (NULL when it cannot be tracked)
+    const char *name = (path != NULL) ? tar_member_name(TAR_CACHE_ROOT, path) : NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    cache->generation++;
+
+    // Remembering the name once, or giving up on patching when it cannot be tracked
+    int known = 0;
+    for (int i = 0; name != NULL && i < cache->dirty_count; i++)
+    {
+        if (strcmp(cache->dirty[i], name) == 0)
+        {
+            known = 1;
+            break;
+        }
+    }
+    if (name == NULL || (!known && cache->dirty_count == TAR_CACHE_MAX_DIRTY))
+    {
+        cache->dirty_overflow = 1;
+    }
+    else if (!known)
+    {
+        cache->dirty[cache->dirty_count] = strdup(name);
+        if (cache->dirty[cache->dirty_count] == NULL)
+        {
+            cache->dirty_overflow = 1;
+        }
+        else
+        {
+            cache->dirty_count++;
+        }
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Writing exactly length bytes to a file
+int write_all(int fd, const void *buffer, long length)
+{
+    long total_written = 0;
+    while (total_written < length)
+    {
+        ssize_t bytes_written = write(fd, (const char *)buffer + total_written, length - total_written);
+        if (bytes_written == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_written <= 0)
+        {
+            return -1;
+        }
+        total_written += bytes_written;
+    }
+    return 0;
+}
+
+// Adding a member to the cache index
+int tar_cache_record(struct tar_cache *cache, const char *name, long offset, long length)
+{
+    // Growing index when full
+    if (cache->member_count == cache->member_capacity)
+    {
+        int capacity = cache->member_capacity ? cache->member_capacity * 2 : 64;
+        struct tar_cache_member *members = realloc(cache->members, capacity * sizeof(*members));
+        if (members == NULL)
+        {
+            return -1;
+        }
+        cache->members = members;
+        cache->member_capacity = capacity;
+    }
+
+    char *name_copy = strdup(name);
+    if (name_copy == NULL)
+    {
+        return -1;
+    }
+    cache->members[cache->member_count].name = name_copy;
+    cache->members[cache->member_count].offset = offset;
+    cache->members[cache->member_count].length = length;
+    cache->member_count++;
+    return 0;
+}
+
+/*=== TAR STREAM FUNCTIONS ===*/
+
+// Holding a tar archive that is written straight to a socket as DATA frames
+struct tar_stream
+{
+    // Socket the frames go to, or the cache file when cache is set
+    int socket;
+    // Cache being written: bytes go to the file unframed and every member is indexed
+    struct tar_cache *cache;
+    // Bytes flushed so far, so offset + used is the current archive position
+    long offset;
+    // Files last modified before this time are left out (0 archives everything)
+    long since;
+    // Headers, padding and small files collected into one frame
+    char buffer[TRANSMIT_BUFFER_SIZE];
+    // Bytes waiting in buffer
+    int used;
+    // Set while a member is partly written, so frames sent meanwhile are marked as continuing
+    int in_member;
+    // Members written so far
+    int member_count;
+};
+
+// Sending whatever is buffered as one DATA frame
+// The frame is STATUS_OK when it ends on a member boundary and STATUS_PARTIAL when the
+// next DATA frame continues a member, so a reader may splice streams at OK frames
+int tar_stream_flush(struct tar_stream *stream)
+{
+    if (stream->used == 0)
+    {
+        return 0;
+    }
+    if (stream->cache != NULL)
+    {
+        // Appending raw archive bytes to the cache file
+        if (write_all(stream->socket, stream->buffer, stream->used) == -1)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        int status = stream->in_member ? STATUS_PARTIAL : STATUS_OK;
+        if (send_frame(stream->socket, FRAME_DATA, status, stream->buffer, stream->used) == -1)
+        {
+            return -1;
+        }
+    }
+    stream->offset += stream->used;
+    stream->used = 0;
+    return 0;
+}
+
+// Appending bytes to the archive (NULL data appends zeros)
+int tar_stream_write(struct tar_stream *stream, const void *data, long length)
+{
+    while (length > 0)
+    {
+        // Flushing once the buffer is full
+        if (stream->used == (int)sizeof(stream->buffer) && tar_stream_flush(stream) == -1)
+        {
+            return -1;
+        }
+
+        // Copying as much as fits
+        long room = sizeof(stream->buffer) - stream->used;
+        long piece = (length < room) ? length : room;
+        if (data != NULL)
+        {
+            memcpy(stream->buffer + stream->used, data, piece);
+            data = (const char *)data + piece;
+        }
+        else
+        {
+            memset(stream->buffer + stream->used, 0, piece);
+        }
+        stream->used += piece;
+        length -= piece;
+    }
+
+    return 0;
+}
+
+// Padding the archive with zeros up to the next block boundary after length bytes
+int tar_stream_pad(struct tar_stream *stream, unsigned long long length)
+{
+    long padding = (TAR_BLOCK_SIZE - length % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+    return tar_stream_write(stream, NULL, padding);
+}
+
+// Writing a number as zero-padded octal into a header field of width bytes
+void tar_format_octal(char *field, int width, unsigned long long value)
+{
+    // Keeping only the digits that fit (the last byte holds the terminator)
+    unsigned long long limit = 1ULL << (3 * (width - 1));
+    snprintf(field, width, "%0*llo", width - 1, value % limit);
+}
+
+// Writing one 512-byte ustar header block
+int tar_write_header_block(struct tar_stream *stream, const char *name, const char *prefix,
+                           char type, unsigned long long size, const struct stat *st)
+{
+    // Starting from an all-zero block
+    char header[TAR_BLOCK_SIZE];
+    memset(header, 0, sizeof(header));
+
+    // Filling fields at their ustar offsets
+    memcpy(header, name, strnlen(name, 100));
+    tar_format_octal(header + 100, 8, st->st_mode & 07777);
+    tar_format_octal(header + 108, 8, st->st_uid);
+    tar_format_octal(header + 116, 8, st->st_gid);
+    tar_format_octal(header + 124, 12, size);
+    tar_format_octal(header + 136, 12, st->st_mtime);
+    header[156] = type;
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+    memcpy(header + 345, prefix, strnlen(prefix, 155));
+
+    // Computing checksum with the checksum field counted as spaces
+    memset(header + 148, ' ', 8);
+    unsigned int checksum = 0;
+    for (int i = 0; i < TAR_BLOCK_SIZE; i++)
+    {
+        checksum += (unsigned char)header[i];
+    }
+    snprintf(header + 148, 8, "%06o", checksum);
+
+    return tar_stream_write(stream, header, TAR_BLOCK_SIZE);
+}
+
+// Adding one pax record ("length key=value\n", where length counts the whole record)
+void tar_add_pax_record(char *records, int max_size, const char *key, const char *value)
+{
+    // Sizing the record, whose length field counts its own digits
+    int body = strlen(key) + strlen(value) + 3;
+    int length = body + 1;
+    while (length != body + snprintf(NULL, 0, "%d", length))
+    {
+        length = body + snprintf(NULL, 0, "%d", length);
+    }
+
+    int used = strlen(records);
+    snprintf(records + used, max_size - used, "%d %s=%s\n", length, key, value);
+}
+
+// Writing the header of one member, preceded by a pax extended header when the
+// name or size does not fit the classic ustar fields
+int tar_write_member_header(struct tar_stream *stream, const char *member_name, const struct stat *st)
+{
+    // Storing ustar name split and pax records
+    char name[101] = "";
+    char prefix[156] = "";
+    char records[MAX_PATH + 64] = "";
+    int name_length = strlen(member_name);
+
+    if (name_length <= 100)
+    {
+        strcpy(name, member_name);
+    }
+    else
+    {
+        // Looking for a slash that splits the path into prefix (155) and name (100)
+        const char *split = NULL;
+        for (const char *p = member_name; *p != '\0'; p++)
+        {
+            if (*p == '/' && name_length - (p - member_name) - 1 <= 100)
+            {
+                split = p;
+                break;
+            }
+        }
+
+        if (split != NULL && split != member_name && split - member_name <= 155 && split[1] != '\0')
+        {
+            memcpy(prefix, member_name, split - member_name);
+            strcpy(name, split + 1);
+        }
+        else
+        {
+            // Path too long for ustar - carrying it in a pax record
+            tar_add_pax_record(records, sizeof(records), "path", member_name);
+            memcpy(name, member_name, 100);
+        }
+    }
+
+    // Sizes of 8 GiB and more do not fit the 11-digit octal field
+    unsigned long long size = st->st_size;
+    if (size > TAR_MAX_OCTAL_SIZE)
+    {
+        char size_text[32];
+        snprintf(size_text, sizeof(size_text), "%llu", size);
+        tar_add_pax_record(records, sizeof(records), "size", size_text);
+        size = 0;
+    }
+
+    // Sending pax extended header first when needed
+    if (records[0] != '\0')
+    {
+        long records_length = strlen(records);
+        if (tar_write_header_block(stream, "././S2PaxHeader", "", 'x', records_length, st) == -1 ||
+            tar_stream_write(stream, records, records_length) == -1 ||
+            tar_stream_pad(stream, records_length) == -1)
+        {
+            return -1;
+        }
+    }
+
+    return tar_write_header_block(stream, name, prefix, '0', size, st);
+}
+
+// Adding one file to the archive
+// Returns 0 when added, 1 when skipped (unreadable), -1 if the connection broke
+int tar_add_file(struct tar_stream *stream, const char *full_path, const char *member_name)
+{
+    // Opening file for reading
+    int file_fd = open(full_path, O_RDONLY);
+    if (file_fd == -1)
+    {
+        printf("[S2] WARNING: Skipping unreadable file: %s\n", full_path);
+        return 1;
+    }
+
+    // Reading size and metadata from the open descriptor
+    struct stat st;
+    if (fstat(file_fd, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        close(file_fd);
+        return 1;
+    }
+    long file_size = st.st_size;
+
+    // Starting a small member in a fresh frame when it would not fit the room left,
+    // so it is never split across frames (headers take at most a few blocks)
+    if (file_size <= TAR_INLINE_LIMIT &&
+        stream->used + 6 * TAR_BLOCK_SIZE + file_size > (long)sizeof(stream->buffer) &&
+        tar_stream_flush(stream) == -1)
+    {
+        close(file_fd);
+        return -1;
+    }
+    stream->in_member = 1;
+    long member_start = stream->offset + stream->used;
+
+    if (tar_write_member_header(stream, member_name, &st) == -1)
+    {
+        close(file_fd);
+        return -1;
+    }
+
+    if (file_size <= TAR_INLINE_LIMIT || stream->cache != NULL)
+    {
+        // Copying small file (or any file bound for the cache) through the frame buffer
+        long total_read = 0;
+        while (total_read < file_size)
+        {
+            if (stream->used == (int)sizeof(stream->buffer) && tar_stream_flush(stream) == -1)
+            {
+                close(file_fd);
+                return -1;
+            }
+            long room = sizeof(stream->buffer) - stream->used;
+            long remaining = file_size - total_read;
+            ssize_t bytes_read = read(file_fd, stream->buffer + stream->used, (remaining < room) ? remaining : room);
+            if (bytes_read <= 0)
+            {
+                // File shrank while reading - zero-filling so the member keeps its announced size
+                printf("[S2] WARNING: %s changed while being archived\n", full_path);
+                if (tar_stream_write(stream, NULL, remaining) == -1)
+                {
+                    close(file_fd);
+                    return -1;
+                }
+                break;
+            }
+            stream->used += bytes_read;
+            total_read += bytes_read;
+        }
+    }
+    else
+    {
+        // Handing the body of a large file to the kernel as its own DATA frame
+        if (tar_stream_flush(stream) == -1 ||
+            send_frame_header(stream->socket, FRAME_DATA, STATUS_PARTIAL, file_size) == -1 ||
+            transmit_file_data(stream->socket, file_fd, file_size) == -1)
+        {
+            close(file_fd);
+            return -1;
+        }
+    }
+
+    // Closing file and padding member to a whole block
+    close(file_fd);
+    if (tar_stream_pad(stream, file_size) == -1)
+    {
+        return -1;
+    }
+    stream->in_member = 0;
+
+    // Indexing member so the cache can later copy or drop it without reading the file again
+    if (stream->cache != NULL &&
+        tar_cache_record(stream->cache, member_name, member_start, stream->offset + stream->used - member_start) == -1)
+    {
+        return -1;
+    }
+
+    stream->member_count++;
+    printf("[S2] Archived %s (%ld bytes)\n", member_name, file_size);
+    return 0;
+}
+
+// Walking directory recursively and adding every regular file whose name ends in file_extension
+// member_prefix is the directory's path inside the archive ("" at the root)
+// Returns 0 when the walk finished, -1 if the connection broke
+int tar_add_directory(struct tar_stream *stream, const char *directory, const char *member_prefix,
+                      const char *file_extension)
+{
+    // Opening directory
+    DIR *dir = opendir(directory);
+    if (dir == NULL)
+    {
+        printf("[S2] WARNING: Cannot open directory: %s\n", directory);
+        return 0;
+    }
+
+    // Reading entries one by one
+    struct dirent *entry;
+    int extension_length = strlen(file_extension);
+    while ((entry = readdir(dir)) != NULL)
+    {
+        // Skipping current and parent directory entries
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        // Building path on disk and name inside the archive
+        char full_path[MAX_PATH];
+        char member_name[MAX_PATH];
+        snprintf(full_path, sizeof(full_path), "%s/%s", directory, entry->d_name);
+        if (member_prefix[0] != '\0')
+        {
+            snprintf(member_name, sizeof(member_name), "%s/%s", member_prefix, entry->d_name);
+        }
+        else
+        {
+            snprintf(member_name, sizeof(member_name), "%s", entry->d_name);
+        }
+
+        // Checking entry type without following symlinks
+        struct stat st;
+        if (lstat(full_path, &st) == -1)
+        {
+            continue;
+        }
+
+        int result = 0;
+        if (S_ISDIR(st.st_mode))
+        {
+            // Descending into subdirectory
+            result = tar_add_directory(stream, full_path, member_name, file_extension);
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            // Adding file when its name ends with the extension and it changed at or after since
+            int name_length = strlen(entry->d_name);
+            if (name_length >= extension_length &&
+                strcmp(entry->d_name + name_length - extension_length, file_extension) == 0 &&
+                st.st_mtime >= stream->since)
+            {
+                result = tar_add_file(stream, full_path, member_name);
+            }
+        }
+
+        if (result == -1)
+        {
+            closedir(dir);
+            return -1;
+        }
+    }
+
+    // Closing directory
+    closedir(dir);
+    return 0;
+}
+
+// Streaming every matching file under root_directory modified at or after since as tar
+// members in DATA frames
+// The end-of-archive blocks are left out so several streams can be joined into one archive
+// Returns number of members, or -1 if the connection broke
+int stream_tar_members(int socket, const char *root_directory, const char *file_extension, long since)
+{
+    printf("[S2] Streaming %s files under %s as tar members\n", file_extension, root_directory);
+
+    // Allocating writer state (its frame buffer is too big for a thread stack)
+    struct tar_stream *stream = malloc(sizeof(*stream));
+    if (stream == NULL)
+    {
+        return -1;
+    }
+    stream->socket = socket;
+    stream->cache = NULL;
+    stream->offset = 0;
+    stream->since = since;
+    stream->used = 0;
+    stream->in_member = 0;
+    stream->member_count = 0;
+
+    // Walking the tree and sending what is left in the buffer
+    int result = tar_add_directory(stream, root_directory, "", file_extension);
+    if (result == 0)
+    {
+        result = tar_stream_flush(stream);
+    }
+    if (result == 0)
+    {
+        result = stream->member_count;
+        printf("[S2] Streamed %d tar members\n", result);
+    }
+
+    free(stream);
+    return result;
+}
+
+/*=== TAR CACHE FUNCTIONS ===*/
+
+// Copying length bytes at offset of one file to the current end of another
+// Uses copy_file_range() so unchanged members never pass through user space
+// (and may be shared on filesystems that support reflinks)
+int copy_file_segment(int from_fd, long offset, int to_fd, long length)
+{
+    long total_copied = 0;
+
+#ifdef __linux__
+    loff_t from_offset = offset;
+    while (total_copied < length)
+    {
+        ssize_t bytes_copied = copy_file_range(from_fd, &from_offset, to_fd, NULL, length - total_copied, 0);
+        if (bytes_copied == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_copied == -1 && total_copied == 0 &&
+            (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+        {
+            // Kernel cannot copy between these files - using copy loop instead
+            break;
+        }
+        if (bytes_copied <= 0)
+        {
+            return -1;
+        }
+        total_copied += bytes_copied;
+    }
+    if (total_copied == length)
+    {
+        return 0;
+    }
+#endif
+
+    // Copying through a buffer from where the kernel copy stopped
+    char buffer[TRANSMIT_BUFFER_SIZE];
+    while (total_copied < length)
+    {
+        long remaining = length - total_copied;
+        ssize_t bytes_read = pread(from_fd, buffer, (remaining > TRANSMIT_BUFFER_SIZE) ? TRANSMIT_BUFFER_SIZE : remaining,
+                                   offset + total_copied);
+        if (bytes_read <= 0 || write_all(to_fd, buffer, bytes_read) == -1)
+        {
+            return -1;
+        }
+        total_copied += bytes_read;
+    }
+    return 0;
+}
+
+// Forgetting the cached archive so the next request rebuilds it from scratch
+void tar_cache_discard(struct tar_cache *cache)
+{
+    for (int i = 0; i < cache->member_count; i++)
+    {
+        free(cache->members[i].name);
+    }
+    cache->member_count = 0;
+    cache->archive_size = 0;
+    cache->built = 0;
+}
+
+// Checking whether name is in a list of changed names
+int tar_cache_name_listed(char **names, int count, const char *name)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(names[i], name) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Adding the current version of each changed file to a cache archive open for writing
+// Files that no longer exist (deleted) or do not have the extension are left out
+// Returns 0, or -1 when the cache file could not be written
+int tar_cache_add_files(struct tar_stream *stream, char **names, int count, const char *file_extension)
+{
+    int extension_length = strlen(file_extension);
+    for (int i = 0; i < count; i++)
+    {
+        // Skipping names the directory walk would not archive
+        int name_length = strlen(names[i]);
+        if (name_length < extension_length ||
+            strcmp(names[i] + name_length - extension_length, file_extension) != 0)
+        {
+            continue;
+        }
+
+        // Archiving file if it is still there
+        char full_path[MAX_PATH];
+        snprintf(full_path, sizeof(full_path), "%s/%s", TAR_CACHE_ROOT, names[i]);
+        struct stat st;
+        if (lstat(full_path, &st) == -1 || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+        if (tar_add_file(stream, full_path, names[i]) == -1)
+        {
+            return -1;
+        }
+    }
+
+    return tar_stream_flush(stream);
+}
+
+// Bringing the cache file up to date with the storage root
+// changed lists the names changed since the cache was built (full_rebuild ignores it)
+// Returns 0 when the cache file is current, -1 when it had to be discarded
+int tar_cache_update(struct tar_cache *cache, char **changed, int changed_count, int full_rebuild,
+                     const char *file_extension)
+{
+    // Allocating writer state that writes raw archive bytes to the cache file
+    struct tar_stream *stream = malloc(sizeof(*stream));
+    if (stream == NULL)
+    {
+        return -1;
+    }
+    stream->cache = cache;
+    stream->since = 0;
+    stream->used = 0;
+    stream->in_member = 0;
+    stream->member_count = 0;
+
+    // Appending in place when every changed name is new to the archive
+    int append_only = cache->built && !full_rebuild;
+    for (int i = 0; append_only && i < changed_count; i++)
+    {
+        for (int m = 0; m < cache->member_count; m++)
+        {
+            if (strcmp(cache->members[m].name, changed[i]) == 0)
+            {
+                append_only = 0;
+                break;
+            }
+        }
+    }
+
+    int result = 0;
+    if (append_only)
+    {
+        printf("[S2] Appending %d changed files to cached tar\n", changed_count);
+
+        // Dropping anything a failed earlier append left past the last member
+        stream->socket = open(TAR_CACHE_FILE, O_WRONLY);
+        if (stream->socket == -1 || ftruncate(stream->socket, cache->archive_size) == -1 ||
+            lseek(stream->socket, cache->archive_size, SEEK_SET) == -1)
+        {
+            result = -1;
+        }
+        stream->offset = cache->archive_size;
+        if (result == 0)
+        {
+            result = tar_cache_add_files(stream, changed, changed_count, file_extension);
+        }
+    }
+    else
+    {
+        // Writing a new cache file next to the old one and swapping it in at the end,
+        // so requests still sending the old file keep a consistent archive
+        stream->socket = open(TAR_CACHE_TEMP_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        stream->offset = 0;
+        if (stream->socket == -1)
+        {
+            result = -1;
+        }
+        else if (!cache->built || full_rebuild)
+        {
+            printf("[S2] Building cached tar of %s\n", TAR_CACHE_ROOT);
+            tar_cache_discard(cache);
+            result = tar_add_directory(stream, TAR_CACHE_ROOT, "", file_extension);
+            if (result == 0)
+            {
+                result = tar_stream_flush(stream);
+            }
+        }
+        else
+        {
+            printf("[S2] Patching cached tar for %d changed files\n", changed_count);
+
+            // Copying members that did not change straight from the old cache file
+            int old_fd = open(TAR_CACHE_FILE, O_RDONLY);
+            int kept = 0;
+            int m = 0;
+            result = (old_fd == -1) ? -1 : 0;
+            for (; result == 0 && m < cache->member_count; m++)
+            {
+                struct tar_cache_member *member = &cache->members[m];
+                if (tar_cache_name_listed(changed, changed_count, member->name))
+                {
+                    free(member->name);
+                    continue;
+                }
+                if (copy_file_segment(old_fd, member->offset, stream->socket, member->length) == -1)
+                {
+                    result = -1;
+                    break;
+                }
+                member->offset = stream->offset;
+                stream->offset += member->length;
+                cache->members[kept++] = *member;
+            }
+            if (old_fd != -1)
+            {
+                close(old_fd);
+            }
+
+            if (result == 0)
+            {
+                cache->member_count = kept;
+                // Archiving the current version of every changed file after the kept members
+                result = tar_cache_add_files(stream, changed, changed_count, file_extension);
+            }
+            else
+            {
+                // Index is half rewritten - dropping it with the rest of the cache
+                for (; m < cache->member_count; m++)
+                {
+                    free(cache->members[m].name);
+                }
+                cache->member_count = kept;
+            }
+        }
+
+        if (result == 0 && rename(TAR_CACHE_TEMP_FILE, TAR_CACHE_FILE) == -1)
+        {
+            result = -1;
+        }
+    }
+
+    if (stream->socket != -1)
+    {
+        close(stream->socket);
+    }
+    if (result == 0)
+    {
+        cache->archive_size = stream->offset;
+        cache->built = 1;
+    }
+    else
+    {
+        printf("[S2] ERROR: Could not update cached tar\n");
+        tar_cache_discard(cache);
+        unlink(TAR_CACHE_TEMP_FILE);
+    }
+
+    free(stream);
+    return result;
+}
+
+// Sending the archive of the storage root from the cache, updated first if files changed
+// An unchanged tree costs one DATA frame sent with sendfile; when the cache cannot be
+// brought up to date the members are streamed from the tree directly
+// Returns number of members, or -1 if the connection broke
+int stream_cached_tar_members(int socket, const char *file_extension)
+{
+    struct tar_cache *cache = &archive_cache;
+    pthread_mutex_lock(&cache->build_lock);
+
+    // Taking the changed names recorded so far; anything stored from now on bumps the generation again
+    pthread_mutex_lock(&cache->lock);
+    unsigned long generation = cache->generation;
+    int current = cache->built && cache->cached_generation == generation;
+    int full_rebuild = cache->dirty_overflow;
+    int changed_count = cache->dirty_count;
+    char *changed[TAR_CACHE_MAX_DIRTY];
+    memcpy(changed, cache->dirty, changed_count * sizeof(char *));
+    cache->dirty_count = 0;
+    cache->dirty_overflow = 0;
+    pthread_mutex_unlock(&cache->lock);
+
+    // Patching cache when the tree changed since it was built
+    if (current)
+    {
+        printf("[S2] Serving tar of %s from cache (generation %lu)\n", TAR_CACHE_ROOT, generation);
+    }
+    else if (tar_cache_update(cache, changed, changed_count, full_rebuild, file_extension) == 0)
+    {
+        cache->cached_generation = generation;
+    }
+    for (int i = 0; i < changed_count; i++)
+    {
+        free(changed[i]);
+    }
+
+    // Opening the cache file while it cannot be swapped, then letting other requests in
+    int cache_fd = cache->built ? open(TAR_CACHE_FILE, O_RDONLY) : -1;
+    long archive_size = cache->archive_size;
+    int member_count = cache->member_count;
+    if (cache_fd == -1)
+    {
+        tar_cache_discard(cache);
+    }
+    pthread_mutex_unlock(&cache->build_lock);
+
+    if (cache_fd == -1)
+    {
+        printf("[S2] WARNING: Tar cache unavailable, streaming members directly\n");
+        return stream_tar_members(socket, TAR_CACHE_ROOT, file_extension, 0);
+    }
+
+    // Sending the whole archive as one frame ending on a member boundary
+    int result = 0;
+    if (archive_size > 0 &&
+        (send_frame_header(socket, FRAME_DATA, STATUS_OK, archive_size) == -1 ||
+         transmit_file_data(socket, cache_fd, archive_size) == -1))
+    {
+        result = -1;
+    }
+    close(cache_fd);
+
+    if (result == -1)
+    {
+        return -1;
+    }
+    printf("[S2] Sent %d cached tar members (%ld bytes)\n", member_count, archive_size);
+    return member_count;
+}
+
+/*=== FILE LISTING FUNCTIONS ===*/
+
+// Sending file list to S1 server in one LIST frame (S1 servers that do not ask for a stream)
+// Names that no longer fit the frame are left out
+int send_filelist_to_S1(int s1_socket, const char *directory_path, const char *file_extension)
+{
+    // Creating directory pointer
+    DIR *dir;
+    // Creating directory entry structure
+    struct dirent *entry;
+    // Creating buffer to collect all file names
+    char file_list[4096] = "";
+    // Tracking how much of the buffer is used
+    int total_length = 0;
+
+    printf("[S2] Collecting file list from: %s\n", directory_path);
+
+    // Opening directory
+    dir = opendir(directory_path);
+    if (dir == NULL)
+    {
+        printf("[S2] Cannot open directory: %s\n", directory_path);
+        // Sending empty list so S1 knows there are no files
+        send_frame(s1_socket, FRAME_LIST, STATUS_NOT_FOUND, "", 0);
+        return -1;
+    }
+
+    // Reading directory entries and collecting filenames
+    while ((entry = readdir(dir)) != NULL)
+    {
+        // Skipping current and parent directory entries
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        // Filtering by extension if specified
+        if (file_extension != NULL && strstr(entry->d_name, file_extension) == NULL)
+        {
+            continue;
+        }
+
+        // Adding filename with newline while it fits
+        int name_length = strlen(entry->d_name);
+        if (total_length + name_length + 1 >= (int)sizeof(file_list))
+        {
+            printf("[S2] Warning: File list full, leaving out remaining files\n");
+            break;
+        }
+        memcpy(file_list + total_length, entry->d_name, name_length);
+        file_list[total_length + name_length] = '\n';
+        total_length += name_length + 1;
+        file_list[total_length] = '\0';
+    }
+
+    // Closing directory
+    closedir(dir);
+
+    // Sending the complete file list as one frame (empty when no files matched)
+    if (send_text_frame(s1_socket, FRAME_LIST, STATUS_OK, file_list) == -1)
+    {
+        return -1;
+    }
+    printf("[S2] File list sent to S1\n");
+
+    return 0;
+}
+
+// Next names of a directory in name order, picked a batch at a time in fixed memory
+struct name_batch
+{
+    // Slots holding the picked names
+    char (*names)[256];
+    // Slot numbers: a max-heap while picking, then sorted by name
+    int *order;
+    int count;
+    // Set when names after the cursor were left out because the batch was full
+    int more;
+};
+
+// Moving order[position] down the max-heap of count slots until its children sort before it
+void sift_name_down(struct name_batch *batch, int position, int count)
+{
+    while (2 * position + 1 < count)
+    {
+        int child = 2 * position + 1;
+        if (child + 1 < count && strcmp(batch->names[batch->order[child + 1]], batch->names[batch->order[child]]) > 0)
+        {
+            child++;
+        }
+        if (strcmp(batch->names[batch->order[child]], batch->names[batch->order[position]]) <= 0)
+        {
+            break;
+        }
+        int slot = batch->order[child];
+        batch->order[child] = batch->order[position];
+        batch->order[position] = slot;
+        position = child;
+    }
+}
+
+// Picking the first limit names (at most LIST_BATCH) in directory_path that contain file_extension
+// and sort after `after` ("" for the start), with one readdir pass: the smallest names seen so far
+// sit in a max-heap, so each new name only has to beat the largest of them
+// Returns 0 with batch->order sorted by name, or -1 when the directory cannot be read
+int pick_name_batch(const char *directory_path, const char *file_extension, const char *after, int limit,
+                    struct name_batch *batch)
+{
+    DIR *dir = opendir(directory_path);
+    if (dir == NULL)
+    {
+        return -1;
+    }
+    batch->count = 0;
+    batch->more = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strstr(name, file_extension) == NULL ||
+            strcmp(name, after) <= 0 || strlen(name) >= sizeof(batch->names[0]))
+        {
+            continue;
+        }
+
+        if (batch->count < limit)
+        {
+            // Filling a free slot and moving it up the heap
+            int position = batch->count++;
+            batch->order[position] = position;
+            snprintf(batch->names[position], sizeof(batch->names[0]), "%s", name);
+            while (position > 0 &&
+                   strcmp(batch->names[batch->order[(position - 1) / 2]], batch->names[batch->order[position]]) < 0)
+            {
+                int slot = batch->order[(position - 1) / 2];
+                batch->order[(position - 1) / 2] = batch->order[position];
+                batch->order[position] = slot;
+                position = (position - 1) / 2;
+            }
+            continue;
+        }
+
+        // Replacing the largest picked name when this one sorts before it
+        batch->more = 1;
+        if (limit > 0 && strcmp(name, batch->names[batch->order[0]]) < 0)
+        {
+            snprintf(batch->names[batch->order[0]], sizeof(batch->names[0]), "%s", name);
+            sift_name_down(batch, 0, batch->count);
+        }
+    }
+    closedir(dir);
+
+    // Sorting picked slots by name (heap sort: the largest goes to the end each round)
+    for (int end = batch->count - 1; end > 0; end--)
+    {
+        int slot = batch->order[0];
+        batch->order[0] = batch->order[end];
+        batch->order[end] = slot;
+        sift_name_down(batch, 0, end);
+    }
+    return 0;
+}
+
+// One sorted run of names spilled to the temporary file, read back a buffer at a time
+struct name_run
+{
+    // Unread part of the run in the file
+    long offset;
+    long end;
+    // Names read so far ('\0' after each), position is the run's current name
+    char buffer[LIST_MERGE_BUFFER];
+    int position;
+    int filled;
+};
+
+// A directory's names in name order after one readdir pass: names are packed into an arena and
+// sorted by pointer; a directory outgrowing the arena is spilled as sorted runs that are then
+// merged k ways through a min-heap, so no name is moved once it is stored
+struct sorted_names
+{
+    // Packed names of the run in memory (used bytes of the arena) and pointers to them in name order
+    char *arena;
+    long used;
+    char **sorted;
+    int count;
+    int next;
+    // Runs spilled so far (NULL while everything fits in the arena)
+    FILE *spill;
+    struct name_run *runs;
+    int run_count;
+    // Runs ordered by current name, and the run whose name was returned last (-1 for none)
+    int *heap;
+    int heap_count;
+    int last_run;
+    // Set when the spill file could not be read back
+    int failed;
+};
+
+// Ordering name pointers for qsort
+int compare_name_pointers(const void *first, const void *second)
+{
+    return strcmp(*(char *const *)first, *(char *const *)second);
+}
+
+// Writing the names in the arena as one sorted run at the end of the spill file
+// Returns 0, or -1 if the file could not be written
+int spill_name_run(struct sorted_names *names)
+{
+    qsort(names->sorted, names->count, sizeof(char *), compare_name_pointers);
+    if (names->spill == NULL && (names->spill = tmpfile()) == NULL)
+    {
+        return -1;
+    }
+    struct name_run *runs = realloc(names->runs, (names->run_count + 1) * sizeof(struct name_run));
+    if (runs == NULL)
+    {
+        return -1;
+    }
+    names->runs = runs;
+
+    struct name_run *run = &names->runs[names->run_count++];
+    run->offset = ftell(names->spill);
+    for (int i = 0; i < names->count; i++)
+    {
+        fwrite(names->sorted[i], 1, strlen(names->sorted[i]) + 1, names->spill);
+    }
+    run->end = ftell(names->spill);
+    run->position = 0;
+    run->filled = 0;
+    names->count = 0;
+    return (ferror(names->spill) || fflush(names->spill) != 0) ? -1 : 0;
+}
+
+// Making sure the run's current name is whole in its buffer, reading on from the file
+// Returns 1 when there is a current name, 0 once the run is used up, -1 if reading failed
+int load_name_run(struct sorted_names *names, struct name_run *run)
+{
+    if (memchr(run->buffer + run->position, '\0', run->filled - run->position) != NULL)
+    {
+        return 1;
+    }
+
+    // Moving the partial name to the front and filling the rest of the buffer
+    memmove(run->buffer, run->buffer + run->position, run->filled - run->position);
+    run->filled -= run->position;
+    run->position = 0;
+    long wanted = LIST_MERGE_BUFFER - run->filled;
+    if (wanted > run->end - run->offset)
+    {
+        wanted = run->end - run->offset;
+    }
+    if (wanted == 0)
+    {
+        return (run->filled == 0) ? 0 : -1;
+    }
+    ssize_t bytes_read = pread(fileno(names->spill), run->buffer + run->filled, wanted, run->offset);
+    if (bytes_read <= 0)
+    {
+        return -1;
+    }
+    run->offset += bytes_read;
+    run->filled += bytes_read;
+    return (memchr(run->buffer, '\0', run->filled) != NULL) ? 1 : -1;
+}
+
+// Moving heap[position] down the min-heap of runs until its children sort after it
+void sift_run_down(struct sorted_names *names, int position)
+{
+    while (2 * position + 1 < names->heap_count)
+    {
+        int child = 2 * position + 1;
+        struct name_run *runs = names->runs;
+        if (child + 1 < names->heap_count &&
+            strcmp(runs[names->heap[child + 1]].buffer + runs[names->heap[child + 1]].position,
+                   runs[names->heap[child]].buffer + runs[names->heap[child]].position) < 0)
+        {
+            child++;
+        }
+        if (strcmp(runs[names->heap[child]].buffer + runs[names->heap[child]].position,
+                   runs[names->heap[position]].buffer + runs[names->heap[position]].position) >= 0)
+        {
+            break;
+        }
+        int run = names->heap[child];
+        names->heap[child] = names->heap[position];
+        names->heap[position] = run;
+        position = child;
+    }
+}
+
+// Readying an empty set of names for add_sorted_name
+// Returns 0, or -2 when out of memory
+int prepare_sorted_names(struct sorted_names *names)
+{
+    memset(names, 0, sizeof(*names));
+    names->last_run = -1;
+    names->arena = malloc(LIST_RUN_SIZE);
+    names->sorted = malloc(LIST_RUN_NAMES * sizeof(char *));
+    return (names->arena == NULL || names->sorted == NULL) ? -2 : 0;
+}
+
+// Packing a name into the arena, spilling the arena as a sorted run first when it is full
+// Returns 0, or -2 when the spill file could not be written
+int add_sorted_name(struct sorted_names *names, const char *name)
+{
+    long size = strlen(name) + 1;
+    if (names->used + size > LIST_RUN_SIZE || names->count == LIST_RUN_NAMES)
+    {
+        if (spill_name_run(names) == -1)
+        {
+            return -2;
+        }
+        names->used = 0;
+    }
+    memcpy(names->arena + names->used, name, size);
+    names->sorted[names->count++] = names->arena + names->used;
+    names->used += size;
+    return 0;
+}
+
+// Putting the names added from directory_path in order, ready for next_sorted_name
+// Returns 0, or -2 when out of memory or spill space
+int order_sorted_names(struct sorted_names *names, const char *directory_path)
+{
+    if (names->spill == NULL)
+    {
+        // Everything fitted: sorting the pointers is all it takes
+        qsort(names->sorted, names->count, sizeof(char *), compare_name_pointers);
+        return 0;
+    }
+    if (names->count > 0 && spill_name_run(names) == -1)
+    {
+        return -2;
+    }
+
+    // Starting the merge with every run's first name in the heap
+    names->heap = malloc(names->run_count * sizeof(int));
+    if (names->heap == NULL)
+    {
+        return -2;
+    }
+    for (int run = 0; run < names->run_count; run++)
+    {
+        int loaded = load_name_run(names, &names->runs[run]);
+        names->failed = names->failed || loaded == -1;
+        if (loaded == 1)
+        {
+            names->heap[names->heap_count++] = run;
+        }
+    }
+    for (int position = names->heap_count / 2 - 1; position >= 0; position--)
+    {
+        sift_run_down(names, position);
+    }
+    printf("[S2] Merging %d sorted runs of names from %s\n", names->run_count, directory_path);
+    return 0;
+}
+
+// Reading directory_path once, keeping the names that contain file_extension and sort after
+// `after` ("" for all of them), ready to be taken in name order with next_sorted_name
+// Returns 0, -1 when the directory cannot be read, -2 when out of memory or spill space
+int open_sorted_names(struct sorted_names *names, const char *directory_path, const char *file_extension,
+                      const char *after)
+{
+    if (prepare_sorted_names(names) == -2)
+    {
+        return -2;
+    }
+    DIR *dir = opendir(directory_path);
+    if (dir == NULL)
+    {
+        return -1;
+    }
+
+    int result = 0;
+    struct dirent *entry;
+    while (result == 0 && (entry = readdir(dir)) != NULL)
+    {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strstr(name, file_extension) == NULL ||
+            strcmp(name, after) <= 0)
+        {
+            continue;
+        }
+        result = add_sorted_name(names, name);
+    }
+    closedir(dir);
+    return (result == 0) ? order_sorted_names(names, directory_path) : result;
+}
+
+// Taking the next name in order (valid until the following call)
+// Returns NULL at the end, or when a spilled run could not be read (names->failed is set)
+const char *next_sorted_name(struct sorted_names *names)
+{
+    if (names->spill == NULL)
+    {
+        return (names->next < names->count) ? names->sorted[names->next++] : NULL;
+    }
+
+    // Moving the run whose name went out last on to its next name
+    if (names->last_run != -1)
+    {
+        struct name_run *run = &names->runs[names->last_run];
+        run->position += strlen(run->buffer + run->position) + 1;
+        int loaded = load_name_run(names, run);
+        names->failed = names->failed || loaded == -1;
+        if (loaded != 1)
+        {
+            names->heap[0] = names->heap[--names->heap_count];
+        }
+        sift_run_down(names, 0);
+        names->last_run = -1;
+    }
+    if (names->heap_count == 0 || names->failed)
+    {
+        return NULL;
+    }
+    names->last_run = names->heap[0];
+    return names->runs[names->last_run].buffer + names->runs[names->last_run].position;
+}
+
+// Releasing everything open_sorted_names (or open_found_files) set up
+void close_sorted_names(struct sorted_names *names)
+{
+    if (names->spill != NULL)
+    {
+        fclose(names->spill);
+    }
+    free(names->arena);
+    free(names->sorted);
+    free(names->runs);
+    free(names->heap);
+}
+
+// Conditions of a filtered listing (LIST ... STAT), checked while the directory is walked
+struct list_filter
+{
+    // Set to descend into subdirectories (names are then paths below the listed directory)
+    int recursive;
+    // Shell pattern the file name must match ("" for any)
+    char pattern[64];
+    // Size bounds in bytes and modification time bounds (seconds since the epoch), -1 for none;
+    // files must be at least min_size, at most max_size, changed at or after newer and before older
+    long min_size;
+    long max_size;
+    long newer;
+    long older;
+};
+
+// Adding the files below one directory of a filtered listing (dir_fd, at `relative` within the
+// listed directory, "" at its top) that contain file_extension, sort after `after` and pass the
+// filter, as "path\tsize\tmtime" entries
+// Names are checked before anything is looked up, and only metadata is read; symbolic links
+// are not followed, and paths too long for a listing cursor are left out
+// Returns 0, or -2 when out of memory or spill space
+int walk_found_files(struct sorted_names *names, int dir_fd, const char *relative, const char *file_extension,
+                     const char *after, const struct list_filter *filter)
+{
+    DIR *dir = fdopendir(dir_fd);
+    if (dir == NULL)
+    {
+        close(dir_fd);
+        return 0;
+    }
+
+    int result = 0;
+    struct dirent *entry;
+    while (result == 0 && (entry = readdir(dir)) != NULL)
+    {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            (entry->d_type == DT_DIR && !filter->recursive) ||
+            (entry->d_type != DT_DIR && entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN))
+        {
+            continue;
+        }
+        char path[256];
+        if (snprintf(path, sizeof(path), "%s%s%s", relative, (relative[0] != '\0') ? "/" : "", name) >=
+            (int)sizeof(path))
+        {
+            printf("[S2] WARNING: Leaving %s/%s out of the listing - path too long\n", relative, name);
+            continue;
+        }
+
+        // Descending into subdirectories
+        struct stat info;
+        int is_dir = (entry->d_type == DT_DIR);
+        if (entry->d_type == DT_UNKNOWN)
+        {
+            if (fstatat(dirfd(dir), name, &info, AT_SYMLINK_NOFOLLOW) == -1 ||
+                (!S_ISDIR(info.st_mode) && !S_ISREG(info.st_mode)))
+            {
+                continue;
+            }
+            is_dir = S_ISDIR(info.st_mode);
+        }
+        if (is_dir)
+        {
+            int child_fd = filter->recursive ? openat(dirfd(dir), name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW) : -1;
+            if (child_fd != -1)
+            {
+                result = walk_found_files(names, child_fd, path, file_extension, after, filter);
+            }
+            continue;
+        }
+
+        // Checking the name, then size and modification time
+        if (strstr(name, file_extension) == NULL || strcmp(path, after) <= 0 ||
+            (filter->pattern[0] != '\0' && fnmatch(filter->pattern, name, 0) != 0) ||
+            (entry->d_type != DT_UNKNOWN && fstatat(dirfd(dir), name, &info, AT_SYMLINK_NOFOLLOW) == -1) ||
+            !S_ISREG(info.st_mode) || (filter->min_size != -1 && info.st_size < filter->min_size) ||
+            (filter->max_size != -1 && info.st_size > filter->max_size) ||
+            (filter->newer != -1 && info.st_mtime < filter->newer) ||
+            (filter->older != -1 && info.st_mtime >= filter->older))
+        {
+            continue;
+        }
+        char line[256 + 48];
+        snprintf(line, sizeof(line), "%s\t%ld\t%ld", path, (long)info.st_size, (long)info.st_mtime);
+        result = add_sorted_name(names, line);
+    }
+    closedir(dir);
+    return result;
+}
+
+// Walking directory_path for a filtered listing, ready to be taken in path order with
+// next_sorted_name; arguments as for walk_found_files
+// Returns 0, -1 when the directory cannot be read, -2 when out of memory or spill space
+int open_found_files(struct sorted_names *names, const char *directory_path, const char *file_extension,
+                     const char *after, const struct list_filter *filter)
+{
+    if (prepare_sorted_names(names) == -2)
+    {
+        return -2;
+    }
+    int dir_fd = open(directory_path, O_RDONLY | O_DIRECTORY);
+    if (dir_fd == -1)
+    {
+        return -1;
+    }
+    int result = walk_found_files(names, dir_fd, "", file_extension, after, filter);
+    return (result == 0) ? order_sorted_names(names, directory_path) : result;
+}
+
+// Streaming the names in directory_path that contain file_extension to S1 in name order,
+// starting after `after` and stopping after count names (-1 for all of them)
+// Names go out in LIST frames (status PARTIAL) of up to LIST_CHUNK_SIZE bytes, followed by an
+// END frame saying "MORE" when count stopped it early (status NOT_FOUND when there is no directory)
+// The directory is read once: short pages keep only the names they need, anything longer is
+// sorted in runs and merged
+// With a filter (NULL for none) the directory is walked instead, and each file that passes goes
+// out as "path\tsize\tmtime" in path order
+// Returns 0, or -1 if the connection broke
+int stream_filelist_to_S1(int s1_socket, const char *directory_path, const char *file_extension, const char *after,
+                          long count, const struct list_filter *filter)
+{
+    printf("[S2] Streaming file list from: %s\n", directory_path);
+    char chunk[LIST_CHUNK_SIZE];
+    int used = 0;
+    long sent = 0;
+    int status = STATUS_OK;
+    int more = 0;
+    int result = 0;
+
+    // Opening the names in order
+    int small = (filter == NULL && count != -1 && count <= LIST_BATCH);
+    struct name_batch batch = {NULL, NULL, 0, 0};
+    struct sorted_names names;
+    int opened;
+    if (small)
+    {
+        batch.names = malloc(LIST_BATCH * sizeof(batch.names[0]));
+        batch.order = malloc(LIST_BATCH * sizeof(int));
+        opened = (batch.names == NULL || batch.order == NULL) ? -2 :
+                 pick_name_batch(directory_path, file_extension, after, (int)count, &batch);
+        more = batch.more;
+    }
+    else if (filter != NULL)
+    {
+        opened = open_found_files(&names, directory_path, file_extension, after, filter);
+    }
+    else
+    {
+        opened = open_sorted_names(&names, directory_path, file_extension, after);
+    }
+    if (opened == -1)
+    {
+        printf("[S2] Cannot open directory: %s\n", directory_path);
+        status = STATUS_NOT_FOUND;
+    }
+    else if (opened == -2)
+    {
+        printf("[S2] ERROR: Not enough memory or disk space to sort %s\n", directory_path);
+        status = STATUS_ERROR;
+    }
+
+    // Sending names, a LIST frame whenever the chunk is full
+    while (opened == 0 && result == 0 && (count == -1 || sent < count))
+    {
+        const char *name = small ? ((sent < batch.count) ? batch.names[batch.order[sent]] : NULL) : next_sorted_name(&names);
+        if (name == NULL)
+        {
+            break;
+        }
+        int name_length = strlen(name);
+        if (used + name_length + 1 > LIST_CHUNK_SIZE)
+        {
+            result = send_frame(s1_socket, FRAME_LIST, STATUS_PARTIAL, chunk, used);
+            used = 0;
+        }
+        memcpy(chunk + used, name, name_length);
+        chunk[used + name_length] = '\n';
+        used += name_length + 1;
+        sent++;
+    }
+    if (!small)
+    {
+        if (opened == 0)
+        {
+            more = (count != -1 && sent == count && next_sorted_name(&names) != NULL);
+            status = names.failed ? STATUS_ERROR : status;
+        }
+        close_sorted_names(&names);
+    }
+    free(batch.names);
+    free(batch.order);
+
+    // Sending last names and the end marker
+    if (result == 0 && used > 0)
+    {
+        result = send_frame(s1_socket, FRAME_LIST, STATUS_PARTIAL, chunk, used);
+    }
+    if (result == 0)
+    {
+        result = send_text_frame(s1_socket, FRAME_END, status, more ? "MORE" : "");
+    }
+    if (result == 0)
+    {
+        printf("[S2] Streamed %ld names to S1%s\n", sent, more ? " (more left)" : "");
+    }
+    return result;
+}
+
+// Turning a hex-encoded name from a LIST request back into text
+// Returns 0, or -1 when it is not valid hex or too long
+int decode_list_name(const char *hex, char *name, int max_size)
+{
+    int length = strlen(hex);
+    if (length % 2 != 0 || length / 2 >= max_size || (int)strspn(hex, "0123456789abcdefABCDEF") != length)
+    {
+        return -1;
+    }
+    for (int i = 0; i < length / 2; i++)
+    {
+        unsigned int value;
+        sscanf(hex + 2 * i, "%2x", &value);
+        name[i] = (char)value;
+    }
+    name[length / 2] = '\0';
+    return (strlen(name) == (size_t)length / 2) ? 0 : -1;
+}
+
+/*=== DELTA UPLOAD FUNCTIONS ===*/
+
+// Walking a file in content-defined chunks: cut points depend only on the bytes around them,
+// so an edit changes the chunks it touches and every other chunk keeps its hash
+struct cdc_reader
+{
+    // File being chunked, read front to back
+    int fd;
+    // Window over the file holding at least one largest chunk unless the file ends first
+    unsigned char *buffer;
+    long start;
+    long filled;
+    int at_end;
+    // Random value per byte value that the rolling hash adds up (same on every peer)
+    unsigned long long gear[256];
+};
+
+// Preparing to chunk file_fd from its current offset
+// Returns 0, or -1 when out of memory
+int cdc_open(struct cdc_reader *reader, int file_fd)
+{
+    reader->fd = file_fd;
+    reader->buffer = malloc(2 * CDC_MAX_SIZE);
+    reader->start = 0;
+    reader->filled = 0;
+    reader->at_end = 0;
+
+    // Deriving gear table from the fixed seed (splitmix64) so client and servers cut alike
+    unsigned long long state = CDC_GEAR_SEED;
+    for (int i = 0; i < 256; i++)
+    {
+        state += 0x9E3779B97F4A7C15ULL;
+        unsigned long long mixed = state;
+        mixed = (mixed ^ (mixed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        mixed = (mixed ^ (mixed >> 27)) * 0x94D049BB133111EBULL;
+        reader->gear[i] = mixed ^ (mixed >> 31);
+    }
+    return (reader->buffer == NULL) ? -1 : 0;
+}
+
+// Finding the next chunk; *chunk points at its bytes until the following call
+// Returns its length, 0 at the end of the file, or -1 if reading failed
+long cdc_next_chunk(struct cdc_reader *reader, const unsigned char **chunk)
+{
+    // Topping up window so a whole largest chunk is in it
+    if (!reader->at_end && reader->filled - reader->start < CDC_MAX_SIZE)
+    {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->filled - reader->start);
+        reader->filled -= reader->start;
+        reader->start = 0;
+        while (!reader->at_end && reader->filled < 2 * CDC_MAX_SIZE)
+        {
+            ssize_t bytes_read = read(reader->fd, reader->buffer + reader->filled, 2 * CDC_MAX_SIZE - reader->filled);
+            if (bytes_read == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (bytes_read == -1)
+            {
+                return -1;
+            }
+            reader->at_end = (bytes_read == 0);
+            reader->filled += bytes_read;
+        }
+    }
+
+    // Cutting after the first byte where the rolling hash (covering the last 64 bytes) has its
+    // top CDC_BOUNDARY_BITS clear, never before the smallest and never past the largest size
+    const unsigned char *data = reader->buffer + reader->start;
+    long available = reader->filled - reader->start;
+    long length = (available < CDC_MAX_SIZE) ? available : CDC_MAX_SIZE;
+    unsigned long long hash = 0;
+    for (long i = CDC_MIN_SIZE; i < length; i++)
+    {
+        hash = (hash << 1) + reader->gear[data[i]];
+        if ((hash >> (64 - CDC_BOUNDARY_BITS)) == 0)
+        {
+            length = i + 1;
+            break;
+        }
+    }
+
+    *chunk = data;
+    reader->start += length;
+    return length;
+}
+
+// File a delta upload is rebuilt against: the copy being replaced, cut into chunks
+struct delta_basis
+{
+    // Plain content of the file being replaced, -1 when there is none
+    int fd;
+    // Chunk i spans offsets[i] up to offsets[i + 1]
+    int chunk_count;
+    long *offsets;
+    // Hash the client offered for the new content, checked once it is rebuilt
+    char hex[2 * BLOB_HASH_SIZE + 1];
+};
+
+// Closing and freeing a basis
+void free_delta_basis(struct delta_basis *basis)
+{
+    if (basis->fd != -1)
+    {
+        close(basis->fd);
+    }
+    free(basis->offsets);
+    basis->fd = -1;
+    basis->offsets = NULL;
+}
+
+// Chunking the file stored at full_path and hashing every chunk
+// Returns a malloc'd array of chunk_count SHA-256 hashes, or NULL when there is no usable file
+unsigned char *load_delta_basis(struct delta_basis *basis, const char *full_path)
+{
+    basis->fd = open(full_path, O_RDONLY);
+    basis->chunk_count = 0;
+    basis->offsets = NULL;
+    if (basis->fd == -1)
+    {
+        return NULL;
+    }
+
+    // Starting with room for 1024 chunks (about 8 MB of content)
+    struct cdc_reader reader;
+    long capacity = 1024;
+    unsigned char *signatures = malloc(capacity * BLOB_HASH_SIZE);
+    basis->offsets = malloc((capacity + 1) * sizeof(long));
+    int failed = cdc_open(&reader, basis->fd) == -1 || signatures == NULL || basis->offsets == NULL;
+
+    long offset = 0;
+    long length = 0;
+    const unsigned char *chunk;
+    while (!failed && (length = cdc_next_chunk(&reader, &chunk)) > 0)
+    {
+        // Growing both lists together when full
+        if (basis->chunk_count == capacity)
+        {
+            unsigned char *grown = realloc(signatures, 2 * capacity * BLOB_HASH_SIZE);
+            if (grown != NULL)
+            {
+                signatures = grown;
+            }
+            long *grown_offsets = realloc(basis->offsets, (2 * capacity + 1) * sizeof(long));
+            if (grown_offsets != NULL)
+            {
+                basis->offsets = grown_offsets;
+            }
+            if (grown == NULL || grown_offsets == NULL)
+            {
+                failed = 1;
+                break;
+            }
+            capacity *= 2;
+        }
+
+        // Recording where the chunk starts and what it hashes to
+        basis->offsets[basis->chunk_count] = offset;
+        if (EVP_Digest(chunk, length, signatures + basis->chunk_count * BLOB_HASH_SIZE, NULL, EVP_sha256(), NULL) != 1)
+        {
+            failed = 1;
+            break;
+        }
+        basis->chunk_count++;
+        offset += length;
+    }
+    free(reader.buffer);
+
+    if (failed || length == -1)
+    {
+        free(signatures);
+        free_delta_basis(basis);
+        return NULL;
+    }
+    basis->offsets[basis->chunk_count] = offset;
+    return signatures;
+}
+
+// Rebuilding a file from a delta body: literal bytes from S1 and runs of basis chunks,
+// written to file_fd (-1 just drains the body) and hashed into digest
+// Returns 0 when exactly file_size bytes were rebuilt, -1 when the body was unusable
+// (drained up to its END frame), -2 if the stream broke
+int receive_delta_body(int s1_socket, const struct delta_basis *basis, long file_size, int file_fd, EVP_MD_CTX *digest)
+{
+    unsigned char *buffer = malloc(CDC_MAX_SIZE);
+    int failed = (buffer == NULL || file_fd == -1);
+    long total = 0;
+    long literal_bytes = 0;
+
     while (1)
     {
-        printf("[S2] Waiting for S1 connection\n");
+        int type, status;
+        long length;
+        if (recv_frame_header(s1_socket, &type, &status, &length) == -1)
+        {
+            free(buffer);
+            return -2;
+        }
+        if (type == FRAME_END)
+        {
+            break;
+        }
+
+        // Draining anything that cannot be applied so the connection stays usable
+        if (failed || type != FRAME_DATA || length > CDC_MAX_SIZE)
+        {
+            failed = 1;
+            if (skip_frame_payload(s1_socket, length) == -1)
+            {
+                free(buffer);
+                return -2;
+            }
+            continue;
+        }
+        if (recv_all(s1_socket, buffer, length) == -1)
+        {
+            free(buffer);
+            return -2;
+        }
+
+        if (status == DELTA_LITERAL)
+        {
+            // Writing new bytes as they are
+            failed = total + length > file_size || write_all(file_fd, buffer, length) == -1;
+            if (!failed)
+            {
+                EVP_DigestUpdate(digest, buffer, length);
+                total += length;
+                literal_bytes += length;
+            }
+        }
+        else if (status == DELTA_COPY && length == 8)
+        {
+            // Copying run of chunks (first index and count, 32 bits each) from the basis
+            unsigned long first = ((unsigned long)buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8) | buffer[3];
+            unsigned long count = ((unsigned long)buffer[4] << 24) | (buffer[5] << 16) | (buffer[6] << 8) | buffer[7];
+            failed = first > (unsigned long)basis->chunk_count || count > basis->chunk_count - first;
+            for (unsigned long chunk = first; !failed && chunk < first + count; chunk++)
+            {
+                long chunk_length = basis->offsets[chunk + 1] - basis->offsets[chunk];
+                failed = total + chunk_length > file_size ||
+                         pread(basis->fd, buffer, chunk_length, basis->offsets[chunk]) != chunk_length ||
+                         write_all(file_fd, buffer, chunk_length) == -1;
+                if (!failed)
+                {
+                    EVP_DigestUpdate(digest, buffer, chunk_length);
+                    total += chunk_length;
+                }
+            }
+        }
+        else
+        {
+            failed = 1;
+        }
+    }
+
+    free(buffer);
+    if (failed || total != file_size)
+    {
+        printf("[S2] ERROR: Delta body could not be applied\n");
+        return -1;
+    }
+    printf("[S2] Rebuilt %ld bytes from delta (%ld bytes sent, %ld copied)\n", file_size, literal_bytes,
+           file_size - literal_bytes);
+    return 0;
+}
+
+// Receiving the DELTA frame and body that replace full_path, and storing the rebuilt file
+// The file is rebuilt beside the blob store (outside the storage root) while the old copy is
+// still being read, and only replaces it once its hash matches the one the client offered
+// Returns 0 when stored, -1 when it could not be stored (body drained), -2 if the stream broke
+int receive_delta_file(int s1_socket, struct delta_basis *basis, long payload_length, const char *full_path)
+{
+    // Reading size of the new content
+    char size_text[32];
+    if (recv_frame_payload(s1_socket, payload_length, size_text, sizeof(size_text)) == -1)
+    {
+        return -2;
+    }
+    char *end;
+    long file_size = strtol(size_text, &end, 10);
+    if (end == size_text || *end != '\0' || file_size < 0)
+    {
+        file_size = -1;
+    }
+
+    // Preparing scratch file and hash
+    char temp_path[MAX_PATH];
+    FILE *file = (file_size == -1) ? NULL : blob_open_temp(temp_path, sizeof(temp_path));
+    EVP_MD_CTX *digest = EVP_MD_CTX_new();
+    int ready = file != NULL && digest != NULL && EVP_DigestInit_ex(digest, EVP_sha256(), NULL) == 1;
+    printf("[S2] Receiving %s as a delta against %d stored chunks\n", full_path, basis->chunk_count);
+    int result = receive_delta_body(s1_socket, basis, file_size, ready ? fileno(file) : -1, digest);
+
+    // Checking rebuilt content is what the client hashed
+    unsigned char hash[BLOB_HASH_SIZE];
+    if (result == 0)
+    {
+        char hex[2 * BLOB_HASH_SIZE + 1];
+        if (EVP_DigestFinal_ex(digest, hash, NULL) != 1)
+        {
+            result = -1;
+        }
+        blob_hash_hex(hash, hex);
+        if (result == 0 && strcmp(hex, basis->hex) != 0)
+        {
+            printf("[S2] ERROR: Rebuilt %s does not match the offered content\n", full_path);
+            result = -1;
+        }
+    }
+    EVP_MD_CTX_free(digest);
+    if (file != NULL && fclose(file) != 0)
+    {
+        result = (result == 0) ? -1 : result;
+    }
+
+    // Replacing the old copy (through the blob store in --dedup mode)
+    if (result == 0)
+    {
+        if (store_deduplicated)
+        {
+            result = blob_commit(temp_path, hash, full_path);
+        }
+        else
+        {
+            blob_release(full_path);
+            result = (rename(temp_path, full_path) == -1) ? -1 : 0;
+        }
+    }
+    if (result != 0 && file != NULL)
+    {
+        printf("[S2] ERROR: Failed to store file %s\n", full_path);
+        unlink(temp_path);
+    }
+    if (result == 0)
+    {
+        printf("[S2] File received successfully: %s\n", full_path);
+    }
+    return result;
+}
+
+/*=== FILE TRANSFER FUNCTIONS ===*/
+
+// Sending file to S1 server as one FILE frame
+// Returns 0 on success, -1 if the file could not be opened (nothing sent), -2 if the stream broke
+int send_file_to_S1(int s1_socket, const char *full_path)
+{
+    // Storing file size
+    long file_size;
+    // Creating stat structure for file metadata
+    struct stat st;
+
+    printf("[S2] Preparing to send file: %s\n", full_path);
+
+    // Opening file for reading
+    int file_fd = open(full_path, O_RDONLY);
+    if (file_fd == -1)
+    {
+        printf("[S2] ERROR: File not found: %s\n", full_path);
+        return -1;
+    }
+
+    // Getting file size from metadata
+    if (fstat(file_fd, &st) == -1)
+    {
+        printf("[S2] ERROR: Cannot read file size: %s\n", full_path);
+        close(file_fd);
+        return -1;
+    }
+    file_size = st.st_size;
+
+    printf("[S2] File size: %ld bytes\n", file_size);
+
+    // Sending FILE frame header announcing the size
+    if (send_frame_header(s1_socket, FRAME_FILE, STATUS_OK, file_size) == -1)
+    {
+        printf("[S2] ERROR: Failed to send file header to S1\n");
+        close(file_fd);
+        return -2;
+    }
+    printf("[S2] File header sent to S1\n");
+
+    printf("[S2] Starting file transfer\n");
+    // Sending file data with zero-copy transmit
+    if (transmit_file_data(s1_socket, file_fd, file_size) == -1)
+    {
+        close(file_fd);
+        return -2;
+    }
+
+    // Closing file
+    close(file_fd);
+    printf("[S2] File sent successfully\n");
+    return 0;
+}
+
+// Finding the size of the content a blob holds, or -1 when there is no such blob
+long blob_content_size(const char *blob)
+{
+    struct stat st;
+    if (stat(blob, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        return -1;
+    }
+    return st.st_size;
+}
+
+// Answering the content hash S1 offers ahead of a body ("<size> <sha256> [DELTA]", hash-first uploadf)
+// When the blob store already holds that content the path is linked to it and no body follows;
+// when the client can send a delta and a copy to rebuild against is stored, the hashes of its
+// chunks are sent (RESPONSE "DELTA" and a DATA frame) and basis is kept open for the delta;
+// otherwise S1 is told to send the body
+// Returns 0 when linked, 1 when the body was asked for, 2 when a delta was asked for, -2 if the stream broke
+int answer_content_offer(int s1_socket, long payload_length, const char *filename, const char *filepath,
+                         struct delta_basis *basis)
+{
+    char offer[128];
+    if (recv_frame_payload(s1_socket, payload_length, offer, sizeof(offer)) == -1)
+    {
+        return -2;
+    }
+    char full_path[MAX_PATH];
+    snprintf(full_path, sizeof(full_path), "%s/%s", filepath, filename);
+
+    // Only well-formed hashes are looked up, since they become part of a path
+    long file_size;
+    char hex[2 * BLOB_HASH_SIZE + 2];
+    char mode[16] = "";
+    int valid = sscanf(offer, "%ld %65s %15s", &file_size, hex, mode) >= 2 &&
+                strlen(hex) == 2 * BLOB_HASH_SIZE && strspn(hex, "0123456789abcdef") == 2 * BLOB_HASH_SIZE;
+    if (store_deduplicated && valid)
+    {
+        char blob[MAX_PATH];
+        blob_path(hex, blob, sizeof(blob));
+        char filepath_copy[MAX_PATH];
+        snprintf(filepath_copy, sizeof(filepath_copy), "%s", filepath);
+        if (blob_content_size(blob) == file_size && create_full_directories(filepath_copy) == 0 &&
+            blob_link_path(blob, full_path) == 0)
+        {
+            printf("[S2] Linked %s to stored content %.12s without a transfer\n", full_path, hex);
+            return 0;
+        }
+    }
+
+    // Offering chunks of the copy being replaced, so only the changed ones are sent
+    struct stat st;
+    if (valid && strcmp(mode, "DELTA") == 0 && file_size >= DELTA_MIN_SIZE && lstat(full_path, &st) == 0 &&
+        S_ISREG(st.st_mode))
+    {
+        unsigned char *signatures = load_delta_basis(basis, full_path);
+        if (signatures != NULL)
+        {
+            strcpy(basis->hex, hex);
+            printf("[S2] Offering %d chunks of %s for a delta upload\n", basis->chunk_count, full_path);
+            int sent = send_text_frame(s1_socket, FRAME_RESPONSE, STATUS_NOT_FOUND, "DELTA") != -1 &&
+                       send_frame(s1_socket, FRAME_DATA, STATUS_OK, signatures,
+                                  (long)basis->chunk_count * BLOB_HASH_SIZE) != -1;
+            free(signatures);
+            return sent ? 2 : -2;
+        }
+    }
+
+    printf("[S2] Content of %s not stored yet, asking for it\n", filename);
+    return (send_text_frame(s1_socket, FRAME_RESPONSE, STATUS_NOT_FOUND, "SEND") == -1) ? -2 : 1;
+}
+
+// Receiving the FILE frame that follows a STORE command
+// A hash-first upload sends a DIGEST frame first; the FILE frame only follows when asked for,
+// and a DELTA frame replaces it when a delta was asked for
+// Returns 0 when stored, -1 when it could not be stored (frame consumed), -2 if the stream broke
+int receive_file_from_S1(int s1_socket, const char *filename, const char *filepath)
+{
+    // Creating complete path including filename
+    char full_path[MAX_PATH];
+    // Creating buffer for reading file data chunks
+    char buffer[BUFFER_SIZE];
+    // Creating file pointer for writing
+    FILE *file;
+    // Storing incoming file size
+    long file_size;
+    // Tracking total bytes received
+    long total_received = 0;
+
+    printf("[S2] Preparing to receive file: %s\n", filename);
+
+    // Receiving FILE frame header from S1
+    int type, status;
+    if (recv_frame_header(s1_socket, &type, &status, &file_size) == -1)
+    {
+        printf("[S2] ERROR: Failed to receive file header\n");
+        return -2;
+    }
+    if (type == FRAME_DIGEST)
+    {
+        struct delta_basis basis = {-1, 0, NULL, ""};
+        int offer = answer_content_offer(s1_socket, file_size, filename, filepath, &basis);
+        if (offer == 0 || offer == -2)
+        {
+            free_delta_basis(&basis);
+            return offer;
+        }
+        if (recv_frame_header(s1_socket, &type, &status, &file_size) == -1)
+        {
+            printf("[S2] ERROR: Failed to receive file header\n");
+            free_delta_basis(&basis);
+            return -2;
+        }
+
+        // Rebuilding file from the chunks offered and the new bytes
+        if (offer == 2 && type == FRAME_DELTA)
+        {
+            snprintf(full_path, sizeof(full_path), "%s/%s", filepath, filename);
+            int result = receive_delta_file(s1_socket, &basis, file_size, full_path);
+            free_delta_basis(&basis);
+            return result;
+        }
+        free_delta_basis(&basis);
+    }
+    if (type != FRAME_FILE)
+    {
+        printf("[S2] ERROR: Expected file data, got frame type %d\n", type);
+        return skip_frame_payload(s1_socket, file_size) == -1 ? -2 : -1;
+    }
+    if (status != STATUS_OK)
+    {
+        // Client had no such file, so no data follows
+        printf("[S2] ERROR: No file data for %s\n", filename);
+        return skip_frame_payload(s1_socket, file_size) == -1 ? -2 : -1;
+    }
+    printf("[S2] File size: %ld bytes\n", file_size);
+
+    // Creating mutable copy of filepath for directory creation
+    char filepath_copy[MAX_PATH];
+    strcpy(filepath_copy, filepath);
+
+    // Creating the directory structure if it doesn't exist
+    if (create_full_directories(filepath_copy) == -1)
+    {
+        printf("[S2] ERROR: Failed to create directory structure\n");
+        // Consuming data so the connection stays usable
+        return skip_frame_payload(s1_socket, file_size) == -1 ? -2 : -1;
+    }
+
+    // Building complete path for file storage
+    snprintf(full_path, sizeof(full_path), "%s/%s", filepath, filename);
+    printf("[S2] Saving file to: %s\n", full_path);
+
+    // Receiving into a blob store file in --dedup mode, hashing the body on the way;
+    // otherwise writing the path in place (after unsharing it from any blob)
+    char write_path[MAX_PATH];
+    EVP_MD_CTX *digest = NULL;
+    if (store_deduplicated)
+    {
+        digest = EVP_MD_CTX_new();
+        file = blob_open_temp(write_path, sizeof(write_path));
+        if (digest == NULL || EVP_DigestInit_ex(digest, EVP_sha256(), NULL) != 1)
+        {
+            if (file != NULL)
+            {
+                fclose(file);
+                remove(write_path);
+            }
+            file = NULL;
+        }
+    }
+    else
+    {
+        blob_detach(full_path);
+        strcpy(write_path, full_path);
+        file = fopen(write_path, "wb");
+    }
+    if (file == NULL)
+    {
+        printf("[S2] ERROR: Failed to create file %s\n", full_path);
+        EVP_MD_CTX_free(digest);
+        // Consuming data so the connection stays usable
+        return skip_frame_payload(s1_socket, file_size) == -1 ? -2 : -1;
+    }
 
-        // Accepting connection from S1
-        int s1_socket = accept(server_socket, NULL, NULL);
-        if (s1_socket == -1)
+    printf("[S2] Starting file transfer\n");
+    // Receiving file data in chunks
+    while (total_received < file_size)
+    {
+        // Receiving data chunk from S1, never reading past the end of the frame
+        long remaining = file_size - total_received;
+        int to_receive = (remaining > BUFFER_SIZE) ? BUFFER_SIZE : remaining;
+        int bytes_received = recv(s1_socket, buffer, to_receive, 0);
+        if (bytes_received <= 0)
         {
-            printf("[S2] ERROR: Failed to accept connection\n");
-            continue;
+            printf("[S2] ERROR: Failed to receive file data\n");
+            fclose(file);
+            remove(write_path);
+            EVP_MD_CTX_free(digest);
+            return -2;
+        }
+
+        // Writing received data to file
+        int bytes_written = fwrite(buffer, 1, bytes_received, file);
+        if (bytes_written != bytes_received)
+        {
+            printf("[S2] ERROR: Failed to write data to file\n");
+            fclose(file);
+            remove(write_path);
+            EVP_MD_CTX_free(digest);
+            // Skipping what is left of this file
+            total_received += bytes_received;
+            return skip_frame_payload(s1_socket, file_size - total_received) == -1 ? -2 : -1;
+        }
+
+        // Updating total received
+        total_received += bytes_received;
+        if (digest != NULL)
+        {
+            EVP_DigestUpdate(digest, buffer, bytes_received);
         }
+    }
+
+    // Closing file, checking buffered data made it to disk
+    int failed = fclose(file) != 0;
+
+    // Moving body into place through the blob store
+    if (digest != NULL)
+    {
+        unsigned char hash[BLOB_HASH_SIZE];
+        failed = failed || EVP_DigestFinal_ex(digest, hash, NULL) != 1 ||
+                 blob_commit(write_path, hash, full_path) == -1;
+        EVP_MD_CTX_free(digest);
+    }
+    if (failed)
+    {
+        printf("[S2] ERROR: Failed to store file %s\n", full_path);
+        remove(write_path);
+        return -1;
+    }
+    printf("[S2] File received successfully: %s\n", full_path);
+    return 0;
+}
+
+/*=== CONNECTION HANDLING FUNCTIONS ===*/
+
+// Serving every command S1 sends over one connection until it disconnects
+void handle_s1_connection(int s1_socket)
+{
+    printf("[S2] S1 connected successfully\n");
+
+    // Creating buffer to store commands from S1
+    char command[1024];
 
-        printf("[S2] S1 connected successfully\n");
+    // Inner loop - keep processing commands from S1
+    while (1)
+    {
+        // Clearing command buffer
+        memset(command, 0, sizeof(command));
 
-        // Creating buffer to store commands from S1
-        char command[1024];
+        // Receiving next COMMAND frame from S1
+        int status;
+        int bytes = recv_text_frame(s1_socket, FRAME_COMMAND, &status, command, sizeof(command));
 
-        // Inner loop - keep processing commands from S1
-        while (1)
+        // Checking if S1 disconnected
+        if (bytes == -1)
         {
-            // Clearing command buffer
-            memset(command, 0, sizeof(command));
+            printf("[S2] S1 disconnected\n");
+            break;
+        }
+
+        printf("\n[S2] Processing command: %s\n", command);
 
-            // Receiving command from S1
-            int bytes = recv(s1_socket, command, sizeof(command) - 1, 0);
+        /*=== STORE COMMAND PROCESSING ===*/
+        if (strncmp(command, "STORE", 5) == 0)
+        {
+            // Declaring variables for filename and filepath
+            char filename[256], filepath[MAX_PATH];
 
-            // Checking if S1 disconnected
-            if (bytes <= 0)
+            // Parsing command to extract filename and filepath
+            if (sscanf(command, "STORE %s %s", filename, filepath) == 2)
             {
-                printf("[S2] S1 disconnected\n");
-                break;
+                printf("[S2] Storing %s in %s\n", filename, filepath);
+
+                // Receiving the FILE frame that follows the command
+                int result = receive_file_from_S1(s1_socket, filename, filepath);
+
+                // Marking member changed even on failure - a replaced file may already be gone
+                // (a path that does not fit is not cut short, which would mark some other member)
+                char stored_path[MAX_PATH];
+                int fits = snprintf(stored_path, sizeof(stored_path), "%s/%s", filepath, filename) <
+                           (int)sizeof(stored_path);
+                tar_cache_mark_changed(&archive_cache, fits ? stored_path : NULL);
+                if (result == -2)
+                {
+                    printf("[S2] ERROR: Connection broke while storing file\n");
+                    break;
+                }
+                if (result == 0)
+                {
+                    // Sending success status to S1
+                    send_text_frame(s1_socket, FRAME_RESPONSE, STATUS_OK, "SUCCESS");
+                    printf("[S2] File stored successfully\n");
+                }
+                else
+                {
+                    // Sending error status to S1
+                    send_text_frame(s1_socket, FRAME_RESPONSE, STATUS_ERROR, "ERROR");
+                    printf("[S2] ERROR: Failed to store file\n");
+                }
+            }
+            else
+            {
+                printf("[S2] ERROR: Invalid STORE command format\n");
+                // Dropping the file data that follows so the connection stays in sync
+                if (skip_frame(s1_socket) == -1)
+                {
+                    break;
+                }
+                // Sending format error status to S1
+                send_text_frame(s1_socket, FRAME_RESPONSE, STATUS_BAD_REQUEST, "FORMAT ERROR");
             }
+        }
 
-            // Adding null terminator to command
-            command[bytes] = '\0';
-            printf("\n[S2] Processing command: %s\n", command);
+        /*=== RETRIEVE COMMAND PROCESSING ===*/
+        else if (strncmp(command, "RETRIEVE", 8) == 0)
+        {
+            // Declaring variable for filepath
+            char filepath[MAX_PATH];
 
-            /*=== STORE COMMAND PROCESSING ===*/
-            if (strncmp(command, "STORE", 5) == 0)
+            // Parsing command to extract filepath
+            if (sscanf(command, "RETRIEVE %s", filepath) == 1)
             {
-                // Declaring variables for filename and filepath
-                char filename[256], filepath[MAX_PATH];
+                printf("[S2] Retrieving from filepath: %s\n", filepath);
 
-                // Parsing command to extract filename and filepath
-                if (sscanf(command, "STORE %s %s", filename, filepath) == 2)
+                // Sending file to S1
+                int result = send_file_to_S1(s1_socket, filepath);
+                if (result == -2)
                 {
-                    printf("[S2] Storing %s in %s\n", filename, filepath);
-
-                    // Sending ready status to S1
-                    send(s1_socket, "READY", 5, 0);
-
-                    // Receiving file from S1
-                    if (receive_file_from_S1(s1_socket, filename, filepath) == 0)
-                    {
-                        // Sending success status to S1
-                        send(s1_socket, "SUCCESS", 7, 0);
-                        printf("[S2] File stored successfully\n");
-                    }
-                    else
-                    {
-                        // Sending error status to S1
-                        send(s1_socket, "ERROR", 5, 0);
-                        printf("[S2] ERROR: Failed to store file\n");
-                    }
+                    printf("[S2] ERROR: Connection broke while sending file\n");
+                    break;
+                }
+                if (result == 0)
+                {
+                    printf("[S2] File sent successfully\n");
                 }
                 else
                 {
-                    printf("[S2] ERROR: Invalid STORE command format\n");
-                    // Sending format error status to S1
-                    send(s1_socket, "FORMAT ERROR", 12, 0);
+                    // Answering with a response instead of file data
+                    send_text_frame(s1_socket, FRAME_RESPONSE, STATUS_NOT_FOUND, "ERROR: File not found");
+                    printf("[S2] ERROR: Failed to send file\n");
                 }
             }
+            else
+            {
+                printf("[S2] ERROR: Invalid RETRIEVE command format\n");
+                // Sending format error status to S1
+                send_text_frame(s1_socket, FRAME_RESPONSE, STATUS_BAD_REQUEST, "FORMAT ERROR");
+            }
+        }
+
+        /*=== DELETE COMMAND PROCESSING ===*/
+        else if (strncmp(command, "DELETE", 6) == 0)
+        {
+            // Declaring variable for filepath
+            char filepath[MAX_PATH];
 
-            /*=== RETRIEVE COMMAND PROCESSING ===*/
-            else if (strncmp(command, "RETRIEVE", 8) == 0)
+            // Parsing command to extract filepath
+            if (sscanf(command, "DELETE %s", filepath) == 1)
             {
-                // Declaring variable for filepath
-                char filepath[MAX_PATH];
+                printf("[S2] Attempting to delete file: %s\n", filepath);
 
-                // Parsing command to extract filepath
-                if (sscanf(command, "RETRIEVE %s", filepath) == 1)
+                // Deleting file
+                int result = delete_file(filepath);
+                tar_cache_mark_changed(&archive_cache, filepath);
+                if (result == 0)
                 {
-                    printf("[S2] Retrieving from filepath: %s\n", filepath);
-
-                    // Sending file to S1
-                    if (send_file_to_S1(s1_socket, filepath) == 0)
-                    {
-                        printf("[S2] File sent successfully\n");
-                        // Cleaning up tar file after successful transfer
-                        if (remove(filepath) == 0)
-                        {
-                            printf("[S2] Cleaned up tar file: %s\n", filepath);
-                        }
-                        else
-                        {
-                            printf("[S2] Warning: Failed to clean up tar file: %s\n", filepath);
-                        }
-                    }
-                    else
-                    {
-                        // Sending error status to S1
-                        send(s1_socket, "ERROR", 5, 0);
-                        printf("[S2] ERROR: Failed to send file\n");
-                    }
+                    // Remembering deletion for incremental archives
+                    record_tombstone(TAR_CACHE_ROOT, filepath);
+                    // Sending success status to S1
+                    send_text_frame(s1_socket, FRAME_RESPONSE, STATUS_OK, "SUCCESS");
+                    printf("[S2] File deleted successfully\n");
                 }
                 else
                 {
-                    printf("[S2] ERROR: Invalid RETRIEVE command format\n");
-                    // Sending format error status to S1
-                    send(s1_socket, "FORMAT ERROR", 12, 0);
+                    // Sending error status to S1
+                    send_text_frame(s1_socket, FRAME_RESPONSE, STATUS_ERROR, "ERROR");
+                    printf("[S2] ERROR: Unable to delete file\n");
                 }
             }
+            else
+            {
+                printf("[S2] ERROR: Invalid DELETE command format\n");
+                // Sending format error status to S1
+                send_text_frame(s1_socket, FRAME_RESPONSE, STATUS_BAD_REQUEST, "FORMAT ERROR");
+            }
+        }
+
+        /*=== CREATETAR COMMAND PROCESSING ===*/
+        else if (strncmp(command, "CREATETAR", 9) == 0)
+        {
+            char root_path[MAX_PATH];
+            long since = 0;
 
-            /*=== DELETE COMMAND PROCESSING ===*/
-            else if (strncmp(command, "DELETE", 6) == 0)
+            // Parsing command to extract root directory path and optional SINCE cutoff
+            int argc = sscanf(command, "CREATETAR %s SINCE %ld", root_path, &since);
+            if (argc >= 1)
             {
-                // Declaring variable for filepath
-                char filepath[MAX_PATH];
+                printf("[S2] Processing CREATETAR command\n");
+                printf("[S2] Streaming PDF tar from: %s\n", root_path);
 
-                // Parsing command to extract filepath
-                if (sscanf(command, "DELETE %s", filepath) == 1)
+                // Converting path from ~/S2 format to actual directory
+                char actual_path[MAX_PATH];
+                if (strncmp(root_path, "~/S2", 4) == 0)
+                {
+                    strcpy(actual_path, "S2");
+                }
+                else
                 {
-                    printf("[S2] Attempting to delete file: %s\n", filepath);
+                    strcpy(actual_path, root_path);
+                }
 
-                    // Deleting file
-                    if (delete_file(filepath) == 0)
-                    {
-                        // Sending success status to S1
-                        send(s1_socket, "SUCCESS", 7, 0);
-                        printf("[S2] File deleted successfully\n");
-                    }
-                    else
-                    {
-                        // Sending error status to S1
-                        send(s1_socket, "ERROR", 5, 0);
-                        printf("[S2] ERROR: Unable to delete file\n");
-                    }
+                // Serving the storage root from the cached archive, other directories by walking them
+                // (incremental requests always walk, keeping only files changed since the cutoff)
+                int member_count;
+                if (argc == 1 && strcmp(actual_path, TAR_CACHE_ROOT) == 0)
+                {
+                    member_count = stream_cached_tar_members(s1_socket, ".pdf");
                 }
                 else
                 {
-                    printf("[S2] ERROR: Invalid DELETE command format\n");
-                    // Sending format error status to S1
-                    send(s1_socket, "FORMAT ERROR", 12, 0);
+                    member_count = stream_tar_members(s1_socket, actual_path, ".pdf", since);
+                }
+                if (member_count == -1)
+                {
+                    printf("[S2] ERROR: Connection broke while streaming tar\n");
+                    break;
+                }
+
+                // Listing files deleted since the cutoff after the changed members
+                if (argc == 2)
+                {
+                    long deleted_length = 0;
+                    char *deleted = collect_tombstones(TAR_CACHE_ROOT, ".pdf", since, &deleted_length);
+                    int sent = send_frame(s1_socket, FRAME_LIST, STATUS_OK, deleted != NULL ? deleted : "", deleted_length);
+                    free(deleted);
+                    if (sent == -1)
+                    {
+                        printf("[S2] ERROR: Connection broke while sending deletions\n");
+                        break;
+                    }
                 }
-            }
 
-            /*=== CREATETAR COMMAND PROCESSING ===*/
-            else if (strncmp(command, "CREATETAR", 9) == 0)
+                // Closing the stream so S1 knows every member has arrived
+                send_frame(s1_socket, FRAME_END, STATUS_OK, "", 0);
+                printf("[S2] Tar stream of %d PDF files sent to S1\n", member_count);
+            }
+            else
             {
-                char root_path[MAX_PATH];
+                printf("[S2] ERROR: Invalid CREATETAR command format\n");
+                send_text_frame(s1_socket, FRAME_END, STATUS_BAD_REQUEST, "TAR_ERROR");
+            }
+        }
 
-                // Parsing command to extract root directory path
-                if (sscanf(command, "CREATETAR %s", root_path) == 1)
-                {
-                    printf("[S2] Processing CREATETAR command\n");
-                    printf("[S2] Creating PDF tar file from: %s\n", root_path);
+        /*=== LIST COMMAND PROCESSING ===*/
+        else if (strncmp(command, "LIST", 4) == 0)
+        {
+            // Declaring variable for directory path
+            char directory_path[MAX_PATH];
 
-                    // Converting path from ~/S2 format to actual directory
-                    char actual_path[MAX_PATH];
-                    if (strncmp(root_path, "~/S2", 4) == 0)
+            // Parsing command to extract directory path
+            if (sscanf(command, "LIST %s", directory_path) == 1)
+            {
+                printf("[S2] Preparing list for directory path: %s\n", directory_path);
+
+                // Reading stream options: LIST path STREAM [AFTER hex-name] [COUNT n], and for a
+                // filtered listing STAT [RECURSIVE] [NAME hex-pattern] [MINSIZE n] [MAXSIZE n]
+                // [NEWER time] [OLDER time]
+                int stream = 0;
+                char after[256] = "";
+                long count = -1;
+                int filtered = 0;
+                struct list_filter filter = {0, "", -1, -1, -1, -1};
+                int valid = 1;
+                char command_copy[1024];
+                snprintf(command_copy, sizeof(command_copy), "%s", command);
+                char *save_ptr;
+                char *word = strtok_r(command_copy, " ", &save_ptr);
+                word = strtok_r(NULL, " ", &save_ptr);
+                while ((word = strtok_r(NULL, " ", &save_ptr)) != NULL)
+                {
+                    char *value = NULL;
+                    long *bound = (strcmp(word, "MINSIZE") == 0) ? &filter.min_size :
+                                  (strcmp(word, "MAXSIZE") == 0) ? &filter.max_size :
+                                  (strcmp(word, "NEWER") == 0)   ? &filter.newer :
+                                  (strcmp(word, "OLDER") == 0)   ? &filter.older : NULL;
+                    if (strcmp(word, "STREAM") == 0)
                     {
-                        strcpy(actual_path, "S2");
+                        stream = 1;
                     }
-                    else
+                    else if (strcmp(word, "STAT") == 0)
                     {
-                        strcpy(actual_path, root_path);
+                        filtered = 1;
                     }
-
-                    // Creating tar file in server directory
-                    char tar_filename[] = "pdffiles.tar";
-
-                    // Creating tar file for PDF files
-                    if (create_tar_file(actual_path, ".pdf", tar_filename) == 0)
+                    else if (strcmp(word, "RECURSIVE") == 0)
                     {
-                        // Building tar file path to send back to S1
-                        char tar_path[MAX_PATH];
-                        snprintf(tar_path, sizeof(tar_path), "S2/%s", tar_filename);
-
-                        // Sending tar file path back to S1
-                        send(s1_socket, tar_path, strlen(tar_path), 0);
-                        printf("[S2] TAR file created and path sent to S1: %s\n", tar_path);
+                        filter.recursive = 1;
+                    }
+                    else if (strcmp(word, "NAME") == 0 && (value = strtok_r(NULL, " ", &save_ptr)) != NULL)
+                    {
+                        valid = valid && decode_list_name(value, filter.pattern, sizeof(filter.pattern)) == 0;
+                    }
+                    else if (bound != NULL && (value = strtok_r(NULL, " ", &save_ptr)) != NULL)
+                    {
+                        char *end;
+                        *bound = strtol(value, &end, 10);
+                        valid = valid && end != value && *end == '\0' && *bound >= 0;
+                    }
+                    else if (strcmp(word, "AFTER") == 0 && (value = strtok_r(NULL, " ", &save_ptr)) != NULL)
+                    {
+                        valid = valid && decode_list_name(value, after, sizeof(after)) == 0;
+                    }
+                    else if (strcmp(word, "COUNT") == 0 && (value = strtok_r(NULL, " ", &save_ptr)) != NULL)
+                    {
+                        char *end;
+                        count = strtol(value, &end, 10);
+                        valid = valid && end != value && *end == '\0' && count >= 0;
                     }
                     else
                     {
-                        // Sending error response to S1
-                        send(s1_socket, "TAR_ERROR", 9, 0);
-                        printf("[S2] ERROR: Failed to create PDF tar file\n");
+                        valid = 0;
                     }
                 }
-                else
+
+                // Filter conditions only apply to streamed listings that ask for STAT
+                valid = valid && (!filtered || stream) &&
+                        (filtered || (filter.recursive == 0 && filter.pattern[0] == '\0' && filter.min_size == -1 &&
+                                      filter.max_size == -1 && filter.newer == -1 && filter.older == -1));
+                if (!valid)
                 {
-                    printf("[S2] ERROR: Invalid CREATETAR command format\n");
-                    send(s1_socket, "TAR_ERROR", 9, 0);
+                    printf("[S2] ERROR: Invalid LIST options\n");
+                    send_text_frame(s1_socket, stream ? FRAME_END : FRAME_LIST, STATUS_BAD_REQUEST, "");
                 }
-            }
-
-            /*=== LIST COMMAND PROCESSING ===*/
-            else if (strncmp(command, "LIST", 4) == 0)
-            {
-                // Declaring variable for directory path
-                char directory_path[MAX_PATH];
-
-                // Parsing command to extract directory path
-                if (sscanf(command, "LIST %s", directory_path) == 1)
+                else if (stream)
                 {
-                    printf("[S2] Preparing list for directory path: %s\n", directory_path);
-
-                    // Sending file list to S1
-                    if (send_filelist_to_S1(s1_socket, directory_path, ".pdf") == 0)
+                    // Streaming names in order (files passing the filter, with their size and time)
+                    if (stream_filelist_to_S1(s1_socket, directory_path, ".pdf", after, count,
+                                              filtered ? &filter : NULL) == 0)
                     {
                         printf("[S2] List of files sent successfully\n");
                     }
@@ -631,35 +3274,174 @@ int main()
                         printf("[S2] ERROR: Failed to send list of files\n");
                     }
                 }
+                // Sending file list to S1
+                else if (send_filelist_to_S1(s1_socket, directory_path, ".pdf") == 0)
+                {
+                    printf("[S2] List of files sent successfully\n");
+                }
                 else
                 {
-                    printf("[S2] ERROR: Invalid LIST command format\n");
-                    // Sending format error status to S1
-                    send(s1_socket, "FORMAT ERROR", 12, 0);
+                    printf("[S2] ERROR: Failed to send list of files\n");
                 }
             }
-
-            /*=== TEST COMMAND PROCESSING ===*/
-            else if (strncmp(command, "TEST", 4) == 0)
-            {
-                printf("[S2] Received test command\n");
-                // Sending working response to S1
-                send(s1_socket, "S2_OK", 5, 0);
-                printf("[S2] Sent OK response to S1\n");
-            }
-
-            /*=== UNKNOWN COMMAND HANDLING ===*/
             else
             {
-                printf("[S2] WARNING: Unknown command received: %s\n", command);
-                // Sending generic OK response
-                send(s1_socket, "OK", 2, 0);
+                printf("[S2] ERROR: Invalid LIST command format\n");
+                // Sending format error status to S1
+                send_text_frame(s1_socket, FRAME_RESPONSE, STATUS_BAD_REQUEST, "FORMAT ERROR");
             }
         }
 
-        // Closing connection to S1
-        close(s1_socket);
-        printf("[S2] Connection to S1 closed\n");
+        /*=== TEST COMMAND PROCESSING ===*/
+        else if (strncmp(command, "TEST", 4) == 0)
+        {
+            printf("[S2] Received test command\n");
+            // Sending working response to S1
+            send_text_frame(s1_socket, FRAME_RESPONSE, STATUS_OK, "S2_OK");
+            printf("[S2] Sent OK response to S1\n");
+        }
+
+        /*=== UNKNOWN COMMAND HANDLING ===*/
+        else
+        {
+            printf("[S2] WARNING: Unknown command received: %s\n", command);
+            // Telling S1 the command is not supported
+            send_text_frame(s1_socket, FRAME_RESPONSE, STATUS_UNSUPPORTED, "ERROR: Unknown command");
+        }
+    }
+
+    // Closing connection to S1
+    close(s1_socket);
+    printf("[S2] Connection to S1 closed\n");
+}
+
+// Thread body - serving one S1 connection so transfers run in parallel
+void *connection_thread(void *arg)
+{
+    // Taking ownership of the socket handed over by main
+    int s1_socket = *(int *)arg;
+    free(arg);
+
+    handle_s1_connection(s1_socket);
+    return NULL;
+}
+
+/*=== MAIN FUNCTION ===*/
+
+// Main function - S2 PDF server entry point
+int main(int argc, char *argv[])
+{
+    // Reading options (--dedup stores each distinct content once)
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--dedup") == 0)
+        {
+            store_deduplicated = 1;
+        }
+        else
+        {
+            printf("Usage: %s [--dedup]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    // Printing startup message
+    printf("S2 - PDF File Server\n");
+    printf("Starting on port %d\n", PORT);
+    if (store_deduplicated)
+    {
+        printf("Deduplicating stored files in %s\n", BLOB_STORE_DIR);
+    }
+
+    // Creating socket for S2 server
+    printf("[S2] Creating server socket\n");
+    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_socket == -1)
+    {
+        printf("[S2] ERROR: Failed to create socket\n");
+        exit(1);
+    }
+
+    // Setting socket option to reuse address
+    printf("[S2] Setting socket options\n");
+    int opt = 1;
+    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
+    {
+        printf("[S2] WARNING: Failed to set socket options\n");
+    }
+
+    // Creating address structure for S2
+    printf("[S2] Configuring server address\n");
+    struct sockaddr_in addr = {0};
+    // Setting protocol family to IPv4
+    addr.sin_family = AF_INET;
+    // Setting to accept connections from any IP address
+    addr.sin_addr.s_addr = INADDR_ANY;
+    // Converting port number to network format
+    addr.sin_port = htons(PORT);
+
+    // Binding socket to address
+    printf("[S2] Binding socket to address\n");
+    if (bind(server_socket, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        printf("[S2] ERROR: Failed to bind socket\n");
+        close(server_socket);
+        exit(1);
+    }
+
+    // Starting to listen for S1 connections
+    printf("[S2] Starting to listen for connections\n");
+    if (listen(server_socket, LISTEN_BACKLOG) == -1)
+    {
+        printf("[S2] ERROR: Failed to listen on socket\n");
+        close(server_socket);
+        exit(1);
+    }
+
+    printf("\n[S2] Server is ready and waiting for S1 connections\n");
+    printf("[S2] Listening on port %d\n", PORT);
+
+    // Ignoring SIGPIPE so a vanished S1 only fails the send on its own connection
+    signal(SIGPIPE, SIG_IGN);
+
+    // Creating detached threads so finished connections clean up after themselves
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+
+    // Main server loop - keep accepting S1 connections
+    while (1)
+    {
+        printf("[S2] Waiting for S1 connection\n");
+
+        // Accepting connection from S1
+        int s1_socket = accept(server_socket, NULL, NULL);
+        if (s1_socket == -1)
+        {
+            printf("[S2] ERROR: Failed to accept connection\n");
+            continue;
+        }
+
+        // Handing connection to its own thread so one long transfer does not block others
+        int *socket_arg = malloc(sizeof(int));
+        if (socket_arg == NULL)
+        {
+            printf("[S2] ERROR: Out of memory for connection\n");
+            close(s1_socket);
+            continue;
+        }
+        *socket_arg = s1_socket;
+
+        pthread_t thread;
+        if (pthread_create(&thread, &thread_attr, connection_thread, socket_arg) != 0)
+        {
+            printf("[S2] ERROR: Failed to start connection thread\n");
+            free(socket_arg);
+            close(s1_socket);
+            continue;
+        }
+
+        printf("[S2] S1 connection handed to worker thread\n");
     }
 
     // This code never executes due to infinite loop
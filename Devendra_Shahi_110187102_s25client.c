@@ -6,12 +6,101 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <zlib.h>
+#include <openssl/evp.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 // Server connection details
 #define S1_PORT 4301
 #define BUFFER_SIZE 4096
 #define MAX_PATH 1024
 
+// Defining bulk transfer sizes (zero-copy chunk and copy fallback buffer)
+#define TRANSMIT_CHUNK_SIZE 1048576
+#define TRANSMIT_BUFFER_SIZE 65536
+
+// Framed protocol version and header size (version, type, status, 64-bit length)
+#define FRAME_VERSION 1
+#define FRAME_HEADER_SIZE 12
+
+// Frame types
+#define FRAME_COMMAND 1
+#define FRAME_RESPONSE 2
+#define FRAME_FILE 3
+#define FRAME_NAME 4
+#define FRAME_LIST 5
+#define FRAME_DATA 6
+#define FRAME_END 7
+// Compressed file body: payload is the original size in decimal, followed by DATA frames
+// holding one chunk each until that many bytes are rebuilt
+#define FRAME_ZFILE 8
+// Content offered ahead of an uploadf body in hash-first sessions: payload is
+// "<size> <sha256 hex>", answered with HAVE (no body needed), SEND, or DELTA (in delta
+// sessions, with a DATA frame of chunk hashes of the stored copy)
+#define FRAME_DIGEST 9
+// Delta body sent after DELTA instead of a FILE frame: payload is the new size in decimal,
+// followed by DATA frames (literal bytes or a run of stored chunks to copy) and an END frame
+#define FRAME_DELTA 10
+
+// Encoding of a chunk after FRAME_ZFILE, carried in the DATA frame's status field
+#define CHUNK_STORED 0
+#define CHUNK_DEFLATE 1
+
+// Transfer codecs the session can agree on with HELLO
+#define CODEC_NONE 0
+#define CODEC_DEFLATE 1
+
+// Largest chunk of a compressed file body, and the (fast) deflate level used on the wire
+#define TRANSFER_CHUNK_SIZE 65536
+#define TRANSFER_LEVEL 1
+
+// Bytes in a SHA-256 content hash
+#define DIGEST_SIZE 32
+
+// Content-defined chunking for delta uploads: chunks of CDC_MIN_SIZE to CDC_MAX_SIZE bytes,
+// cut where the top CDC_BOUNDARY_BITS of a rolling hash are clear, with the gear table derived
+// from CDC_GEAR_SEED (all four must match the storage servers)
+#define CDC_MIN_SIZE 2048
+#define CDC_MAX_SIZE 65536
+#define CDC_BOUNDARY_BITS 13
+#define CDC_GEAR_SEED 0x6466732d63646331ULL
+
+// Instruction carried in the status field of each DATA frame of a delta body
+#define DELTA_LITERAL 0
+#define DELTA_COPY 1
+
+// Bytes sampled (in COMPRESS_SAMPLE_COUNT runs) to spot incompressible data, and the
+// entropy in bits per byte from which data is sent as it is
+#define COMPRESS_SAMPLE_SIZE 4096
+#define COMPRESS_SAMPLE_COUNT 16
+#define COMPRESS_ENTROPY_LIMIT 7.5
+
+// Largest LIST frame of names in a dispfnames listing
+#define LIST_CHUNK_SIZE 8192
+
+// Frame status codes
+#define STATUS_OK 0
+#define STATUS_PARTIAL 1
+#define STATUS_ERROR 2
+#define STATUS_NOT_FOUND 3
+#define STATUS_BAD_REQUEST 4
+#define STATUS_UNSUPPORTED 5
+
+// Transfer codec agreed with S1 at session start
+int session_codec = CODEC_NONE;
+// Set when S1 takes content hashes ahead of uploadf bodies
+int session_hash_first = 0;
+// Set when S1 may ask for uploadf bodies as deltas against stored copies
+int session_delta = 0;
+// Set when S1 sends dispfnames listings as a stream of LIST frames ended by an END frame
+int session_list_stream = 0;
+
 /*=== HELPER FUNCTIONS ===*/
 
 // Displaying help information for available commands
@@ -28,11 +117,18 @@ void display_help()
     printf("REMOVEF - Delete files from server\n");
     printf("  Command: removef filepath1 [filepath2]\n");
 
-    printf("DOWNLTAR - Download tar archive of specific file type\n");
-    printf("  Command: downltar filetype\n");
+    printf("DOWNLTAR - Download tar archive of one or more file types\n");
+    printf("  Command: downltar filetype [filetype...] | all [--since seconds] [--gzip]\n");
+    printf("  - --since keeps only files changed after that time and lists deletions in .dfs-deleted\n");
+    printf("  - --gzip downloads the archive compressed (.tar.gz)\n");
 
     printf("DISPFNAMES - Display files in directory\n");
-    printf("  Command: dispfnames pathname\n");
+    printf("  Command: dispfnames pathname [--page N] [--after TOKEN] [-r] [--name GLOB]\n");
+    printf("           [--min-size SIZE] [--max-size SIZE] [--newer AGE] [--older AGE]\n");
+    printf("  - --page shows N files and the --after token that continues the listing\n");
+    printf("  - -r includes subdirectories, --name keeps file names matching GLOB (e.g. report*, unquoted)\n");
+    printf("  - SIZE is bytes or 64K, 10M, 2G; AGE is seconds or 30m, 12h, 7d (--newer: changed within it)\n");
+    printf("  - Filtered listings are checked by the servers and show each file's size and time\n");
 
     printf("TEST - Test server connectivity\n");
     printf("  Command: TEST\n");
@@ -47,87 +143,916 @@ void display_help()
     printf("======================================================================\n");
 }
 
-/*=== FILE TRANSFER FUNCTIONS ===*/
+/*=== ZERO-COPY TRANSMIT FUNCTIONS ===*/
 
-// Sending file to S1 server
-int send_file_to_server(int s1_socket, const char *filename)
+// Sending exactly length bytes over socket
+int send_all(int s1_socket, const void *buffer, long length)
 {
-    // Creating file pointer for reading
-    FILE *file;
-    // Creating buffer for file data
-    char buffer[BUFFER_SIZE];
-    // Storing file size
-    long file_size;
-    // Tracking total bytes sent
+    // Tracking total bytes sent so far
     long total_sent = 0;
 
-    printf("[CLIENT] Sending file: %s\n", filename);
+    // Looping until the whole block has been written
+    while (total_sent < length)
+    {
+        // Sending next piece of the block
+        int bytes_sent = send(s1_socket, (const char *)buffer + total_sent, length - total_sent, 0);
+        // Checking if send failed
+        if (bytes_sent <= 0)
+        {
+            return -1;
+        }
 
-    // Opening file for reading in binary mode
-    file = fopen(filename, "rb");
-    if (file == NULL)
+        // Updating total sent
+        total_sent += bytes_sent;
+    }
+
+    return 0;
+}
+
+// Showing upload progress for larger files
+void show_send_progress(long total_sent, long file_size)
+{
+    if (file_size > 10000)
     {
-        printf("[CLIENT] ERROR: Cannot open file %s\n", filename);
-        return -1;
+        printf("[CLIENT] Sent %ld/%ld bytes (%.1f%%)\r", total_sent, file_size,
+               (total_sent * 100.0) / file_size);
+        fflush(stdout);
     }
+}
 
-    // Moving to end of file to get size
-    fseek(file, 0, SEEK_END);
-    // Getting current position (file size)
-    file_size = ftell(file);
-    // Moving back to beginning
-    fseek(file, 0, SEEK_SET);
+// Sending file_size bytes of an open file over a socket
+// Uses sendfile() so data moves from the page cache to the socket without a
+// user-space copy, falling back to a large-buffer loop where it is unavailable
+int transmit_file_data(int s1_socket, int file_fd, long file_size)
+{
+    // Tracking total bytes sent
+    long total_sent = 0;
 
-    printf("[CLIENT] File size: %ld bytes\n", file_size);
+#ifdef __linux__
+    // Tracking read position inside the file
+    off_t offset = 0;
+    while (total_sent < file_size)
+    {
+        // Calculating how much to hand to the kernel this round
+        long remaining = file_size - total_sent;
+        size_t to_send = (remaining > TRANSMIT_CHUNK_SIZE) ? TRANSMIT_CHUNK_SIZE : remaining;
 
-    // Sending file size first to server
-    if (send(s1_socket, &file_size, sizeof(file_size), 0) == -1)
+        // Sending chunk directly from file to socket
+        ssize_t bytes_sent = sendfile(s1_socket, file_fd, &offset, to_send);
+        if (bytes_sent == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_sent == -1 && total_sent == 0 && (errno == EINVAL || errno == ENOSYS))
+        {
+            // Kernel cannot sendfile this descriptor pair - using copy loop instead
+            break;
+        }
+        if (bytes_sent <= 0)
+        {
+            printf("[CLIENT] ERROR: Error sending file data\n");
+            return -1;
+        }
+
+        // Updating total sent
+        total_sent += bytes_sent;
+        show_send_progress(total_sent, file_size);
+    }
+    if (total_sent == file_size)
     {
-        printf("[CLIENT] ERROR: Failed to send file size\n");
-        fclose(file);
-        return -1;
+        return 0;
     }
+#endif
 
-    printf("[CLIENT] File size sent successfully\n");
-
-    // Adding small delay to ensure file size is processed
-    usleep(50000); // 50ms
+    // Creating large buffer for the copy fallback
+    char buffer[TRANSMIT_BUFFER_SIZE];
 
-    // Sending file data in chunks
+    // Continuing from where zero-copy stopped
+    lseek(file_fd, total_sent, SEEK_SET);
     while (total_sent < file_size)
     {
+        // Calculating bytes remaining
+        long remaining = file_size - total_sent;
+        size_t to_read = (remaining > TRANSMIT_BUFFER_SIZE) ? TRANSMIT_BUFFER_SIZE : remaining;
+
         // Reading chunk from file
-        int bytes_read = fread(buffer, 1, BUFFER_SIZE, file);
+        ssize_t bytes_read = read(file_fd, buffer, to_read);
         if (bytes_read <= 0)
         {
             printf("[CLIENT] ERROR: Error reading file\n");
-            fclose(file);
             return -1;
         }
 
         // Sending chunk to server
-        int bytes_sent = send(s1_socket, buffer, bytes_read, 0);
-        if (bytes_sent <= 0)
+        if (send_all(s1_socket, buffer, bytes_read) == -1)
         {
             printf("[CLIENT] ERROR: Error sending file data\n");
-            fclose(file);
             return -1;
         }
 
         // Updating total sent
-        total_sent += bytes_sent;
+        total_sent += bytes_read;
+        show_send_progress(total_sent, file_size);
+    }
+
+    return 0;
+}
+
+/*=== FRAMING PROTOCOL FUNCTIONS ===*/
+
+// Every message travels as one frame: version (1 byte), type (1 byte), status (2 bytes)
+// and payload length (8 bytes) in network byte order, followed by exactly length payload bytes
+
+// Receiving exactly length bytes from socket
+int recv_all(int socket, void *buffer, long length)
+{
+    // Tracking total bytes received so far
+    long total_received = 0;
+
+    // Looping until the whole block has arrived
+    while (total_received < length)
+    {
+        // Receiving next piece of the block
+        int bytes_received = recv(socket, (char *)buffer + total_received, length - total_received, 0);
+        // Checking if peer closed or failed
+        if (bytes_received <= 0)
+        {
+            return -1;
+        }
+
+        // Updating total received
+        total_received += bytes_received;
+    }
+
+    return 0;
+}
+
+// Sending a frame header announcing length payload bytes
+int send_frame_header(int socket, int type, int status, long length)
+{
+    // Packing header fields in network byte order
+    unsigned char header[FRAME_HEADER_SIZE];
+    header[0] = FRAME_VERSION;
+    header[1] = type;
+    header[2] = (status >> 8) & 0xFF;
+    header[3] = status & 0xFF;
+    for (int i = 0; i < 8; i++)
+    {
+        header[4 + i] = ((unsigned long long)length >> (56 - 8 * i)) & 0xFF;
+    }
+
+    return send_all(socket, header, FRAME_HEADER_SIZE);
+}
+
+// Sending a whole frame whose payload is in memory
+int send_frame(int socket, int type, int status, const void *payload, long length)
+{
+    if (send_frame_header(socket, type, status, length) == -1)
+    {
+        return -1;
+    }
+    return send_all(socket, payload, length);
+}
+
+// Sending a text message as one frame (terminator is not sent)
+int send_text_frame(int socket, int type, int status, const char *text)
+{
+    return send_frame(socket, type, status, text, strlen(text));
+}
+
+// Receiving a frame header, rejecting other protocol versions
+int recv_frame_header(int socket, int *type, int *status, long *length)
+{
+    // Reading the fixed-size header
+    unsigned char header[FRAME_HEADER_SIZE];
+    if (recv_all(socket, header, FRAME_HEADER_SIZE) == -1)
+    {
+        return -1;
+    }
+
+    // Checking protocol version
+    if (header[0] != FRAME_VERSION)
+    {
+        printf("[CLIENT] ERROR: Unsupported frame version %d\n", header[0]);
+        return -1;
+    }
+
+    // Unpacking fields from network byte order
+    unsigned long long value = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        value = (value << 8) | header[4 + i];
+    }
+    *type = header[1];
+    *status = (header[2] << 8) | header[3];
+    *length = (long)value;
+
+    // Rejecting lengths that cannot be real
+    if (*length < 0)
+    {
+        printf("[CLIENT] ERROR: Invalid frame length\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Dropping payload bytes nobody wants so the next frame lines up
+int skip_frame_payload(int socket, long length)
+{
+    // Creating buffer for unwanted data
+    char buffer[BUFFER_SIZE];
+
+    while (length > 0)
+    {
+        // Receiving and dropping next chunk
+        int to_receive = (length > BUFFER_SIZE) ? BUFFER_SIZE : length;
+        int bytes_received = recv(socket, buffer, to_receive, 0);
+        if (bytes_received <= 0)
+        {
+            return -1;
+        }
+        length -= bytes_received;
+    }
+
+    return 0;
+}
+
+// Receiving a frame payload as text into buffer, dropping whatever does not fit
+// Returns number of bytes stored, or -1 if the stream broke
+int recv_frame_payload(int socket, long length, char *buffer, int max_size)
+{
+    // Keeping as much as the buffer holds
+    long kept = (length < max_size - 1) ? length : max_size - 1;
+    if (recv_all(socket, buffer, kept) == -1)
+    {
+        return -1;
+    }
+    buffer[kept] = '\0';
+
+    // Skipping the rest
+    if (skip_frame_payload(socket, length - kept) == -1)
+    {
+        return -1;
+    }
+
+    return kept;
+}
+
+// Receiving a whole text frame of the expected type
+// Returns number of bytes stored, or -1 if the stream broke or another frame type arrived
+int recv_text_frame(int socket, int expected_type, int *status, char *buffer, int max_size)
+{
+    // Storing header fields
+    int type;
+    long length;
+
+    if (recv_frame_header(socket, &type, status, &length) == -1)
+    {
+        return -1;
+    }
+
+    int kept = recv_frame_payload(socket, length, buffer, max_size);
+    if (kept == -1)
+    {
+        return -1;
+    }
+
+    // Checking that the peer sent what we expected
+    if (type != expected_type)
+    {
+        printf("[CLIENT] ERROR: Expected frame type %d, got %d\n", expected_type, type);
+        return -1;
+    }
+
+    return kept;
+}
+
+/*=== TRANSFER COMPRESSION FUNCTIONS ===*/
+
+// Estimating bits of information per byte from samples spread over a block
+// Already-compressed data (.zip, most .pdf streams) comes out close to 8
+double sample_entropy(const unsigned char *data, long length)
+{
+    // Counting byte values in evenly spaced samples
+    long counts[256] = {0};
+    long sampled = 0;
+    long step = (length > COMPRESS_SAMPLE_SIZE) ? length / COMPRESS_SAMPLE_COUNT : length;
+    long sample_length = (length > COMPRESS_SAMPLE_SIZE) ? COMPRESS_SAMPLE_SIZE / COMPRESS_SAMPLE_COUNT : length;
+    for (long start = 0; start + sample_length <= length && sampled < COMPRESS_SAMPLE_SIZE; start += step)
+    {
+        for (long i = start; i < start + sample_length; i++)
+        {
+            counts[data[i]]++;
+        }
+        sampled += sample_length;
+    }
+    if (sampled == 0)
+    {
+        return 0;
+    }
+
+    // Summing -p log2 p over the byte values seen
+    double entropy = 0;
+    for (int value = 0; value < 256; value++)
+    {
+        if (counts[value] > 0)
+        {
+            double p = (double)counts[value] / sampled;
+            entropy -= p * log2(p);
+        }
+    }
+    return entropy;
+}
+
+// Reading exactly length bytes from a file
+int read_all(int fd, void *buffer, long length)
+{
+    long total_read = 0;
+    while (total_read < length)
+    {
+        ssize_t bytes_read = read(fd, (char *)buffer + total_read, length - total_read);
+        if (bytes_read == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_read <= 0)
+        {
+            return -1;
+        }
+        total_read += bytes_read;
+    }
+    return 0;
+}
+
+// Writing exactly length bytes to a file
+int write_all(int fd, const void *buffer, long length)
+{
+    long total_written = 0;
+    while (total_written < length)
+    {
+        ssize_t bytes_written = write(fd, (const char *)buffer + total_written, length - total_written);
+        if (bytes_written == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_written <= 0)
+        {
+            return -1;
+        }
+        total_written += bytes_written;
+    }
+    return 0;
+}
+
+// Deciding whether a file is worth compressing on the way to S1
+// Archives are skipped by name and the start of the file is sampled, so already-compressed
+// data keeps the zero-copy path
+int transfer_wants_compression(int codec, const char *filename, int file_fd)
+{
+    if (codec == CODEC_NONE)
+    {
+        return 0;
+    }
+
+    const char *extension = strrchr(filename, '.');
+    if (extension != NULL && strcmp(extension, ".zip") == 0)
+    {
+        return 0;
+    }
+
+    unsigned char sample[COMPRESS_SAMPLE_SIZE];
+    ssize_t sampled = pread(file_fd, sample, sizeof(sample), 0);
+    return !(sampled > 0 && sample_entropy(sample, sampled) >= COMPRESS_ENTROPY_LIMIT);
+}
+
+// Sending file_size bytes of an open file as a compressed body: a ZFILE frame with the
+// original size, then one DATA frame per chunk, each deflated on its own or stored when
+// it samples as incompressible or does not shrink
+int send_compressed_file_data(int s1_socket, int file_fd, long file_size)
+{
+    // Preparing deflate without zlib header (each chunk is a raw deflate stream)
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, TRANSFER_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        printf("[CLIENT] ERROR: Cannot start compression\n");
+        return -1;
+    }
+    unsigned char *input = malloc(TRANSFER_CHUNK_SIZE);
+    unsigned char *output = malloc(TRANSFER_CHUNK_SIZE);
+
+    // Announcing the original size
+    char size_text[32];
+    snprintf(size_text, sizeof(size_text), "%ld", file_size);
+    int result = 0;
+    if (input == NULL || output == NULL || send_text_frame(s1_socket, FRAME_ZFILE, STATUS_OK, size_text) == -1)
+    {
+        result = -1;
+    }
+
+    long total_read = 0;
+    long total_sent = 0;
+    while (result == 0 && total_read < file_size)
+    {
+        // Reading next chunk of the file
+        long remaining = file_size - total_read;
+        long piece = (remaining > TRANSFER_CHUNK_SIZE) ? TRANSFER_CHUNK_SIZE : remaining;
+        if (read_all(file_fd, input, piece) == -1)
+        {
+            printf("\n[CLIENT] ERROR: Failed to read file data\n");
+            result = -1;
+            break;
+        }
+        total_read += piece;
+
+        // Deflating chunk, keeping it only if it comes out smaller
+        int encoding = CHUNK_STORED;
+        long length = piece;
+        if (sample_entropy(input, piece) < COMPRESS_ENTROPY_LIMIT)
+        {
+            deflateReset(&zs);
+            zs.next_in = input;
+            zs.avail_in = piece;
+            zs.next_out = output;
+            zs.avail_out = piece - 1;
+            if (deflate(&zs, Z_FINISH) == Z_STREAM_END)
+            {
+                encoding = CHUNK_DEFLATE;
+                length = zs.total_out;
+            }
+        }
+
+        // Sending chunk as one DATA frame tagged with its encoding
+        if (send_frame(s1_socket, FRAME_DATA, encoding, (encoding == CHUNK_DEFLATE) ? output : input, length) == -1)
+        {
+            printf("\n[CLIENT] ERROR: Failed to send file data\n");
+            result = -1;
+            break;
+        }
+        total_sent += length;
+        show_send_progress(total_read, file_size);
+    }
+
+    deflateEnd(&zs);
+    free(input);
+    free(output);
+    if (result == 0)
+    {
+        if (file_size > 10000)
+        {
+            printf("\n");
+        }
+        printf("[CLIENT] Compressed %ld bytes to %ld on the wire\n", file_size, total_sent);
+    }
+    return result;
+}
+
+// Receiving a compressed body of file_size bytes (the DATA frames after a ZFILE frame)
+// and writing the rebuilt data to file_fd; once writing has failed the body is only drained
+// Returns 0 on success, -1 if writing failed (body drained), -2 if the stream broke or is corrupt
+int receive_compressed_file_data(int s1_socket, long file_size, int file_fd)
+{
+    // Preparing raw inflate and chunk buffers
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -15) != Z_OK)
+    {
+        return -2;
+    }
+    unsigned char *input = malloc(TRANSFER_CHUNK_SIZE);
+    unsigned char *output = malloc(TRANSFER_CHUNK_SIZE);
+    int result = (input == NULL || output == NULL) ? -2 : 0;
+
+    long rebuilt = 0;
+    long total_received = 0;
+    while (result != -2 && rebuilt < file_size)
+    {
+        // Receiving next chunk; no chunk is larger than the data it holds
+        int type, encoding;
+        long length;
+        if (recv_frame_header(s1_socket, &type, &encoding, &length) == -1 || type != FRAME_DATA ||
+            length > TRANSFER_CHUNK_SIZE || recv_all(s1_socket, input, length) == -1)
+        {
+            printf("\n[CLIENT] ERROR: Compressed transfer broke after %ld bytes\n", rebuilt);
+            result = -2;
+            break;
+        }
+        total_received += length;
+
+        // Rebuilding chunk, never past the announced size
+        long remaining = file_size - rebuilt;
+        long limit = (remaining > TRANSFER_CHUNK_SIZE) ? TRANSFER_CHUNK_SIZE : remaining;
+        unsigned char *data = input;
+        long data_length = length;
+        if (encoding == CHUNK_DEFLATE)
+        {
+            inflateReset(&zs);
+            zs.next_in = input;
+            zs.avail_in = length;
+            zs.next_out = output;
+            zs.avail_out = limit;
+            data = output;
+            data_length = (inflate(&zs, Z_FINISH) == Z_STREAM_END) ? (long)zs.total_out : 0;
+        }
+        else if (encoding != CHUNK_STORED || length > limit)
+        {
+            data_length = 0;
+        }
+        if (data_length == 0)
+        {
+            printf("\n[CLIENT] ERROR: Corrupt compressed chunk after %ld bytes\n", rebuilt);
+            result = -2;
+            break;
+        }
+
+        // Writing rebuilt data, draining the rest once the file has failed
+        if (result == 0 && write_all(file_fd, data, data_length) == -1)
+        {
+            printf("\n[CLIENT] ERROR: Error writing decompressed data\n");
+            result = -1;
+        }
+        rebuilt += data_length;
 
         // Showing progress for larger files
         if (file_size > 10000)
         {
-            printf("[CLIENT] Sent %ld/%ld bytes (%.1f%%)\r", total_sent, file_size,
-                   (total_sent * 100.0) / file_size);
+            printf("[CLIENT] Received %ld/%ld bytes (%.1f%%)\r", rebuilt, file_size, (rebuilt * 100.0) / file_size);
             fflush(stdout);
         }
     }
 
+    inflateEnd(&zs);
+    free(input);
+    free(output);
+    if (result == 0)
+    {
+        if (file_size > 10000)
+        {
+            printf("\n");
+        }
+        printf("[CLIENT] Received %ld bytes as %ld on the wire\n", file_size, total_received);
+    }
+    return result;
+}
+
+/*=== CONTENT HASH FUNCTIONS ===*/
+
+// Computing the SHA-256 of a whole file as 64 hex digits, without moving its offset
+// Returns 0, or -1 when the file could not be read
+int hash_file_content(int file_fd, char *hex)
+{
+    EVP_MD_CTX *digest = EVP_MD_CTX_new();
+    if (digest == NULL || EVP_DigestInit_ex(digest, EVP_sha256(), NULL) != 1)
+    {
+        EVP_MD_CTX_free(digest);
+        return -1;
+    }
+
+    // Hashing file from the start
+    char buffer[TRANSMIT_BUFFER_SIZE];
+    long offset = 0;
+    ssize_t bytes_read;
+    while ((bytes_read = pread(file_fd, buffer, sizeof(buffer), offset)) > 0)
+    {
+        EVP_DigestUpdate(digest, buffer, bytes_read);
+        offset += bytes_read;
+    }
+
+    unsigned char hash[DIGEST_SIZE];
+    int result = (bytes_read == 0 && EVP_DigestFinal_ex(digest, hash, NULL) == 1) ? 0 : -1;
+    EVP_MD_CTX_free(digest);
+    for (int i = 0; result == 0 && i < DIGEST_SIZE; i++)
+    {
+        sprintf(hex + 2 * i, "%02x", hash[i]);
+    }
+    return result;
+}
+
+// Offering a file's size and content hash to S1 ahead of its body (hash-first sessions)
+// A file that cannot be read is offered without a hash, so S1 asks for the body as usual
+// Returns 1 when the server already has the content, 0 when the body must be sent,
+// 2 when it must be sent as a delta (send_delta_file), -1 if the connection broke
+int offer_file_digest(int s1_socket, const char *filename)
+{
+    // Creating offer and reply buffers
+    char offer[128] = "";
+    int offer_status = STATUS_NOT_FOUND;
+    char reply[64];
+    int reply_status;
+
+    // Hashing the whole file before anything is sent
+    int file_fd = open(filename, O_RDONLY);
+    struct stat st;
+    char hex[2 * DIGEST_SIZE + 1];
+    if (file_fd != -1 && fstat(file_fd, &st) == 0 && hash_file_content(file_fd, hex) == 0)
+    {
+        snprintf(offer, sizeof(offer), "%ld %s", (long)st.st_size, hex);
+        offer_status = STATUS_OK;
+    }
+    if (file_fd != -1)
+    {
+        close(file_fd);
+    }
+
+    if (send_text_frame(s1_socket, FRAME_DIGEST, offer_status, offer) == -1 ||
+        recv_text_frame(s1_socket, FRAME_RESPONSE, &reply_status, reply, sizeof(reply)) == -1)
+    {
+        printf("[CLIENT] ERROR: No answer to content hash of %s\n", filename);
+        return -1;
+    }
+    if (reply_status == STATUS_NOT_FOUND && strcmp(reply, "DELTA") == 0)
+    {
+        return 2;
+    }
+    return reply_status == STATUS_OK && strcmp(reply, "HAVE") == 0;
+}
+
+/*=== DELTA UPLOAD FUNCTIONS ===*/
+
+// Walking a file in content-defined chunks: cut points depend only on the bytes around them,
+// so an edit changes the chunks it touches and every other chunk keeps its hash
+struct cdc_reader
+{
+    // File being chunked, read front to back
+    int fd;
+    // Window over the file holding at least one largest chunk unless the file ends first
+    unsigned char *buffer;
+    long start;
+    long filled;
+    int at_end;
+    // Random value per byte value that the rolling hash adds up (same on every peer)
+    unsigned long long gear[256];
+};
+
+// Preparing to chunk file_fd from its current offset
+// Returns 0, or -1 when out of memory
+int cdc_open(struct cdc_reader *reader, int file_fd)
+{
+    reader->fd = file_fd;
+    reader->buffer = malloc(2 * CDC_MAX_SIZE);
+    reader->start = 0;
+    reader->filled = 0;
+    reader->at_end = 0;
+
+    // Deriving gear table from the fixed seed (splitmix64) so client and servers cut alike
+    unsigned long long state = CDC_GEAR_SEED;
+    for (int i = 0; i < 256; i++)
+    {
+        state += 0x9E3779B97F4A7C15ULL;
+        unsigned long long mixed = state;
+        mixed = (mixed ^ (mixed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        mixed = (mixed ^ (mixed >> 27)) * 0x94D049BB133111EBULL;
+        reader->gear[i] = mixed ^ (mixed >> 31);
+    }
+    return (reader->buffer == NULL) ? -1 : 0;
+}
+
+// Finding the next chunk; *chunk points at its bytes until the following call
+// Returns its length, 0 at the end of the file, or -1 if reading failed
+long cdc_next_chunk(struct cdc_reader *reader, const unsigned char **chunk)
+{
+    // Topping up window so a whole largest chunk is in it
+    if (!reader->at_end && reader->filled - reader->start < CDC_MAX_SIZE)
+    {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->filled - reader->start);
+        reader->filled -= reader->start;
+        reader->start = 0;
+        while (!reader->at_end && reader->filled < 2 * CDC_MAX_SIZE)
+        {
+            ssize_t bytes_read = read(reader->fd, reader->buffer + reader->filled, 2 * CDC_MAX_SIZE - reader->filled);
+            if (bytes_read == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (bytes_read == -1)
+            {
+                return -1;
+            }
+            reader->at_end = (bytes_read == 0);
+            reader->filled += bytes_read;
+        }
+    }
+
+    // Cutting after the first byte where the rolling hash (covering the last 64 bytes) has its
+    // top CDC_BOUNDARY_BITS clear, never before the smallest and never past the largest size
+    const unsigned char *data = reader->buffer + reader->start;
+    long available = reader->filled - reader->start;
+    long length = (available < CDC_MAX_SIZE) ? available : CDC_MAX_SIZE;
+    unsigned long long hash = 0;
+    for (long i = CDC_MIN_SIZE; i < length; i++)
+    {
+        hash = (hash << 1) + reader->gear[data[i]];
+        if ((hash >> (64 - CDC_BOUNDARY_BITS)) == 0)
+        {
+            length = i + 1;
+            break;
+        }
+    }
+
+    *chunk = data;
+    reader->start += length;
+    return length;
+}
+
+// Chunk of the stored copy, found by its hash
+struct known_chunk
+{
+    unsigned char hash[DIGEST_SIZE];
+    unsigned long index;
+};
+
+// Ordering chunks by hash for qsort and bsearch
+int compare_known_chunks(const void *a, const void *b)
+{
+    return memcmp(((const struct known_chunk *)a)->hash, ((const struct known_chunk *)b)->hash, DIGEST_SIZE);
+}
+
+// Sending a run of count stored chunks from first on as one copy instruction
+// Returns 0, or -1 if the connection broke
+int send_delta_copy(int s1_socket, unsigned long first, unsigned long count)
+{
+    unsigned char run[8];
+    for (int i = 0; i < 4; i++)
+    {
+        run[i] = (first >> (24 - 8 * i)) & 0xFF;
+        run[4 + i] = (count >> (24 - 8 * i)) & 0xFF;
+    }
+    return send_frame(s1_socket, FRAME_DATA, DELTA_COPY, run, sizeof(run));
+}
+
+// Sending a file as a delta against the stored copy it replaces, after S1 answered DELTA
+// S1 first sends the hashes of the stored copy's chunks; the file is cut the same way and
+// each chunk the server already holds is sent as its number (consecutive ones as one run),
+// every other chunk as literal bytes. The server checks the rebuilt file against the hash
+// offered before, so a file that changes or cannot be read meanwhile is just not stored
+// Returns 0 when the delta was sent, -1 if the connection broke
+int send_delta_file(int s1_socket, const char *filename)
+{
+    // Receiving chunk hashes of the stored copy
+    int type, status;
+    long length;
+    if (recv_frame_header(s1_socket, &type, &status, &length) == -1 || type != FRAME_DATA ||
+        length % DIGEST_SIZE != 0)
+    {
+        printf("[CLIENT] ERROR: No chunk list for %s\n", filename);
+        return -1;
+    }
+    long chunk_count = length / DIGEST_SIZE;
+    struct known_chunk *known = malloc(chunk_count * sizeof(struct known_chunk) + 1);
+    unsigned char *hashes = malloc(length + 1);
+    if (known == NULL || hashes == NULL || recv_all(s1_socket, hashes, length) == -1)
+    {
+        free(known);
+        free(hashes);
+        return -1;
+    }
+    for (long i = 0; i < chunk_count; i++)
+    {
+        memcpy(known[i].hash, hashes + i * DIGEST_SIZE, DIGEST_SIZE);
+        known[i].index = i;
+    }
+    free(hashes);
+    qsort(known, chunk_count, sizeof(struct known_chunk), compare_known_chunks);
+
+    // Announcing new size (an unreadable file goes out as an empty body the server will refuse)
+    struct cdc_reader reader;
+    struct stat st;
+    int file_fd = open(filename, O_RDONLY);
+    int readable = file_fd != -1 && fstat(file_fd, &st) == 0 && cdc_open(&reader, file_fd) == 0;
+    char size_text[32];
+    snprintf(size_text, sizeof(size_text), "%ld", readable ? (long)st.st_size : 0L);
+    int result = send_text_frame(s1_socket, FRAME_DELTA, STATUS_OK, size_text);
+
+    // Matching chunks against the stored ones
+    long literal_bytes = 0;
+    long total_bytes = 0;
+    unsigned long run_first = 0;
+    unsigned long run_count = 0;
+    const unsigned char *chunk;
+    long chunk_length;
+    while (readable && result == 0 && (chunk_length = cdc_next_chunk(&reader, &chunk)) > 0)
+    {
+        struct known_chunk key;
+        struct known_chunk *match = NULL;
+        if (EVP_Digest(chunk, chunk_length, key.hash, NULL, EVP_sha256(), NULL) == 1)
+        {
+            match = bsearch(&key, known, chunk_count, sizeof(struct known_chunk), compare_known_chunks);
+        }
+        total_bytes += chunk_length;
+
+        // Extending the current run when the match follows on from it
+        if (match != NULL && run_count > 0 && match->index == run_first + run_count)
+        {
+            run_count++;
+            continue;
+        }
+        if (run_count > 0)
+        {
+            result = send_delta_copy(s1_socket, run_first, run_count);
+            run_count = 0;
+        }
+        if (match != NULL)
+        {
+            run_first = match->index;
+            run_count = 1;
+        }
+        else if (result == 0)
+        {
+            result = send_frame(s1_socket, FRAME_DATA, DELTA_LITERAL, chunk, chunk_length);
+            literal_bytes += chunk_length;
+        }
+    }
+    if (result == 0 && run_count > 0)
+    {
+        result = send_delta_copy(s1_socket, run_first, run_count);
+    }
+
+    // Closing the body
+    if (result == 0)
+    {
+        result = send_frame_header(s1_socket, FRAME_END, STATUS_OK, 0);
+    }
+    if (readable)
+    {
+        free(reader.buffer);
+    }
+    if (file_fd != -1)
+    {
+        close(file_fd);
+    }
+    free(known);
+    if (result == 0)
+    {
+        printf("[CLIENT] Sent %s as a delta: %ld of %ld bytes new, the rest copied from %ld stored chunks\n",
+               filename, literal_bytes, total_bytes, chunk_count);
+    }
+    return result;
+}
+
+/*=== FILE TRANSFER FUNCTIONS ===*/
+
+// Sending file to S1 server as one FILE frame, or compressed when the session agreed on a
+// codec and the file looks compressible
+int send_file_to_server(int s1_socket, const char *filename)
+{
+    // Storing file size
+    long file_size;
+    // Creating stat structure for file metadata
+    struct stat st;
+
+    printf("[CLIENT] Sending file: %s\n", filename);
+
+    // Opening file for reading
+    int file_fd = open(filename, O_RDONLY);
+    if (file_fd == -1)
+    {
+        printf("[CLIENT] ERROR: Cannot open file %s\n", filename);
+        return -1;
+    }
+
+    // Getting file size from metadata
+    if (fstat(file_fd, &st) == -1)
+    {
+        printf("[CLIENT] ERROR: Cannot read size of %s\n", filename);
+        close(file_fd);
+        return -1;
+    }
+    file_size = st.st_size;
+
+    printf("[CLIENT] File size: %ld bytes\n", file_size);
+
+    // Compressing body chunk by chunk when it is worth it
+    if (transfer_wants_compression(session_codec, filename, file_fd))
+    {
+        int result = send_compressed_file_data(s1_socket, file_fd, file_size);
+        close(file_fd);
+        if (result == 0)
+        {
+            printf("[CLIENT] File %s sent successfully\n", filename);
+        }
+        return result;
+    }
+
+    // Sending FILE frame header announcing the size
+    if (send_frame_header(s1_socket, FRAME_FILE, STATUS_OK, file_size) == -1)
+    {
+        printf("[CLIENT] ERROR: Failed to send file header\n");
+        close(file_fd);
+        return -1;
+    }
+
+    printf("[CLIENT] File header sent successfully\n");
+
+    // Sending file data with zero-copy transmit
+    if (transmit_file_data(s1_socket, file_fd, file_size) == -1)
+    {
+        close(file_fd);
+        return -1;
+    }
+
     // Closing file
-    fclose(file);
+    close(file_fd);
 
     if (file_size > 10000)
     {
@@ -139,37 +1064,19 @@ int send_file_to_server(int s1_socket, const char *filename)
     return 0;
 }
 
-// Receiving file from S1 server
-// Fixed receive_file_from_server function
-int receive_file_from_server(int s1_socket, const char *filename)
+// Receiving the body of a FILE frame whose header announced file_size bytes
+int receive_file_from_server(int s1_socket, const char *filename, long file_size)
 {
     // Creating file pointer for writing
     FILE *file;
     // Creating buffer for file data
     char buffer[BUFFER_SIZE];
-    // Storing file size
-    long file_size;
     // Tracking total bytes received
     long total_received = 0;
 
     printf("[CLIENT] Receiving file: %s\n", filename);
-
-    // Receiving file size first from server
-    if (recv(s1_socket, &file_size, sizeof(file_size), 0) <= 0)
-    {
-        printf("[CLIENT] ERROR: Failed to receive file size\n");
-        return -1;
-    }
-
     printf("[CLIENT] File size: %ld bytes\n", file_size);
 
-    // Validate file size
-    if (file_size <= 0)
-    {
-        printf("[CLIENT] ERROR: Invalid file size: %ld\n", file_size);
-        return -1;
-    }
-
     // Opening file for writing in binary mode
     file = fopen(filename, "wb");
     if (file == NULL)
@@ -256,80 +1163,260 @@ int receive_file_from_server(int s1_socket, const char *filename)
     return 0;
 }
 
+// Receiving a compressed file body whose ZFILE frame header announced payload_length bytes
+int receive_compressed_file_from_server(int s1_socket, const char *filename, long payload_length)
+{
+    // Reading original size from the ZFILE frame
+    char size_text[32];
+    char *end;
+    if (recv_frame_payload(s1_socket, payload_length, size_text, sizeof(size_text)) == -1)
+    {
+        printf("[CLIENT] ERROR: Failed to receive compressed file header\n");
+        return -1;
+    }
+    long file_size = strtol(size_text, &end, 10);
+    if (end == size_text || *end != '\0' || file_size < 0)
+    {
+        printf("[CLIENT] ERROR: Invalid compressed file size\n");
+        return -1;
+    }
+
+    printf("[CLIENT] Receiving file: %s\n", filename);
+    printf("[CLIENT] File size: %ld bytes (compressed transfer)\n", file_size);
+
+    // Opening file for writing (the body is still drained if this fails)
+    int file_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file_fd == -1)
+    {
+        printf("[CLIENT] ERROR: Cannot create file %s\n", filename);
+        receive_compressed_file_data(s1_socket, file_size, -1);
+        return -1;
+    }
+
+    // Decompressing straight into the file
+    int result = receive_compressed_file_data(s1_socket, file_size, file_fd);
+    close(file_fd);
+    if (result != 0)
+    {
+        remove(filename);
+        return -1;
+    }
+
+    printf("[CLIENT] File %s received successfully (%ld bytes)\n", filename, file_size);
+    return 0;
+}
+
+// Receiving a stream of DATA frames into a file until the closing END frame
+// type, status and length describe the first frame, already read by the caller;
+// the END frame's message is copied to end_message
+int receive_stream_from_server(int s1_socket, const char *filename, int type, int status, long length,
+                               char *end_message, int max_size)
+{
+    // Creating buffer for stream data
+    char buffer[BUFFER_SIZE];
+    // Tracking total bytes received
+    long total_received = 0;
+
+    printf("[CLIENT] Receiving stream into: %s\n", filename);
+
+    // Opening file for writing (the stream is still drained if this fails)
+    FILE *file = fopen(filename, "wb");
+    int write_failed = (file == NULL);
+    if (file == NULL)
+    {
+        printf("[CLIENT] ERROR: Cannot create file %s\n", filename);
+    }
+
+    // Copying DATA frames into the file until another frame type arrives
+    while (type == FRAME_DATA)
+    {
+        while (length > 0)
+        {
+            // Receiving next chunk of this frame
+            int to_receive = (length > BUFFER_SIZE) ? BUFFER_SIZE : length;
+            int bytes_received = recv(s1_socket, buffer, to_receive, 0);
+            if (bytes_received <= 0)
+            {
+                printf("\n[CLIENT] ERROR: Stream broke after %ld bytes\n", total_received);
+                if (file != NULL)
+                {
+                    fclose(file);
+                    remove(filename);
+                }
+                return -1;
+            }
+
+            // Writing chunk to file
+            if (file != NULL && (int)fwrite(buffer, 1, bytes_received, file) != bytes_received)
+            {
+                printf("\n[CLIENT] ERROR: Error writing to file %s\n", filename);
+                fclose(file);
+                remove(filename);
+                file = NULL;
+                write_failed = 1;
+            }
+
+            length -= bytes_received;
+            total_received += bytes_received;
+        }
+
+        // Showing progress
+        printf("[CLIENT] Received %ld bytes\r", total_received);
+        fflush(stdout);
+
+        // Receiving next frame header
+        if (recv_frame_header(s1_socket, &type, &status, &length) == -1)
+        {
+            printf("\n[CLIENT] ERROR: Stream broke after %ld bytes\n", total_received);
+            if (file != NULL)
+            {
+                fclose(file);
+                remove(filename);
+            }
+            return -1;
+        }
+    }
+    printf("\n");
+
+    // Reading the closing frame's message
+    char *message = end_message;
+    if (recv_frame_payload(s1_socket, length, message, max_size) == -1)
+    {
+        printf("[CLIENT] ERROR: Stream broke before it was closed\n");
+        write_failed = 1;
+    }
+    else if (type != FRAME_END || (status != STATUS_OK && status != STATUS_PARTIAL))
+    {
+        printf("[CLIENT] ERROR: Server could not complete the stream: %s\n", message);
+        write_failed = 1;
+    }
+    else if (status == STATUS_PARTIAL)
+    {
+        // Keeping a valid archive that lacks some servers' files
+        printf("[CLIENT] WARNING: Stream is incomplete: %s\n", message);
+    }
+
+    // Keeping the file only if the whole stream arrived
+    if (file != NULL)
+    {
+        fclose(file);
+        if (write_failed)
+        {
+            remove(filename);
+        }
+    }
+    if (write_failed)
+    {
+        return -1;
+    }
+
+    printf("[CLIENT] Stream saved to %s (%ld bytes)\n", filename, total_received);
+    return 0;
+}
+
 /*=== DOWNLTAR COMMAND HANDLER ===*/
 int handle_downltar(int s1_socket, char *command)
 {
-    // Creating variables for command parsing
-    char filetype[10];
     // Creating response buffer
     char response[1024];
     // Creating tar filename buffer
-    char tar_filename[256];
-    // Storing bytes received
-    int bytes;
+    char tar_filename[256] = "";
+    // Storing reply frame header
+    int type, status;
+    long length;
+    // Counting requested types
+    int type_count = 0;
+    // Cutoff text for an incremental archive, NULL for a full one
+    char *since = NULL;
+    // Set when the archive is requested gzip compressed
+    int compressed = 0;
+    // Keeping the message that closes the stream
+    char end_message[256] = "";
 
     printf("[CLIENT] Processing downltar command\n");
 
-    // Parsing command to extract filetype
-    if (sscanf(command, "downltar %s", filetype) != 1)
+    // Copying command so tokenizing does not modify it
+    char command_copy[1024];
+    snprintf(command_copy, sizeof(command_copy), "%s", command);
+
+    // Skipping the command word, then validating each filetype
+    char *save_ptr;
+    char *filetype = strtok_r(command_copy, " \t\r\n", &save_ptr);
+    while ((filetype = strtok_r(NULL, " \t\r\n", &save_ptr)) != NULL)
     {
-        printf("[CLIENT] ERROR: Invalid downltar format\n");
-        printf("[CLIENT] Command: downltar filetype\n");
-        return -1;
-    }
+        // Reading incremental cutoff in seconds since the epoch
+        if (strcmp(filetype, "--since") == 0)
+        {
+            since = strtok_r(NULL, " \t\r\n", &save_ptr);
+            if (since == NULL || since[strspn(since, "0123456789")] != '\0')
+            {
+                printf("[CLIENT] ERROR: --since needs a time in seconds (the SNAPSHOT of an earlier archive)\n");
+                return -1;
+            }
+            continue;
+        }
+
+        // Asking for a compressed archive
+        if (strcmp(filetype, "--gzip") == 0)
+        {
+            compressed = 1;
+            continue;
+        }
 
-    printf("[CLIENT] Requesting tar file for filetype: %s\n", filetype);
+        if (strcmp(filetype, "all") != 0 && strcmp(filetype, ".c") != 0 && strcmp(filetype, ".pdf") != 0 &&
+            strcmp(filetype, ".txt") != 0 && strcmp(filetype, ".zip") != 0)
+        {
+            printf("[CLIENT] ERROR: Invalid filetype %s. Supported: .c, .pdf, .txt, .zip, all\n", filetype);
+            return -1;
+        }
+
+        // Naming the archive after the types in it (cfiles.tar, c_pdffiles.tar, allfiles.tar)
+        if (type_count > 0)
+        {
+            strncat(tar_filename, "_", sizeof(tar_filename) - strlen(tar_filename) - 1);
+        }
+        strncat(tar_filename, filetype[0] == '.' ? filetype + 1 : filetype,
+                sizeof(tar_filename) - strlen(tar_filename) - 1);
+        type_count++;
+    }
 
-    // Validate filetype
-    if (strcmp(filetype, ".c") != 0 && strcmp(filetype, ".pdf") != 0 && strcmp(filetype, ".txt") != 0)
+    if (type_count == 0)
     {
-        printf("[CLIENT] ERROR: Invalid filetype. Supported: .c, .pdf, .txt\n");
+        printf("[CLIENT] ERROR: Invalid downltar format\n");
+        printf("[CLIENT] Command: downltar filetype [filetype...] | all [--since seconds] [--gzip]\n");
         return -1;
     }
+    strncat(tar_filename, "files", sizeof(tar_filename) - strlen(tar_filename) - 1);
+    if (since != NULL)
+    {
+        // Keeping incremental archives apart from full ones (pdffiles_since_1760000000.tar)
+        strncat(tar_filename, "_since_", sizeof(tar_filename) - strlen(tar_filename) - 1);
+        strncat(tar_filename, since, sizeof(tar_filename) - strlen(tar_filename) - 1);
+    }
+    strncat(tar_filename, compressed ? ".tar.gz" : ".tar", sizeof(tar_filename) - strlen(tar_filename) - 1);
+
+    printf("[CLIENT] Requesting tar file for: %s\n", command + 9);
 
     // Sending command to server
     printf("[CLIENT] Sending command to server\n");
-    if (send(s1_socket, command, strlen(command), 0) == -1)
+    if (send_text_frame(s1_socket, FRAME_COMMAND, STATUS_OK, command) == -1)
     {
         printf("[CLIENT] ERROR: Failed to send command\n");
         return -1;
     }
 
-    // Waiting for response from server
+    // Waiting for the tar stream or an error response
     printf("[CLIENT] Waiting for server response\n");
-    bytes = recv(s1_socket, response, sizeof(response) - 1, 0);
-    if (bytes <= 0)
+    if (recv_frame_header(s1_socket, &type, &status, &length) == -1)
     {
         printf("[CLIENT] ERROR: No response from server\n");
         return -1;
     }
-    // Adding null terminator to response
-    response[bytes] = '\0';
-
-    printf("[CLIENT] Server response: %s\n", response);
 
     // Checking server response
-    if (strncmp(response, "TAR_READY", 9) == 0)
+    if (type == FRAME_DATA || type == FRAME_END)
     {
-        printf("[CLIENT] Server created tar file, downloading\n");
-
-        // Creating filename for the tar file based on filetype
-        if (strcmp(filetype, ".c") == 0)
-        {
-            strcpy(tar_filename, "cfiles.tar");
-        }
-        else if (strcmp(filetype, ".pdf") == 0)
-        {
-            strcpy(tar_filename, "pdffiles.tar");
-        }
-        else if (strcmp(filetype, ".txt") == 0)
-        {
-            strcpy(tar_filename, "txtfiles.tar");
-        }
-        else
-        {
-            strcpy(tar_filename, "files.tar");
-        }
+        printf("[CLIENT] Server is streaming the tar archive, downloading\n");
 
         printf("[CLIENT] Downloading tar file as: %s\n", tar_filename);
 
@@ -343,9 +1430,17 @@ int handle_downltar(int s1_socket, char *command)
             }
         }
 
-        // Receiving the tar file using existing function
-        if (receive_file_from_server(s1_socket, tar_filename) == 0)
+        // Receiving the archive as it is generated
+        if (receive_stream_from_server(s1_socket, tar_filename, type, status, length,
+                                       end_message, sizeof(end_message)) == 0)
         {
+            // Showing the cutoff to pass as --since for the next incremental archive
+            if (strncmp(end_message, "SNAPSHOT ", 9) == 0)
+            {
+                printf("[CLIENT] Archive snapshot: %s (use --since %s for changes after it)\n",
+                       end_message + 9, end_message + 9);
+            }
+
             // Verify the file actually exists after download
             if (access(tar_filename, F_OK) == 0)
             {
@@ -386,29 +1481,28 @@ int handle_downltar(int s1_socket, char *command)
             return -1;
         }
     }
-    else if (strstr(response, "TAR_ERROR") != NULL)
-    {
-        printf("[CLIENT] ERROR: Server failed to create tar file: %s\n", response);
-        return -1;
-    }
-    else if (strstr(response, "INVALID_TYPE") != NULL)
+
+    // Reading the error text that came instead of the tar file
+    if (recv_frame_payload(s1_socket, length, response, sizeof(response)) == -1)
     {
-        printf("[CLIENT] ERROR: Invalid file type: %s\n", filetype);
+        printf("[CLIENT] ERROR: No response from server\n");
         return -1;
     }
-    else if (strstr(response, "FORMAT_ERROR") != NULL)
+    printf("[CLIENT] Server response: %s\n", response);
+
+    if (type != FRAME_RESPONSE)
     {
-        printf("[CLIENT] ERROR: Invalid command format\n");
+        printf("[CLIENT] ERROR: Unexpected server response: %s\n", response);
         return -1;
     }
-    else if (strstr(response, "ZIP file not supported") != NULL)
+    else if (status == STATUS_BAD_REQUEST)
     {
-        printf("[CLIENT] ERROR: ZIP files are not supported for tar operations\n");
+        printf("[CLIENT] ERROR: Invalid request: %s\n", response);
         return -1;
     }
     else
     {
-        printf("[CLIENT] ERROR: Unexpected server response: %s\n", response);
+        printf("[CLIENT] ERROR: Server failed to create tar file: %s\n", response);
         return -1;
     }
 }
@@ -422,8 +1516,8 @@ int handle_uploadf(int s1_socket, char *command)
     char cmd[20], file1[256], file2[256], file3[256], dest_path[512];
     // Creating response buffer
     char response[1024];
-    // Storing bytes received
-    int bytes;
+    // Storing response status
+    int status;
 
     printf("[CLIENT] Processing uploadf command\n");
 
@@ -460,7 +1554,7 @@ int handle_uploadf(int s1_socket, char *command)
 
     // Sending command to server
     printf("[CLIENT] Sending command to server\n");
-    if (send(s1_socket, command, strlen(command), 0) == -1)
+    if (send_text_frame(s1_socket, FRAME_COMMAND, STATUS_OK, command) == -1)
     {
         printf("[CLIENT] ERROR: Failed to send command\n");
         return -1;
@@ -468,17 +1562,14 @@ int handle_uploadf(int s1_socket, char *command)
 
     // Waiting for READY response from server
     printf("[CLIENT] Waiting for server response\n");
-    bytes = recv(s1_socket, response, sizeof(response) - 1, 0);
-    if (bytes <= 0)
+    if (recv_text_frame(s1_socket, FRAME_RESPONSE, &status, response, sizeof(response)) == -1)
     {
         printf("[CLIENT] ERROR: No response from server\n");
         return -1;
     }
-    // Adding null terminator to response
-    response[bytes] = '\0';
 
     // Checking if server is ready
-    if (strncmp(response, "READY", 5) != 0)
+    if (status != STATUS_OK)
     {
         printf("[CLIENT] ERROR: Server response: %s\n", response);
         return -1;
@@ -489,17 +1580,48 @@ int handle_uploadf(int s1_socket, char *command)
     // Creating array of filenames for easier processing
     char *filenames[3] = {file1, file2, file3};
 
-    // Sending each file with delays between transfers
+    // Sending each file back to back; every FILE frame carries its own length
     for (int i = 0; i < file_count; i++)
     {
         printf("\n[CLIENT] === Sending file %d/%d: %s ===\n", i + 1, file_count, filenames[i]);
 
+        // Offering content hash first; content the servers already hold is not sent again
+        if (session_hash_first)
+        {
+            int offer = offer_file_digest(s1_socket, filenames[i]);
+            if (offer == -1)
+            {
+                return -1;
+            }
+            if (offer == 1)
+            {
+                printf("[CLIENT] %s is already stored - transfer skipped\n", filenames[i]);
+                continue;
+            }
+
+            // Sending only the chunks the stored copy lacks
+            if (offer == 2)
+            {
+                if (send_delta_file(s1_socket, filenames[i]) == -1)
+                {
+                    printf("[CLIENT] ERROR: Failed to send delta of %s\n", filenames[i]);
+                    return -1;
+                }
+                continue;
+            }
+        }
+
         // Checking if file exists before sending
         FILE *check_file = fopen(filenames[i], "r");
         if (check_file == NULL)
         {
             printf("[CLIENT] ERROR: File not found: %s\n", filenames[i]);
-            return -1;
+            // Announcing an empty slot so the server can move on to the next file
+            if (send_frame_header(s1_socket, FRAME_FILE, STATUS_NOT_FOUND, 0) == -1)
+            {
+                return -1;
+            }
+            continue;
         }
         fclose(check_file);
 
@@ -511,31 +1633,21 @@ int handle_uploadf(int s1_socket, char *command)
         }
 
         printf("[CLIENT] File %s sent successfully\n", filenames[i]);
-
-        // Adding delay between files to ensure server processes each file completely
-        if (i < file_count - 1)
-        {
-            printf("[CLIENT] Waiting before sending next file\n");
-            usleep(200000); // 200ms delay between files
-        }
     }
 
     // Waiting for final response from server
     printf("\n[CLIENT] Waiting for final server response\n");
-    bytes = recv(s1_socket, response, sizeof(response) - 1, 0);
-    if (bytes > 0)
+    if (recv_text_frame(s1_socket, FRAME_RESPONSE, &status, response, sizeof(response)) != -1)
     {
-        // Adding null terminator to response
-        response[bytes] = '\0';
         printf("[CLIENT] Upload result: %s\n", response);
 
         // Checking if upload was successful
-        if (strstr(response, "SUCCESS") != NULL)
+        if (status == STATUS_OK)
         {
             printf("[CLIENT] All files uploaded successfully\n");
             return 0;
         }
-        else if (strstr(response, "PARTIAL") != NULL)
+        else if (status == STATUS_PARTIAL)
         {
             printf("[CLIENT] Some files uploaded successfully\n");
             return 0;
@@ -559,15 +1671,15 @@ int handle_downlf(int s1_socket, char *command)
 {
     // Creating response buffer
     char response[1024];
-    // Storing bytes received
-    int bytes;
+    // Storing response status
+    int status;
 
     printf("[CLIENT] Processing downlf command\n");
     printf("[CLIENT] Downloading files from S1\n");
 
     // Sending command to server
     printf("[CLIENT] Sending command to server\n");
-    if (send(s1_socket, command, strlen(command), 0) == -1)
+    if (send_text_frame(s1_socket, FRAME_COMMAND, STATUS_OK, command) == -1)
     {
         printf("[CLIENT] ERROR: Failed to send command\n");
         return -1;
@@ -575,22 +1687,19 @@ int handle_downlf(int s1_socket, char *command)
 
     // Waiting for response from server
     printf("[CLIENT] Waiting for server response\n");
-    bytes = recv(s1_socket, response, sizeof(response) - 1, 0);
-    if (bytes <= 0)
+    if (recv_text_frame(s1_socket, FRAME_RESPONSE, &status, response, sizeof(response)) == -1)
     {
         printf("[CLIENT] ERROR: No response from server\n");
         return -1;
     }
-    // Adding null terminator to response
-    response[bytes] = '\0';
 
     printf("[CLIENT] Server response: %s\n", response);
 
     // Checking if server is ready to send files
-    if (strncmp(response, "READY", 5) == 0)
+    if (status == STATUS_OK)
     {
         // Extracting file count from server response
-        int file_count;
+        int file_count = 0;
         sscanf(response, "READY %d", &file_count);
         printf("[CLIENT] Server will send %d files\n", file_count);
 
@@ -599,49 +1708,41 @@ int handle_downlf(int s1_socket, char *command)
         {
             printf("\n[CLIENT] === Receiving file %d/%d ===\n", i + 1, file_count);
 
-            // Receiving filename with null terminator
+            // Receiving filename from its NAME frame
             char filename[257];
-            memset(filename, 0, sizeof(filename));
-
             printf("[CLIENT] Receiving filename\n");
-            // Receiving filename character by character until null terminator
-            int filename_pos = 0;
-            while (filename_pos < 256)
+            if (recv_text_frame(s1_socket, FRAME_NAME, &status, filename, sizeof(filename)) <= 0)
             {
-                char c;
-                // Receiving one character at a time
-                bytes = recv(s1_socket, &c, 1, 0);
-                if (bytes != 1)
-                {
-                    printf("[CLIENT] ERROR: Failed to receive filename character at position %d\n", filename_pos);
-                    return -1;
-                }
-
-                // Storing character in filename
-                filename[filename_pos] = c;
-
-                // Checking if we found null terminator
-                if (c == '\0')
-                {
-                    // Filename is complete
-                    break;
-                }
-
-                // Moving to next position
-                filename_pos++;
+                printf("[CLIENT] ERROR: Failed to receive filename\n");
+                return -1;
             }
 
-            // Checking if filename is too long
-            if (filename_pos >= 256)
+            printf("[CLIENT] Received filename: '%s' (length: %d)\n", filename, (int)strlen(filename));
+
+            // Receiving FILE (or compressed ZFILE) frame header announcing the size
+            int type;
+            long file_size;
+            if (recv_frame_header(s1_socket, &type, &status, &file_size) == -1 ||
+                (type != FRAME_FILE && type != FRAME_ZFILE))
             {
-                printf("[CLIENT] ERROR: Filename too long or no null terminator found\n");
+                printf("[CLIENT] ERROR: Failed to receive file header for %s\n", filename);
                 return -1;
             }
 
-            printf("[CLIENT] Received filename: '%s' (length: %d)\n", filename, (int)strlen(filename));
+            // Receiving a compressed body
+            if (type == FRAME_ZFILE)
+            {
+                if (receive_compressed_file_from_server(s1_socket, filename, file_size) != 0)
+                {
+                    printf("[CLIENT] ERROR: Failed to receive file: %s\n", filename);
+                    return -1;
+                }
+                printf("[CLIENT] Successfully downloaded: %s\n", filename);
+                continue;
+            }
 
             // Receiving the file using existing function
-            if (receive_file_from_server(s1_socket, filename) != 0)
+            if (receive_file_from_server(s1_socket, filename, file_size) != 0)
             {
                 printf("[CLIENT] ERROR: Failed to receive file: %s\n", filename);
                 return -1;
@@ -653,77 +1754,160 @@ int handle_downlf(int s1_socket, char *command)
         printf("\n[CLIENT] Download result: SUCCESS - %d file(s) downloaded successfully\n", file_count);
         return 0;
     }
-    else if (strstr(response, "ERROR") != NULL)
-    {
-        printf("[CLIENT] Download failed: %s\n", response);
-        return -1;
-    }
     else
     {
-        printf("[CLIENT] ERROR: Unexpected server response: %s\n", response);
+        printf("[CLIENT] Download failed: %s\n", response);
         return -1;
     }
 }
 
 /*=== DISPFNAMES COMMAND HANDLER ===*/
 
+// Printing entries of a filtered listing ("path\tsize\tmtime" lines) as size, time and path
+void print_found_files(char *entries)
+{
+    char *save_ptr;
+    for (char *entry = strtok_r(entries, "\n", &save_ptr); entry != NULL; entry = strtok_r(NULL, "\n", &save_ptr))
+    {
+        // Splitting off the last two fields, since the path itself may hold tabs
+        char *mtime_field = strrchr(entry, '\t');
+        if (mtime_field != NULL)
+        {
+            *mtime_field = '\0';
+        }
+        char *size_field = (mtime_field != NULL) ? strrchr(entry, '\t') : NULL;
+        if (size_field == NULL)
+        {
+            printf("%s\n", entry);
+            continue;
+        }
+        *size_field = '\0';
+
+        time_t mtime = strtol(mtime_field + 1, NULL, 10);
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime(&mtime));
+        printf("%12s  %s  %s\n", size_field + 1, when, entry);
+    }
+}
+
 // Handling dispfnames command
+// Names are printed as they arrive, so a listing of any size needs only one frame of memory
 int handle_dispfnames(int s1_socket, char *command)
 {
-    // Creating response buffer (larger for file lists)
-    char response[8192];
+    // Creating buffer for one LIST frame of names
+    char names[LIST_CHUNK_SIZE + 1];
     // Storing bytes received
     int bytes;
+    // Storing reply frame header
+    int type, status;
+    long length;
 
     printf("[CLIENT] Processing dispfnames command\n");
 
+    // Noting filtered listings (-r, --name, --min-size, --max-size, --newer, --older), whose
+    // entries carry each file's size and modification time
+    int filtered = 0;
+    char words[1024];
+    snprintf(words, sizeof(words), "%s", command);
+    char *save_ptr;
+    for (char *word = strtok_r(words, " ", &save_ptr); word != NULL; word = strtok_r(NULL, " ", &save_ptr))
+    {
+        filtered = filtered || strcmp(word, "-r") == 0 || strcmp(word, "--name") == 0 ||
+                   strcmp(word, "--min-size") == 0 || strcmp(word, "--max-size") == 0 ||
+                   strcmp(word, "--newer") == 0 || strcmp(word, "--older") == 0;
+    }
+
     // Sending command to server
     printf("[CLIENT] Sending command to server\n");
-    if (send(s1_socket, command, strlen(command), 0) == -1)
+    if (send_text_frame(s1_socket, FRAME_COMMAND, STATUS_OK, command) == -1)
     {
         printf("[CLIENT] ERROR: Failed to send command\n");
         return -1;
     }
 
-    // Receiving file list from server
+    // Receiving file list (or an error response) from server: LIST frames ended by an END frame
+    // carrying the continuation token, or a single LIST frame from servers without LIST stream
     printf("[CLIENT] Receiving file list from server\n");
-    bytes = recv(s1_socket, response, sizeof(response) - 1, 0);
-    if (bytes <= 0)
+    printf("\n========== Files in directory ==========\n");
+    long file_count = 0;
+    int finished = 0;
+    int end_status = STATUS_OK;
+    char token[1024] = "";
+    while (!finished)
     {
-        printf("[CLIENT] ERROR: No response from server\n");
-        return -1;
+        if (recv_frame_header(s1_socket, &type, &status, &length) == -1 ||
+            (bytes = recv_frame_payload(s1_socket, length, (type == FRAME_END) ? token : names,
+                                        (type == FRAME_END) ? (int)sizeof(token) : (int)sizeof(names))) == -1)
+        {
+            printf("[CLIENT] ERROR: No response from server\n");
+            return -1;
+        }
+
+        if (type == FRAME_LIST)
+        {
+            // Counting names and displaying them
+            for (int i = 0; i < bytes; i++)
+            {
+                file_count += (names[i] == '\n');
+            }
+            if (filtered)
+            {
+                print_found_files(names);
+            }
+            else
+            {
+                printf("%s", names);
+            }
+            finished = (!session_list_stream || status != STATUS_PARTIAL);
+        }
+        else if (type == FRAME_END)
+        {
+            end_status = status;
+            finished = 1;
+        }
+        else
+        {
+            printf("Error: %s\n", names);
+            printf("========================================\n");
+            return 0;
+        }
     }
-    // Adding null terminator to response
-    response[bytes] = '\0';
 
-    // Displaying file list to user
-    printf("\n========== Files in directory ==========\n");
-    if (strstr(response, "No files found") != NULL)
+    // Displaying totals and how to get the next page
+    if (file_count == 0)
     {
         printf("No files found in the specified directory\n");
     }
-    else if (strstr(response, "ERROR") != NULL)
+    else
+    {
+        printf("Found %ld files\n", file_count);
+    }
+    if (end_status == STATUS_PARTIAL)
     {
-        printf("Error: %s\n", response);
+        printf("Some servers could not be listed - their files are missing above\n");
     }
-    else
+    if (token[0] != '\0')
     {
-        // Counting number of files
-        int file_count = 0;
-        char *temp_response = strdup(response);
-        char *line = strtok(temp_response, "\n");
-        while (line != NULL)
+        // Repeating the command (with its page size and filters) with the new token instead of
+        // any earlier one
+        char next[1024] = "";
+        int next_length = 0;
+        int skip = 0;
+        snprintf(words, sizeof(words), "%s", command);
+        for (char *word = strtok_r(words, " ", &save_ptr); word != NULL; word = strtok_r(NULL, " ", &save_ptr))
         {
-            if (strlen(line) > 0)
+            if (skip || strcmp(word, "--after") == 0)
             {
-                file_count++;
+                skip = !skip;
+                continue;
+            }
+            next_length += snprintf(next + next_length, sizeof(next) - next_length, "%s ", word);
+            if (next_length >= (int)sizeof(next))
+            {
+                next_length = sizeof(next) - 1;
             }
-            line = strtok(NULL, "\n");
         }
-        free(temp_response);
-
-        printf("Found %d files:\n", file_count);
-        printf("%s", response);
+        printf("More files: %s--after %s\n", next, token);
     }
     printf("========================================\n");
 
@@ -737,8 +1921,8 @@ int handle_removef(int s1_socket, char *command)
 {
     // Creating response buffer
     char response[1024];
-    // Storing bytes received
-    int bytes;
+    // Storing response status
+    int status;
 
     printf("[CLIENT] Processing removef command\n");
 
@@ -757,7 +1941,7 @@ int handle_removef(int s1_socket, char *command)
 
     // Sending command to server
     printf("[CLIENT] Sending command to server\n");
-    if (send(s1_socket, command, strlen(command), 0) == -1)
+    if (send_text_frame(s1_socket, FRAME_COMMAND, STATUS_OK, command) == -1)
     {
         printf("[CLIENT] ERROR: Failed to send command\n");
         return -1;
@@ -765,36 +1949,28 @@ int handle_removef(int s1_socket, char *command)
 
     // Waiting for response from server
     printf("[CLIENT] Waiting for server response\n");
-    bytes = recv(s1_socket, response, sizeof(response) - 1, 0);
-    if (bytes <= 0)
+    if (recv_text_frame(s1_socket, FRAME_RESPONSE, &status, response, sizeof(response)) == -1)
     {
         printf("[CLIENT] ERROR: No response from server\n");
         return -1;
     }
-    // Adding null terminator to response
-    response[bytes] = '\0';
 
     printf("[CLIENT] Delete result: %s\n", response);
 
     // Analyzing server response
-    if (strstr(response, "SUCCESS: All files deleted") != NULL)
+    if (status == STATUS_OK)
     {
         printf("[CLIENT] All files deleted successfully\n");
         return 0;
     }
-    else if (strstr(response, "PARTIAL SUCCESS") != NULL)
+    else if (status == STATUS_PARTIAL)
     {
         printf("[CLIENT] Some files deleted successfully\n");
         return 0;
     }
-    else if (strstr(response, "ERROR") != NULL)
-    {
-        printf("[CLIENT] Deletion failed\n");
-        return -1;
-    }
     else
     {
-        printf("[CLIENT] Unexpected server response\n");
+        printf("[CLIENT] Deletion failed\n");
         return -1;
     }
 }
@@ -806,37 +1982,29 @@ int handle_test(int s1_socket, char *command)
 {
     // Creating response buffer
     char response[1024];
-    // Storing bytes received
-    int bytes;
+    // Storing response status
+    int status;
 
     printf("[CLIENT] Processing test command\n");
     printf("[CLIENT] Testing server connectivity\n");
 
     // Sending test command to server
-    if (send(s1_socket, command, strlen(command), 0) != -1)
+    if (send_text_frame(s1_socket, FRAME_COMMAND, STATUS_OK, command) != -1)
     {
         // Receiving response from server
-        bytes = recv(s1_socket, response, sizeof(response) - 1, 0);
-        if (bytes > 0)
+        if (recv_text_frame(s1_socket, FRAME_RESPONSE, &status, response, sizeof(response)) != -1)
         {
-            // Adding null terminator to response
-            response[bytes] = '\0';
             printf("[CLIENT] Test result: %s\n", response);
 
             // Analyzing test result
-            if (strstr(response, "OK") != NULL)
+            if (status == STATUS_OK)
             {
                 printf("[CLIENT] Server connectivity test passed\n");
                 return 0;
             }
-            else if (strstr(response, "ERROR") != NULL)
-            {
-                printf("[CLIENT] Server connectivity test failed\n");
-                return -1;
-            }
             else
             {
-                printf("[CLIENT] Server responded with unknown status\n");
+                printf("[CLIENT] Server connectivity test failed\n");
                 return -1;
             }
         }
@@ -897,14 +2065,29 @@ int main()
 
     // Receiving welcome message from server
     char welcome[1024];
-    int bytes = recv(s1_socket, welcome, sizeof(welcome) - 1, 0);
-    if (bytes > 0)
+    int welcome_status;
+    if (recv_text_frame(s1_socket, FRAME_RESPONSE, &welcome_status, welcome, sizeof(welcome)) != -1)
     {
-        // Adding null terminator to welcome message
-        welcome[bytes] = '\0';
         printf("[CLIENT] Server says: %s\n", welcome);
     }
 
+    // Offering compressed transfers, hash-first and delta uploads and streamed listings; servers
+    // that do not know HELLO (or a feature) keep plain transfers
+    char hello[64];
+    int hello_status;
+    if (send_text_frame(s1_socket, FRAME_COMMAND, STATUS_OK, "HELLO COMPRESS deflate HASH sha256 DELTA cdc LIST stream") != -1 &&
+        recv_text_frame(s1_socket, FRAME_RESPONSE, &hello_status, hello, sizeof(hello)) != -1 &&
+        hello_status == STATUS_OK)
+    {
+        session_codec = (strstr(hello, "COMPRESS deflate") != NULL) ? CODEC_DEFLATE : CODEC_NONE;
+        session_hash_first = strstr(hello, "HASH sha256") != NULL;
+        session_delta = session_hash_first && strstr(hello, "DELTA cdc") != NULL;
+        session_list_stream = strstr(hello, "LIST stream") != NULL;
+    }
+    printf("[CLIENT] File transfers: %s%s%s%s\n", (session_codec == CODEC_DEFLATE) ? "deflate compressed" : "uncompressed",
+           session_hash_first ? ", hash-first uploads" : "", session_delta ? ", delta uploads" : "",
+           session_list_stream ? ", streamed listings" : "");
+
     // Displaying initial instructions
     printf("\n[CLIENT] Type 'help' for available commands or 'quit' to exit\n");
 